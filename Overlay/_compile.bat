@@ -14,7 +14,7 @@ set "LIBRARIES=openvr_api.lib user32.lib gdi32.lib kernel32.lib shell32.lib open
 set "ICON_FILE=app.ico"
 
 :: Source files - separate C and C++ files
-set "CPP_SOURCE_FILES=main.cpp overlay_manager.cpp math_utils.cpp dashboard_ui.cpp numpy_io.cpp frame_buffer.cpp routine.cpp rest_server.cpp subprocess.cpp trainer_wrapper.cpp trainer_progress.cpp"
+set "CPP_SOURCE_FILES=main.cpp overlay_manager.cpp math_utils.cpp dashboard_ui.cpp numpy_io.cpp frame_buffer.cpp routine.cpp rest_server.cpp subprocess.cpp trainer_wrapper.cpp trainer_progress.cpp preprocess.cpp inference_engine.cpp ort_cache.cpp one_euro_filter.cpp stereo_sync.cpp stream_reactor.cpp stream_health.cpp frame_ring_writer.cpp capture_writer.cpp capture_scheduler.cpp mjpeg_broadcaster.cpp metrics.cpp job_scheduler.cpp"
 set "C_SOURCE_FILES=jpeg_stream.c"
 
 :: Check if cl.exe is in PATH
@@ -55,7 +55,7 @@ rc.exe /nologo build\app.rc
 
 :: Define compiler and linker flags
 set "COMMON_FLAGS=/nologo /W3 /Od /D_CRT_SECURE_NO_WARNINGS /DWIN32 /D_WINDOWS"
-set "CPP_FLAGS=/EHsc"
+set "CPP_FLAGS=/EHsc /constexpr:steps10000000"
 set "INCLUDE_DIRS=/I"%OPENVR_PATH%\headers" /I"%TURBOJPEG_PATH%\include" /I"%ONNXRUNTIME_PATH%\include""
 set "LIBRARY_DIRS=/LIBPATH:"%OPENVR_PATH%\lib\win64" /LIBPATH:"%TURBOJPEG_PATH%\lib" /LIBPATH:"%ONNXRUNTIME_PATH%\lib""
 
@@ -1,5 +1,14 @@
 #pragma once
 
+#include <stdint.h>
+
+// A JPEG length of CAPTURE_IMAGE_REF means no bytes follow: the image is the
+// one stored by an earlier record with the same timestamp_left/right
+#define CAPTURE_IMAGE_REF 0xFFFFFFFFu
+
+// Bytes that follow the record for a JPEG length
+#define CAPTURE_IMAGE_BYTES(length) ((length) == CAPTURE_IMAGE_REF ? 0u : (uint32_t)(length))
+
 typedef struct CaptureFrame {
 #ifdef _MSC_VER
 #pragma pack(push, 1)
@@ -0,0 +1,338 @@
+// Converts a capture file into NumPy arrays for the Python tooling, with the
+// same decode and preprocessing the native trainer applies, so Python never
+// has to parse captures or JPEGs itself.
+//
+// Usage: capture_export <capture.bin> <output_dir> [--threads N] [--shard-rows N] [--resolution N] [--float]
+//
+// Writes to output_dir (which must exist), one row per aligned frame:
+//   labels.npy  float32 (N, 11)  pitch, yaw, distance, fovAdjust, leftLid, rightLid,
+//                                browRaise, browAngry, widen, squint, dilate
+//   flags.npy   uint32  (N,)     routine state flags (see flags.h)
+//   left.npy    uint8   (N, R, R) equalized gray eye, or float32 in [0, 1] with --float
+//   right.npy   same as left.npy
+// With --shard-rows the arrays are split into labels_0000.npy, left_0000.npy, ...
+// of at most that many rows each. Frames whose JPEGs don't decode are skipped.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <turbojpeg.h>
+
+#include "capture_reader.h"
+#include "numpy_io.h"
+#include "preprocess.h"
+
+#define EXPORT_BATCH_ROWS 512 // Frames preprocessed together; one batch is written while the next is preprocessed
+#define EXPORT_LABELS     11  // Float label columns
+
+struct ExportOptions {
+    int threads = 0; // 0: one per core
+    size_t shardRows = 0;
+    int resolution = PREPROCESS_RESOLUTION;
+    bool asFloat = false;
+};
+
+// Decoder and scratch buffers of one preprocessing thread
+struct ExportWorker {
+    tjhandle tjInstance = nullptr;
+    std::vector<uint32_t> pixels;
+    std::vector<uint8_t> gray;
+};
+
+// Output rows of EXPORT_BATCH_ROWS consecutive frames
+struct ExportBatch {
+    size_t first = 0;
+    size_t count = 0;
+    std::vector<float> labels;
+    std::vector<uint32_t> flags;
+    std::vector<uint8_t> left; // count planes of planeBytes
+    std::vector<uint8_t> right;
+    std::vector<uint8_t> valid; // 0 where a JPEG didn't decode
+};
+
+/**
+ * @brief The output arrays, split into shards
+ */
+class ExportOutput {
+public:
+    ExportOutput(const std::string& directory, const ExportOptions& options)
+        : m_directory(directory)
+        , m_options(options)
+        , m_shard(0)
+        , m_shardRows(0)
+        , m_rows(0) {
+    }
+
+    bool open() {
+        std::string suffix;
+        if (m_options.shardRows > 0) {
+            char shard[16];
+            snprintf(shard, sizeof(shard), "_%04zu", m_shard);
+            suffix = shard;
+        }
+
+        const NumPyDataType planeType = m_options.asFloat ? NumPyDataType::FLOAT32 : NumPyDataType::UINT8;
+        const std::vector<size_t> planeShape = { (size_t)m_options.resolution, (size_t)m_options.resolution };
+        m_shardRows = 0;
+        return m_labels.open(m_directory + "/labels" + suffix + ".npy", NumPyDataType::FLOAT32, { EXPORT_LABELS })
+            && m_flags.open(m_directory + "/flags" + suffix + ".npy", NumPyDataType::UINT32)
+            && m_left.open(m_directory + "/left" + suffix + ".npy", planeType, planeShape)
+            && m_right.open(m_directory + "/right" + suffix + ".npy", planeType, planeShape);
+    }
+
+    // Append the decoded rows of a batch, in frame order
+    bool write(const ExportBatch& batch, size_t planeBytes) {
+        size_t row = 0;
+        while (row < batch.count) {
+            if (!batch.valid[row]) {
+                row++;
+                continue;
+            }
+
+            // Longest run of decoded rows that fits the current shard
+            size_t end = row;
+            size_t room = m_options.shardRows > 0 ? m_options.shardRows - m_shardRows : SIZE_MAX;
+            while (end < batch.count && batch.valid[end] && end - row < room) {
+                end++;
+            }
+            const size_t count = end - row;
+            if (!m_labels.append(&batch.labels[row * EXPORT_LABELS], count)
+                || !m_flags.append(&batch.flags[row], count)
+                || !m_left.append(&batch.left[row * planeBytes], count)
+                || !m_right.append(&batch.right[row * planeBytes], count)) {
+                return false;
+            }
+            m_shardRows += count;
+            m_rows += count;
+            row = end;
+
+            if (m_options.shardRows > 0 && m_shardRows == m_options.shardRows && !nextShard()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Close the arrays, removing a trailing shard that got no rows
+    bool close() {
+        bool ok = closeWriters();
+        if (m_options.shardRows > 0 && m_shardRows == 0 && m_shard > 0) {
+            char shard[16];
+            snprintf(shard, sizeof(shard), "_%04zu", m_shard);
+            for (const char* name : { "labels", "flags", "left", "right" }) {
+                remove((m_directory + "/" + name + shard + ".npy").c_str());
+            }
+        }
+        return ok;
+    }
+
+    size_t rows() const {
+        return m_rows;
+    }
+
+    size_t shards() const {
+        return m_shard + (m_shardRows > 0 || m_shard == 0 ? 1 : 0);
+    }
+
+private:
+    bool closeWriters() {
+        bool labels = m_labels.close();
+        bool flags = m_flags.close();
+        bool left = m_left.close();
+        bool right = m_right.close();
+        return labels && flags && left && right;
+    }
+
+    bool nextShard() {
+        if (!closeWriters()) {
+            return false;
+        }
+        m_shard++;
+        return open();
+    }
+
+    std::string m_directory;
+    ExportOptions m_options;
+    size_t m_shard;
+    size_t m_shardRows;
+    size_t m_rows;
+    NumPyWriter m_labels;
+    NumPyWriter m_flags;
+    NumPyWriter m_left;
+    NumPyWriter m_right;
+};
+
+// Decode like AlignedFrame::DecodeImageLeft/Right (RGBX, fast DCT) and run
+// the trainer's preprocessing into one plane of dst
+static bool preprocessEye(ExportWorker& worker, const std::vector<uint8_t>& jpeg, const ExportOptions& options, uint8_t* dst) {
+    int width, height, subsamp, colorspace;
+    if (jpeg.empty()
+        || tjDecompressHeader3(worker.tjInstance, jpeg.data(), (unsigned long)jpeg.size(), &width, &height, &subsamp, &colorspace) != 0) {
+        return false;
+    }
+
+    worker.pixels.resize((size_t)width * height);
+    if (tjDecompress2(worker.tjInstance, jpeg.data(), (unsigned long)jpeg.size(),
+                      reinterpret_cast<unsigned char*>(worker.pixels.data()), width, width * 4, height,
+                      TJPF_RGBX, TJFLAG_FASTDCT)
+        != 0) {
+        return false;
+    }
+
+    if (options.asFloat) {
+        PreprocessEyeImage(worker.pixels.data(), width, height, reinterpret_cast<float*>(dst), options.resolution, worker.gray);
+        return true;
+    }
+
+    // The 8-bit plane is what PreprocessEyeImage produces before scaling to [0, 1]
+    const size_t count = (size_t)width * height;
+    worker.gray.resize(std::max(worker.gray.size(), count));
+    PreprocessToGray(worker.pixels.data(), width, height, worker.gray.data());
+    PreprocessEqualize(worker.gray.data(), count);
+    PreprocessResampleGray(worker.gray.data(), width, height, dst, options.resolution, options.resolution);
+    return true;
+}
+
+// Preprocess frames [first, first + count) into batch on all workers
+static void fillBatch(const std::vector<AlignedFrame>& frames, size_t first, size_t count,
+                      const ExportOptions& options, size_t planeBytes,
+                      std::vector<ExportWorker>& workers, ExportBatch& batch) {
+    batch.first = first;
+    batch.count = count;
+    batch.labels.resize(count * EXPORT_LABELS);
+    batch.flags.resize(count);
+    batch.left.resize(count * planeBytes);
+    batch.right.resize(count * planeBytes);
+    batch.valid.resize(count);
+
+    std::atomic<size_t> next(0);
+    auto work = [&](ExportWorker& worker) {
+        for (size_t row = next++; row < count; row = next++) {
+            const AlignedFrame& frame = frames[first + row];
+            float* labels = &batch.labels[row * EXPORT_LABELS];
+            extract_label_data(frame, labels[0], labels[1], labels[2], labels[3], labels[4], labels[5],
+                               labels[6], labels[7], labels[8], labels[9], labels[10], batch.flags[row]);
+
+            batch.valid[row] = preprocessEye(worker, frame.left_image, options, &batch.left[row * planeBytes])
+                && preprocessEye(worker, frame.right_image, options, &batch.right[row * planeBytes]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers.size(); i++) {
+        threads.emplace_back(work, std::ref(workers[i]));
+    }
+    work(workers[0]);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+static void printUsage(const char* program) {
+    printf("Usage: %s <capture.bin> <output_dir> [--threads N] [--shard-rows N] [--resolution N] [--float]\n", program);
+    printf("  --threads N     preprocessing threads (default: one per core)\n");
+    printf("  --shard-rows N  split the arrays into files of at most N rows\n");
+    printf("  --resolution N  eye plane width and height (default %d, the model input)\n", PREPROCESS_RESOLUTION);
+    printf("  --float         write eye planes as float32 in [0, 1], exactly the trainer's input tensors\n");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    const char* capturePath = argv[1];
+    const char* outputDir = argv[2];
+    ExportOptions options;
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.threads = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--shard-rows") == 0 && i + 1 < argc) {
+            options.shardRows = (size_t)std::max(0LL, atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--resolution") == 0 && i + 1 < argc) {
+            options.resolution = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--float") == 0) {
+            options.asFloat = true;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.threads == 0) {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    printf("Reading capture file %s...\n", capturePath);
+    std::vector<AlignedFrame> frames = read_capture_file(capturePath);
+    if (frames.empty()) {
+        printf("No aligned frames in %s\n", capturePath);
+        return 1;
+    }
+
+    std::vector<ExportWorker> workers(options.threads);
+    for (ExportWorker& worker : workers) {
+        worker.tjInstance = tjInitDecompress();
+        if (!worker.tjInstance) {
+            printf("Failed to create a JPEG decompressor: %s\n", tjGetErrorStr());
+            return 1;
+        }
+    }
+
+    ExportOutput output(outputDir, options);
+    if (!output.open()) {
+        printf("Can't create the arrays in %s (does the directory exist?)\n", outputDir);
+        return 1;
+    }
+
+    printf("Exporting %zu frames with %d threads...\n", frames.size(), options.threads);
+    const auto start = std::chrono::steady_clock::now();
+    const size_t planeBytes = (size_t)options.resolution * options.resolution * (options.asFloat ? sizeof(float) : 1);
+
+    // Batch k is written while batch k + 1 is preprocessed
+    ExportBatch batches[2];
+    fillBatch(frames, 0, std::min<size_t>(EXPORT_BATCH_ROWS, frames.size()), options, planeBytes, workers, batches[0]);
+
+    bool ok = true;
+    for (size_t first = 0, current = 0; first < frames.size() && ok; first += EXPORT_BATCH_ROWS, current ^= 1) {
+        const size_t nextFirst = first + EXPORT_BATCH_ROWS;
+        std::thread preprocessing;
+        if (nextFirst < frames.size()) {
+            preprocessing = std::thread(fillBatch, std::cref(frames), nextFirst,
+                                        std::min<size_t>(EXPORT_BATCH_ROWS, frames.size() - nextFirst),
+                                        std::cref(options), planeBytes, std::ref(workers), std::ref(batches[current ^ 1]));
+        }
+
+        ok = output.write(batches[current], planeBytes);
+        if (preprocessing.joinable()) {
+            preprocessing.join();
+        }
+    }
+    ok = output.close() && ok;
+
+    for (ExportWorker& worker : workers) {
+        tjDestroy(worker.tjInstance);
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double megabytes = output.rows() * (2 * planeBytes + EXPORT_LABELS * sizeof(float) + sizeof(uint32_t)) / (1024.0 * 1024.0);
+    printf("Wrote %zu of %zu frames (%zu skipped, %zu shard%s) to %s\n",
+           output.rows(), frames.size(), frames.size() - output.rows(),
+           output.shards(), output.shards() == 1 ? "" : "s", outputDir);
+    printf("%.2f s, %.0f frames/s, %.1f MB/s\n", seconds, output.rows() / seconds, megabytes / seconds);
+
+    if (!ok) {
+        printf("Export failed; the arrays are incomplete\n");
+        return 1;
+    }
+    return 0;
+}
@@ -28,6 +28,7 @@ std::vector<AlignedFrame> read_capture_file(const std::string& filename) {
     std::map<uint64_t, std::tuple<float, float, float, float, float, float, float, float, float, float, float, uint32_t>> all_label_frames; // timestamp -> label_data
 
     int raw_frames = 0;
+    int reference_frames = 0; // Records whose images an earlier record stored
 
     // Read the raw data from file
     std::ifstream file(filename, std::ios::binary);
@@ -49,25 +50,42 @@ std::vector<AlignedFrame> read_capture_file(const std::string& filename) {
             break;
         }
 
-        // Read the image data
-        std::vector<uint8_t> image_left_data(frame.jpeg_data_left_length);
-        std::vector<uint8_t> image_right_data(frame.jpeg_data_right_length);
+        // Read the image data; CAPTURE_IMAGE_REF has none
+        const bool left_ref = frame.jpeg_data_left_length == CAPTURE_IMAGE_REF;
+        const bool right_ref = frame.jpeg_data_right_length == CAPTURE_IMAGE_REF;
+        std::vector<uint8_t> image_left_data(CAPTURE_IMAGE_BYTES(frame.jpeg_data_left_length));
+        std::vector<uint8_t> image_right_data(CAPTURE_IMAGE_BYTES(frame.jpeg_data_right_length));
 
-        if (!file.read(reinterpret_cast<char*>(image_left_data.data()), frame.jpeg_data_left_length) || !file.read(reinterpret_cast<char*>(image_right_data.data()), frame.jpeg_data_right_length)) {
+        if (!file.read(reinterpret_cast<char*>(image_left_data.data()), image_left_data.size()) || !file.read(reinterpret_cast<char*>(image_right_data.data()), image_right_data.size())) {
             std::cerr << "Error reading image data" << std::endl;
             break;
         }
 
         raw_frames++;
+        if (left_ref || right_ref) {
+            reference_frames++;
+        }
+
+        // A reference resolves to the image already stored under its timestamp
+        if ((left_ref && all_eye_frames_left.find(frame.timestamp_left) == all_eye_frames_left.end())
+            || (right_ref && all_eye_frames_right.find(frame.timestamp_right) == all_eye_frames_right.end())) {
+            std::cerr << "Skipping frame " << frame.timestamp << ": refers to an image that isn't in the file" << std::endl;
+            continue;
+        }
 
         // Store all frame data
-        all_eye_frames_left[frame.timestamp_left] = image_left_data;
-        all_eye_frames_right[frame.timestamp_right] = image_right_data;
+        if (!left_ref) {
+            all_eye_frames_left[frame.timestamp_left] = image_left_data;
+        }
+        if (!right_ref) {
+            all_eye_frames_right[frame.timestamp_right] = image_right_data;
+        }
+        // Packed fields can't bind to make_tuple's references on GCC/Clang; copy them
         all_label_frames[frame.timestamp] = std::make_tuple(
-            frame.routinePitch, frame.routineYaw, frame.routineDistance,
-            frame.fovAdjustDistance, frame.routineLeftLid, frame.routineRightLid,
-            frame.routineBrowRaise, frame.routineBrowAngry, frame.routineWiden,
-            frame.routineSquint, frame.routineDilate, frame.routineState);
+            (float)frame.routinePitch, (float)frame.routineYaw, (float)frame.routineDistance,
+            (float)frame.fovAdjustDistance, (float)frame.routineLeftLid, (float)frame.routineRightLid,
+            (float)frame.routineBrowRaise, (float)frame.routineBrowAngry, (float)frame.routineWiden,
+            (float)frame.routineSquint, (float)frame.routineDilate, (uint32_t)frame.routineState);
 
         /*std::cout << "Read frame: Pitch=" << frame.routinePitch
                   << ", Yaw=" << frame.routineYaw
@@ -78,7 +96,7 @@ std::vector<AlignedFrame> read_capture_file(const std::string& filename) {
                   << ", timeRight=" << frame.timestamp_right << std::endl;*/
     }
 
-    std::cout << "Detected " << raw_frames << " raw frames" << std::endl;
+    std::cout << "Detected " << raw_frames << " raw frames (" << reference_frames << " referring to earlier images)" << std::endl;
     std::cout << "Unique left eye frames: " << all_eye_frames_left.size() << std::endl;
     std::cout << "Unique right eye frames: " << all_eye_frames_right.size() << std::endl;
     std::cout << "Unique label frames: " << all_label_frames.size() << std::endl;
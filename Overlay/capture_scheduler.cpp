@@ -0,0 +1,239 @@
+#include "capture_scheduler.h"
+#include "capture_writer.h"
+#include "jpeg_stream.h"
+#include "stereo_sync.h"
+
+#include <algorithm>
+
+CaptureScheduler::CaptureScheduler(StereoSynchronizer* pairs, CaptureWriter* writer, Clock clock)
+    : m_pairs(pairs)
+    , m_writer(writer)
+    , m_clock(clock)
+    , m_running(false)
+    , m_labels(CAPTURE_SCHEDULER_LABEL_HISTORY)
+    , m_labelHead(0)
+    , m_labelCount(0)
+    , m_latchedFlags(0)
+    , m_hasLastPair(false)
+    , m_lastRecordMs(0) {
+}
+
+CaptureScheduler::~CaptureScheduler() {
+    stop();
+}
+
+void CaptureScheduler::start() {
+    if (m_running.exchange(true)) {
+        return; // Already running
+    }
+
+    // Labels from before the last stop() belong to another recording
+    clearLabels();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats = CaptureSchedulerStats();
+    }
+    m_thread = std::thread(&CaptureScheduler::scheduleLoop, this);
+}
+
+void CaptureScheduler::stop() {
+    if (!m_running.exchange(false)) {
+        return; // Already stopped
+    }
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    clearLabels();
+}
+
+bool CaptureScheduler::isRunning() const {
+    return m_running;
+}
+
+void CaptureScheduler::pushLabel(const CaptureFrame& label, uint64_t timeMs) {
+    CaptureFrame record;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Interpolation needs increasing times; start over if the clock jumped back
+        if (m_labelCount > 0 && timeMs < m_labels[(m_labelHead + m_labelCount - 1) % m_labels.size()].timeMs) {
+            m_labelCount = 0;
+            m_hasLastPair = false;
+            m_lastRecordMs = 0;
+        }
+
+        if (m_labelCount == m_labels.size()) {
+            m_labelHead = (m_labelHead + 1) % m_labels.size();
+            m_labelCount--;
+        }
+        LabelSample& sample = m_labels[(m_labelHead + m_labelCount) % m_labels.size()];
+        sample.timeMs = timeMs;
+        sample.label = label;
+        m_labelCount++;
+        m_latchedFlags |= label.routineState & CAPTURE_SCHEDULER_ONE_SHOT_FLAGS;
+
+        // Between pairs the sample gets a record of its own, on the last pair's images
+        if (!m_running || !m_hasLastPair || timeMs <= m_lastRecordMs || timeMs - m_lastPair.timestamp > CAPTURE_SCHEDULER_LABEL_HOLD_MS) {
+            return;
+        }
+        record = label;
+        record.routineState = takeLatchedFlags(label.routineState);
+        record.timestamp = timeMs;
+        record.timestamp_left = m_lastPair.timestamp_left;
+        record.timestamp_right = m_lastPair.timestamp_right;
+        record.jpeg_data_left_length = m_lastPair.jpeg_data_left_length;
+        record.jpeg_data_right_length = m_lastPair.jpeg_data_right_length;
+        m_lastRecordMs = timeMs;
+    }
+
+    bool written = m_writer->writeReference(record);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (written) {
+        m_stats.references++;
+    } else {
+        m_stats.dropped++;
+    }
+}
+
+void CaptureScheduler::clearLabels() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_labelCount = 0;
+    m_latchedFlags = 0;
+    m_hasLastPair = false;
+    m_lastRecordMs = 0;
+}
+
+uint32_t CaptureScheduler::takeLatchedFlags(uint32_t routineState) {
+    // A one-shot flag goes out once, on the first record after its sample;
+    // an interpolated label may carry the sample's own copy again
+    routineState = (routineState & ~CAPTURE_SCHEDULER_ONE_SHOT_FLAGS) | m_latchedFlags;
+    m_latchedFlags = 0;
+    return routineState;
+}
+
+CaptureSchedulerStats CaptureScheduler::getStats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+bool CaptureScheduler::sampleLabel(uint64_t timeMs, CaptureFrame* label) {
+    if (m_labelCount == 0) {
+        return false;
+    }
+
+    const LabelSample& oldest = m_labels[m_labelHead];
+    const LabelSample& newest = m_labels[(m_labelHead + m_labelCount - 1) % m_labels.size()];
+    if (timeMs < oldest.timeMs || timeMs > newest.timeMs + CAPTURE_SCHEDULER_LABEL_HOLD_MS) {
+        return false;
+    }
+    if (timeMs >= newest.timeMs) {
+        *label = newest.label;
+        return true;
+    }
+
+    // Samples on either side of timeMs
+    size_t i = 1;
+    while (m_labels[(m_labelHead + i) % m_labels.size()].timeMs < timeMs) {
+        i++;
+    }
+    const LabelSample& a = m_labels[(m_labelHead + i - 1) % m_labels.size()];
+    const LabelSample& b = m_labels[(m_labelHead + i) % m_labels.size()];
+
+    *label = a.label;
+
+    // A gap means recording paused; only a close sample counts then
+    if (b.timeMs - a.timeMs > CAPTURE_SCHEDULER_LABEL_HOLD_MS) {
+        return timeMs - a.timeMs <= CAPTURE_SCHEDULER_LABEL_HOLD_MS;
+    }
+
+    // Never blend across a routine step; the target jumps there
+    if (a.label.routineState != b.label.routineState || b.timeMs == a.timeMs) {
+        return true;
+    }
+
+    const float f = (float)(timeMs - a.timeMs) / (float)(b.timeMs - a.timeMs);
+#define LERP_LABEL(field) label->field = a.label.field + (b.label.field - a.label.field) * f
+    LERP_LABEL(routinePitch);
+    LERP_LABEL(routineYaw);
+    LERP_LABEL(routineDistance);
+    LERP_LABEL(routineConvergence);
+    LERP_LABEL(fovAdjustDistance);
+    LERP_LABEL(leftEyePitch);
+    LERP_LABEL(leftEyeYaw);
+    LERP_LABEL(rightEyePitch);
+    LERP_LABEL(rightEyeYaw);
+    LERP_LABEL(routineLeftLid);
+    LERP_LABEL(routineRightLid);
+    LERP_LABEL(routineBrowRaise);
+    LERP_LABEL(routineBrowAngry);
+    LERP_LABEL(routineWiden);
+    LERP_LABEL(routineSquint);
+    LERP_LABEL(routineDilate);
+#undef LERP_LABEL
+    return true;
+}
+
+void CaptureScheduler::scheduleLoop() {
+    uint64_t lastSequence = 0;
+
+    while (m_running) {
+        StereoPair pair;
+        if (!m_pairs->waitForPair(lastSequence, CAPTURE_SCHEDULER_WAIT_MS, &pair)) {
+            continue;
+        }
+        lastSequence = pair.sequence;
+
+        // The pair's camera time if the cameras share our clock, otherwise
+        // the moment we got it
+        uint64_t arrivalMs = m_clock();
+        uint64_t pairMs = std::max(pair.left->timestamp, pair.right->timestamp);
+        bool cameraClock = pairMs != 0
+            && (pairMs > arrivalMs ? pairMs - arrivalMs : arrivalMs - pairMs) <= CAPTURE_SCHEDULER_CLOCK_SKEW_MS;
+        if (!cameraClock) {
+            pairMs = arrivalMs;
+        }
+
+        CaptureFrame record;
+        bool labeled;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.pairs++;
+            labeled = sampleLabel(pairMs, &record);
+            if (!labeled) {
+                m_stats.unlabeled++;
+            } else {
+                record.routineState = takeLatchedFlags(record.routineState);
+                if (!cameraClock) {
+                    m_stats.arrivalTime++;
+                }
+            }
+        }
+
+        if (labeled) {
+            record.timestamp = pairMs;
+            record.timestamp_left = pair.left->timestamp;
+            record.timestamp_right = pair.right->timestamp;
+            record.jpeg_data_left_length = (uint32_t)pair.left->size;
+            record.jpeg_data_right_length = (uint32_t)pair.right->size;
+
+            bool written = m_writer->write(record, pair.left, pair.right);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (written) {
+                m_stats.records++;
+                // Only images with a camera timestamp can be referred back to
+                if (record.timestamp_left != 0 && record.timestamp_right != 0) {
+                    m_hasLastPair = true;
+                    m_lastPair = record;
+                }
+                m_lastRecordMs = std::max(m_lastRecordMs, pairMs);
+            } else {
+                m_stats.dropped++;
+            }
+        }
+
+        StereoSynchronizer::releasePair(&pair);
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef CAPTURE_SCHEDULER_H
+#define CAPTURE_SCHEDULER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "capture_data.h"
+#include "flags.h"
+
+class CaptureWriter;
+class StereoSynchronizer;
+
+#define CAPTURE_SCHEDULER_LABEL_HISTORY 64   // Label samples kept for interpolation (~640 ms of the 10 ms overlay loop)
+#define CAPTURE_SCHEDULER_LABEL_HOLD_MS 100  // Longest a pair may be newer than the last label and still get it
+#define CAPTURE_SCHEDULER_CLOCK_SKEW_MS 1000 // Pair timestamps further than this from our clock are replaced by the arrival time
+#define CAPTURE_SCHEDULER_WAIT_MS       100  // Pair wait before re-checking for stop()
+#define CAPTURE_SCHEDULER_ONE_SHOT_FLAGS FLAG_RESTING // routineState flags pushed on a single sample, kept until a record carries them
+
+/**
+ * @brief Counters since start()
+ */
+struct CaptureSchedulerStats {
+    uint64_t pairs = 0;       // New stereo pairs seen
+    uint64_t records = 0;     // Pairs queued on the CaptureWriter
+    uint64_t references = 0;  // Label samples between pairs queued as records referring to the last pair
+    uint64_t unlabeled = 0;   // Pairs with no label sample near their timestamp (not recording)
+    uint64_t dropped = 0;     // Records the CaptureWriter had no room for
+    uint64_t arrivalTime = 0; // Pairs whose camera clock was off ours, labeled at arrival instead
+};
+
+/**
+ * @brief Emits one capture record per new stereo pair, and one per label
+ *        sample in between that refers to the last pair's images
+ *
+ * The overlay loop pushes the routine label (gaze, lids, routine state) as
+ * often as it runs. A thread waits for each new timestamp-matched pair and
+ * labels it with the label at the pair's timestamp, interpolated between the
+ * two samples around it; that record carries the JPEGs. Pairs outside the
+ * label history (nothing is being recorded) are skipped.
+ *
+ * Labels come faster than pairs. Every pushed sample newer than the last
+ * record is written at its own time as a CaptureWriter::writeReference()
+ * record pointing at the last pair written, as long as that pair is at most
+ * CAPTURE_SCHEDULER_LABEL_HOLD_MS old, so the file keeps the full label
+ * rate without repeating any JPEG.
+ *
+ * Some routineState flags (CAPTURE_SCHEDULER_ONE_SHOT_FLAGS) mark a moment
+ * rather than a state and are set on just one label sample, which may fall
+ * between two records. They are latched and ORed into the next record
+ * written, and only that one, whichever kind it is.
+ */
+class CaptureScheduler {
+public:
+    typedef uint64_t (*Clock)();
+
+    /**
+     * @param pairs Source of stereo pairs
+     * @param writer Receives the records; must be open while labels are pushed
+     * @param clock Wall clock in ms; pushLabel() times and camera X-Timestamps use it
+     */
+    CaptureScheduler(StereoSynchronizer* pairs, CaptureWriter* writer, Clock clock);
+    ~CaptureScheduler();
+
+    void start();
+    void stop();
+    bool isRunning() const;
+
+    /**
+     * @brief Record the label as of timeMs
+     *
+     * The JPEG lengths and timestamps of label are ignored; they are filled
+     * in from the pair.
+     */
+    void pushLabel(const CaptureFrame& label, uint64_t timeMs);
+
+    // Forget the label history and latched flags; start() and stop() do this too
+    void clearLabels();
+
+    CaptureSchedulerStats getStats() const;
+
+private:
+    struct LabelSample {
+        uint64_t timeMs;
+        CaptureFrame label;
+    };
+
+    void scheduleLoop();
+
+    // Label at timeMs; false if the history doesn't cover it
+    bool sampleLabel(uint64_t timeMs, CaptureFrame* label);
+
+    // Take the latched one-shot flags for the record being written
+    uint32_t takeLatchedFlags(uint32_t routineState);
+
+    StereoSynchronizer* m_pairs;
+    CaptureWriter* m_writer;
+    Clock m_clock;
+
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+
+    // Guards the label ring and m_stats
+    mutable std::mutex m_mutex;
+    std::vector<LabelSample> m_labels; // Ring of CAPTURE_SCHEDULER_LABEL_HISTORY, oldest at m_labelHead
+    size_t m_labelHead;
+    size_t m_labelCount;
+    uint32_t m_latchedFlags; // One-shot flags pushed since the last record
+    CaptureSchedulerStats m_stats;
+
+    // Images of the last pair written, for the label records that refer to it
+    bool m_hasLastPair;
+    CaptureFrame m_lastPair; // Only the timestamps and JPEG lengths are used
+    uint64_t m_lastRecordMs; // Newest record time; a label sample must be newer to get a record
+};
+
+#endif // CAPTURE_SCHEDULER_H
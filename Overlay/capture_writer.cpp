@@ -0,0 +1,462 @@
+#include "capture_writer.h"
+#include "jpeg_stream.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#undef min
+#undef max
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#endif
+
+#define CAPTURE_WRITER_NO_FILE ((intptr_t)-1)
+
+static uint64_t steadyNowMs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CaptureWriter::CaptureWriter()
+    : m_file(CAPTURE_WRITER_NO_FILE)
+    , m_running(false)
+    , m_queue(CAPTURE_WRITER_QUEUE_RECORDS)
+    , m_head(0)
+    , m_count(0)
+    , m_batch(CAPTURE_WRITER_BATCH_RECORDS)
+    , m_batchCount(0)
+    , m_fileOffset(0) {
+    for (int eye = 0; eye < 2; eye++) {
+        m_stored[eye].resize(CAPTURE_WRITER_DEDUP_HISTORY);
+        m_storedNext[eye] = 0;
+    }
+
+    MetricsRegistry& metrics = MetricsRegistry::global();
+    m_recordsMetric = &metrics.counter("baballs_capture_records_total", "Capture records written");
+    m_bytesMetric = &metrics.counter("baballs_capture_bytes_total", "Bytes written to capture files");
+    m_droppedMetric = &metrics.counter("baballs_capture_dropped_total", "Capture records dropped because the write queue was full");
+    m_writeErrorsMetric = &metrics.counter("baballs_capture_write_errors_total", "Failed capture batch writes");
+    m_deduplicatedMetric = &metrics.counter("baballs_capture_deduplicated_total", "Eye images written as a reference to an earlier record");
+    m_queueDepthMetric = &metrics.gauge("baballs_capture_queue_depth", "Capture records waiting for the disk");
+    m_writeSecondsMetric = &metrics.histogram("baballs_capture_write_seconds", "Writing one batch of capture records", MetricsLatencyBuckets);
+    m_syncSecondsMetric = &metrics.histogram("baballs_capture_sync_seconds", "Syncing the capture file to disk", MetricsLatencyBuckets);
+}
+
+CaptureWriter::~CaptureWriter() {
+    close();
+}
+
+bool CaptureWriter::open(const char* filename) {
+    close();
+
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        printf("CaptureWriter: can't open %s (error %lu)\n", filename, GetLastError());
+        return false;
+    }
+    m_file = (intptr_t)handle;
+    m_staging.resize(CAPTURE_WRITER_STAGING_BYTES);
+#else
+    int fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("CaptureWriter: can't open %s: %s\n", filename, strerror(errno));
+        return false;
+    }
+    m_file = fd;
+#endif
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_head = 0;
+        m_count = 0;
+        m_stats = CaptureWriterStats();
+    }
+    m_fileOffset = 0;
+    for (int eye = 0; eye < 2; eye++) {
+        std::fill(m_stored[eye].begin(), m_stored[eye].end(), StoredImage { 0, 0 });
+        m_storedNext[eye] = 0;
+    }
+
+    m_running = true;
+    m_thread = std::thread(&CaptureWriter::writerLoop, this);
+    return true;
+}
+
+void CaptureWriter::close() {
+    if (m_file == CAPTURE_WRITER_NO_FILE) {
+        return;
+    }
+
+    // The thread drains the queue before it exits
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+    m_condition.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    sync();
+    {
+        // Calibration records come at the label rate; with no references every label repeated its JPEGs
+        std::lock_guard<std::mutex> lock(m_mutex);
+        printf("CaptureWriter: closed after %llu records, %llu bytes, %llu images written as references, %llu unresolved\n",
+               (unsigned long long)m_stats.records, (unsigned long long)m_stats.bytes,
+               (unsigned long long)m_stats.deduplicated, (unsigned long long)m_stats.unresolved);
+    }
+#ifdef _WIN32
+    CloseHandle((HANDLE)m_file);
+#else
+    ::close((int)m_file);
+#endif
+    m_file = CAPTURE_WRITER_NO_FILE;
+}
+
+bool CaptureWriter::isOpen() const {
+    return m_file != CAPTURE_WRITER_NO_FILE;
+}
+
+bool CaptureWriter::write(const CaptureFrame& meta, MJPEGFrame* left, MJPEGFrame* right) {
+    if ((left ? left->size : 0) != meta.jpeg_data_left_length || (right ? right->size : 0) != meta.jpeg_data_right_length) {
+        printf("CaptureWriter: JPEG lengths don't match the frames\n");
+        return false;
+    }
+    return enqueue(meta, left, right, false);
+}
+
+bool CaptureWriter::writeReference(const CaptureFrame& meta) {
+    return enqueue(meta, nullptr, nullptr, true);
+}
+
+bool CaptureWriter::enqueue(const CaptureFrame& meta, MJPEGFrame* left, MJPEGFrame* right, bool reference) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return false;
+        }
+        if (m_count == m_queue.size() || m_stats.failed) {
+            m_stats.dropped++;
+            m_droppedMetric->add();
+            return false;
+        }
+
+        // The slot's buffers keep their capacity, so this only allocates while the queue warms up
+        Record& record = m_queue[(m_head + m_count) % m_queue.size()];
+        record.meta = meta;
+        record.reference = reference;
+        if (left) {
+            record.left.assign(left->data, left->data + left->size);
+        } else {
+            record.left.clear();
+        }
+        if (right) {
+            record.right.assign(right->data, right->data + right->size);
+        } else {
+            record.right.clear();
+        }
+        m_count++;
+        m_stats.maxQueueDepth = std::max(m_stats.maxQueueDepth, m_count);
+        m_queueDepthMetric->set((double)m_count);
+    }
+    m_condition.notify_one();
+    return true;
+}
+
+CaptureWriterStats CaptureWriter::getStats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    CaptureWriterStats stats = m_stats;
+    stats.queueDepth = m_count;
+    return stats;
+}
+
+void CaptureWriter::writerLoop() {
+    uint64_t lastSyncMs = steadyNowMs();
+    bool unsynced = false;
+
+    for (;;) {
+        m_batchCount = 0;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait_for(lock, std::chrono::milliseconds(CAPTURE_WRITER_SYNC_MS), [&]() {
+                return m_count > 0 || !m_running;
+            });
+            if (m_count == 0 && !m_running) {
+                break;
+            }
+
+            // Swap rather than copy, so the buffers go back to the queue with the next batch
+            m_batchCount = std::min(m_count, (size_t)CAPTURE_WRITER_BATCH_RECORDS);
+            for (size_t i = 0; i < m_batchCount; i++) {
+                std::swap(m_batch[i], m_queue[(m_head + i) % m_queue.size()]);
+            }
+            m_head = (m_head + m_batchCount) % m_queue.size();
+            m_count -= m_batchCount;
+            m_queueDepthMetric->set((double)m_count);
+        }
+
+        size_t unresolved = 0;
+        size_t deduplicated = deduplicate(m_batch.data(), &m_batchCount, &unresolved);
+        if (unresolved > 0) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.unresolved += unresolved;
+            m_stats.dropped += unresolved;
+            m_droppedMetric->add(unresolved);
+        }
+
+        if (m_batchCount > 0) {
+            size_t bytes = 0;
+            for (size_t i = 0; i < m_batchCount; i++) {
+                const CaptureFrame& meta = m_batch[i].meta;
+                bytes += sizeof(CaptureFrame) + CAPTURE_IMAGE_BYTES(meta.jpeg_data_left_length) + CAPTURE_IMAGE_BYTES(meta.jpeg_data_right_length);
+            }
+
+            auto writeStart = std::chrono::steady_clock::now();
+            bool ok = writeRecords(m_batch.data(), m_batchCount);
+            m_writeSecondsMetric->observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - writeStart).count());
+            bool failed = false;
+            if (ok) {
+                m_fileOffset += bytes;
+            } else {
+                // Some of the remembered images may not have made it to the file
+                for (int eye = 0; eye < 2; eye++) {
+                    std::fill(m_stored[eye].begin(), m_stored[eye].end(), StoredImage { 0, 0 });
+                }
+                // Part of the batch may be in the file; cut it off so the file ends on a whole record
+                failed = !rollback();
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (ok) {
+                m_stats.records += m_batchCount;
+                m_stats.bytes += bytes;
+                m_stats.deduplicated += deduplicated;
+                m_recordsMetric->add(m_batchCount);
+                m_bytesMetric->add(bytes);
+                m_deduplicatedMetric->add(deduplicated);
+            } else {
+                m_stats.writeErrors++;
+                m_writeErrorsMetric->add();
+            }
+            if (failed) {
+                // Whatever is still queued can't be written either
+                m_stats.failed = true;
+                m_stats.dropped += m_count;
+                m_droppedMetric->add(m_count);
+                m_head = (m_head + m_count) % m_queue.size();
+                m_count = 0;
+                m_queueDepthMetric->set(0.0);
+            }
+            unsynced = true;
+        }
+
+        uint64_t now = steadyNowMs();
+        if (unsynced && now - lastSyncMs >= CAPTURE_WRITER_SYNC_MS) {
+            auto syncStart = std::chrono::steady_clock::now();
+            sync();
+            m_syncSecondsMetric->observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - syncStart).count());
+            lastSyncMs = now;
+            unsynced = false;
+        }
+    }
+}
+
+size_t CaptureWriter::deduplicate(Record* records, size_t* count, size_t* unresolved) {
+    size_t deduplicated = 0;
+    size_t kept = 0;
+
+    for (size_t i = 0; i < *count; i++) {
+        CaptureFrame& meta = records[i].meta;
+        if (records[i].reference) {
+            // Both images must be ones an earlier record wrote; an empty image stays empty
+            const bool left = meta.jpeg_data_left_length == 0 || findStored(0, meta.timestamp_left, meta.jpeg_data_left_length);
+            const bool right = meta.jpeg_data_right_length == 0 || findStored(1, meta.timestamp_right, meta.jpeg_data_right_length);
+            if (!left || !right) {
+                (*unresolved)++;
+                continue;
+            }
+            if (meta.jpeg_data_left_length > 0) {
+                meta.jpeg_data_left_length = CAPTURE_IMAGE_REF;
+                deduplicated++;
+            }
+            if (meta.jpeg_data_right_length > 0) {
+                meta.jpeg_data_right_length = CAPTURE_IMAGE_REF;
+                deduplicated++;
+            }
+            std::swap(records[kept++], records[i]);
+            continue;
+        }
+
+        if (isStored(0, meta.timestamp_left, meta.jpeg_data_left_length)) {
+            meta.jpeg_data_left_length = CAPTURE_IMAGE_REF;
+            deduplicated++;
+        }
+        if (isStored(1, meta.timestamp_right, meta.jpeg_data_right_length)) {
+            meta.jpeg_data_right_length = CAPTURE_IMAGE_REF;
+            deduplicated++;
+        }
+        std::swap(records[kept++], records[i]);
+    }
+    *count = kept;
+    return deduplicated;
+}
+
+bool CaptureWriter::findStored(int eye, uint64_t timestamp, uint32_t length) const {
+    for (const StoredImage& image : m_stored[eye]) {
+        if (image.timestamp == timestamp && image.length == length) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CaptureWriter::isStored(int eye, uint64_t timestamp, uint32_t length) {
+    // Streams without X-Timestamp have nothing to refer back by
+    if (timestamp == 0 || length == 0 || length == CAPTURE_IMAGE_REF) {
+        return false;
+    }
+
+    if (findStored(eye, timestamp, length)) {
+        return true;
+    }
+
+    // It's about to be written; later records can refer to it
+    m_stored[eye][m_storedNext[eye]] = StoredImage { timestamp, length };
+    m_storedNext[eye] = (m_storedNext[eye] + 1) % m_stored[eye].size();
+    return false;
+}
+
+#ifdef _WIN32
+
+bool CaptureWriter::writeRecords(const Record* records, size_t count) {
+    // No writev for buffered files, so coalesce into the staging buffer and
+    // write that once it's full
+    size_t staged = 0;
+    bool ok = true;
+
+    for (size_t i = 0; i < count; i++) {
+        const void* parts[3] = { &records[i].meta, records[i].left.data(), records[i].right.data() };
+        size_t sizes[3] = { sizeof(CaptureFrame), CAPTURE_IMAGE_BYTES(records[i].meta.jpeg_data_left_length), CAPTURE_IMAGE_BYTES(records[i].meta.jpeg_data_right_length) };
+
+        for (int p = 0; p < 3; p++) {
+            if (staged + sizes[p] > m_staging.size()) {
+                ok = writeAll(m_staging.data(), staged) && ok;
+                staged = 0;
+            }
+            if (sizes[p] > m_staging.size()) {
+                ok = writeAll(parts[p], sizes[p]) && ok;
+            } else if (sizes[p] > 0) {
+                memcpy(m_staging.data() + staged, parts[p], sizes[p]);
+                staged += sizes[p];
+            }
+        }
+    }
+
+    return writeAll(m_staging.data(), staged) && ok;
+}
+
+bool CaptureWriter::writeAll(const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    while (size > 0) {
+        DWORD written;
+        if (!WriteFile((HANDLE)m_file, bytes, (DWORD)std::min(size, (size_t)0x40000000), &written, NULL)) {
+            printf("CaptureWriter: write failed (error %lu)\n", GetLastError());
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool CaptureWriter::rollback() {
+    LARGE_INTEGER offset;
+    offset.QuadPart = (LONGLONG)m_fileOffset;
+    if (!SetFilePointerEx((HANDLE)m_file, offset, NULL, FILE_BEGIN) || !SetEndOfFile((HANDLE)m_file)) {
+        printf("CaptureWriter: can't truncate the file after a failed write (error %lu), no more records will be written\n", GetLastError());
+        return false;
+    }
+    return true;
+}
+
+void CaptureWriter::sync() {
+    FlushFileBuffers((HANDLE)m_file);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.syncs++;
+}
+
+#else
+
+bool CaptureWriter::writeRecords(const Record* records, size_t count) {
+    struct iovec iov[3 * CAPTURE_WRITER_BATCH_RECORDS];
+    int iovCount = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        iov[iovCount++] = { (void*)&records[i].meta, sizeof(CaptureFrame) };
+        uint32_t leftBytes = CAPTURE_IMAGE_BYTES(records[i].meta.jpeg_data_left_length);
+        uint32_t rightBytes = CAPTURE_IMAGE_BYTES(records[i].meta.jpeg_data_right_length);
+        if (leftBytes > 0) {
+            iov[iovCount++] = { (void*)records[i].left.data(), leftBytes };
+        }
+        if (rightBytes > 0) {
+            iov[iovCount++] = { (void*)records[i].right.data(), rightBytes };
+        }
+    }
+
+    // writev may stop early; continue from where it did
+    struct iovec* next = iov;
+    while (iovCount > 0) {
+        ssize_t written = writev((int)m_file, next, std::min(iovCount, IOV_MAX));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("CaptureWriter: write failed: %s\n", strerror(errno));
+            return false;
+        }
+
+        size_t remaining = (size_t)written;
+        while (iovCount > 0 && remaining >= next->iov_len) {
+            remaining -= next->iov_len;
+            next++;
+            iovCount--;
+        }
+        if (iovCount > 0) {
+            next->iov_base = static_cast<char*>(next->iov_base) + remaining;
+            next->iov_len -= remaining;
+        }
+    }
+    return true;
+}
+
+bool CaptureWriter::rollback() {
+    if (ftruncate((int)m_file, (off_t)m_fileOffset) != 0 || lseek((int)m_file, (off_t)m_fileOffset, SEEK_SET) < 0) {
+        printf("CaptureWriter: can't truncate the file after a failed write: %s, no more records will be written\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void CaptureWriter::sync() {
+#ifdef __APPLE__
+    fsync((int)m_file);
+#else
+    fdatasync((int)m_file);
+#endif
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.syncs++;
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef CAPTURE_WRITER_H
+#define CAPTURE_WRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "capture_data.h"
+
+struct MJPEGFrame;
+class MetricCounter;
+class MetricGauge;
+class MetricHistogram;
+
+#define CAPTURE_WRITER_QUEUE_RECORDS 256     // Records waiting for the disk before new ones are dropped
+#define CAPTURE_WRITER_BATCH_RECORDS 64      // Most records coalesced into one write
+#define CAPTURE_WRITER_STAGING_BYTES 1048576 // Coalescing buffer where there is no writev (Windows)
+#define CAPTURE_WRITER_SYNC_MS       1000    // Longest time written data stays unsynced
+#define CAPTURE_WRITER_DEDUP_HISTORY 256     // Images per eye remembered for CAPTURE_IMAGE_REF records
+
+/**
+ * @brief Counters since open()
+ */
+struct CaptureWriterStats {
+    size_t queueDepth = 0;    // Records waiting right now
+    size_t maxQueueDepth = 0; // Highest queueDepth seen
+    uint64_t records = 0;     // Records written to the file
+    uint64_t bytes = 0;
+    uint64_t dropped = 0;     // Records discarded because the queue was full
+    uint64_t writeErrors = 0; // Failed writes; their records are lost
+    bool failed = false;      // A failed write couldn't be undone, so nothing more is written
+    uint64_t syncs = 0;
+    uint64_t deduplicated = 0; // Images written as a reference to an earlier record
+    uint64_t unresolved = 0;   // writeReference() records whose images weren't in the file; dropped
+};
+
+/**
+ * @brief Writes capture records (metadata, left JPEG, right JPEG) on a
+ *        thread of its own
+ *
+ * write() only copies the record into the queue, so a slow disk never
+ * stalls the caller and queued records don't hold on to the stream's pooled
+ * frames (there are far fewer of those than queue slots). The queue slots
+ * keep their buffers, so steady-state capture doesn't allocate. The writer
+ * thread takes everything
+ * queued and writes it in one writev (a staging buffer and one WriteFile on
+ * Windows). It syncs the file to disk at least every CAPTURE_WRITER_SYNC_MS.
+ * When the queue is full, new records are dropped and counted rather than
+ * blocking. The file format is the same as writing the three parts in turn.
+ *
+ * A failed or short write truncates the file back to the end of the last
+ * complete record, so a reader never sees a torn one. If even that fails,
+ * the file is marked failed and nothing more is written to it.
+ *
+ * An image whose camera timestamp and length match one already in the file
+ * is written as CAPTURE_IMAGE_REF instead of repeating its bytes. That is
+ * mostly writeReference(): labels sampled between two camera frames are
+ * written as records of their own that refer to the last pair's images.
+ */
+class CaptureWriter {
+public:
+    CaptureWriter();
+    ~CaptureWriter();
+
+    /**
+     * @brief Create (or truncate) the capture file and start the writer thread
+     * @return false if the file couldn't be opened
+     */
+    bool open(const char* filename);
+
+    // Write everything still queued, sync and close the file
+    void close();
+    bool isOpen() const;
+
+    /**
+     * @brief Queue one record
+     *
+     * The JPEG lengths in meta must match the frames. Either frame may be
+     * NULL for an empty image. The JPEG bytes are copied; the frames aren't
+     * referenced after this returns.
+     *
+     * @return false if the queue is full or the file has failed, and the
+     *         record was dropped
+     */
+    bool write(const CaptureFrame& meta, MJPEGFrame* left, MJPEGFrame* right);
+
+    /**
+     * @brief Queue a record whose images an earlier record already wrote
+     *
+     * meta carries the camera timestamps and JPEG lengths of those images,
+     * as in the record that wrote them; this one is written with
+     * CAPTURE_IMAGE_REF lengths and no bytes. If the images aren't in the
+     * file (their record was dropped or lost to a failed write), it's
+     * dropped and counted as unresolved.
+     *
+     * @return false if the queue is full or the file has failed
+     */
+    bool writeReference(const CaptureFrame& meta);
+
+    CaptureWriterStats getStats() const;
+
+private:
+    struct Record {
+        CaptureFrame meta;
+        std::vector<unsigned char> left; // JPEG bytes, empty for none
+        std::vector<unsigned char> right;
+        bool reference; // From writeReference(); the images are in the file already
+    };
+
+    // Copy a record into the queue; frames are null for a reference
+    bool enqueue(const CaptureFrame& meta, MJPEGFrame* left, MJPEGFrame* right, bool reference);
+
+    void writerLoop();
+
+    // Turn images already in the file into CAPTURE_IMAGE_REF and drop
+    // references that can't be resolved; returns how many images were
+    // turned into references and shrinks *count by the dropped records
+    size_t deduplicate(Record* records, size_t* count, size_t* unresolved);
+
+    // Whether this image of eye (0 left, 1 right) is already in the file;
+    // remembers it if not
+    bool isStored(int eye, uint64_t timestamp, uint32_t length);
+    bool findStored(int eye, uint64_t timestamp, uint32_t length) const;
+
+    // Write a batch; false if anything failed
+    bool writeRecords(const Record* records, size_t count);
+
+    // Truncate the file back to m_fileOffset after a failed write
+    bool rollback();
+#ifdef _WIN32
+    bool writeAll(const void* data, size_t size);
+#endif
+    void sync();
+
+    intptr_t m_file; // int descriptor, or HANDLE on Windows
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+
+    // Guards the queue and m_stats
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::vector<Record> m_queue; // Ring of CAPTURE_WRITER_QUEUE_RECORDS; slots are swapped with m_batch, not copied
+    size_t m_head;
+    size_t m_count;
+    CaptureWriterStats m_stats;
+
+    // Owned by the writer thread
+    std::vector<Record> m_batch; // CAPTURE_WRITER_BATCH_RECORDS slots
+    size_t m_batchCount;
+    uint64_t m_fileOffset; // End of the last complete record
+    std::vector<unsigned char> m_staging;
+
+    // Rings of CAPTURE_WRITER_DEDUP_HISTORY (timestamp, length) per eye
+    struct StoredImage {
+        uint64_t timestamp;
+        uint32_t length;
+    };
+    std::vector<StoredImage> m_stored[2];
+    size_t m_storedNext[2];
+
+    // Process-wide totals across open()s, served at /metrics
+    MetricCounter* m_recordsMetric;
+    MetricCounter* m_bytesMetric;
+    MetricCounter* m_droppedMetric;
+    MetricCounter* m_writeErrorsMetric;
+    MetricCounter* m_deduplicatedMetric;
+    MetricGauge* m_queueDepthMetric;
+    MetricHistogram* m_writeSecondsMetric;
+    MetricHistogram* m_syncSecondsMetric;
+};
+
+#endif // CAPTURE_WRITER_H
@@ -0,0 +1,127 @@
+@echo off
+setlocal enabledelayedexpansion
+
+echo Compiling capture export tool...
+
+:: Configuration variables - Modify these to match your environment
+set "OUTPUT_EXE=capture_export.exe"
+set "VS_PATH=C:\Program Files (x86)\Microsoft Visual Studio\2019\Community\VC\Auxiliary\Build\vcvarsall.bat"
+set "VS_ARCHITECTURE=x64"
+set "LIBRARIES=turbojpeg.lib"
+set "ICON_FILE=app.ico"
+set "TURBOJPEG_PATH=C:\libjpeg-turbo64"
+
+:: Source files - separate C and C++ files
+set "CPP_SOURCE_FILES=capture_export.cpp capture_reader.cpp numpy_io.cpp preprocess.cpp"
+set "C_SOURCE_FILES="
+
+:: Check if cl.exe is in PATH
+where cl.exe >nul 2>nul
+if !ERRORLEVEL! NEQ 0 (
+    echo MSVC compiler not found in PATH. Attempting to set up environment...
+    
+    :: Check if the VS_PATH file exists
+    if exist "!VS_PATH!" (
+        echo Setting up Visual Studio environment from: !VS_PATH!
+        call "!VS_PATH!" !VS_ARCHITECTURE!
+    ) else (
+        echo Could not find Visual Studio at: !VS_PATH!
+        echo Please modify the VS_PATH in this batch file or run from a Developer Command Prompt.
+        pause
+        exit /b 1
+    )
+)
+
+:: Check again if cl.exe is available after setup
+where cl.exe >nul 2>nul
+if !ERRORLEVEL! NEQ 0 (
+    echo Failed to set up MSVC compiler. Please check your Visual Studio installation.
+    pause
+    exit /b 1
+)
+
+:: Create build directory if it doesn't exist
+if not exist "build" mkdir build
+
+:: Create resource file for the icon
+echo Creating resource file for the icon...
+echo 1 ICON "%ICON_FILE%" > build\app.rc
+
+:: Compile the resource file
+echo Compiling resource file...
+rc.exe /nologo build\app.rc
+
+:: Define compiler and linker flags
+set "COMMON_FLAGS=/nologo /W3 /Od /D_CRT_SECURE_NO_WARNINGS /DWIN32 /D_WINDOWS /std:c++17 /EHsc"
+set "INCLUDE_DIRS=/I"%TURBOJPEG_PATH%\include""
+set "LIBRARY_DIRS=/LIBPATH:"%TURBOJPEG_PATH%\lib""
+
+cls
+if exist "build_helper.c" (
+    cl.exe /nologo /W3 /Od /D_CRT_SECURE_NO_WARNINGS build_helper.c /Fe:"bhelp.exe"
+    echo.
+)
+
+:: Compile C source files (without /EHsc and /std flags)
+echo Compiling C source files:
+for %%f in (%C_SOURCE_FILES%) do (
+    if exist "bhelp.exe" bhelp /clformat
+    cl.exe /nologo /W3 /Od /D_CRT_SECURE_NO_WARNINGS /DWIN32 /D_WINDOWS !INCLUDE_DIRS! /c %%f /Fo:"build\%%~nf.obj"
+)
+
+:: Compile C++ source files
+echo Compiling C++ source files:
+for %%f in (%CPP_SOURCE_FILES%) do (
+    if exist "bhelp.exe" bhelp /clformat
+    cl.exe !COMMON_FLAGS! !INCLUDE_DIRS! /c %%f /Fo:"build\%%~nf.obj"
+)
+
+:: Create a list of object files
+set "OBJ_FILES="
+for %%f in (%C_SOURCE_FILES% %CPP_SOURCE_FILES%) do (
+    set "OBJ_FILES=!OBJ_FILES! build\%%~nf.obj"
+)
+
+:: Add the resource object to the list of object files
+set "OBJ_FILES=!OBJ_FILES! build\app.res"
+
+:: Link the object files
+echo.
+echo Linking...
+link.exe /nologo /OUT:"build\%OUTPUT_EXE%" %OBJ_FILES% %LIBRARY_DIRS% %LIBRARIES%
+
+if exist "bhelp.exe" (
+    bhelp /clformat
+    echo %OUTPUT_EXE%
+    echo.
+)
+
+:: Check if compilation was successful
+if !ERRORLEVEL! EQU 0 (
+    echo Compilation successful!
+    echo.
+    
+    :: Copy the executable to the root directory as well
+    copy /Y "build\!OUTPUT_EXE!" "!OUTPUT_EXE!" >nul
+    
+    :: Copy required DLLs
+    if exist "%TURBOJPEG_PATH%\bin\turbojpeg.dll" (
+        copy /Y "%TURBOJPEG_PATH%\bin\turbojpeg.dll" "build\turbojpeg.dll" >nul
+        copy /Y "%TURBOJPEG_PATH%\bin\turbojpeg.dll" "turbojpeg.dll" >nul
+    )
+
+    if exist "bhelp.exe" bhelp
+
+    echo.
+    echo Required files for running:
+    echo !OUTPUT_EXE!
+    echo turbojpeg.dll
+    echo.
+    echo Usage: !OUTPUT_EXE! ^<capture.bin^> ^<output_dir^> [--threads N] [--shard-rows N] [--resolution N] [--float]
+    echo.
+) else (
+    echo Compilation failed with error code !ERRORLEVEL!.
+)
+
+endlocal
+pause
\ No newline at end of file
@@ -12,8 +12,10 @@ set "LIBRARIES=turbojpeg.lib onnxruntime.lib"
 set "ICON_FILE=app.ico"
 set "TURBOJPEG_PATH=C:\libjpeg-turbo64"
 
-:: Source files
-set "CPP_SOURCE_FILES=trainer.cpp numpy_io.cpp capture_reader.cpp"
+:: Source files; the training library (trainer_core.h) is built into trainer_core.lib
+set "CPP_SOURCE_FILES=trainer.cpp label_ranges.cpp numpy_io.cpp capture_reader.cpp preprocess.cpp"
+set "LIB_SOURCE_FILES=trainer_core.cpp ort_cache.cpp"
+set "OUTPUT_LIB=trainer_core.lib"
 
 :: Check if cl.exe is in PATH
 where cl.exe >nul 2>nul
@@ -73,19 +75,28 @@ if exist "build_helper.c" (
 
 :: Compile C++ source files
 echo Compiling C++ source files:
-for %%f in (%CPP_SOURCE_FILES%) do (
+for %%f in (%LIB_SOURCE_FILES% %CPP_SOURCE_FILES%) do (
     if exist "bhelp.exe" bhelp /clformat
     cl.exe !COMMON_FLAGS! !INCLUDE_DIRS! /c %%f /Fo:"build\%%~nf.obj"
 )
 
+:: Archive the training library
+set "LIB_OBJ_FILES="
+for %%f in (%LIB_SOURCE_FILES%) do (
+    set "LIB_OBJ_FILES=!LIB_OBJ_FILES! build\%%~nf.obj"
+)
+echo.
+echo Archiving %OUTPUT_LIB%...
+lib.exe /nologo /OUT:"build\%OUTPUT_LIB%" !LIB_OBJ_FILES!
+
 :: Create a list of object files
 set "OBJ_FILES="
 for %%f in (%CPP_SOURCE_FILES%) do (
     set "OBJ_FILES=!OBJ_FILES! build\%%~nf.obj"
 )
 
-:: Add the resource object to the list of object files
-set "OBJ_FILES=!OBJ_FILES! build\app.res"
+:: Add the resource object and the training library
+set "OBJ_FILES=!OBJ_FILES! build\app.res build\%OUTPUT_LIB%"
 
 :: Link the object files
 echo.
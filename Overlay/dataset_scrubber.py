@@ -162,6 +162,8 @@ class DatasetScrubber:
             frame_size = struct.calcsize(struct_format)
             
             self.frames = []
+            stored_left = {}   # timestamp_left -> image bytes, for records that refer back to them
+            stored_right = {}
             
             with open(filename, 'rb') as f:
                 frame_count = 0
@@ -180,9 +182,17 @@ class DatasetScrubber:
                      timestamp, timestamp_left, timestamp_right,
                      routine_state, jpeg_data_left_length, jpeg_data_right_length) = unpacked
                     
-                    # Read image data
-                    image_left_data = f.read(jpeg_data_left_length) if jpeg_data_left_length > 0 else None
-                    image_right_data = f.read(jpeg_data_right_length) if jpeg_data_right_length > 0 else None
+                    # Read image data; CAPTURE_IMAGE_REF (0xFFFFFFFF) reuses an earlier record's image
+                    if jpeg_data_left_length == 0xFFFFFFFF:
+                        image_left_data = stored_left.get(timestamp_left)
+                    else:
+                        image_left_data = f.read(jpeg_data_left_length) if jpeg_data_left_length > 0 else None
+                        stored_left[timestamp_left] = image_left_data
+                    if jpeg_data_right_length == 0xFFFFFFFF:
+                        image_right_data = stored_right.get(timestamp_right)
+                    else:
+                        image_right_data = f.read(jpeg_data_right_length) if jpeg_data_right_length > 0 else None
+                        stored_right[timestamp_right] = image_right_data
                     
                     # Store frame data
                     frame = {
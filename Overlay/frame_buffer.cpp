@@ -1,5 +1,10 @@
 #include "frame_buffer.h"
+#include "frame_ring_writer.h"
 #include "jpeg_stream.h" // Include the correct header file
+#include "metrics.h"
+#include "preprocess.h"
+#include "stream_reactor.h"
+#include <turbojpeg.h>
 #include <chrono>
 #include <cstdlib> // for malloc/free
 #include <cstring> // for memcpy
@@ -42,58 +47,73 @@ uint64_t current_time_ms_2(void) { // todo: utils class
 
 FrameBuffer::FrameBuffer(const char* url, int updateInterval)
     : streamUrl(url)
-    , frontBuffer(0)
+    , frameSequence(0)
     , running(false)
     , updateIntervalMs(updateInterval)
-    , frameInUse(false)
     , targetWidth(0)
     , targetHeight(0)
     , resizeEnabled(false) {
-    // Initialize empty buffers
-    buffers[0].clear();
-    buffers[1].clear();
 }
 
 FrameBuffer::FrameBuffer(const char* url, int targetWidth, int targetHeight, int updateInterval)
     : streamUrl(url)
-    , frontBuffer(0)
+    , frameSequence(0)
     , running(false)
     , updateIntervalMs(updateInterval)
-    , frameInUse(false)
     , targetWidth(targetWidth)
     , targetHeight(targetHeight)
     , resizeEnabled(true) {
-    // Initialize empty buffers
-    buffers[0].clear();
-    buffers[1].clear();
 }
 
 FrameBuffer::FrameBuffer(int targetWidth, int targetHeight, int updateInterval)
     : streamUrl(nullptr)
-    , frontBuffer(0)
+    , frameSequence(0)
     , running(false)
     , updateIntervalMs(updateInterval)
-    , frameInUse(false)
     , targetWidth(targetWidth)
     , targetHeight(targetHeight)
     , resizeEnabled(true) {
-    // Initialize empty buffers
-    buffers[0].clear();
-    buffers[1].clear();
 }
 
 FrameBuffer::~FrameBuffer() {
     stop();
 
-    // Clean up buffers
-    buffers[0].clear();
-    buffers[1].clear();
+    // Drop our reference; the stream's pool is freed with its last frame
+    ReleaseFrame(currentFrame);
+    currentFrame = nullptr;
+
+    if (planeDecoder) {
+        tjDestroy(static_cast<tjhandle>(planeDecoder));
+    }
+    delete frameRing;
 }
 
 void FrameBuffer::setURL(const char* url) {
     this->streamUrl = url;
 }
 
+void FrameBuffer::setReactor(StreamReactor* reactor) {
+    this->reactor = reactor;
+}
+
+bool FrameBuffer::setFrameRing(const char* name) {
+    std::lock_guard<std::mutex> lock(ringMutex);
+    delete frameRing;
+    frameRing = nullptr;
+
+    if (!name) {
+        return true;
+    }
+
+    FrameRingWriter* writer = new FrameRingWriter();
+    if (!writer->open(name)) {
+        delete writer;
+        return false;
+    }
+    frameRing = writer;
+    return true;
+}
+
 void FrameBuffer::setTargetResolution(int width, int height) {
     std::lock_guard<std::mutex> lock(frameMutex);
     targetWidth = width;
@@ -105,16 +125,48 @@ void FrameBuffer::start() {
     if (running.exchange(true)) {
         return; // Already running
     }
+    if (!streamUrl) {
+        running = false;
+        printf("ERROR: FrameBuffer: no stream URL, call setURL() before start()\n");
+        return;
+    }
 
-    // Connect to the stream - use the exact function from jpeg_stream.h
+    // Series are per camera URL; a restart with the same URL continues them
+    MetricsRegistry& metrics = MetricsRegistry::global();
+    MetricLabels labels = { { "stream", streamUrl } };
+    framesMetric = &metrics.counter("baballs_frames_total", "Camera frames published", labels);
+    bytesMetric = &metrics.counter("baballs_frame_bytes_total", "JPEG bytes of published camera frames", labels);
+    planeSecondsMetric = &metrics.histogram("baballs_plane_decode_seconds", "Decoding a frame to its model-ready plane", MetricsLatencyBuckets, labels);
+    planeErrorsMetric = &metrics.counter("baballs_plane_decode_errors_total", "Frames whose plane couldn't be decoded", labels);
+    poolOverflowsMetric = &metrics.counter("baballs_frame_pool_overflows_total", "Frames allocated outside the stream's pool because every pooled frame was held", labels);
+
+    if (reactor) {
+        // The reactor's workers publish frames as they arrive
+        // A camera that isn't up yet stays registered and is retried there
+        reactorStreamId = reactor->addStream(streamUrl, [this](MJPEGFrame* frame) {
+            publishFrame(frame);
+        });
+        if (reactorStreamId < 0) {
+            running = false;
+            printf("ERROR: Can't add stream %s to reactor!\n", streamUrl);
+            return;
+        }
+        printf("Added JPEG stream %s to reactor\n", streamUrl);
+        return;
+    }
+
+    // Connect to the stream - use the exact function from jpeg_stream.h.
+    // If the camera isn't up yet the update thread keeps retrying.
     printf("Getting JPEG stream handle to %s...", streamUrl);
     stream = GetStreamHandle(streamUrl);
-    if (!stream) {
-        running = false;
-        printf("\nERROR: Can't get stream handle!\n");
-        return;
+    if (stream) {
+        printf(" [OK]\n");
+        health.setConnected(true);
+        reportedParseErrors = 0;
+        reportedHeaderFailures = 0;
+    } else {
+        printf("\nFrameBuffer: can't connect to %s yet, retrying\n", streamUrl);
     }
-    printf(" [OK]\n");
 
     // Start update thread
     updateThread = std::thread(&FrameBuffer::updateLoop, this);
@@ -131,6 +183,12 @@ void FrameBuffer::stop() {
         frameCondition.notify_all();
     }
 
+    // No frame is published after this returns
+    if (reactorStreamId >= 0) {
+        reactor->removeStream(reactorStreamId);
+        reactorStreamId = -1;
+    }
+
     // Wait for update thread to finish
     if (updateThread.joinable()) {
         updateThread.join();
@@ -141,12 +199,22 @@ void FrameBuffer::stop() {
         CloseStream(stream);
         stream = nullptr;
     }
+    health.setConnected(false);
 }
 
 bool FrameBuffer::isRunning() const {
     return running;
 }
 
+StreamHealth FrameBuffer::getHealth() const {
+    StreamHealth result;
+    int id = reactorStreamId;
+    if (reactor && id >= 0 && reactor->getStreamHealth(id, &result)) {
+        return result;
+    }
+    return health.getHealth();
+}
+
 int* FrameBuffer::resizeFrame(int* sourcePixels, int sourceWidth, int sourceHeight,
                               int targetWidth, int targetHeight) {
     if (!sourcePixels || sourceWidth <= 0 || sourceHeight <= 0 || targetWidth <= 0 || targetHeight <= 0) {
@@ -179,141 +247,243 @@ int* FrameBuffer::resizeFrame(int* sourcePixels, int sourceWidth, int sourceHeig
 }
 
 void FrameBuffer::updateLoop() {
-    // printf("Update loop 1\n");
+    if (!stream && !reconnect()) {
+        return;
+    }
+
     while (running) {
-        // Decode a new frame
-        int width, height;
-        uint64_t timestamp;
-        size_t frame_size;
-        // printf("Update loop 2\n");
-        unsigned char* pixels = DecodeFrame(stream, &width, &height, &timestamp, &frame_size);
-
-        // FILE* fp = fopen("./good_data2.bin", "wb");
-        // if (fp) {
-        //     fwrite(pixels, 1, frame_size, fp);
-        //     fclose(fp);
-        //     printf("Dumped bad JPEG data to bad_data4.bin (%u bytes)\n", frame_size);
-        // }
-
-        // printf("Update loop 3\n");
-        uint64_t time = current_time_ms_2();
-        // printf("Update loop 4\n");
-        if (pixels) {
-            // printf("Update loop 5\n");
-            //  Get back buffer index
-            int backBuffer = 1 - frontBuffer;
-
-            // Clear old back buffer
-            buffers[backBuffer].clear();
-
-            // Check if we need to resize
-            /*if (resizeEnabled && targetWidth > 0 && targetHeight > 0 &&
-                (width != targetWidth || height != targetHeight)) {
-
-                int* resizedPixels = resizeFrame(pixels, width, height, targetWidth, targetHeight);
-
-                if (resizedPixels) {
-                    // Free the original pixels since we made a copy
-                    free(pixels);
-
-                    // Update back buffer with resized image
-                    buffers[backBuffer].pixels = resizedPixels;
-                    buffers[backBuffer].width = targetWidth;
-                    buffers[backBuffer].height = targetHeight;
-                } else {
-                    // Resize failed, use original image
-                    buffers[backBuffer].pixels = pixels;
-                    buffers[backBuffer].width = width;
-                    buffers[backBuffer].height = height;
-                }
-            } else {
-                // No resize needed, update back buffer with original image
-                buffers[backBuffer].pixels = pixels;
-                buffers[backBuffer].width = width;
-                buffers[backBuffer].height = height;
-
-            }*/
-            // if(buffers[backBuffer].pixels)
-            //     free(buffers[backBuffer].pixels);
-
-            buffers[backBuffer].pixels = (unsigned char*)malloc(frame_size);
-            // buffers[backBuffer].pixels = pixels;
-            buffers[backBuffer].width = width;
-            buffers[backBuffer].height = height;
-
-            buffers[backBuffer].time = timestamp;
-            buffers[backBuffer].frame_size = frame_size;
-
-            memcpy(buffers[backBuffer].pixels, pixels, frame_size);
-
-            free(pixels);
-
-            /*FILE* fp = fopen("./good_data3.bin", "wb");
-            if (fp) {
-                fwrite(buffers[backBuffer].pixels, 1, frame_size, fp);
-                fclose(fp);
-                printf("Dumped bad JPEG data to bad_data4.bin (%u bytes)\n", frame_size);
-            }*/
-
-            // Swap buffers (thread-safe operation)
-            swapBuffers();
+        // Read the next frame straight into a pooled buffer. The socket read
+        // blocks until the camera sends it, so frames are published at the
+        // camera rate with no added delay.
+        MJPEGFrame* frame = DecodeSharedFrame(stream);
+
+        unsigned long parseErrors, headerFailures;
+        GetStreamErrorCounts(stream, &parseErrors, &headerFailures);
+        if (parseErrors != reportedParseErrors) {
+            health.onParseErrors(parseErrors - reportedParseErrors);
+            reportedParseErrors = parseErrors;
+        }
+        for (; reportedHeaderFailures < headerFailures; reportedHeaderFailures++) {
+            health.onHeaderFailure();
+        }
+
+        if (frame) {
+            health.onFrame(frame->size);
+            publishFrame(frame);
+        } else if (!reconnect()) {
+            return;
         }
-        // printf("Update loop 6\n");
-        //  Sleep for a while
-        std::this_thread::sleep_for(std::chrono::milliseconds(updateIntervalMs));
     }
 }
 
-void FrameBuffer::swapBuffers() {
-    std::lock_guard<std::mutex> lock(frameMutex);
+bool FrameBuffer::reconnect() {
+    // No stream yet means the first connect failed; that isn't a reconnect
+    const bool lost = (stream != nullptr);
+    if (lost) {
+        printf("FrameBuffer: lost stream %s, reconnecting\n", streamUrl);
+        CloseStream(stream);
+        stream = nullptr;
+    }
+    health.setConnected(false);
 
-    // Only swap if the front buffer is not in use
-    if (!frameInUse) {
-        frontBuffer = 1 - frontBuffer;
+    int delayMs = updateIntervalMs;
+    while (running) {
+        // Waiting on frameCondition lets stop() cut the delay short
+        {
+            std::unique_lock<std::mutex> lock(frameMutex);
+            frameCondition.wait_for(lock, std::chrono::milliseconds(delayMs), [&]() {
+                return !running;
+            });
+        }
+        if (!running) {
+            break;
+        }
+
+        stream = GetStreamHandle(streamUrl);
+        if (stream) {
+            printf("FrameBuffer: %s to %s\n", lost ? "reconnected" : "connected", streamUrl);
+            reportedParseErrors = 0;
+            reportedHeaderFailures = 0;
+            if (lost) {
+                health.onReconnect();
+            }
+            health.setConnected(true);
+            return true;
+        }
+
+        delayMs = (delayMs * 2 < STREAM_REACTOR_RECONNECT_MAX_MS) ? delayMs * 2 : STREAM_REACTOR_RECONNECT_MAX_MS;
     }
+
+    return false;
 }
 
-unsigned char* FrameBuffer::getFrameCopy(int* width, int* height, uint64_t* time, size_t* data_size) {
+bool FrameBuffer::decodePlane(MJPEGFrame* frame, int width, int height) {
+    tjhandle tjInstance = static_cast<tjhandle>(planeDecoder);
+    if (!tjInstance) {
+        tjInstance = tjInitDecompress();
+        if (!tjInstance) {
+            printf("FrameBuffer: can't create plane decoder\n");
+            return false;
+        }
+        planeDecoder = tjInstance;
+    }
+
+    int jpegWidth, jpegHeight, subsamp, colorspace;
+    if (tjDecompressHeader3(tjInstance, frame->data, (unsigned long)frame->size, &jpegWidth, &jpegHeight, &subsamp, &colorspace) != 0) {
+        return false;
+    }
+
+    // Let the IDCT do most of the downscale: pick the smallest scaling
+    // factor whose output still covers the target
+    int scaledWidth = jpegWidth;
+    int scaledHeight = jpegHeight;
+    int factorCount = 0;
+    tjscalingfactor* factors = tjGetScalingFactors(&factorCount);
+    for (int i = 0; i < factorCount; i++) {
+        int w = TJSCALED(jpegWidth, factors[i]);
+        int h = TJSCALED(jpegHeight, factors[i]);
+        if (w >= width && h >= height && (size_t)w * h < (size_t)scaledWidth * scaledHeight) {
+            scaledWidth = w;
+            scaledHeight = h;
+        }
+    }
+
+    const size_t scaledCount = (size_t)scaledWidth * scaledHeight;
+    if (planeScratch.size() < scaledCount) {
+        planeScratch.resize(scaledCount);
+    }
+
+    // TJPF_GRAY returns the JPEG's luma channel, no color conversion
+    if (tjDecompress2(tjInstance, frame->data, (unsigned long)frame->size, planeScratch.data(),
+                      scaledWidth, 0, scaledHeight, TJPF_GRAY, TJFLAG_FASTDCT) != 0) {
+        return false;
+    }
+
+    unsigned char* plane = ReserveFramePlane(frame, width, height);
+    if (!plane) {
+        return false;
+    }
+
+    // Same order as PreprocessEyeImage: equalize, then resample
+    PreprocessEqualize(planeScratch.data(), scaledCount);
+    PreprocessResampleGray(planeScratch.data(), scaledWidth, scaledHeight, plane, width, height);
+
+    frame->plane = plane;
+    frame->plane_width = width;
+    frame->plane_height = height;
+    return true;
+}
+
+void FrameBuffer::publishFrame(MJPEGFrame* frame) {
+    int planeWidth = 0;
+    int planeHeight = 0;
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        if (resizeEnabled) {
+            planeWidth = targetWidth;
+            planeHeight = targetHeight;
+        }
+    }
+
+    // Decoded before the frame is shared, so consumers never see a partial plane
+    if (planeWidth > 0 && planeHeight > 0) {
+        auto decodeStart = std::chrono::steady_clock::now();
+        if (decodePlane(frame, planeWidth, planeHeight)) {
+            planeSecondsMetric->observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - decodeStart).count());
+        } else {
+            planeErrorsMetric->add();
+            printf("FrameBuffer: failed to decode plane for %s\n", streamUrl);
+        }
+    }
+    framesMetric->add();
+    bytesMetric->add(frame->size);
+    if (!frame->pool) {
+        poolOverflowsMetric->add();
+    }
+
+    MJPEGFrame* previous;
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        previous = currentFrame;
+        currentFrame = frame;
+        sequence = frameSequence.fetch_add(1, std::memory_order_release) + 1;
+    }
+    frameCondition.notify_all();
+
+    // Our reference keeps the frame alive until the next publish, which
+    // only this thread does
+    {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        if (frameRing) {
+            frameRing->publish(frame, sequence);
+        }
+    }
+
+    // Consumers may still hold the previous frame; it returns to the pool
+    // once they release it
+    ReleaseFrame(previous);
+}
+
+MJPEGFrame* FrameBuffer::acquireFrame(uint64_t* sequence) {
     std::lock_guard<std::mutex> lock(frameMutex);
+    RetainFrame(currentFrame);
+    if (sequence) {
+        *sequence = frameSequence.load(std::memory_order_relaxed);
+    }
+    return currentFrame;
+}
 
-    Frame& front = buffers[frontBuffer];
+MJPEGFrame* FrameBuffer::waitForFrame(uint64_t afterSequence, int timeoutMs, uint64_t* sequence) {
+    std::unique_lock<std::mutex> lock(frameMutex);
 
-    if (!front.pixels) {
-        *width = *height = 0;
-        *time = 0;
-        printf("Get Frame Copy returned nothing!\n");
+    // stop() cuts the wait short; a buffer that isn't running yet waits the
+    // full timeout so callers polling in a loop don't spin
+    bool wasRunning = running;
+    bool published = frameCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&]() {
+        return (wasRunning && !running) || frameSequence.load(std::memory_order_relaxed) > afterSequence;
+    });
+
+    if (!published || frameSequence.load(std::memory_order_relaxed) <= afterSequence || !currentFrame) {
         return nullptr;
     }
 
-    // Allocate memory for the copy
-    /*int pixelCount = front.width * front.height;
-    int* copy = static_cast<int*>(malloc(pixelCount * sizeof(int)));
+    RetainFrame(currentFrame);
+    if (sequence) {
+        *sequence = frameSequence.load(std::memory_order_relaxed);
+    }
+    return currentFrame;
+}
 
-    if (copy) {
-        // Copy the pixel data
-        memcpy(copy, front.pixels, pixelCount * sizeof(int));
-        *width = front.width;
-        *height = front.height;
-        *time = front.time;
-    } else {
+uint64_t FrameBuffer::getFrameSequence() const {
+    return frameSequence.load(std::memory_order_acquire);
+}
+
+unsigned char* FrameBuffer::getFrameCopy(int* width, int* height, uint64_t* time, size_t* data_size) {
+    MJPEGFrame* frame = acquireFrame();
+
+    if (!frame) {
         *width = *height = 0;
         *time = 0;
-    }*/
+        *data_size = 0;
+        printf("Get Frame Copy returned nothing!\n");
+        return nullptr;
+    }
 
-    unsigned char* copy = static_cast<unsigned char*>(malloc(front.frame_size));
+    unsigned char* copy = static_cast<unsigned char*>(malloc(frame->size));
     if (copy) {
-        // Copy the pixel data
-        memcpy(copy, front.pixels, front.frame_size);
-        *width = front.width;
-        *height = front.height;
-        *time = front.time;
-        *data_size = front.frame_size;
+        memcpy(copy, frame->data, frame->size);
+        *width = frame->width;
+        *height = frame->height;
+        *time = frame->timestamp;
+        *data_size = frame->size;
     } else {
         *width = *height = 0;
         *time = 0;
         *data_size = 0;
     }
 
+    ReleaseFrame(frame);
     return copy;
 }
 
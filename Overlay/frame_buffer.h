@@ -4,15 +4,27 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <cstdint>
 #include <mutex>
 #include <thread>
+#include <vector>
+
+#include "stream_health.h"
 
 // Forward declaration - use the exact same struct name from jpeg_stream.h
 struct MJPEGStream;
+struct MJPEGFrame;
+class StreamReactor;
+class FrameRingWriter;
+class MetricCounter;
+class MetricHistogram;
 
 class FrameBuffer {
 public:
-    // New constructor with target resolution
+    // New constructor with target resolution. Frames are published as soon
+    // as they arrive; updateInterval is only the first reconnect delay after
+    // the stream is lost. With a target resolution every frame also carries
+    // a model-ready plane (see setTargetResolution).
     FrameBuffer(const char* url, int targetWidth, int targetHeight, int updateInterval = 30);
     FrameBuffer(const char* url, int updateInterval = 30);
     FrameBuffer(int targetWidth, int targetHeight, int updateInterval = 30);
@@ -22,6 +34,29 @@ public:
     // The caller is responsible for freeing the returned memory
     unsigned char* getFrameCopy(int* width, int* height, uint64_t* time, size_t* data_size);
 
+    // Get a shared reference to the current frame without copying it, or
+    // nullptr if none has arrived yet. The frame stays valid until the caller
+    // passes it to ReleaseFrame() (jpeg_stream.h). sequence (optional)
+    // receives the frame's sequence number.
+    MJPEGFrame* acquireFrame(uint64_t* sequence = nullptr);
+
+    // Block until a frame newer than afterSequence is published, then return
+    // a shared reference to it as acquireFrame() does. Returns nullptr on
+    // timeout or when stop() is called. Pass 0 to wait for the first frame.
+    MJPEGFrame* waitForFrame(uint64_t afterSequence, int timeoutMs, uint64_t* sequence = nullptr);
+
+    // Sequence number of the latest frame: 0 before the first frame, then
+    // increasing by one per published frame. Never blocks.
+    uint64_t getFrameSequence() const;
+
+    // Decode every frame on the ingestion thread to an equalized 8-bit
+    // grayscale plane of this size, published with the JPEG as
+    // MJPEGFrame::plane. The JPEG is decoded with DCT scaling straight to the
+    // smallest size that covers the target, so consumers like the inference
+    // engine skip their own full-resolution decode. 0 disables the plane.
+    // The plane is taken from the JPEG luma and equalized after the DCT
+    // downscale, so it is close to but not bit-identical with
+    // PreprocessEyeImage; leave it off where inference must match training.
     void setTargetResolution(int width, int height);
 
     // Get direct access to the current frame buffer (no copy)
@@ -29,34 +64,38 @@ public:
     // void unlockFrame();
     void setURL(const char* url);
 
+    // Read the stream on a shared StreamReactor instead of a thread of its
+    // own. Takes effect on the next start(); nullptr goes back to the thread.
+    void setReactor(StreamReactor* reactor);
+
+    // Also publish every frame, with its plane, into the named shared-memory
+    // ring so other local processes can read it (frame_ring.h). nullptr
+    // removes the ring. Returns false if the ring couldn't be created.
+    bool setFrameRing(const char* name);
+
+    // Health of the camera stream. Lost connections, and a camera that
+    // wasn't reachable at start(), are retried with exponential backoff on
+    // either reader.
+    StreamHealth getHealth() const;
+
     // Control methods
     void start();
     void stop();
     bool isRunning() const;
 
 private:
-    // Frame data structure
-    struct Frame {
-        unsigned char* pixels = nullptr;
-        int width = 0;
-        int height = 0;
-        uint64_t time = 0;
-        size_t frame_size = 0;
-
-        void clear() {
-            if (pixels) {
-                free(pixels);
-                pixels = nullptr;
-            }
-            width = height = 0;
-        }
-    };
-
     // Buffer update thread function
     void updateLoop();
 
-    // Swap front and back buffers
-    void swapBuffers();
+    // Open the stream after it was lost or never came up, waiting longer
+    // after every failed attempt. Returns false when stop() is called.
+    bool reconnect();
+
+    // Publish a newly decoded frame, taking over the caller's reference
+    void publishFrame(MJPEGFrame* frame);
+
+    // Fill frame->plane; runs on whichever thread publishes the frame
+    bool decodePlane(MJPEGFrame* frame, int width, int height);
 
     int* resizeFrame(int* sourcePixels, int sourceWidth, int sourceHeight,
                      int targetWidth, int targetHeight);
@@ -65,9 +104,20 @@ private:
     MJPEGStream* stream = nullptr;
     const char* streamUrl;
 
-    // Double buffer
-    Frame buffers[2];
-    int frontBuffer; // Index of the current front buffer
+    // Set when frames come from a StreamReactor instead of updateThread
+    StreamReactor* reactor = nullptr;
+    std::atomic<int> reactorStreamId { -1 };
+
+    // Health of the thread reader; the reactor keeps its own
+    StreamHealthMonitor health;
+    unsigned long reportedParseErrors = 0;
+    unsigned long reportedHeaderFailures = 0;
+
+    // Latest frame from the stream's pool; this object holds one reference.
+    // frameMutex only guards the pointer swap and the reader's RetainFrame(),
+    // never decoding or copying, so the producer can't stall behind a reader.
+    MJPEGFrame* currentFrame = nullptr;
+    std::atomic<uint64_t> frameSequence;
 
     // Thread control
     std::atomic<bool> running;
@@ -76,11 +126,26 @@ private:
 
     // Synchronization
     std::mutex frameMutex;
-    std::condition_variable frameCondition;
-    bool frameInUse;
+    std::condition_variable frameCondition; // Signalled on every published frame and on stop()
     int targetWidth = 0;
     int targetHeight = 0;
     bool resizeEnabled = false;
+
+    // Shared-memory copy of published frames; ringMutex only keeps
+    // setFrameRing() from closing the ring under a publish
+    std::mutex ringMutex;
+    FrameRingWriter* frameRing = nullptr;
+
+    // Registered by start() for the stream's URL
+    MetricCounter* framesMetric = nullptr;
+    MetricCounter* bytesMetric = nullptr;
+    MetricHistogram* planeSecondsMetric = nullptr;
+    MetricCounter* planeErrorsMetric = nullptr;
+    MetricCounter* poolOverflowsMetric = nullptr;
+
+    // Plane decoding state, only touched by the publishing thread
+    void* planeDecoder = nullptr; // tjhandle, created with the first plane
+    std::vector<unsigned char> planeScratch;
 };
 
 #endif // FRAME_BUFFER_H
\ No newline at end of file
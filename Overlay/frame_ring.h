@@ -0,0 +1,311 @@
+/**
+ * @file frame_ring.h
+ * @brief Shared-memory ring of camera frames, layout and reader side
+ *
+ * A FrameBuffer can publish every frame it receives into a named
+ * shared-memory ring (see FrameRingWriter). Any number of local processes
+ * can then read the frames in place instead of opening their own camera
+ * connection. This header has no dependencies besides the C runtime and the
+ * OS, so tools and Python extensions can include it on its own.
+ *
+ * There is one writer and any number of readers, and nobody takes a lock.
+ * Every slot has a sequence lock. The writer makes it odd while it fills
+ * the slot and even when the slot is complete. A reader remembers the
+ * value, reads the frame in place and then checks that the value has not
+ * changed. The writer never waits for readers. A reader that falls more
+ * than FRAME_RING_SLOTS frames behind loses the frame and just moves on to
+ * the newest one.
+ *
+ * Typical reader loop:
+ *
+ *     FrameRing* ring = FrameRingOpen("baballs_left");
+ *     uint64_t last = 0;
+ *     for (;;) {
+ *         FrameRingView view;
+ *         uint64_t latest = FrameRingLatest(ring);
+ *         if (latest == last || !FrameRingAcquire(ring, latest, &view)) {
+ *             continue; // or sleep
+ *         }
+ *         consume(view.jpeg, view.jpeg_size);
+ *         if (FrameRingStillValid(&view)) {
+ *             last = latest; // consume() saw a consistent frame
+ *         }
+ *     }
+ */
+
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_RING_MAGIC    0x474E5246u // "FRNG"
+#define FRAME_RING_VERSION  1
+#define FRAME_RING_SLOTS    8   // Frames a reader can fall behind before it loses one
+#define FRAME_RING_ALIGN    64  // Slot and plane alignment, one cache line
+#define FRAME_RING_NAME_LEN 128 // Longest ring name, without the OS prefix
+
+#ifdef _WIN32
+// Readers map the ring read-only, so loads must be plain reads; an interlocked
+// compare-exchange writes the page and faults there
+#define FRAME_RING_LOAD(p)     (uint64_t) ReadAcquire64((const volatile LONG64*)(p))
+#define FRAME_RING_LOAD32(p)   (uint32_t) ReadAcquire((const volatile LONG*)(p))
+#define FRAME_RING_STORE(p, v) InterlockedExchange64((volatile LONG64*)(p), (LONG64)(v))
+#define FRAME_RING_STORE32(p, v) InterlockedExchange((volatile LONG*)(p), (LONG)(v))
+#define FRAME_RING_FENCE()     MemoryBarrier()
+#else
+#define FRAME_RING_LOAD(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define FRAME_RING_LOAD32(p)   __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define FRAME_RING_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define FRAME_RING_STORE32(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define FRAME_RING_FENCE()     __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+/**
+ * @brief Start of the shared memory, followed by slot_count slots
+ */
+typedef struct FrameRingHeader {
+    volatile uint32_t magic; // Written last by the writer, so a half-initialized ring is never opened
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;        // Bytes from one slot to the next, FrameRingSlot included
+    volatile uint64_t latest;  // Sequence of the newest complete frame, 0 before the first
+    volatile uint64_t dropped;    // Frames that didn't fit in a slot
+    volatile uint32_t writer_pid; // Process writing the ring, 0 once it closed; tells a new writer whether the ring is in use
+    uint8_t reserved[28];
+} FrameRingHeader;
+
+/**
+ * @brief One frame; the JPEG follows the slot header, the plane (if any)
+ *        follows the JPEG at plane_offset
+ */
+typedef struct FrameRingSlot {
+    volatile uint64_t lock; // 2 * sequence + 1 while being written, 2 * sequence once complete
+    uint64_t sequence;      // Same numbering as FrameBuffer::getFrameSequence()
+    uint64_t timestamp;     // X-Timestamp of the camera, 0 if the stream doesn't send one
+    uint32_t width;         // JPEG dimensions
+    uint32_t height;
+    uint32_t jpeg_size;
+    uint32_t plane_offset;  // From the start of the JPEG bytes
+    uint32_t plane_width;   // 0 when the frame has no model plane
+    uint32_t plane_height;
+    uint8_t reserved[16];
+} FrameRingSlot;
+
+/**
+ * @brief Reader handle of a mapped ring
+ */
+typedef struct FrameRing {
+    const FrameRingHeader* header;
+    size_t size;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+} FrameRing;
+
+/**
+ * @brief A frame read in place; only valid while FrameRingStillValid() says so
+ */
+typedef struct FrameRingView {
+    uint64_t sequence;
+    uint64_t timestamp;
+    int width;
+    int height;
+    const unsigned char* jpeg;
+    size_t jpeg_size;
+    const unsigned char* plane; // Equalized 8-bit grayscale, NULL if not published
+    int plane_width;
+    int plane_height;
+
+    // Internal
+    const FrameRingSlot* slot;
+    uint64_t lock;
+} FrameRingView;
+
+// Bytes from the ring start to the given slot
+static inline size_t FrameRingSlotOffset(uint32_t slot_size, uint64_t index) {
+    return sizeof(FrameRingHeader) + (size_t)index * slot_size;
+}
+
+/**
+ * @brief Map an existing ring read-only
+ *
+ * @param name Ring name as given to the writer, e.g. "baballs_left"
+ * @return FrameRing* Handle for the other reader calls, or NULL if no writer
+ *                    has created the ring (yet)
+ */
+static inline FrameRing* FrameRingOpen(const char* name) {
+    char path[FRAME_RING_NAME_LEN + 8];
+    if (strlen(name) > FRAME_RING_NAME_LEN) {
+        return NULL;
+    }
+
+    FrameRing* ring = (FrameRing*)calloc(1, sizeof(FrameRing));
+    if (!ring) {
+        return NULL;
+    }
+
+#ifdef _WIN32
+    strcpy(path, "Local\\");
+    strcat(path, name);
+    ring->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, path);
+    if (!ring->mapping) {
+        free(ring);
+        return NULL;
+    }
+    ring->header = (const FrameRingHeader*)MapViewOfFile(ring->mapping, FILE_MAP_READ, 0, 0, 0);
+    MEMORY_BASIC_INFORMATION info;
+    if (!ring->header || !VirtualQuery(ring->header, &info, sizeof(info))) {
+        if (ring->header) {
+            UnmapViewOfFile(ring->header);
+        }
+        CloseHandle(ring->mapping);
+        free(ring);
+        return NULL;
+    }
+    ring->size = info.RegionSize;
+#else
+    strcpy(path, "/");
+    strcat(path, name);
+    int fd = shm_open(path, O_RDONLY, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FrameRingHeader)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(ring);
+        return NULL;
+    }
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        free(ring);
+        return NULL;
+    }
+    ring->header = (const FrameRingHeader*)base;
+    ring->size = (size_t)st.st_size;
+#endif
+
+    // Reject rings that aren't initialized yet or were made by another build
+    const FrameRingHeader* header = ring->header;
+    if (FRAME_RING_LOAD32(&header->magic) != FRAME_RING_MAGIC || header->version != FRAME_RING_VERSION
+        || header->slot_count == 0 || header->slot_size < sizeof(FrameRingSlot)
+        || FrameRingSlotOffset(header->slot_size, header->slot_count) > ring->size) {
+#ifdef _WIN32
+        UnmapViewOfFile(ring->header);
+        CloseHandle(ring->mapping);
+#else
+        munmap((void*)ring->header, ring->size);
+#endif
+        free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+/**
+ * @brief Unmap a ring; views into it become invalid. NULL is ignored.
+ */
+static inline void FrameRingClose(FrameRing* ring) {
+    if (!ring) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(ring->header);
+    CloseHandle(ring->mapping);
+#else
+    munmap((void*)ring->header, ring->size);
+#endif
+    free(ring);
+}
+
+/**
+ * @brief Sequence number of the newest complete frame, 0 before the first
+ */
+static inline uint64_t FrameRingLatest(const FrameRing* ring) {
+    return FRAME_RING_LOAD(&ring->header->latest);
+}
+
+/**
+ * @brief Number of frames the writer skipped because they didn't fit a slot
+ */
+static inline uint64_t FrameRingDropped(const FrameRing* ring) {
+    return FRAME_RING_LOAD(&ring->header->dropped);
+}
+
+/**
+ * @brief Check that a view's frame wasn't overwritten while it was read
+ *
+ * Call after using the view's data (or after copying it out). If this
+ * returns 0, whatever was read may be torn and must be discarded.
+ */
+static inline int FrameRingStillValid(const FrameRingView* view) {
+    FRAME_RING_FENCE();
+    return FRAME_RING_LOAD(&view->slot->lock) == view->lock;
+}
+
+/**
+ * @brief Point a view at a frame without copying it
+ *
+ * @param sequence The frame to read, usually FrameRingLatest()
+ * @return int 1 if the frame is complete and in the ring, 0 if it was
+ *             already overwritten or is still being written
+ */
+static inline int FrameRingAcquire(const FrameRing* ring, uint64_t sequence, FrameRingView* view) {
+    const FrameRingHeader* header = ring->header;
+    if (sequence == 0) {
+        return 0;
+    }
+
+    const FrameRingSlot* slot = (const FrameRingSlot*)((const unsigned char*)header
+        + FrameRingSlotOffset(header->slot_size, sequence % header->slot_count));
+    uint64_t lock = FRAME_RING_LOAD(&slot->lock);
+    if (lock != 2 * sequence || slot->sequence != sequence) {
+        return 0;
+    }
+
+    // The writer only stores sizes that fit its slot; check anyway so a
+    // reader can't be pointed outside the mapping
+    const size_t capacity = header->slot_size - sizeof(FrameRingSlot);
+    if (slot->jpeg_size > capacity
+        || (slot->plane_width && (size_t)slot->plane_offset + (size_t)slot->plane_width * slot->plane_height > capacity)) {
+        return 0;
+    }
+
+    const unsigned char* data = (const unsigned char*)(slot + 1);
+    view->sequence = slot->sequence;
+    view->timestamp = slot->timestamp;
+    view->width = (int)slot->width;
+    view->height = (int)slot->height;
+    view->jpeg = data;
+    view->jpeg_size = slot->jpeg_size;
+    view->plane = slot->plane_width ? data + slot->plane_offset : NULL;
+    view->plane_width = (int)slot->plane_width;
+    view->plane_height = (int)slot->plane_height;
+    view->slot = slot;
+    view->lock = lock;
+
+    // The fields above must belong to the same write as lock
+    return FrameRingStillValid(view);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FRAME_RING_H
@@ -0,0 +1,232 @@
+#include "frame_ring_writer.h"
+#include "jpeg_stream.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#endif
+
+static size_t alignUp(size_t value) {
+    return (value + FRAME_RING_ALIGN - 1) & ~(size_t)(FRAME_RING_ALIGN - 1);
+}
+
+static uint32_t currentProcessId() {
+#ifdef _WIN32
+    return (uint32_t)GetCurrentProcessId();
+#else
+    return (uint32_t)getpid();
+#endif
+}
+
+// Whether another process with this id is running
+static bool isOtherWriterAlive(uint32_t pid) {
+    if (pid == 0 || pid == currentProcessId()) {
+        return false;
+    }
+#ifdef _WIN32
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+    if (!process) {
+        return GetLastError() == ERROR_ACCESS_DENIED; // Exists, but isn't ours to open
+    }
+    bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return alive;
+#else
+    return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+FrameRingWriter::FrameRingWriter()
+    : m_base(nullptr)
+    , m_size(0)
+#ifdef _WIN32
+    , m_mapping(NULL)
+#endif
+{
+}
+
+FrameRingWriter::~FrameRingWriter() {
+    close();
+}
+
+bool FrameRingWriter::open(const char* name, size_t slotBytes) {
+    close();
+
+    if (strlen(name) > FRAME_RING_NAME_LEN) {
+        printf("FrameRingWriter: ring name %s is too long\n", name);
+        return false;
+    }
+
+    const size_t slotSize = alignUp(sizeof(FrameRingSlot) + slotBytes);
+    if (slotSize > UINT32_MAX) {
+        printf("FrameRingWriter: slot size %zu is too large\n", slotBytes);
+        return false;
+    }
+    const size_t size = FrameRingSlotOffset((uint32_t)slotSize, FRAME_RING_SLOTS);
+
+#ifdef _WIN32
+    std::string path = std::string("Local\\") + name;
+    m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                   (DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xFFFFFFFF), path.c_str());
+    if (!m_mapping) {
+        printf("FrameRingWriter: can't create %s (error %lu)\n", path.c_str(), GetLastError());
+        return false;
+    }
+    const bool existed = GetLastError() == ERROR_ALREADY_EXISTS;
+    m_base = static_cast<unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+    if (!m_base) {
+        // An existing mapping keeps its size; one made with smaller slots can't be reused
+        printf("FrameRingWriter: can't map %s (error %lu)\n", path.c_str(), GetLastError());
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+        return false;
+    }
+    if (existed) {
+        // Windows frees a mapping with its last handle, but readers hold one
+        // too, so an existing ring may have outlived its writer
+        FrameRingHeader* old = reinterpret_cast<FrameRingHeader*>(m_base);
+        uint32_t pid = FRAME_RING_LOAD32(&old->writer_pid);
+        if (isOtherWriterAlive(pid)) {
+            printf("FrameRingWriter: %s is in use by process %u\n", path.c_str(), pid);
+            UnmapViewOfFile(m_base);
+            CloseHandle(m_mapping);
+            m_base = nullptr;
+            m_mapping = NULL;
+            return false;
+        }
+
+        // Start over in place. Readers still attached see every slot change
+        // under them and discard what they were reading.
+        FRAME_RING_STORE32(&old->magic, 0);
+        FRAME_RING_STORE(&old->latest, 0);
+        FRAME_RING_STORE(&old->dropped, 0);
+        for (uint64_t i = 0; i < FRAME_RING_SLOTS; i++) {
+            FrameRingSlot* slot = reinterpret_cast<FrameRingSlot*>(m_base + FrameRingSlotOffset((uint32_t)slotSize, i));
+            FRAME_RING_STORE(&slot->lock, 0);
+        }
+        printf("FrameRingWriter: taking over %s from a writer that exited\n", path.c_str());
+    }
+#else
+    // A writer that crashed leaves its ring behind; readers still mapping it
+    // keep their copy, new ones get ours
+    std::string path = std::string("/") + name;
+    FrameRing* existing = FrameRingOpen(name);
+    if (existing) {
+        uint32_t pid = FRAME_RING_LOAD32(&existing->header->writer_pid);
+        FrameRingClose(existing);
+        if (isOtherWriterAlive(pid)) {
+            printf("FrameRingWriter: %s is in use by process %u\n", path.c_str(), pid);
+            return false;
+        }
+    }
+    shm_unlink(path.c_str());
+
+    int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        perror("FrameRingWriter: shm_open");
+        return false;
+    }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        perror("FrameRingWriter: ftruncate");
+        ::close(fd);
+        shm_unlink(path.c_str());
+        return false;
+    }
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        perror("FrameRingWriter: mmap");
+        shm_unlink(path.c_str());
+        return false;
+    }
+    m_base = static_cast<unsigned char*>(base);
+#endif
+
+    m_name = name;
+    m_size = size;
+
+    // New shared memory is zero-filled, so every slot starts unwritten
+    FrameRingHeader* header = reinterpret_cast<FrameRingHeader*>(m_base);
+    header->version = FRAME_RING_VERSION;
+    header->slot_count = FRAME_RING_SLOTS;
+    header->slot_size = (uint32_t)slotSize;
+    FRAME_RING_STORE32(&header->writer_pid, currentProcessId());
+    FRAME_RING_STORE32(&header->magic, FRAME_RING_MAGIC);
+
+    printf("FrameRingWriter: publishing frames to %s\n", path.c_str());
+    return true;
+}
+
+void FrameRingWriter::close() {
+    if (!m_base) {
+        return;
+    }
+
+    // The next writer can take over the ring even while readers keep it alive
+    FRAME_RING_STORE32(&reinterpret_cast<FrameRingHeader*>(m_base)->writer_pid, 0);
+
+#ifdef _WIN32
+    UnmapViewOfFile(m_base);
+    CloseHandle(m_mapping);
+    m_mapping = NULL;
+#else
+    munmap(m_base, m_size);
+    shm_unlink(("/" + m_name).c_str());
+#endif
+
+    m_base = nullptr;
+    m_size = 0;
+    m_name.clear();
+}
+
+bool FrameRingWriter::isOpen() const {
+    return m_base != nullptr;
+}
+
+bool FrameRingWriter::publish(const MJPEGFrame* frame, uint64_t sequence) {
+    if (!m_base || !frame || sequence == 0) {
+        return false;
+    }
+
+    FrameRingHeader* header = reinterpret_cast<FrameRingHeader*>(m_base);
+    const size_t capacity = header->slot_size - sizeof(FrameRingSlot);
+
+    // A plane that doesn't fit is left out, a JPEG that doesn't fit drops the frame
+    const size_t planeOffset = alignUp(frame->size);
+    size_t planeBytes = frame->plane ? (size_t)frame->plane_width * frame->plane_height : 0;
+    if (planeOffset + planeBytes > capacity) {
+        planeBytes = 0;
+    }
+    if (frame->size > capacity) {
+        FRAME_RING_STORE(&header->dropped, header->dropped + 1);
+        return false;
+    }
+
+    FrameRingSlot* slot = reinterpret_cast<FrameRingSlot*>(m_base + FrameRingSlotOffset(header->slot_size, sequence % header->slot_count));
+    unsigned char* data = reinterpret_cast<unsigned char*>(slot + 1);
+
+    // Odd while the slot is being written; readers of the previous frame in
+    // this slot see the change and discard what they read
+    FRAME_RING_STORE(&slot->lock, 2 * sequence + 1);
+    FRAME_RING_FENCE();
+
+    slot->sequence = sequence;
+    slot->timestamp = frame->timestamp;
+    slot->width = (uint32_t)frame->width;
+    slot->height = (uint32_t)frame->height;
+    slot->jpeg_size = (uint32_t)frame->size;
+    slot->plane_offset = (uint32_t)planeOffset;
+    slot->plane_width = planeBytes ? (uint32_t)frame->plane_width : 0;
+    slot->plane_height = planeBytes ? (uint32_t)frame->plane_height : 0;
+    memcpy(data, frame->data, frame->size);
+    if (planeBytes) {
+        memcpy(data + planeOffset, frame->plane, planeBytes);
+    }
+
+    FRAME_RING_STORE(&slot->lock, 2 * sequence);
+    FRAME_RING_STORE(&header->latest, sequence);
+    return true;
+}
@@ -0,0 +1,62 @@
+#ifndef FRAME_RING_WRITER_H
+#define FRAME_RING_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "frame_ring.h"
+
+struct MJPEGFrame;
+
+#define FRAME_RING_DEFAULT_SLOT_BYTES (1024 * 1024) // JPEG plus plane bytes one slot holds
+
+/**
+ * @brief Writer side of a shared-memory frame ring (see frame_ring.h)
+ *
+ * Creates the named ring and copies published frames into it, one slot per
+ * frame. The copy into shared memory is the only one: readers in other
+ * processes use the frames in place. publish() must only be called from one
+ * thread at a time.
+ */
+class FrameRingWriter {
+public:
+    FrameRingWriter();
+    ~FrameRingWriter();
+
+    /**
+     * @brief Create the ring, taking over one whose writer has exited
+     *
+     * A ring outlives its writer while readers still map it, or after a
+     * crash. The header's writer_pid tells whether that writer is still
+     * running; only then is the ring in use.
+     *
+     * @param name Ring name readers pass to FrameRingOpen()
+     * @param slotBytes Largest JPEG plus plane a slot holds
+     * @return false if the shared memory couldn't be created or another
+     *         running process writes the ring
+     */
+    bool open(const char* name, size_t slotBytes = FRAME_RING_DEFAULT_SLOT_BYTES);
+
+    // Remove the ring; readers keep their mapping until they close it
+    void close();
+    bool isOpen() const;
+
+    /**
+     * @brief Copy a frame and its plane (if any) into the next slot
+     *
+     * @param sequence Frame number readers see, must increase by at least one per call
+     * @return false if the frame didn't fit a slot and was dropped
+     */
+    bool publish(const MJPEGFrame* frame, uint64_t sequence);
+
+private:
+    std::string m_name;
+    unsigned char* m_base;
+    size_t m_size;
+#ifdef _WIN32
+    HANDLE m_mapping;
+#endif
+};
+
+#endif // FRAME_RING_WRITER_H
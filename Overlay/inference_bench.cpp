@@ -0,0 +1,241 @@
+// Replays a capture file through an exported model and reports per-stage
+// latency, throughput and gaze error per routine flag.
+//
+// Usage: inference_bench <capture.bin> <model.onnx> [--realtime] [--threads N] [--cold-start]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture_reader.h"
+#include "flags.h"
+#include "inference_engine.h"
+#include "label_ranges.h"
+
+// Index of the stages in the timing tables
+enum BenchStage {
+    STAGE_DECODE,
+    STAGE_PREPROCESS,
+    STAGE_RUN,
+    STAGE_POSTPROCESS,
+    STAGE_TOTAL,
+    STAGE_COUNT
+};
+
+static const char* g_stageNames[STAGE_COUNT] = { "decode", "preprocess", "run", "postprocess", "total" };
+
+static const char* g_flagNames[32] = {
+    "ROUTINE_1", "ROUTINE_2", "ROUTINE_3", "ROUTINE_4", "ROUTINE_5", "ROUTINE_6",
+    "ROUTINE_7", "ROUTINE_8", "ROUTINE_9", "ROUTINE_10", "ROUTINE_11", "ROUTINE_12",
+    "ROUTINE_13", "ROUTINE_14", "ROUTINE_15", "ROUTINE_16", "ROUTINE_17", "ROUTINE_18",
+    "ROUTINE_19", "ROUTINE_20", "ROUTINE_21", "ROUTINE_22", "ROUTINE_23", "ROUTINE_24",
+    "CONVERGENCE", "IN_MOVEMENT", "RESTING", "DILATION_BLACK", "DILATION_WHITE",
+    "DILATION_GRADIENT", "GOOD_DATA", "ROUTINE_COMPLETE"
+};
+
+struct FlagError {
+    size_t count = 0;
+    double pitch_abs_sum = 0.0;
+    double yaw_abs_sum = 0.0;
+    double squared_sum = 0.0; // pitch^2 + yaw^2, for angular RMSE
+};
+
+static double percentile(std::vector<double>& values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+
+    size_t index = (size_t)std::ceil(p / 100.0 * values.size());
+    index = std::min(values.size() - 1, index > 0 ? index - 1 : 0);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+static void printUsage(const char* program) {
+    printf("Usage: %s <capture.bin> <model.onnx> [--realtime] [--threads N] [--cold-start]\n", program);
+    printf("  --realtime    replay at the recorded frame timing instead of full speed\n");
+    printf("  --threads N   ONNX Runtime intra-op threads (default 1)\n");
+    printf("  --cold-start  also load the model without the optimized-graph cache and compare startup\n");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    const char* capturePath = argv[1];
+    const char* modelPath = argv[2];
+    bool realtime = false;
+    bool coldStart = false;
+    int threads = 1;
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--cold-start") == 0) {
+            coldStart = true;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    printf("Reading capture file %s...\n", capturePath);
+    std::vector<AlignedFrame> frames = read_capture_file(capturePath);
+    if (frames.empty()) {
+        fprintf(stderr, "No frames in %s\n", capturePath);
+        return 1;
+    }
+
+    InferenceStartupStats uncachedStats;
+    if (coldStart) {
+        InferenceEngine uncached(threads);
+        uncached.setUseModelCache(false);
+        if (!uncached.loadModel(modelPath)) {
+            return 1;
+        }
+        uncachedStats = uncached.getStartupStats();
+    }
+
+    InferenceEngine engine(threads);
+    if (!engine.loadModel(modelPath)) {
+        return 1;
+    }
+    InferenceStartupStats startupStats = engine.getStartupStats();
+
+    // Model output is normalized with the trainer's ranges, so take them from the same frames it does
+    LabelRanges ranges = calculateLabelRanges(selectSequenceLabels(frames, INFERENCE_NUM_FRAMES));
+
+    std::vector<double> stageTimes[STAGE_COUNT];
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        stageTimes[s].reserve(frames.size());
+    }
+
+    FlagError flagErrors[32];
+    FlagError overall;
+    size_t decodeFailures = 0;
+
+    std::vector<uint32_t> leftPixels, rightPixels;
+
+    const uint64_t firstTimestamp = frames.front().label_timestamp;
+    auto replayStart = std::chrono::steady_clock::now();
+
+    printf("Replaying %zu frames (%s)...\n", frames.size(), realtime ? "recorded timing" : "full speed");
+
+    for (const auto& frame : frames) {
+        if (realtime) {
+            std::this_thread::sleep_until(replayStart + std::chrono::milliseconds(frame.label_timestamp - firstTimestamp));
+        }
+
+        auto t0 = std::chrono::steady_clock::now();
+
+        int leftWidth, leftHeight, rightWidth, rightHeight;
+        if (!engine.decodeJpeg(frame.left_image.data(), frame.left_image.size(), leftPixels, leftWidth, leftHeight)
+            || !engine.decodeJpeg(frame.right_image.data(), frame.right_image.size(), rightPixels, rightWidth, rightHeight)) {
+            decodeFailures++;
+            continue;
+        }
+        auto t1 = std::chrono::steady_clock::now();
+
+        engine.pushFrame(leftPixels.data(), leftWidth, leftHeight, rightPixels.data(), rightWidth, rightHeight);
+        auto t2 = std::chrono::steady_clock::now();
+
+        InferenceResult result;
+        if (!engine.run(&result)) {
+            return 1;
+        }
+        auto t3 = std::chrono::steady_clock::now();
+
+        // Postprocess: undo the trainer's label normalization
+        float pitch = result.pitch * ranges.pitch_range + ranges.pitchOffset();
+        float yaw = result.yaw * ranges.yaw_range + ranges.yawOffset();
+        auto t4 = std::chrono::steady_clock::now();
+
+        stageTimes[STAGE_DECODE].push_back(elapsedMs(t0, t1));
+        stageTimes[STAGE_PREPROCESS].push_back(elapsedMs(t1, t2));
+        stageTimes[STAGE_RUN].push_back(elapsedMs(t2, t3));
+        stageTimes[STAGE_POSTPROCESS].push_back(elapsedMs(t3, t4));
+        stageTimes[STAGE_TOTAL].push_back(elapsedMs(t0, t4));
+
+        double pitchError = pitch - std::get<0>(frame.label_data);
+        double yawError = yaw - std::get<1>(frame.label_data);
+        uint32_t state = std::get<11>(frame.label_data);
+
+        for (int bit = 0; bit < 32; bit++) {
+            if (state & (1U << bit)) {
+                flagErrors[bit].count++;
+                flagErrors[bit].pitch_abs_sum += std::abs(pitchError);
+                flagErrors[bit].yaw_abs_sum += std::abs(yawError);
+                flagErrors[bit].squared_sum += pitchError * pitchError + yawError * yawError;
+            }
+        }
+        overall.count++;
+        overall.pitch_abs_sum += std::abs(pitchError);
+        overall.yaw_abs_sum += std::abs(yawError);
+        overall.squared_sum += pitchError * pitchError + yawError * yawError;
+    }
+
+    double wallSeconds = elapsedMs(replayStart, std::chrono::steady_clock::now()) / 1000.0;
+    size_t processed = stageTimes[STAGE_TOTAL].size();
+
+    printf("\n=== Startup (ms) ===\n");
+    printf("%-12s %10s %10s %10s\n", "load", "session", "first run", "warm-up");
+    printf("%-12s %10.2f %10.2f %10.2f\n", startupStats.cacheHit ? "cached" : "cache miss",
+           startupStats.sessionMs, startupStats.firstRunMs, startupStats.warmupMs);
+    if (coldStart) {
+        printf("%-12s %10.2f %10.2f %10.2f\n", "no cache", uncachedStats.sessionMs, uncachedStats.firstRunMs, uncachedStats.warmupMs);
+        if (startupStats.cacheHit) {
+            printf("Cold-start savings: %.2f ms\n",
+                   (uncachedStats.sessionMs + uncachedStats.firstRunMs) - (startupStats.sessionMs + startupStats.firstRunMs));
+        } else {
+            printf("Cache was just written, run again to measure the cached start\n");
+        }
+    }
+
+    printf("\n=== Latency (ms) ===\n");
+    printf("%-12s %10s %10s %10s %10s\n", "stage", "p50", "p95", "p99", "max");
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        std::vector<double>& times = stageTimes[s];
+        double p50 = percentile(times, 50.0);
+        double p95 = percentile(times, 95.0);
+        double p99 = percentile(times, 99.0);
+        double max = times.empty() ? 0.0 : *std::max_element(times.begin(), times.end());
+        printf("%-12s %10.3f %10.3f %10.3f %10.3f\n", g_stageNames[s], p50, p95, p99, max);
+    }
+
+    printf("\n=== Throughput ===\n");
+    printf("Frames processed: %zu (%zu decode failures)\n", processed, decodeFailures);
+    printf("Wall time: %.2fs, %.1f fps\n", wallSeconds, wallSeconds > 0.0 ? processed / wallSeconds : 0.0);
+
+    printf("\n=== Gaze error (degrees) ===\n");
+    printf("%-18s %8s %10s %10s %10s\n", "flag", "frames", "pitch MAE", "yaw MAE", "RMSE");
+    for (int bit = 0; bit < 32; bit++) {
+        const FlagError& e = flagErrors[bit];
+        if (e.count == 0) {
+            continue;
+        }
+        printf("%-18s %8zu %10.3f %10.3f %10.3f\n", g_flagNames[bit], e.count,
+               e.pitch_abs_sum / e.count, e.yaw_abs_sum / e.count, std::sqrt(e.squared_sum / e.count));
+    }
+    if (overall.count > 0) {
+        printf("%-18s %8zu %10.3f %10.3f %10.3f\n", "ALL", overall.count,
+               overall.pitch_abs_sum / overall.count, overall.yaw_abs_sum / overall.count,
+               std::sqrt(overall.squared_sum / overall.count));
+    }
+
+    return 0;
+}
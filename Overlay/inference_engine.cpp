@@ -0,0 +1,368 @@
+#include "inference_engine.h"
+#include "jpeg_stream.h"
+#include "ort_cache.h"
+#include "stereo_sync.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define INFERENCE_WAIT_TIMEOUT_MS 100 // Longest wait for a new frame before re-checking m_running
+
+InferenceEngine::InferenceEngine(int numThreads)
+    : m_numThreads(numThreads)
+    , m_useModelCache(true)
+    , m_arenaRegistered(false)
+    , m_historyCount(0)
+    , m_tjInstance(nullptr)
+    , m_filter(INFERENCE_NUM_OUTPUTS, INFERENCE_SMOOTHING_MIN_CUTOFF, INFERENCE_SMOOTHING_BETA, INFERENCE_SMOOTHING_D_CUTOFF)
+    , m_smoothingEnabled(true)
+    , m_pairs(nullptr)
+    , m_running(false)
+    , m_hasResult(false) {
+    m_tjInstance = tjInitDecompress();
+}
+
+InferenceEngine::~InferenceEngine() {
+    stop();
+
+    if (m_tjInstance) {
+        tjDestroy(m_tjInstance);
+        m_tjInstance = nullptr;
+    }
+}
+
+bool InferenceEngine::loadModel(const std::string& modelPath) {
+    if (m_running) {
+        printf("InferenceEngine: can't load a model while running\n");
+        return false;
+    }
+
+    // The binding references the old session, drop it first
+    m_binding.reset();
+
+    m_startupStats = InferenceStartupStats();
+
+    try {
+        if (!m_env) {
+            m_env.reset(new Ort::Env(ORT_LOGGING_LEVEL_WARNING, "inference_engine"));
+        }
+
+        std::string cachePath = m_useModelCache ? GetOptimizedModelCachePath(modelPath) : "";
+        auto sessionStart = std::chrono::steady_clock::now();
+
+        // The cached graph is already optimized, don't pay for it again
+        if (!cachePath.empty() && FileExists(cachePath)) {
+            try {
+                m_session.reset(createSession(cachePath, GraphOptimizationLevel::ORT_DISABLE_ALL, ""));
+                m_startupStats.cacheHit = true;
+            } catch (const Ort::Exception& e) {
+                printf("InferenceEngine: ignoring unreadable model cache %s: %s\n", cachePath.c_str(), e.what());
+            }
+        }
+
+        if (!m_startupStats.cacheHit) {
+            m_session.reset(createSession(modelPath, GraphOptimizationLevel::ORT_ENABLE_ALL, cachePath));
+        }
+
+        m_startupStats.sessionMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sessionStart).count();
+
+        Ort::AllocatorWithDefaultOptions allocator;
+        m_inputName = m_session->GetInputNameAllocated(0, allocator).get();
+        m_outputName = m_session->GetOutputNameAllocated(0, allocator).get();
+
+        // Fixed shapes; a dynamic batch dimension is pinned to 1
+        const int64_t inputShape[] = { 1, 2 * INFERENCE_NUM_FRAMES, PREPROCESS_RESOLUTION, PREPROCESS_RESOLUTION };
+        const int64_t outputShape[] = { 1, INFERENCE_NUM_OUTPUTS };
+
+        m_input.assign(2 * INFERENCE_NUM_FRAMES * INFERENCE_PLANE_SIZE, 0.0f);
+        m_output.assign(INFERENCE_NUM_OUTPUTS, 0.0f);
+
+        Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+        m_inputTensor = Ort::Value::CreateTensor<float>(memoryInfo, m_input.data(), m_input.size(), inputShape, 4);
+        m_outputTensor = Ort::Value::CreateTensor<float>(memoryInfo, m_output.data(), m_output.size(), outputShape, 2);
+
+        m_runOptions.reset(new Ort::RunOptions());
+        m_binding.reset(new Ort::IoBinding(*m_session));
+        m_binding->BindInput(m_inputName.c_str(), m_inputTensor);
+        m_binding->BindOutput(m_outputName.c_str(), m_outputTensor);
+
+        // Warm up on the zeroed input so the first real frame runs at steady-state cost
+        auto warmupStart = std::chrono::steady_clock::now();
+        for (int i = 0; i < ORT_WARMUP_RUNS; i++) {
+            m_session->Run(*m_runOptions, *m_binding);
+            if (i == 0) {
+                m_startupStats.firstRunMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - warmupStart).count();
+            }
+        }
+        m_startupStats.warmupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - warmupStart).count();
+    } catch (const Ort::Exception& e) {
+        printf("InferenceEngine: failed to load %s: %s\n", modelPath.c_str(), e.what());
+        m_binding.reset();
+        m_session.reset();
+        return false;
+    }
+
+    resetHistory();
+    printf("InferenceEngine: loaded %s (input '%s', output '%s')\n",
+           modelPath.c_str(), m_inputName.c_str(), m_outputName.c_str());
+    printf("InferenceEngine: session %.1f ms (optimized cache %s), warm-up %.1f ms (first run %.1f ms)\n",
+           m_startupStats.sessionMs, m_startupStats.cacheHit ? "hit" : "miss",
+           m_startupStats.warmupMs, m_startupStats.firstRunMs);
+    return true;
+}
+
+Ort::Session* InferenceEngine::createSession(const std::string& path, GraphOptimizationLevel level, const std::string& optimizedOutPath) {
+    Ort::SessionOptions options;
+    options.SetIntraOpNumThreads(m_numThreads);
+    options.SetInterOpNumThreads(1);
+    options.SetExecutionMode(ORT_SEQUENTIAL);
+    options.SetGraphOptimizationLevel(level);
+    // Don't burn a core spinning between frames
+    options.AddConfigEntry("session.intra_op.allow_spinning", "0");
+
+    // The shared arena is registered on the env once and reused by every session
+    if (!m_arenaRegistered) {
+        m_arenaRegistered = RegisterPresizedCpuArena(&Ort::GetApi(), *m_env, options);
+    } else {
+        options.AddConfigEntry("session.use_env_allocators", "1");
+    }
+
+#ifdef _WIN32
+    std::wstring widePath(path.begin(), path.end());
+    std::wstring wideOutPath(optimizedOutPath.begin(), optimizedOutPath.end());
+    if (!optimizedOutPath.empty()) {
+        options.SetOptimizedModelFilePath(wideOutPath.c_str());
+    }
+    return new Ort::Session(*m_env, widePath.c_str(), options);
+#else
+    if (!optimizedOutPath.empty()) {
+        options.SetOptimizedModelFilePath(optimizedOutPath.c_str());
+    }
+    return new Ort::Session(*m_env, path.c_str(), options);
+#endif
+}
+
+bool InferenceEngine::start(StereoSynchronizer* pairs, ResultCallback onResult) {
+    if (!isLoaded() || !pairs) {
+        return false;
+    }
+
+    if (m_running.exchange(true)) {
+        return false; // Already running
+    }
+
+    m_pairs = pairs;
+    m_onResult = onResult;
+    resetHistory();
+    m_filter.reset();
+
+    m_thread = std::thread(&InferenceEngine::inferenceLoop, this);
+    return true;
+}
+
+void InferenceEngine::stop() {
+    if (!m_running.exchange(false)) {
+        return; // Already stopped
+    }
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+bool InferenceEngine::isRunning() const {
+    return m_running;
+}
+
+bool InferenceEngine::isLoaded() const {
+    return m_binding != nullptr;
+}
+
+void InferenceEngine::setUseModelCache(bool useCache) {
+    m_useModelCache = useCache;
+}
+
+InferenceStartupStats InferenceEngine::getStartupStats() const {
+    return m_startupStats;
+}
+
+void InferenceEngine::setSmoothingEnabled(bool enabled) {
+    m_smoothingEnabled = enabled;
+}
+
+void InferenceEngine::setSmoothingParams(size_t output, float minCutoff, float beta, float dCutoff) {
+    m_filter.setChannelParams(output, minCutoff, beta, dCutoff);
+}
+
+bool InferenceEngine::getLatestResult(InferenceResult* result) {
+    std::lock_guard<std::mutex> lock(m_resultMutex);
+    if (!m_hasResult) {
+        return false;
+    }
+
+    *result = m_latest;
+    return true;
+}
+
+bool InferenceEngine::decodeJpeg(const unsigned char* data, size_t size, std::vector<uint32_t>& pixels, int& width, int& height) {
+    if (!m_tjInstance || !data || size == 0) {
+        return false;
+    }
+
+    int subsamp, colorspace;
+    if (tjDecompressHeader3(m_tjInstance, data, (unsigned long)size, &width, &height, &subsamp, &colorspace) != 0) {
+        return false;
+    }
+
+    // Only grows; steady-state streams keep the same resolution
+    if (pixels.size() < (size_t)width * height) {
+        pixels.resize((size_t)width * height);
+    }
+
+    // Same pixel format and flags as the trainer's capture reader
+    return tjDecompress2(m_tjInstance, data, (unsigned long)size,
+                         reinterpret_cast<unsigned char*>(pixels.data()),
+                         width, width * 4, height, TJPF_RGBX, TJFLAG_FASTDCT)
+        == 0;
+}
+
+void InferenceEngine::pushFrame(const uint32_t* leftPixels, int leftWidth, int leftHeight,
+                                const uint32_t* rightPixels, int rightWidth, int rightHeight) {
+    float* slot = advanceHistory();
+    PreprocessEyeImage(leftPixels, leftWidth, leftHeight, slot, PREPROCESS_RESOLUTION, m_grayScratch);
+    PreprocessEyeImage(rightPixels, rightWidth, rightHeight, slot + INFERENCE_PLANE_SIZE, PREPROCESS_RESOLUTION, m_grayScratch);
+    commitHistory();
+}
+
+void InferenceEngine::pushPlanes(const uint8_t* leftPlane, const uint8_t* rightPlane) {
+    float* slot = advanceHistory();
+    PreprocessPlaneToInput(leftPlane, INFERENCE_PLANE_SIZE, slot);
+    PreprocessPlaneToInput(rightPlane, INFERENCE_PLANE_SIZE, slot + INFERENCE_PLANE_SIZE);
+    commitHistory();
+}
+
+float* InferenceEngine::advanceHistory() {
+    const size_t frameSize = 2 * INFERENCE_PLANE_SIZE;
+
+    // Slot 0 is always the newest
+    memmove(m_input.data() + frameSize, m_input.data(), (INFERENCE_NUM_FRAMES - 1) * frameSize * sizeof(float));
+    return m_input.data();
+}
+
+void InferenceEngine::commitHistory() {
+    const size_t frameSize = 2 * INFERENCE_PLANE_SIZE;
+
+    // Until the history is full, pad older slots with the first frame we saw
+    // rather than feeding the model black frames
+    if (m_historyCount == 0) {
+        for (int i = 1; i < INFERENCE_NUM_FRAMES; i++) {
+            memcpy(m_input.data() + i * frameSize, m_input.data(), frameSize * sizeof(float));
+        }
+    }
+
+    if (m_historyCount < INFERENCE_NUM_FRAMES) {
+        m_historyCount++;
+    }
+}
+
+bool InferenceEngine::run(InferenceResult* result) {
+    if (!isLoaded() || m_historyCount == 0) {
+        return false;
+    }
+
+    try {
+        // Input and output are pre-bound, nothing to allocate here
+        m_session->Run(*m_runOptions, *m_binding);
+    } catch (const Ort::Exception& e) {
+        printf("InferenceEngine: run failed: %s\n", e.what());
+        return false;
+    }
+
+    result->pitch = m_output[0];
+    result->yaw = m_output[1];
+    result->convergence = m_output[2];
+    return true;
+}
+
+void InferenceEngine::resetHistory() {
+    m_historyCount = 0;
+}
+
+static bool hasModelPlane(const MJPEGFrame* frame) {
+    return frame->plane && frame->plane_width == PREPROCESS_RESOLUTION && frame->plane_height == PREPROCESS_RESOLUTION;
+}
+
+void InferenceEngine::inferenceLoop() {
+    uint64_t lastPairSequence = 0;
+    uint64_t sequence = 0;
+
+    while (m_running) {
+        int leftWidth, leftHeight, rightWidth, rightHeight;
+
+        // Block until the next timestamp-matched pair. Shared references,
+        // so no copy of the JPEG data.
+        StereoPair pair;
+        if (!m_pairs->waitForPair(lastPairSequence, INFERENCE_WAIT_TIMEOUT_MS, &pair)) {
+            continue;
+        }
+
+        auto pickupTime = std::chrono::steady_clock::now();
+        lastPairSequence = pair.sequence;
+
+        uint64_t leftTime = pair.left->timestamp;
+        uint64_t rightTime = pair.right->timestamp;
+
+        // Frame buffers with a target resolution already decoded the pair
+        // to model-sized planes on their ingestion threads
+        if (hasModelPlane(pair.left) && hasModelPlane(pair.right)) {
+            pushPlanes(pair.left->plane, pair.right->plane);
+            StereoSynchronizer::releasePair(&pair);
+        } else {
+            bool decoded = decodeJpeg(pair.left->data, pair.left->size, m_leftPixels, leftWidth, leftHeight)
+                && decodeJpeg(pair.right->data, pair.right->size, m_rightPixels, rightWidth, rightHeight);
+
+            StereoSynchronizer::releasePair(&pair);
+
+            if (!decoded) {
+                printf("InferenceEngine: failed to decode frame pair\n");
+                continue;
+            }
+
+            pushFrame(m_leftPixels.data(), leftWidth, leftHeight, m_rightPixels.data(), rightWidth, rightHeight);
+        }
+
+        InferenceResult result;
+        if (!run(&result)) {
+            continue;
+        }
+
+        result.timestampLeft = leftTime;
+        result.timestampRight = rightTime;
+
+        if (m_smoothingEnabled) {
+            // Always our own monotonic clock: camera X-Timestamps can jump on
+            // reconnect or clock changes, and mixing sources breaks the filter
+            uint64_t sampleTime = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(pickupTime.time_since_epoch()).count();
+
+            float values[INFERENCE_NUM_OUTPUTS] = { result.pitch, result.yaw, result.convergence };
+            m_filter.filter(values, values, sampleTime);
+            result.pitch = values[0];
+            result.yaw = values[1];
+            result.convergence = values[2];
+        }
+        result.sequence = ++sequence;
+        result.processingMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pickupTime).count();
+
+        {
+            std::lock_guard<std::mutex> lock(m_resultMutex);
+            m_latest = result;
+            m_hasResult = true;
+        }
+
+        if (m_onResult) {
+            m_onResult(result);
+        }
+    }
+}
@@ -0,0 +1,190 @@
+#ifndef INFERENCE_ENGINE_H
+#define INFERENCE_ENGINE_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <onnxruntime_cxx_api.h>
+#include <turbojpeg.h>
+
+#include "one_euro_filter.h"
+#include "preprocess.h"
+
+class StereoSynchronizer;
+
+#define INFERENCE_NUM_FRAMES  4 // Current frame + 3 previous frames, must match the trained model
+#define INFERENCE_NUM_OUTPUTS 3 // pitch, yaw, convergence
+#define INFERENCE_PLANE_SIZE  (PREPROCESS_RESOLUTION * PREPROCESS_RESOLUTION)
+
+// Default One Euro smoothing, same values as Inference/infer.py
+#define INFERENCE_SMOOTHING_MIN_CUTOFF 2.09f
+#define INFERENCE_SMOOTHING_BETA       5.6f
+#define INFERENCE_SMOOTHING_D_CUTOFF   1.0f
+
+/**
+ * @brief One model evaluation for a stereo frame pair
+ */
+struct InferenceResult {
+    float pitch = 0.0f;
+    float yaw = 0.0f;
+    float convergence = 0.0f;
+    uint64_t timestampLeft = 0;  // X-Timestamp of the left frame used
+    uint64_t timestampRight = 0; // X-Timestamp of the right frame used
+    uint64_t sequence = 0;       // Increments once per result
+    double processingMs = 0.0;   // Frame pickup to model output
+};
+
+/**
+ * @brief Timings of the last loadModel() call
+ */
+struct InferenceStartupStats {
+    bool cacheHit = false;   // Session was created from the optimized-graph cache
+    double sessionMs = 0.0;  // Session creation (graph load + optimization)
+    double firstRunMs = 0.0; // First warm-up run, includes arena allocation
+    double warmupMs = 0.0;   // All warm-up runs
+};
+
+/**
+ * @brief Native real-time gaze inference over timestamp-matched eye frame pairs
+ *
+ * Frames are decoded with TurboJPEG, run through the same preprocessing
+ * kernels the trainer uses and evaluated with an ONNX Runtime session. The
+ * input and output tensors are allocated once and bound to the session with
+ * IO binding, so a steady-state run does no heap allocation.
+ *
+ * The input tensor is [1, 2 * INFERENCE_NUM_FRAMES, 128, 128], most recent
+ * frame first, left eye before right eye within each frame - the same layout
+ * the trainer builds its batches with.
+ *
+ * Startup reuses the optimized graph cached next to the model (see
+ * ort_cache.h), allocates from a pre-sized arena and runs a few warm-up
+ * passes so the first real frame doesn't pay for allocation.
+ */
+class InferenceEngine {
+public:
+    using ResultCallback = std::function<void(const InferenceResult&)>;
+
+    /**
+     * @brief Create an engine
+     * @param numThreads Intra-op threads for ONNX Runtime (1 keeps inference on one core)
+     */
+    InferenceEngine(int numThreads = 1);
+    ~InferenceEngine();
+
+    /**
+     * @brief Load an exported inference model and bind its tensors
+     * @param modelPath Path to the .onnx file written by the trainer
+     * @return true if the session was created and the tensors were bound
+     */
+    bool loadModel(const std::string& modelPath);
+
+    /**
+     * @brief Start the inference thread, evaluating every matched stereo pair
+     * @param pairs Synchronizer pairing the left and right eye streams
+     * @param onResult Optional callback invoked on the inference thread for every result
+     * @return false if no model is loaded or the engine is already running
+     */
+    bool start(StereoSynchronizer* pairs, ResultCallback onResult = nullptr);
+
+    void stop();
+    bool isRunning() const;
+    bool isLoaded() const;
+
+    // Enable/disable the optimized-graph cache for the next loadModel() (default on)
+    void setUseModelCache(bool useCache);
+
+    InferenceStartupStats getStartupStats() const;
+
+    // One Euro smoothing of the live results, keyed on the camera timestamps.
+    // Configure before start(); run() itself always returns raw model output.
+    void setSmoothingEnabled(bool enabled);
+    void setSmoothingParams(size_t output, float minCutoff, float beta, float dCutoff);
+
+    /**
+     * @brief Copy the most recent result
+     * @return false if nothing has been produced yet
+     */
+    bool getLatestResult(InferenceResult* result);
+
+    // Individual pipeline stages, exposed so tools can drive and time the
+    // engine without a live stream. Not thread safe against start().
+
+    // Decode JPEG bytes to RGBX pixels, reusing the engine's TurboJPEG handle
+    bool decodeJpeg(const unsigned char* data, size_t size, std::vector<uint32_t>& pixels, int& width, int& height);
+
+    // Preprocess a stereo pair into the newest slot of the frame history
+    void pushFrame(const uint32_t* leftPixels, int leftWidth, int leftHeight,
+                   const uint32_t* rightPixels, int rightWidth, int rightHeight);
+
+    // Push a stereo pair of ready PREPROCESS_RESOLUTION planes, as published
+    // in MJPEGFrame::plane, skipping decode and preprocessing. Only used when
+    // the frame buffers were asked for planes; otherwise the JPEG goes
+    // through PreprocessEyeImage exactly as in training
+    void pushPlanes(const uint8_t* leftPlane, const uint8_t* rightPlane);
+
+    // Evaluate the model on the current history (fills pitch/yaw/convergence only)
+    bool run(InferenceResult* result);
+
+    // Forget previous frames, e.g. after a stream reconnect
+    void resetHistory();
+
+private:
+    void inferenceLoop();
+
+    // Age the history by one frame; returns the newest slot to fill
+    float* advanceHistory();
+
+    // Finish the frame advanceHistory() started
+    void commitHistory();
+    Ort::Session* createSession(const std::string& path, GraphOptimizationLevel level, const std::string& optimizedOutPath);
+
+    int m_numThreads;
+    bool m_useModelCache;
+    bool m_arenaRegistered;
+    InferenceStartupStats m_startupStats;
+
+    // ONNX Runtime state. Everything is created in loadModel() so a global
+    // engine doesn't touch the ORT API during static initialization.
+    std::unique_ptr<Ort::Env> m_env;
+    std::unique_ptr<Ort::Session> m_session;
+    std::unique_ptr<Ort::IoBinding> m_binding;
+    std::unique_ptr<Ort::RunOptions> m_runOptions;
+    Ort::Value m_inputTensor{ nullptr };
+    Ort::Value m_outputTensor{ nullptr };
+    std::string m_inputName;
+    std::string m_outputName;
+
+    // Bound tensor storage, never reallocated after loadModel()
+    std::vector<float> m_input;
+    std::vector<float> m_output;
+    int m_historyCount;
+
+    // Decode/preprocess scratch
+    tjhandle m_tjInstance;
+    std::vector<uint32_t> m_leftPixels;
+    std::vector<uint32_t> m_rightPixels;
+    std::vector<uint8_t> m_grayScratch;
+
+    // Output smoothing
+    OneEuroFilterBank m_filter;
+    bool m_smoothingEnabled;
+
+    // Thread control
+    StereoSynchronizer* m_pairs;
+    ResultCallback m_onResult;
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+
+    // Latest result, guarded by m_resultMutex
+    std::mutex m_resultMutex;
+    InferenceResult m_latest;
+    bool m_hasResult;
+};
+
+#endif // INFERENCE_ENGINE_H
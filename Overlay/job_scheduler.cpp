@@ -0,0 +1,605 @@
+#include "job_scheduler.h"
+#include "metrics.h"
+#include "rest_server.h"
+#include "trainer_wrapper.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#undef min
+#undef max
+#endif
+
+static const char* jobStateName(JobState state) {
+    switch (state) {
+    case JobState::Queued:
+        return "queued";
+    case JobState::Running:
+        return "running";
+    case JobState::Completed:
+        return "completed";
+    case JobState::Failed:
+        return "failed";
+    case JobState::Cancelled:
+        return "cancelled";
+    }
+    return "unknown";
+}
+
+static bool jobStateFromName(const std::string& name, JobState& state) {
+    const JobState states[] = { JobState::Queued, JobState::Running, JobState::Completed, JobState::Failed, JobState::Cancelled };
+    for (JobState candidate : states) {
+        if (name == jobStateName(candidate)) {
+            state = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string jsonEscape(const std::string& value) {
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (char c : value) {
+        switch (c) {
+        case '"':
+            escaped += "\\\"";
+            break;
+        case '\\':
+            escaped += "\\\\";
+            break;
+        case '\n':
+            escaped += "\\n";
+            break;
+        case '\r':
+            escaped += "\\r";
+            break;
+        case '\t':
+            escaped += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char code[8];
+                snprintf(code, sizeof(code), "\\u%04x", c);
+                escaped += code;
+            } else {
+                escaped += c;
+            }
+        }
+    }
+    return escaped;
+}
+
+// Fields are tab-separated in the queue file, so they can't contain tabs or line breaks
+static bool isStorable(const std::string& value) {
+    return value.find_first_of("\t\r\n") == std::string::npos;
+}
+
+static uint64_t unixTimeMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Remaining time extrapolated from the fraction of batches done so far
+static float estimateEta(const TrainerProgress& progress, double elapsedSeconds) {
+    if (progress.totalEpochs <= 0 || progress.currentEpoch <= 0) {
+        return -1.0f;
+    }
+
+    double done = progress.currentEpoch - 1;
+    if (progress.totalBatches > 0) {
+        done += static_cast<double>(progress.currentBatch) / progress.totalBatches;
+    }
+    double fraction = done / progress.totalEpochs;
+    if (fraction <= 0.0) {
+        return -1.0f;
+    }
+    if (fraction >= 1.0) {
+        return 0.0f;
+    }
+    return static_cast<float>(elapsedSeconds * (1.0 - fraction) / fraction);
+}
+
+std::string jobJson(const JobInfo& job) {
+    const TrainerProgress& progress = job.progress;
+    return "{\"id\":" + std::to_string(job.id) + ", \"owner\":\"" + jsonEscape(job.owner) + "\", \"dataset\":\"" + jsonEscape(job.datasetFile) + "\", \"output\":\"" + jsonEscape(job.outputFile) + "\", \"priority\":" + std::to_string(job.priority) + ", \"threads\":" + std::to_string(job.threads) + ", \"state\":\"" + jobStateName(job.state) + "\", \"submittedMs\":" + std::to_string(job.submittedMs) + ", \"epoch\":" + std::to_string(progress.currentEpoch) + ", \"totalEpochs\":" + std::to_string(progress.totalEpochs) + ", \"batch\":" + std::to_string(progress.currentBatch) + ", \"totalBatches\":" + std::to_string(progress.totalBatches) + ", \"loss\":" + std::to_string(progress.currentLoss) + ", \"epochAverageLoss\":" + std::to_string(progress.epochAverageLoss) + ", \"etaSeconds\":" + std::to_string(job.etaSeconds) + ", \"error\":\"" + jsonEscape(progress.lastError) + "\"}";
+}
+
+JobScheduler::JobScheduler(HTTPServer* server, const std::string& queueFile, int threadBudget, const std::string& eventsPath)
+    : m_server(server)
+    , m_queueFile(queueFile)
+    , m_eventsPath(eventsPath)
+    , m_threadBudget(threadBudget > 0 ? threadBudget : std::max(1, static_cast<int>(std::thread::hardware_concurrency())))
+    , m_nextId(1)
+    , m_threadsInUse(0)
+    , m_running(false) {
+    MetricsRegistry& metrics = MetricsRegistry::global();
+    m_queuedMetric = &metrics.gauge("baballs_jobs_queued", "Training jobs waiting for threads");
+    m_runningMetric = &metrics.gauge("baballs_jobs_running", "Training jobs running");
+    m_threadsMetric = &metrics.gauge("baballs_job_threads_in_use", "Threads of the job thread budget held by running jobs");
+    m_completedMetric = &metrics.counter("baballs_jobs_completed_total", "Training jobs that finished successfully");
+    m_failedMetric = &metrics.counter("baballs_jobs_failed_total", "Training jobs whose trainer failed or couldn't start");
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (loadQueue()) {
+            printf("Job scheduler: restored %zu jobs from %s\n", m_jobs.size(), m_queueFile.c_str());
+        }
+        updateMetrics();
+    }
+
+    // The scheduler's state is behind m_mutex, so these run concurrently with the other handlers
+    m_server->register_handler("/submit_job", [this](const std::unordered_map<std::string, std::string>& params) -> std::string {
+        if (params.count("dataset") == 0 || params.count("output") == 0) {
+            return "{\"result\":\"error\", \"message\":\"please specify a dataset and output\"}";
+        }
+        std::string owner = params.count("owner") ? urlDecode(params.at("owner")) : "";
+        int priority = params.count("priority") ? std::atoi(params.at("priority").c_str()) : 0;
+        int threads = params.count("threads") ? std::atoi(params.at("threads").c_str()) : JOB_SCHEDULER_DEFAULT_THREADS;
+
+        uint64_t id = submit(urlDecode(params.at("dataset")), urlDecode(params.at("output")), owner, priority, threads);
+        if (id == 0) {
+            return "{\"result\":\"error\", \"message\":\"job rejected: dataset missing or unreadable, or a field holds a tab or line break\"}";
+        }
+        return "{\"result\":\"ok\", \"id\":" + std::to_string(id) + "}";
+    }, true);
+
+    m_server->register_handler("/jobs", [this](const std::unordered_map<std::string, std::string>& params) -> std::string {
+        std::string jobs;
+        for (const JobInfo& job : getJobs()) {
+            jobs += (jobs.empty() ? "" : ", ") + jobJson(job);
+        }
+        return "{\"result\":\"ok\", \"threadBudget\":" + std::to_string(m_threadBudget) + ", \"jobs\":[" + jobs + "]}";
+    }, true);
+
+    m_server->register_handler("/job_status", [this](const std::unordered_map<std::string, std::string>& params) -> std::string {
+        JobInfo job;
+        if (params.count("id") == 0 || !getJob(std::strtoull(params.at("id").c_str(), NULL, 10), job)) {
+            return "{\"result\":\"error\", \"message\":\"unknown job id\"}";
+        }
+        return "{\"result\":\"ok\", \"job\":" + jobJson(job) + "}";
+    }, true);
+
+    m_server->register_handler("/cancel_job", [this](const std::unordered_map<std::string, std::string>& params) -> std::string {
+        if (params.count("id") == 0 || !cancel(std::strtoull(params.at("id").c_str(), NULL, 10))) {
+            return "{\"result\":\"error\", \"message\":\"no queued or running job with that id\"}";
+        }
+        return "{\"result\":\"ok\"}";
+    }, true);
+}
+
+JobScheduler::~JobScheduler() {
+    stop();
+}
+
+void JobScheduler::start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running) {
+        return;
+    }
+    m_running = true;
+    m_thread = std::thread(&JobScheduler::scheduleLoop, this);
+}
+
+void JobScheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+    }
+    m_wake.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    // Kill what is still running; those jobs go back in the queue for next time
+    std::vector<std::shared_ptr<TrainerWrapper>> trainers;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (Job& job : m_jobs) {
+            if (job.trainer) {
+                trainers.push_back(job.trainer);
+            }
+        }
+    }
+    for (const std::shared_ptr<TrainerWrapper>& trainer : trainers) {
+        trainer->cancel();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (Job& job : m_jobs) {
+        if (job.info.state == JobState::Running) {
+            m_threadsInUse -= job.info.threads;
+            job.info.state = JobState::Queued;
+            job.info.progress = TrainerProgress();
+            job.info.etaSeconds = -1.0f;
+            job.slot = -1;
+        }
+        job.trainer.reset();
+    }
+    updateMetrics();
+    saveQueue();
+}
+
+uint64_t JobScheduler::submit(const std::string& datasetFile, const std::string& outputFile, const std::string& owner, int priority, int threads) {
+    if (datasetFile.empty() || outputFile.empty() || !isStorable(datasetFile) || !isStorable(outputFile) || !isStorable(owner)) {
+        return 0;
+    }
+    if (!std::ifstream(datasetFile, std::ios::binary).good()) {
+        printf("Job scheduler: can't read dataset %s\n", datasetFile.c_str());
+        return 0;
+    }
+
+    JobInfo info;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Job job;
+        job.info.id = m_nextId++;
+        job.info.owner = owner;
+        job.info.datasetFile = datasetFile;
+        job.info.outputFile = outputFile;
+        job.info.priority = priority;
+        job.info.threads = std::min(std::max(threads, 1), m_threadBudget);
+        job.info.submittedMs = unixTimeMs();
+        m_jobs.push_back(job);
+        info = job.info;
+
+        updateMetrics();
+        saveQueue();
+    }
+    printf("Job scheduler: queued job %llu (%s -> %s, priority %d, %d threads)\n",
+           (unsigned long long)info.id, datasetFile.c_str(), outputFile.c_str(), info.priority, info.threads);
+
+    publish(info);
+    m_wake.notify_all();
+    return info.id;
+}
+
+bool JobScheduler::cancel(uint64_t id) {
+    JobInfo info;
+    std::shared_ptr<TrainerWrapper> trainer;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Job* job = findJob(id);
+        if (!job || (job->info.state != JobState::Queued && job->info.state != JobState::Running)) {
+            return false;
+        }
+        if (job->info.state == JobState::Queued) {
+            job->info.state = JobState::Cancelled;
+            updateMetrics();
+            saveQueue();
+            info = job->info;
+        } else {
+            trainer = job->trainer;
+        }
+    }
+
+    if (trainer) {
+        // Waits for the trainer to exit. If it exited on its own first, cancel() fails and onFinished runs instead
+        bool killed = trainer->cancel();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Job* job = findJob(id);
+        if (!killed || !job || job->info.state != JobState::Running) {
+            return false; // It finished on its own first
+        }
+        finishJob(*job, JobState::Cancelled);
+        saveQueue();
+        info = job->info;
+    }
+
+    publish(info);
+    m_wake.notify_all();
+    return true;
+}
+
+bool JobScheduler::getJob(uint64_t id, JobInfo& job) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const Job& candidate : m_jobs) {
+        if (candidate.info.id == id) {
+            job = candidate.info;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<JobInfo> JobScheduler::getJobs() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<JobInfo> jobs;
+    jobs.reserve(m_jobs.size());
+    for (const Job& job : m_jobs) {
+        jobs.push_back(job.info);
+    }
+    return jobs;
+}
+
+void JobScheduler::scheduleLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        // Trainers of finished jobs are released here, never on their own I/O thread
+        std::vector<std::shared_ptr<TrainerWrapper>> finished;
+        for (Job& job : m_jobs) {
+            if (job.trainer && job.info.state != JobState::Running && !job.trainer->isRunning()) {
+                finished.push_back(std::move(job.trainer));
+            }
+        }
+        pruneHistory();
+
+        std::vector<JobInfo> started = startJobs();
+
+        lock.unlock();
+        finished.clear();
+        for (const JobInfo& job : started) {
+            publish(job);
+        }
+        lock.lock();
+
+        if (m_running) {
+            m_wake.wait_for(lock, std::chrono::milliseconds(JOB_SCHEDULER_POLL_MS));
+        }
+    }
+}
+
+std::vector<JobInfo> JobScheduler::startJobs() {
+    std::vector<Job*> queued;
+    for (Job& job : m_jobs) {
+        if (job.info.state == JobState::Queued) {
+            queued.push_back(&job);
+        }
+    }
+    std::stable_sort(queued.begin(), queued.end(), [](const Job* a, const Job* b) {
+        return a->info.priority > b->info.priority;
+    });
+
+    std::vector<JobInfo> started;
+    for (Job* job : queued) {
+        if (job->info.threads > m_threadBudget - m_threadsInUse) {
+            break; // Lower priorities wait until this one fits
+        }
+
+        // Lowest slot not held by a running job, so the trainer gauges stay few
+        int slot = 0;
+        while (std::any_of(m_jobs.begin(), m_jobs.end(), [slot](const Job& other) { return other.slot == slot; })) {
+            slot++;
+        }
+
+        uint64_t id = job->info.id;
+        std::shared_ptr<TrainerWrapper> trainer = std::make_shared<TrainerWrapper>("venv", MetricLabels { { "slot", std::to_string(slot) } });
+        trainer->setThreads(job->info.threads);
+
+        job->info.state = JobState::Running;
+        job->info.progress = TrainerProgress();
+        job->info.etaSeconds = -1.0f;
+        job->startTime = std::chrono::steady_clock::now();
+        job->slot = slot;
+        job->trainer = trainer;
+        m_threadsInUse += job->info.threads;
+
+        // Started with m_mutex held so cancel() can't slip in between; the
+        // callbacks run on the trainer's I/O thread and wait for the lock
+        bool success = trainer->start(
+            job->info.datasetFile,
+            job->info.outputFile,
+            [id](const std::string& output) { printf("job %llu: %s", (unsigned long long)id, output.c_str()); },
+            [this, id](const TrainerProgress& progress) { onProgress(id, progress); },
+            [this, id]() { onFinished(id); });
+
+        if (success) {
+            printf("Job scheduler: started job %llu with %d threads (%d of %d in use)\n",
+                   (unsigned long long)id, job->info.threads, m_threadsInUse, m_threadBudget);
+        } else {
+            job->info.progress.hasError = true;
+            job->info.progress.lastError = "trainer could not be started";
+            finishJob(*job, JobState::Failed);
+        }
+        started.push_back(job->info);
+    }
+
+    if (!started.empty()) {
+        updateMetrics();
+        saveQueue();
+    }
+    return started;
+}
+
+void JobScheduler::onProgress(uint64_t id, const TrainerProgress& progress) {
+    JobInfo info;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Job* job = findJob(id);
+        if (!job || job->info.state != JobState::Running) {
+            return;
+        }
+        job->info.progress = progress;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - job->startTime).count();
+        job->info.etaSeconds = estimateEta(progress, elapsed);
+        info = job->info;
+    }
+    publish(info);
+}
+
+void JobScheduler::onFinished(uint64_t id) {
+    JobInfo info;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Job* job = findJob(id);
+        if (!job || job->info.state != JobState::Running) {
+            return;
+        }
+
+        // The exit code decides; the parser flags any output line that mentions an error
+        int exitCode = job->trainer->exitCode();
+        if (exitCode != 0) {
+            if (job->info.progress.lastError.empty()) {
+                job->info.progress.lastError = "trainer exited with code " + std::to_string(exitCode);
+            }
+            job->info.progress.hasError = true;
+            finishJob(*job, JobState::Failed);
+        } else {
+            finishJob(*job, JobState::Completed);
+        }
+        saveQueue();
+        info = job->info;
+    }
+    printf("Job scheduler: job %llu %s\n", (unsigned long long)id, jobStateName(info.state));
+
+    publish(info);
+    m_wake.notify_all();
+}
+
+JobScheduler::Job* JobScheduler::findJob(uint64_t id) {
+    for (Job& job : m_jobs) {
+        if (job.info.id == id) {
+            return &job;
+        }
+    }
+    return nullptr;
+}
+
+void JobScheduler::finishJob(Job& job, JobState state) {
+    m_threadsInUse -= job.info.threads;
+    job.info.state = state;
+    job.info.progress.isTraining = false;
+    job.info.progress.isComplete = state == JobState::Completed;
+    job.info.etaSeconds = state == JobState::Completed ? 0.0f : -1.0f;
+    job.slot = -1;
+
+    if (state == JobState::Completed) {
+        m_completedMetric->add();
+    } else if (state == JobState::Failed) {
+        m_failedMetric->add();
+    }
+    updateMetrics();
+}
+
+void JobScheduler::pruneHistory() {
+    size_t finished = 0;
+    for (const Job& job : m_jobs) {
+        if (job.info.state != JobState::Queued && job.info.state != JobState::Running) {
+            finished++;
+        }
+    }
+
+    // Oldest first; a job whose trainer hasn't been released yet stays
+    for (auto it = m_jobs.begin(); it != m_jobs.end() && finished > JOB_SCHEDULER_HISTORY;) {
+        if (it->info.state != JobState::Queued && it->info.state != JobState::Running && !it->trainer) {
+            it = m_jobs.erase(it);
+            finished--;
+        } else {
+            ++it;
+        }
+    }
+}
+
+void JobScheduler::updateMetrics() {
+    int queued = 0;
+    int running = 0;
+    for (const Job& job : m_jobs) {
+        if (job.info.state == JobState::Queued) {
+            queued++;
+        } else if (job.info.state == JobState::Running) {
+            running++;
+        }
+    }
+    m_queuedMetric->set(queued);
+    m_runningMetric->set(running);
+    m_threadsMetric->set(m_threadsInUse);
+}
+
+bool JobScheduler::saveQueue() const {
+    // Written beside the queue file and then moved over it, so a crash
+    // mid-write leaves the previous queue intact
+    std::string tempFile = m_queueFile + ".tmp";
+    FILE* file = fopen(tempFile.c_str(), "wb");
+    if (!file) {
+        printf("Job scheduler: can't write %s\n", tempFile.c_str());
+        return false;
+    }
+
+    fprintf(file, "# id\tstate\tpriority\tthreads\tsubmittedMs\towner\tdataset\toutput\n");
+    for (const Job& job : m_jobs) {
+        const JobInfo& info = job.info;
+        fprintf(file, "%llu\t%s\t%d\t%d\t%llu\t%s\t%s\t%s\n",
+                (unsigned long long)info.id, jobStateName(info.state), info.priority, info.threads,
+                (unsigned long long)info.submittedMs, info.owner.c_str(), info.datasetFile.c_str(), info.outputFile.c_str());
+    }
+
+    bool written = fflush(file) == 0;
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        printf("Job scheduler: failed writing %s\n", tempFile.c_str());
+        remove(tempFile.c_str());
+        return false;
+    }
+
+#ifdef _WIN32
+    bool moved = MoveFileExA(tempFile.c_str(), m_queueFile.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool moved = rename(tempFile.c_str(), m_queueFile.c_str()) == 0;
+#endif
+    if (!moved) {
+        printf("Job scheduler: can't replace %s\n", m_queueFile.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool JobScheduler::loadQueue() {
+    std::ifstream file(m_queueFile);
+    if (!file) {
+        return false; // No queue yet
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::vector<std::string> fields;
+        std::istringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, '\t')) {
+            fields.push_back(field);
+        }
+
+        Job job;
+        if (fields.size() != 8 || !jobStateFromName(fields[1], job.info.state)) {
+            printf("Job scheduler: skipping malformed line in %s: %s\n", m_queueFile.c_str(), line.c_str());
+            continue;
+        }
+        job.info.id = std::strtoull(fields[0].c_str(), NULL, 10);
+        job.info.priority = std::atoi(fields[2].c_str());
+        job.info.threads = std::min(std::max(std::atoi(fields[3].c_str()), 1), m_threadBudget);
+        job.info.submittedMs = std::strtoull(fields[4].c_str(), NULL, 10);
+        job.info.owner = fields[5];
+        job.info.datasetFile = fields[6];
+        job.info.outputFile = fields[7];
+
+        // Whatever was running when the process stopped starts over
+        if (job.info.state == JobState::Running) {
+            job.info.state = JobState::Queued;
+        }
+
+        m_nextId = std::max(m_nextId, job.info.id + 1);
+        m_jobs.push_back(job);
+    }
+    return true;
+}
+
+void JobScheduler::publish(const JobInfo& job) const {
+    if (m_eventsPath.empty()) {
+        return;
+    }
+    m_server->publish(m_eventsPath, std::make_shared<const std::string>("event: job\ndata: " + jobJson(job) + "\n\n"));
+}
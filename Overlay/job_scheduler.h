@@ -0,0 +1,147 @@
+#ifndef JOB_SCHEDULER_H
+#define JOB_SCHEDULER_H
+
+#include "trainer_progress.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class HTTPServer;
+class MetricCounter;
+class MetricGauge;
+class TrainerWrapper;
+
+#define JOB_SCHEDULER_DEFAULT_THREADS 2   // Thread budget of a job submitted without one
+#define JOB_SCHEDULER_HISTORY         32  // Finished jobs kept for /jobs, oldest forgotten first
+#define JOB_SCHEDULER_POLL_MS         500 // Scheduler thread wake-up when nothing notifies it
+
+enum class JobState {
+    Queued,
+    Running,
+    Completed,
+    Failed,
+    Cancelled
+};
+
+// Snapshot of one training job, as returned by the scheduler
+struct JobInfo {
+    uint64_t id = 0;
+    std::string owner; // Free-form, e.g. the headset or user the capture came from
+    std::string datasetFile;
+    std::string outputFile;
+    int priority = 0; // Higher runs first; equal priorities run in submission order
+    int threads = JOB_SCHEDULER_DEFAULT_THREADS;
+    JobState state = JobState::Queued;
+    uint64_t submittedMs = 0; // Unix time
+    TrainerProgress progress;
+    float etaSeconds = -1.0f; // Estimated time left while running, -1 when unknown
+};
+
+/**
+ * @brief Queues training jobs and runs several at once within a CPU budget
+ *
+ * Every job runs its own trainer process through a TrainerWrapper and is
+ * given a number of CPU threads; jobs start in priority order whenever the
+ * threads they need are free, so total trainer load never exceeds the
+ * budget. If the highest-priority job doesn't fit yet, lower ones wait
+ * behind it rather than starving it.
+ *
+ * The queue is written to a text file on every change and read back by the
+ * constructor; jobs that were running when the process stopped are queued
+ * again. Endpoints, registered on the REST server:
+ *   /submit_job?dataset=&output=[&owner=][&priority=][&threads=]
+ *   /jobs, /job_status?id=, /cancel_job?id=
+ * Each state change and progress update is published as a "job" event on
+ * the events stream, if one was given.
+ */
+class JobScheduler {
+public:
+    /**
+     * @brief Restore the queue and register the endpoints; construct before server->start()
+     *
+     * @param queueFile Where the queue is persisted
+     * @param threadBudget Threads shared by all running jobs; 0 uses every hardware thread
+     * @param eventsPath Stream to publish "job" events on, or empty for none
+     */
+    JobScheduler(HTTPServer* server, const std::string& queueFile, int threadBudget = 0, const std::string& eventsPath = "");
+
+    // Stops the scheduler; running jobs are killed and stay queued for next time
+    ~JobScheduler();
+
+    void start();
+    void stop();
+
+    /**
+     * @brief Queue a training job
+     *
+     * @param threads Thread budget; clamped to the scheduler's total budget
+     * @return the job's id, or 0 if the job was rejected
+     */
+    uint64_t submit(const std::string& datasetFile, const std::string& outputFile, const std::string& owner, int priority, int threads);
+
+    // Remove a queued job or kill a running one. False if the job has already finished.
+    bool cancel(uint64_t id);
+
+    bool getJob(uint64_t id, JobInfo& job) const;
+    std::vector<JobInfo> getJobs() const;
+
+    int threadBudget() const {
+        return m_threadBudget;
+    }
+
+private:
+    struct Job {
+        JobInfo info;
+        std::chrono::steady_clock::time_point startTime;
+        std::shared_ptr<TrainerWrapper> trainer; // While running; released by the scheduler thread
+        int slot = -1;                           // Metric label of the trainer while running
+    };
+
+    void scheduleLoop();
+
+    // Start queued jobs, highest priority first, while their threads fit in
+    // the budget; called with m_mutex held, returns the jobs it started
+    std::vector<JobInfo> startJobs();
+
+    void onProgress(uint64_t id, const TrainerProgress& progress);
+    void onFinished(uint64_t id);
+
+    // Called with m_mutex held
+    Job* findJob(uint64_t id);
+    void finishJob(Job& job, JobState state);
+    void pruneHistory();
+    void updateMetrics();
+    bool saveQueue() const;
+    bool loadQueue();
+
+    void publish(const JobInfo& job) const;
+
+    HTTPServer* m_server;
+    std::string m_queueFile;
+    std::string m_eventsPath;
+    int m_threadBudget;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::vector<Job> m_jobs; // Submission order
+    uint64_t m_nextId;
+    int m_threadsInUse;
+    bool m_running;
+    std::thread m_thread;
+
+    MetricGauge* m_queuedMetric;
+    MetricGauge* m_runningMetric;
+    MetricGauge* m_threadsMetric;
+    MetricCounter* m_completedMetric;
+    MetricCounter* m_failedMetric;
+};
+
+// JSON object for one job, as served by /jobs and /job_status
+std::string jobJson(const JobInfo& job);
+
+#endif // JOB_SCHEDULER_H
@@ -1,10 +1,12 @@
-
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <turbojpeg.h> // libjpeg-turbo
 
+#include "jpeg_stream.h"
+
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -18,6 +20,7 @@ typedef SOCKET socket_t;
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <unistd.h>
 typedef int socket_t;
 #define SOCKET_INVALID -1
@@ -25,19 +28,89 @@ typedef int socket_t;
 #endif
 
 #define BUFFER_SIZE 8192
-#define MAX_URL_LEN 256
+#define MAX_URL_LEN MJPEG_MAX_URL_LEN
+
+#define MJPEG_MAX_FRAME_BYTES      10000000 // Sanity limit on a single JPEG
+#define MJPEG_UNKNOWN_LENGTH_BYTES 65536    // Initial capacity when a part has no Content-Length
+#define MJPEG_HEADER_MAX           8192     // Longest HTTP response or part header block
+#define MJPEG_READY_FRAMES         4        // Parsed frames DecodeSharedFrame() can have waiting
+#define MJPEG_RECV_TIMEOUT_MS      3000     // A silent camera counts as disconnected after this long
+
+#ifdef _WIN32
+#define ATOMIC_INCREMENT(p) InterlockedIncrement(p)
+#define ATOMIC_DECREMENT(p) InterlockedDecrement(p)
+#define ATOMIC_LOAD(p)      InterlockedCompareExchange(p, 0, 0)
+#else
+#define ATOMIC_INCREMENT(p) __atomic_add_fetch(p, 1, __ATOMIC_ACQ_REL)
+#define ATOMIC_DECREMENT(p) __atomic_sub_fetch(p, 1, __ATOMIC_ACQ_REL)
+#define ATOMIC_LOAD(p)      __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#endif
+
+// Frames are recycled once their refcount drops to 0. Only the thread feeding
+// the owning parser takes a frame from 0 to 1, so acquiring a slot needs no
+// lock. The pool outlives the parser while consumers still hold frames.
+struct MJPEGFramePool {
+    volatile long refcount; // One for the parser plus one per frame in use
+    unsigned long overflows; // One-off frames allocated so far; only the parser's thread touches it
+    MJPEGFrame frames[MJPEG_POOL_SIZE];
+};
+
+typedef enum {
+    PARSE_HTTP_HEADERS,        // Status line and response headers
+    PARSE_BOUNDARY,            // Scanning for the next --boundary
+    PARSE_PART_HEADERS,        // Part headers up to the blank line
+    PARSE_BODY,                // Content-Length bytes of JPEG
+    PARSE_BODY_UNTIL_BOUNDARY, // JPEG without Content-Length, ends at the next boundary
+    PARSE_FAILED               // Not an MJPEG stream or the stream ended
+} ParseState;
+
+typedef enum {
+    CHUNK_SIZE,     // Hex size line
+    CHUNK_DATA,     // chunk_remaining bytes of payload
+    CHUNK_DATA_END  // CRLF after the payload
+} ChunkState;
+
+// Incremental multipart/x-mixed-replace parser. It never blocks or reads a
+// socket; callers feed it whatever bytes arrived, in pieces of any size.
+struct MJPEGParser {
+    ParseState state;
+    char boundary[256];
+    size_t boundary_len;
+
+    // Transfer-Encoding: chunked is removed before the multipart parsing
+    int chunked;
+    ChunkState chunk_state;
+    size_t chunk_remaining;
+    char chunk_line[32];
+    size_t chunk_line_len;
+
+    // Header block being collected, or the tail of the last read while
+    // scanning for a boundary that may straddle two reads
+    char header[MJPEG_HEADER_MAX];
+    size_t header_len;
 
-typedef struct {
+    MJPEGFrame* frame; // Part being read
+    size_t body_remaining;
+
+    MJPEGFramePool* pool;
+    unsigned long error_count;
+};
+
+struct MJPEGStream {
     socket_t sock;
     char host[MAX_URL_LEN];
     char path[MAX_URL_LEN];
     int port;
-    char boundary[256];
     char buffer[BUFFER_SIZE];
-    size_t buffer_pos;
-    size_t buffer_len;
     tjhandle tjInstance;
-} MJPEGStream;
+    MJPEGParser* parser;
+
+    // Frames parsed but not yet returned, oldest first
+    MJPEGFrame* ready[MJPEG_READY_FRAMES];
+    size_t ready_count;
+
+    unsigned long header_failures; // Parts rejected by tjDecompressHeader2
+};
 
 // Initialize socket subsystem
 void init_sockets() {
@@ -122,51 +195,172 @@ socket_t connect_to_server(const char* host, int port) {
     return sock;
 }
 
-// Fill the buffer with data from the socket
-int fill_buffer(MJPEGStream* stream) {
-    if (stream->buffer_pos > 0 && stream->buffer_len > 0) {
-        // Move remaining data to the beginning of the buffer
-        memmove(stream->buffer, stream->buffer + stream->buffer_pos,
-                stream->buffer_len - stream->buffer_pos);
-        stream->buffer_len -= stream->buffer_pos;
-        stream->buffer_pos = 0;
-    } else {
-        stream->buffer_len = 0;
-        stream->buffer_pos = 0;
+// memmem() replacement (not available on Windows). memchr is vectorized in
+// every C runtime, so jumping between candidate first bytes is much faster
+// than comparing at every offset.
+const char* find_bytes(const char* haystack, size_t haystack_len, const char* needle, size_t needle_len) {
+    if (needle_len == 0 || haystack_len < needle_len) {
+        return NULL;
     }
 
-    int bytes_read = recv(stream->sock, stream->buffer + stream->buffer_len,
-                          BUFFER_SIZE - (int)stream->buffer_len, MSG_WAITALL);
-    if (bytes_read <= 0) {
-        return 0; // Error or connection closed
+    const char* pos = haystack;
+    const char* last = haystack + haystack_len - needle_len;
+
+    while (pos <= last) {
+        pos = (const char*)memchr(pos, needle[0], (size_t)(last - pos) + 1);
+        if (!pos) {
+            return NULL;
+        }
+        if (memcmp(pos, needle, needle_len) == 0) {
+            return pos;
+        }
+        pos++;
     }
 
-    stream->buffer_len += bytes_read;
-    return 1;
+    return NULL;
 }
 
-// Find boundary in the buffer
-char* find_boundary(MJPEGStream* stream) {
-    if (!stream->boundary[0]) {
+// Value following a header name, e.g. "Content-Length:", in a
+// null-terminated header block, or NULL if the header isn't there
+const char* find_header_value(const char* headers, const char* name) {
+    const char* value = strstr(headers, name);
+    if (!value) {
         return NULL;
     }
 
-    char* pos = stream->buffer + stream->buffer_pos;
-    char* end = stream->buffer + stream->buffer_len;
-    size_t boundary_len = strlen(stream->boundary);
+    value += strlen(name);
+    while (*value == ' ') {
+        value++;
+    }
+    return value;
+}
 
-    while (pos + boundary_len <= end) {
-        if (memcmp(pos, stream->boundary, boundary_len) == 0) {
-            return pos;
+MJPEGFramePool* create_frame_pool() {
+    MJPEGFramePool* pool = (MJPEGFramePool*)calloc(1, sizeof(MJPEGFramePool));
+    if (!pool) {
+        return NULL;
+    }
+
+    pool->refcount = 1; // The parser's reference
+    for (int i = 0; i < MJPEG_POOL_SIZE; i++) {
+        pool->frames[i].pool = pool;
+    }
+    return pool;
+}
+
+void release_frame_pool(MJPEGFramePool* pool) {
+    if (ATOMIC_DECREMENT(&pool->refcount) != 0) {
+        return;
+    }
+
+    for (int i = 0; i < MJPEG_POOL_SIZE; i++) {
+        free(pool->frames[i].data);
+        free(pool->frames[i].plane_storage);
+    }
+    free(pool);
+}
+
+// Grow a frame's storage. Pooled frames keep their capacity between uses, so
+// this only allocates until the largest frame size has been seen.
+int reserve_frame(MJPEGFrame* frame, size_t capacity) {
+    if (frame->capacity >= capacity) {
+        return 1;
+    }
+
+    unsigned char* data = (unsigned char*)realloc(frame->data, capacity);
+    if (!data) {
+        printf("cant decode frame: jpeg malloc null\n");
+        return 0;
+    }
+
+    frame->data = data;
+    frame->capacity = capacity;
+    return 1;
+}
+
+// Take an unreferenced frame from the pool, or allocate a one-off frame if
+// consumers are holding on to all of them
+MJPEGFrame* acquire_frame(MJPEGFramePool* pool, size_t capacity) {
+    MJPEGFrame* frame = NULL;
+    for (int i = 0; i < MJPEG_POOL_SIZE; i++) {
+        if (ATOMIC_LOAD(&pool->frames[i].refcount) == 0) {
+            frame = &pool->frames[i];
+            break;
         }
-        pos++;
     }
 
-    return NULL;
+    if (frame) {
+        ATOMIC_INCREMENT(&pool->refcount);
+    } else {
+        // Logged at powers of two so a consumer that keeps holding frames
+        // shows up without flooding the log
+        pool->overflows++;
+        if ((pool->overflows & (pool->overflows - 1)) == 0) {
+            printf("MJPEG frame pool exhausted, allocating frame (%lu overflows so far)\n", pool->overflows);
+        }
+
+        frame = (MJPEGFrame*)calloc(1, sizeof(MJPEGFrame));
+        if (!frame) {
+            printf("cant decode frame: frame malloc null\n");
+            return NULL;
+        }
+    }
+
+    ATOMIC_INCREMENT(&frame->refcount);
+    frame->size = 0;
+    frame->width = 0;
+    frame->height = 0;
+    frame->timestamp = 0;
+    frame->plane = NULL;
+    frame->plane_width = 0;
+    frame->plane_height = 0;
+
+    if (!reserve_frame(frame, capacity)) {
+        ReleaseFrame(frame);
+        return NULL;
+    }
+    return frame;
+}
+
+void RetainFrame(MJPEGFrame* frame) {
+    if (frame) {
+        ATOMIC_INCREMENT(&frame->refcount);
+    }
+}
+
+void ReleaseFrame(MJPEGFrame* frame) {
+    if (!frame || ATOMIC_DECREMENT(&frame->refcount) != 0) {
+        return;
+    }
+
+    if (frame->pool) {
+        // Storage stays with the slot for the next frame
+        release_frame_pool(frame->pool);
+    } else {
+        free(frame->data);
+        free(frame->plane_storage);
+        free(frame);
+    }
+}
+
+unsigned char* ReserveFramePlane(MJPEGFrame* frame, int width, int height) {
+    size_t size = (size_t)width * height;
+    frame->plane = NULL;
+
+    if (frame->plane_capacity < size) {
+        unsigned char* storage = (unsigned char*)realloc(frame->plane_storage, size);
+        if (!storage) {
+            printf("cant reserve frame plane: malloc null\n");
+            return NULL;
+        }
+        frame->plane_storage = storage;
+        frame->plane_capacity = size;
+    }
+    return frame->plane_storage;
 }
 
 // Extract boundary from Content-Type header
-int extract_boundary(MJPEGStream* stream, const char* header) {
+int extract_boundary(MJPEGParser* parser, const char* header) {
     // Debug output
     printf("extract_boundary: Analyzing header: %.100s\n", header);
 
@@ -187,15 +381,16 @@ int extract_boundary(MJPEGStream* stream, const char* header) {
     }
 
     // Copy boundary
-    strcpy(stream->boundary, "--"); // MJPEG boundaries start with --
+    strcpy(parser->boundary, "--"); // MJPEG boundaries start with --
     size_t i = 2;
     while (*boundary_start && *boundary_start != '"' && *boundary_start != '\r' && *boundary_start != '\n' && *boundary_start != ';') {
-        if (i < sizeof(stream->boundary) - 1) {
-            stream->boundary[i++] = *boundary_start;
+        if (i < sizeof(parser->boundary) - 1) {
+            parser->boundary[i++] = *boundary_start;
         }
         boundary_start++;
     }
-    stream->boundary[i] = '\0';
+    parser->boundary[i] = '\0';
+    parser->boundary_len = i;
 
     // Verify we got a non-empty boundary
     if (i <= 2) {
@@ -203,93 +398,39 @@ int extract_boundary(MJPEGStream* stream, const char* header) {
         return 0;
     }
 
-    printf("extract_boundary: Extracted boundary: '%s'\n", stream->boundary);
+    printf("extract_boundary: Extracted boundary: '%s'\n", parser->boundary);
     return 1;
 }
 
-// Find end of HTTP headers
-char* find_headers_end(char* buffer, size_t len) {
-    for (size_t i = 0; i < len - 3; i++) {
-        if (buffer[i] == '\r' && buffer[i + 1] == '\n' && buffer[i + 2] == '\r' && buffer[i + 3] == '\n') {
-            return buffer + i + 4;
-        }
-    }
-    return NULL;
-}
-
-// Get MJPEG stream handle
-MJPEGStream* GetStreamHandle(const char* url) {
-    printf("GetStreamHandle: Starting with URL: %s\n", url);
-    init_sockets();
-
-    MJPEGStream* stream = (MJPEGStream*)malloc(sizeof(MJPEGStream));
-    if (!stream) {
-        return NULL;
-    }
-
-    memset(stream, 0, sizeof(MJPEGStream));
-    stream->sock = SOCKET_INVALID;
-
-    // Parse URL
-    if (!parse_url(url, stream->host, stream->path, &stream->port)) {
-        printf("ERROR: Failed to parse URL: %s\n", url);
-        free(stream);
-        return NULL;
-    }
-    printf("GetStreamHandle: URL parsed - Host: %s, Path: %s, Port: %d\n",
-           stream->host, stream->path, stream->port);
-
-    // Connect to server
-    stream->sock = connect_to_server(stream->host, stream->port);
-    if (stream->sock == SOCKET_INVALID) {
-        printf("ERROR: Failed to connect to server\n");
-        free(stream);
-        return NULL;
+// Append data to the header block until its terminating blank line.
+// Returns 1 when the block is complete (null-terminated in parser->header),
+// 0 if more data is needed and -1 if the block is too long. *consumed
+// receives how many bytes of data belong to the block.
+int collect_headers(MJPEGParser* parser, const char* data, size_t len, size_t* consumed) {
+    size_t search_from = parser->header_len > 3 ? parser->header_len - 3 : 0;
+    size_t space = MJPEG_HEADER_MAX - 1 - parser->header_len;
+    size_t take = (len < space) ? len : space;
+
+    memcpy(parser->header + parser->header_len, data, take);
+    parser->header_len += take;
+
+    const char* end = find_bytes(parser->header + search_from, parser->header_len - search_from, "\r\n\r\n", 4);
+    if (end) {
+        size_t block_len = (end - parser->header) + 4;
+        *consumed = take - (parser->header_len - block_len);
+        parser->header_len = block_len;
+        parser->header[block_len] = '\0';
+        return 1;
     }
 
-    // Send HTTP request
-    char request[1024];
-    snprintf(request, sizeof(request),
-             "GET %s HTTP/1.1\r\n"
-             "Host: %s\r\n"
-             "Connection: keep-alive\r\n\r\n",
-             stream->path, stream->host);
-
-    printf("GetStreamHandle: Sending HTTP request:\n%s\n", request);
-    send(stream->sock, request, (int)strlen(request), 0);
-
-    // Read HTTP response headers
-    printf("GetStreamHandle: Reading HTTP response headers...\n");
-    char headers[8192] = { 0 };
-    int headers_len = 0;
-    int headers_complete = 0;
-
-    while (!headers_complete && headers_len < sizeof(headers) - 1) {
-        char buf[1024];
-        int received = recv(stream->sock, buf, sizeof(buf) - 1, MSG_WAITALL);
-
-        if (received <= 0) {
-            printf("ERROR: Failed to receive HTTP headers\n");
-            CLOSE_SOCKET(stream->sock);
-            free(stream);
-            return NULL;
-        }
-
-        // Append to headers buffer
-        if (headers_len + received < sizeof(headers)) {
-            memcpy(headers + headers_len, buf, received);
-            headers_len += received;
-            headers[headers_len] = '\0';
-        }
-
-        // Check if we've received the end of headers
-        if (strstr(headers, "\r\n\r\n")) {
-            headers_complete = 1;
-        }
-    }
+    *consumed = take;
+    return (parser->header_len >= MJPEG_HEADER_MAX - 1) ? -1 : 0;
+}
 
-    printf("GetStreamHandle: Received HTTP headers (%d bytes):\n%.200s...\n",
-           headers_len, headers);
+// Check the HTTP response and pick up the boundary and transfer encoding
+int process_response_headers(MJPEGParser* parser) {
+    const char* headers = parser->header;
+    printf("MJPEGParser: Received HTTP headers (%zu bytes):\n%.200s...\n", parser->header_len, headers);
 
     // Find Content-Type header
     const char* content_type = NULL;
@@ -297,488 +438,539 @@ MJPEGStream* GetStreamHandle(const char* url) {
     for (int i = 0; i < 2; i++) {
         content_type = strstr(headers, content_type_patterns[i]);
         if (content_type) {
-            printf("GetStreamHandle: Found content-type header: %.50s\n", content_type);
             break;
         }
     }
 
     if (!content_type) {
-        printf("GetStreamHandle: ERROR - No Content-Type header found\n");
-        CLOSE_SOCKET(stream->sock);
-        free(stream);
-        return NULL;
+        printf("MJPEGParser: ERROR - No Content-Type header found\n");
+        return 0;
     }
 
-    // Find end of Content-Type header line
-    char* content_type_end = strstr(content_type, "\r\n");
-    if (content_type_end) {
-        *content_type_end = '\0'; // Temporarily terminate string
-        printf("GetStreamHandle: Found Content-Type: %s\n", content_type);
-        *content_type_end = '\r'; // Restore original character
+    // Only look at the Content-Type line itself
+    const char* content_type_end = strstr(content_type, "\r\n");
+    size_t content_type_len = content_type_end ? (size_t)(content_type_end - content_type) : strlen(content_type);
+    char content_type_line[512];
+    if (content_type_len >= sizeof(content_type_line)) {
+        content_type_len = sizeof(content_type_line) - 1;
     }
+    memcpy(content_type_line, content_type, content_type_len);
+    content_type_line[content_type_len] = '\0';
+    printf("MJPEGParser: Found Content-Type: %s\n", content_type_line);
 
     // Check if it's a multipart/x-mixed-replace content type
-    if (!strstr(content_type, "multipart/x-mixed-replace")) {
+    if (!strstr(content_type_line, "multipart/x-mixed-replace")) {
         printf("ERROR: Not a multipart/x-mixed-replace stream\n");
-        CLOSE_SOCKET(stream->sock);
-        free(stream);
-        return NULL;
+        return 0;
     }
 
-    // Extract boundary
-    if (!extract_boundary(stream, content_type)) {
+    if (!extract_boundary(parser, content_type_line)) {
         printf("ERROR: Failed to extract boundary\n");
-        CLOSE_SOCKET(stream->sock);
-        free(stream);
-        return NULL;
-    }
-    printf("init buffer...\n");
-    // Find the end of headers and initialize buffer
-    char* headers_end = strstr(headers, "\r\n\r\n");
-    if (headers_end) {
-        headers_end += 4; // Skip \r\n\r\n
-
-        // Copy remaining data to stream buffer
-        int remaining = headers_len - (int)(headers_end - headers);
-        if (remaining > 0) {
-            memcpy(stream->buffer, headers_end, remaining);
-            stream->buffer_len = remaining;
-        }
-    }
-    printf("init tjpeg...\n");
-    // Initialize TurboJPEG decompressor
-    stream->tjInstance = tjInitDecompress();
-    if (!stream->tjInstance) {
-        printf("ERROR: Failed to initialize TurboJPEG decompressor\n");
-        CLOSE_SOCKET(stream->sock);
-        free(stream);
-        return NULL;
+        return 0;
     }
 
-    printf("GetStreamHandle: Stream successfully initialized with boundary: %s\n",
-           stream->boundary);
-    return stream;
+    // Chunked responses interleave chunk-size lines with the multipart data
+    parser->chunked = strstr(headers, "Transfer-Encoding: chunked") || strstr(headers, "transfer-encoding: chunked");
+    return 1;
 }
 
-// Decode a frame from the MJPEG stream
-unsigned char* DecodeFrame(MJPEGStream* stream, int* width, int* height, uint64_t* timestamp, size_t* return_size) {
-    // printf("DecodeFrame...\n");
-    if (!stream || stream->sock == SOCKET_INVALID) {
-        printf("cant decode frame: invalid stream state!\n");
-        return NULL;
-    }
+// Hand a completed frame to the callback, which takes over the reference
+void emit_frame(MJPEGParser* parser, ParseState next_state, MJPEGFrameCallback on_frame, void* user) {
+    MJPEGFrame* frame = parser->frame;
+    parser->frame = NULL;
+    parser->header_len = 0;
+    parser->state = next_state;
+    on_frame(frame, user);
+}
 
-    uint64_t timestamp_read = 0L;
+// Drop the current part and resynchronize on the next boundary
+void parse_error(MJPEGParser* parser) {
+    parser->error_count++;
+    ReleaseFrame(parser->frame);
+    parser->frame = NULL;
+    parser->header_len = 0;
+    parser->state = PARSE_BOUNDARY;
+}
 
-    // printf("DecodeFrame Findboundary...\n");
-    //  Find boundary
-    char* boundary_pos = NULL;
-    while (!(boundary_pos = find_boundary(stream))) {
-        if (!fill_buffer(stream)) {
-            printf("cant decode frame: cant fill buffer\n");
-            return NULL;
-        }
+// Parse the part headers and get a frame to read the JPEG into
+int begin_part(MJPEGParser* parser) {
+    const char* content_length_header = find_header_value(parser->header, "Content-Length:");
+    const char* timestamp_header = find_header_value(parser->header, "X-Timestamp:");
+
+    long content_length = content_length_header ? strtol(content_length_header, NULL, 10) : -1;
+    if (content_length > MJPEG_MAX_FRAME_BYTES || content_length == 0) { // Sanity check
+        return 0;
     }
-    // printf("DecodeFrame MoveBoundary...\n");
-    //  Move past the boundary
-    stream->buffer_pos = (boundary_pos - stream->buffer) + strlen(stream->boundary);
 
-    // Check for chunk encoding marker (hex digits followed by CRLF)
-    int is_chunked = 0;
-    size_t chunk_header_end = 0;
+    parser->frame = acquire_frame(parser->pool, content_length > 0 ? (size_t)content_length : MJPEG_UNKNOWN_LENGTH_BYTES);
+    if (!parser->frame) {
+        return 0;
+    }
+    parser->frame->timestamp = timestamp_header ? strtoull(timestamp_header, NULL, 10) : 0;
 
-    // Look ahead to see if we have a hex number followed by CRLF
-    for (size_t i = stream->buffer_pos; i < stream->buffer_len - 1; i++) {
-        char c = stream->buffer[i];
-        // Check if we have digits or a-f/A-F (hex)
-        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')) {
-            continue;
-        } else if (c == '\r' && stream->buffer[i + 1] == '\n') {
-            // Found CRLF after hex digits - this is likely chunked encoding
-            is_chunked = 1;
-            chunk_header_end = i + 2; // Position after CRLF
-            // printf("Detected chunked encoding format\n");
-            break;
-        } else {
-            // Not chunked encoding
-            break;
-        }
+    parser->header_len = 0;
+    if (content_length > 0) {
+        parser->body_remaining = (size_t)content_length;
+        parser->state = PARSE_BODY;
+    } else {
+        parser->state = PARSE_BODY_UNTIL_BOUNDARY;
     }
+    return 1;
+}
 
-    // Handle chunked encoding
-    if (is_chunked) {
-        // Skip the chunk size and CRLF
-        stream->buffer_pos = chunk_header_end;
+// Returns how many bytes of data the boundary scan used
+size_t scan_boundary(MJPEGParser* parser, const char* data, size_t len) {
+    size_t keep = parser->boundary_len - 1;
+
+    if (parser->header_len > 0) {
+        // A boundary split across two reads: the kept tail plus the first bytes of data
+        char joined[2 * sizeof(parser->boundary)];
+        size_t head = (len < keep) ? len : keep;
+        memcpy(joined, parser->header, parser->header_len);
+        memcpy(joined + parser->header_len, data, head);
+
+        const char* match = find_bytes(joined, parser->header_len + head, parser->boundary, parser->boundary_len);
+        if (match) {
+            size_t used = (match - joined) + parser->boundary_len - parser->header_len;
+            parser->header_len = 0;
+            parser->state = PARSE_PART_HEADERS;
+            return used;
+        }
+    }
 
-        // Find Content-Type and Content-Length headers
-        char* headers_end = NULL;
-        int content_length = -1;
+    const char* match = find_bytes(data, len, parser->boundary, parser->boundary_len);
+    if (match) {
+        parser->header_len = 0;
+        parser->state = PARSE_PART_HEADERS;
+        return (match - data) + parser->boundary_len;
+    }
 
-        while (1) {
-            if (stream->buffer_pos + 4 >= stream->buffer_len) {
-                if (!fill_buffer(stream)) {
-                    printf("cant decode frame: cant fill buffer(2)\n");
-                    return NULL;
-                }
-            }
+    // Keep the last keep bytes seen for the next read
+    if (len >= keep) {
+        memcpy(parser->header, data + len - keep, keep);
+        parser->header_len = keep;
+    } else {
+        size_t total = parser->header_len + len;
+        size_t drop = (total > keep) ? total - keep : 0;
+        memmove(parser->header, parser->header + drop, parser->header_len - drop);
+        parser->header_len -= drop;
+        memcpy(parser->header + parser->header_len, data, len);
+        parser->header_len += len;
+    }
+    return len;
+}
 
-            headers_end = strstr(stream->buffer + stream->buffer_pos, "\r\n\r\n");
-            if (headers_end) {
-                *headers_end = '\0'; // Temporarily null-terminate for strstr
+// Returns how many bytes of data went into a part without Content-Length.
+// The part ends at the next boundary, which is searched for in the frame
+// itself so a boundary split across reads is still found.
+size_t read_until_boundary(MJPEGParser* parser, const char* data, size_t len, MJPEGFrameCallback on_frame, void* user) {
+    MJPEGFrame* frame = parser->frame;
+    size_t before = frame->size;
+
+    if (before + len > MJPEG_MAX_FRAME_BYTES
+        || (before + len > frame->capacity && !reserve_frame(frame, (before + len) * 2))) {
+        parse_error(parser);
+        return 0; // Rescan this data for a boundary
+    }
 
-                char* content_length_header = strstr(stream->buffer + stream->buffer_pos, "Content-Length:");
-                char* timestamp_header = strstr(stream->buffer + stream->buffer_pos, "X-Timestamp:");
+    memcpy(frame->data + before, data, len);
+    frame->size += len;
 
-                if (content_length_header) {
-                    content_length = atoi(content_length_header + 16);
-                    // printf("Found Content-Length: %d\n", content_length);
-                }
+    size_t from = (before > parser->boundary_len - 1) ? before - (parser->boundary_len - 1) : 0;
+    const char* match = find_bytes((const char*)frame->data + from, frame->size - from, parser->boundary, parser->boundary_len);
+    if (!match) {
+        return len;
+    }
 
-                if (timestamp_header) {
-                    // printf("Found timestamp: ");
-                    // printf(timestamp_header);
-                    // printf("\n");
-                    timestamp_read = atoll(timestamp_header + 13);
-                }
+    size_t at = (const unsigned char*)match - frame->data;
+    size_t used = at + parser->boundary_len - before;
 
-                *headers_end = '\r'; // Restore the character
-                headers_end += 4;    // Move past \r\n\r\n
-                break;
-            }
+    // Drop the CRLF that precedes the boundary
+    frame->size = at;
+    if (frame->size >= 2 && frame->data[frame->size - 2] == '\r' && frame->data[frame->size - 1] == '\n') {
+        frame->size -= 2;
+    }
 
-            if (!fill_buffer(stream)) {
-                printf("cant decode frame: cant fill buffer(3)\n");
-                return NULL;
-            }
-        }
+    emit_frame(parser, PARSE_PART_HEADERS, on_frame, user);
+    return used;
+}
 
-        // Update buffer position to after headers
-        stream->buffer_pos = headers_end - stream->buffer;
+// Run de-chunked bytes through the multipart state machine
+void feed_multipart(MJPEGParser* parser, const char* data, size_t len, MJPEGFrameCallback on_frame, void* user) {
+    while (len > 0) {
+        size_t used = len;
 
-        // Look for next chunk marker (hex followed by CRLF)
-        size_t next_chunk_pos = stream->buffer_pos;
-        int found_chunk_marker = 0;
+        switch (parser->state) {
+        case PARSE_BOUNDARY:
+            used = scan_boundary(parser, data, len);
+            break;
 
-        while (next_chunk_pos < stream->buffer_len - 1) {
-            if (stream->buffer[next_chunk_pos] == '\r' && stream->buffer[next_chunk_pos + 1] == '\n') {
-                found_chunk_marker = 1;
-                next_chunk_pos += 2; // Move past CRLF
-                break;
+        case PARSE_PART_HEADERS: {
+            int complete = collect_headers(parser, data, len, &used);
+            if (complete < 0 || (complete > 0 && !begin_part(parser))) {
+                parse_error(parser);
             }
-            next_chunk_pos++;
+            break;
         }
 
-        if (!found_chunk_marker) {
-            // Need more data
-            if (!fill_buffer(stream)) {
-                printf("cant decode frame: cant find next chunk marker\n");
-                return NULL;
+        case PARSE_BODY: {
+            MJPEGFrame* frame = parser->frame;
+            used = (len < parser->body_remaining) ? len : parser->body_remaining;
+            memcpy(frame->data + frame->size, data, used);
+            frame->size += used;
+            parser->body_remaining -= used;
+            if (parser->body_remaining == 0) {
+                emit_frame(parser, PARSE_BOUNDARY, on_frame, user);
             }
+            break;
         }
 
-        // Parse the chunk size (hex)
-        char chunk_size_str[16] = { 0 };
-        size_t i = 0;
-
-        while (next_chunk_pos < stream->buffer_len && i < 15) {
-            char c = stream->buffer[next_chunk_pos++];
-            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')) {
-                chunk_size_str[i++] = c;
-            } else if (c == '\r' && next_chunk_pos < stream->buffer_len && stream->buffer[next_chunk_pos] == '\n') {
-                next_chunk_pos++; // Skip the '\n'
-                break;
-            } else {
-                break;
-            }
+        case PARSE_BODY_UNTIL_BOUNDARY:
+            used = read_until_boundary(parser, data, len, on_frame, user);
+            break;
+
+        default:
+            return;
         }
 
-        // Convert hex string to integer
-        unsigned int jpeg_size = 0;
-        sscanf(chunk_size_str, "%x", &jpeg_size);
-        // printf("JPEG chunk size: %u (0x%s)\n", jpeg_size, chunk_size_str);
+        data += used;
+        len -= used;
+    }
+}
 
-        if (jpeg_size == 0 || jpeg_size > 10000000) { // Sanity check
-            // printf("Invalid JPEG chunk size: %u\n", jpeg_size);
-            return NULL;
-        }
+MJPEGParser* CreateMJPEGParser(void) {
+    MJPEGParser* parser = (MJPEGParser*)calloc(1, sizeof(MJPEGParser));
+    if (!parser) {
+        return NULL;
+    }
 
-        // Allocate memory for JPEG data
-        unsigned char* jpeg_data = (unsigned char*)malloc(jpeg_size);
-        if (!jpeg_data) {
-            printf("cant decode frame: jpeg malloc null\n");
-            return NULL;
-        }
+    parser->pool = create_frame_pool();
+    if (!parser->pool) {
+        free(parser);
+        return NULL;
+    }
 
-        // Read JPEG data
-        size_t total_read = 0;
-        stream->buffer_pos = next_chunk_pos; // Start from after chunk size
+    parser->state = PARSE_HTTP_HEADERS;
+    parser->chunk_state = CHUNK_SIZE;
+    return parser;
+}
 
-        while (total_read < jpeg_size) {
-            size_t available = stream->buffer_len - stream->buffer_pos;
+void DestroyMJPEGParser(MJPEGParser* parser) {
+    if (!parser) {
+        return;
+    }
 
-            if (available == 0) {
-                if (!fill_buffer(stream)) {
-                    free(jpeg_data);
-                    printf("cant decode frame: cant fill buffer for JPEG data\n");
-                    return NULL;
-                }
-                available = stream->buffer_len - stream->buffer_pos;
-            }
+    ReleaseFrame(parser->frame);
+    release_frame_pool(parser->pool);
+    free(parser);
+}
 
-            size_t to_copy = ((jpeg_size - total_read) < available) ? (jpeg_size - total_read) : available;
+int FeedMJPEGParser(MJPEGParser* parser, const char* data, size_t len, MJPEGFrameCallback on_frame, void* user) {
+    if (parser->state == PARSE_FAILED) {
+        return 0;
+    }
 
-            memcpy(jpeg_data + total_read, stream->buffer + stream->buffer_pos, to_copy);
-            total_read += to_copy;
-            stream->buffer_pos += to_copy;
+    if (parser->state == PARSE_HTTP_HEADERS) {
+        size_t used;
+        int complete = collect_headers(parser, data, len, &used);
+        if (complete == 0) {
+            return 1;
+        }
+        if (complete < 0 || !process_response_headers(parser)) {
+            parser->state = PARSE_FAILED;
+            return 0;
         }
 
-        // Decode JPEG data
-        int jpegSubsamp, w, h;
+        parser->header_len = 0;
+        parser->state = PARSE_BOUNDARY;
+        data += used;
+        len -= used;
+    }
 
-        // Get the image dimensions first
-        if (tjDecompressHeader2(stream->tjInstance, jpeg_data, jpeg_size, &w, &h, &jpegSubsamp) < 0) {
-            // printf("Error decoding JPEG header: %s\n", tjGetErrorStr());
+    if (!parser->chunked) {
+        feed_multipart(parser, data, len, on_frame, user);
+        return 1;
+    }
 
-            // Debug dump
-            // FILE* fp = fopen("./bad_data7.bin", "wb");
-            // if (fp) {
-            //    fwrite(jpeg_data, 1, jpeg_size, fp);
-            //    fclose(fp);
-            //    printf("Dumped bad JPEG data to bad_data4.bin (%u bytes)\n", jpeg_size);
-            //}
+    while (len > 0) {
+        switch (parser->chunk_state) {
+        case CHUNK_SIZE: {
+            // Hex size, optional extensions, CRLF
+            const char* line_end = (const char*)memchr(data, '\n', len);
+            size_t used = line_end ? (size_t)(line_end - data) + 1 : len;
+            size_t space = sizeof(parser->chunk_line) - 1 - parser->chunk_line_len;
+            size_t copy = (used < space) ? used : space;
+
+            memcpy(parser->chunk_line + parser->chunk_line_len, data, copy);
+            parser->chunk_line_len += copy;
+            parser->chunk_line[parser->chunk_line_len] = '\0';
+            data += used;
+            len -= used;
+
+            if (line_end) {
+                parser->chunk_remaining = strtoul(parser->chunk_line, NULL, 16);
+                parser->chunk_line_len = 0;
+                if (parser->chunk_remaining == 0) {
+                    printf("MJPEGParser: stream ended\n");
+                    parser->state = PARSE_FAILED;
+                    return 0;
+                }
+                parser->chunk_state = CHUNK_DATA;
+            }
+            break;
+        }
 
-            free(jpeg_data);
-            return NULL;
+        case CHUNK_DATA: {
+            size_t used = (len < parser->chunk_remaining) ? len : parser->chunk_remaining;
+            feed_multipart(parser, data, used, on_frame, user);
+            data += used;
+            len -= used;
+            parser->chunk_remaining -= used;
+            if (parser->chunk_remaining == 0) {
+                parser->chunk_state = CHUNK_DATA_END;
+            }
+            break;
         }
 
-        // FILE* fp = fopen("./good_data.bin", "wb");
-        // if (fp) {
-        //     fwrite(jpeg_data, 1, jpeg_size, fp);
-        //     fclose(fp);
-        //     printf("Dumped bad JPEG data to bad_data4.bin (%u bytes)\n", jpeg_size);
-        // }
-        /*
-        // Allocate pixel buffer (RGBA format)
-        int* pixels = (int*)malloc(w * h * sizeof(int));
-        if (!pixels) {
-            free(jpeg_data);
-            printf("cant decode frame: cant allocate pixel buffer\n");
-            return NULL;
+        case CHUNK_DATA_END: {
+            const char* line_end = (const char*)memchr(data, '\n', len);
+            size_t used = line_end ? (size_t)(line_end - data) + 1 : len;
+            data += used;
+            len -= used;
+            if (line_end) {
+                parser->chunk_state = CHUNK_SIZE;
+            }
+            break;
         }
+        }
+    }
 
-        // Decode the JPEG
-        if (tjDecompress2(stream->tjInstance, jpeg_data, jpeg_size,
-                         (unsigned char*)pixels, w, w * 4, h, TJPF_RGBA, 0) < 0) {
-            free(jpeg_data);
-            free(pixels);
-            printf("Error decoding JPEG: %s\n", tjGetErrorStr());
-            return NULL;
+    return 1;
+}
+
+size_t GetParserBodyWindow(MJPEGParser* parser, unsigned char** dst) {
+    if (parser->state != PARSE_BODY) {
+        return 0;
+    }
+
+    size_t window = parser->body_remaining;
+    if (parser->chunked) {
+        if (parser->chunk_state != CHUNK_DATA) {
+            return 0;
+        }
+        if (parser->chunk_remaining < window) {
+            window = parser->chunk_remaining;
         }
+    }
 
-        free(jpeg_data);*/
+    *dst = parser->frame->data + parser->frame->size;
+    return window;
+}
 
-        // printf("Decoded %u %u jpeg. data size: %u\n", w, h, jpeg_size);
-        //  Set output parameters
-        *width = w;
-        *height = h;
-        *return_size = jpeg_size;
-        *timestamp = timestamp_read;
+void CommitParserBody(MJPEGParser* parser, size_t len, MJPEGFrameCallback on_frame, void* user) {
+    parser->frame->size += len;
+    parser->body_remaining -= len;
 
-        return jpeg_data;
-    } else {
-        // Original non-chunked code path
-        // Find Content-Type and Content-Length headers
-        char* content_type = NULL;
-        int content_length = -1;
-        char* headers_end = NULL;
-
-        while (1) {
-            if (stream->buffer_pos + 4 >= stream->buffer_len) {
-                if (!fill_buffer(stream)) {
-                    printf("cant decode frame: cant fill buffer(2)\n");
-                    return NULL;
-                }
-            }
+    if (parser->chunked) {
+        parser->chunk_remaining -= len;
+        if (parser->chunk_remaining == 0) {
+            parser->chunk_state = CHUNK_DATA_END;
+        }
+    }
 
-            headers_end = strstr(stream->buffer + stream->buffer_pos, "\r\n\r\n");
-            if (headers_end) {
-                *headers_end = '\0'; // Temporarily null-terminate for strstr
+    if (parser->body_remaining == 0) {
+        emit_frame(parser, PARSE_BOUNDARY, on_frame, user);
+    }
+}
 
-                char* content_type_header = strstr(stream->buffer + stream->buffer_pos, "Content-Type: image/jpeg");
-                char* content_length_header = strstr(stream->buffer + stream->buffer_pos, "Content-Length:");
-                char* timestamp_header = strstr(stream->buffer + stream->buffer_pos, "X-Timestamp:");
+int IsParserStreaming(const MJPEGParser* parser) {
+    return parser->state != PARSE_HTTP_HEADERS && parser->state != PARSE_FAILED;
+}
 
-                if (content_length_header) {
-                    content_length = atoi(content_length_header + 16);
-                }
+unsigned long GetParserErrorCount(const MJPEGParser* parser) {
+    return parser->error_count;
+}
 
-                if (timestamp_header) {
-                    // printf("Found timestamp: ");
-                    // printf(timestamp_header);
-                    // printf("\n");
-                    timestamp_read = atoll(timestamp_header + 13);
-                }
+int ParseStreamURL(const char* url, char* host, char* path, int* port) {
+    return parse_url(url, host, path, port);
+}
 
-                *headers_end = '\r'; // Restore the character
-                headers_end += 4;    // Move past \r\n\r\n
-                break;
-            }
+// Parser callback for the blocking API: queue the frame, dropping the oldest
+// if the caller has fallen behind
+void queue_ready_frame(MJPEGFrame* frame, void* user) {
+    MJPEGStream* stream = (MJPEGStream*)user;
 
-            if (!fill_buffer(stream)) {
-                printf("cant decode frame: cant fill buffer(3)\n");
-                return NULL;
-            }
-        }
+    if (stream->ready_count == MJPEG_READY_FRAMES) {
+        ReleaseFrame(stream->ready[0]);
+        memmove(stream->ready, stream->ready + 1, (MJPEG_READY_FRAMES - 1) * sizeof(MJPEGFrame*));
+        stream->ready_count--;
+    }
+    stream->ready[stream->ready_count++] = frame;
+}
 
-        // Update buffer position
-        stream->buffer_pos = headers_end - stream->buffer;
-
-        // Rest of the original function for non-chunked encoding
-        // [Original code for content_length > 0 and else blocks]
-        // ...
-
-        // Ensure we have the full JPEG data
-        unsigned char* jpeg_data = NULL;
-        if (content_length > 0) {
-            // Known content length
-            jpeg_data = (unsigned char*)malloc(content_length);
-            if (!jpeg_data) {
-                printf("cant decode frame: jpeg malloc null\n");
-                return NULL;
-            }
+// Receive once and run the data through the parser. JPEG bodies with a known
+// length are received straight into the frame.
+int read_stream(MJPEGStream* stream) {
+    unsigned char* window_data;
+    size_t window = GetParserBodyWindow(stream->parser, &window_data);
 
-            // Copy what we already have
-            size_t available = stream->buffer_len - stream->buffer_pos;
-            size_t to_copy = (available > content_length) ? content_length : available;
-            memcpy(jpeg_data, stream->buffer + stream->buffer_pos, to_copy);
-
-            // Read the rest if needed
-            size_t total_read = to_copy;
-            stream->buffer_pos += to_copy;
-
-            while (total_read < content_length) {
-                if (stream->buffer_pos >= stream->buffer_len) {
-                    if (!fill_buffer(stream)) {
-                        free(jpeg_data);
-                        printf("cant decode frame: cant fill buffer(4)\n");
-                        return NULL;
-                    }
-                }
+    if (window > 0) {
+        int received = recv(stream->sock, (char*)window_data, window > INT_MAX ? INT_MAX : (int)window, 0);
+        if (received <= 0) {
+            return 0;
+        }
+        CommitParserBody(stream->parser, (size_t)received, queue_ready_frame, stream);
+        return 1;
+    }
 
-                available = stream->buffer_len - stream->buffer_pos;
-                to_copy = ((content_length - total_read) < available) ? (content_length - total_read) : available;
+    int received = recv(stream->sock, stream->buffer, BUFFER_SIZE, 0);
+    if (received <= 0) {
+        return 0;
+    }
+    return FeedMJPEGParser(stream->parser, stream->buffer, (size_t)received, queue_ready_frame, stream);
+}
 
-                memcpy(jpeg_data + total_read, stream->buffer + stream->buffer_pos, to_copy);
-                total_read += to_copy;
-                stream->buffer_pos += to_copy;
-            }
-        } else {
-            // Unknown content length, read until next boundary
-            // This is less efficient but should work
-            size_t jpeg_buffer_size = 65536; // Initial size
-            size_t jpeg_size = 0;
-
-            jpeg_data = (unsigned char*)malloc(jpeg_buffer_size);
-            if (!jpeg_data) {
-                printf("cant decode frame: cant malloc jpeg data(2)\n");
-                return NULL;
-            }
+// Initialize stream and return handle
+MJPEGStream* GetStreamHandle(const char* url) {
+    printf("GetStreamHandle: Starting with URL: %s\n", url);
+    init_sockets();
 
-            while (1) {
-                // Look for next boundary
-                char* next_boundary = find_boundary(stream);
-                if (next_boundary) {
-                    // Found boundary, copy data up to boundary
-                    size_t to_copy = next_boundary - (stream->buffer + stream->buffer_pos);
-
-                    if (jpeg_size + to_copy > jpeg_buffer_size) {
-                        jpeg_buffer_size = jpeg_size + to_copy;
-                        jpeg_data = (unsigned char*)realloc(jpeg_data, jpeg_buffer_size);
-                        if (!jpeg_data) {
-                            printf("cant decode frame: cant malloc jpeg data(3)\n");
-                            return NULL;
-                        }
-                    }
-
-                    memcpy(jpeg_data + jpeg_size, stream->buffer + stream->buffer_pos, to_copy);
-                    jpeg_size += to_copy;
-                    stream->buffer_pos += to_copy;
-                    break;
-                }
+    MJPEGStream* stream = (MJPEGStream*)malloc(sizeof(MJPEGStream));
+    if (!stream) {
+        return NULL;
+    }
 
-                // No boundary found, copy everything and get more data
-                size_t to_copy = stream->buffer_len - stream->buffer_pos;
+    memset(stream, 0, sizeof(MJPEGStream));
+    stream->sock = SOCKET_INVALID;
 
-                if (jpeg_size + to_copy > jpeg_buffer_size) {
-                    jpeg_buffer_size = (jpeg_size + to_copy) * 2;
-                    jpeg_data = (unsigned char*)realloc(jpeg_data, jpeg_buffer_size);
-                    if (!jpeg_data) {
-                        printf("cant decode frame: cant malloc jpeg data (4)\n");
-                        return NULL;
-                    }
-                }
+    // Parse URL
+    if (!parse_url(url, stream->host, stream->path, &stream->port)) {
+        printf("ERROR: Failed to parse URL: %s\n", url);
+        CloseStream(stream);
+        return NULL;
+    }
+    printf("GetStreamHandle: URL parsed - Host: %s, Path: %s, Port: %d\n",
+           stream->host, stream->path, stream->port);
 
-                memcpy(jpeg_data + jpeg_size, stream->buffer + stream->buffer_pos, to_copy);
-                jpeg_size += to_copy;
-                stream->buffer_pos = stream->buffer_len;
+    stream->parser = CreateMJPEGParser();
+    if (!stream->parser) {
+        printf("ERROR: Failed to allocate MJPEG parser\n");
+        CloseStream(stream);
+        return NULL;
+    }
 
-                if (!fill_buffer(stream)) {
-                    free(jpeg_data);
-                    printf("cant decode frame: cant fill buffer(7)\n");
-                    return NULL;
-                }
-            }
+    // Connect to server
+    stream->sock = connect_to_server(stream->host, stream->port);
+    if (stream->sock == SOCKET_INVALID) {
+        printf("ERROR: Failed to connect to server\n");
+        CloseStream(stream);
+        return NULL;
+    }
 
-            content_length = (int)jpeg_size;
-        }
+    // A camera that lost power never closes the connection; time out the
+    // reads so DecodeSharedFrame() reports it instead of blocking forever
+#ifdef _WIN32
+    DWORD recv_timeout = MJPEG_RECV_TIMEOUT_MS;
+#else
+    struct timeval recv_timeout = { MJPEG_RECV_TIMEOUT_MS / 1000, (MJPEG_RECV_TIMEOUT_MS % 1000) * 1000 };
+#endif
+    setsockopt(stream->sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&recv_timeout, sizeof(recv_timeout));
 
-        // Decode JPEG data
-        int jpegSubsamp, w, h;
+    // Send HTTP request
+    char request[1024];
+    snprintf(request, sizeof(request),
+             "GET %s HTTP/1.1\r\n"
+             "Host: %s\r\n"
+             "Connection: keep-alive\r\n\r\n",
+             stream->path, stream->host);
 
-        // Get the image dimensions first
-        if (tjDecompressHeader2(stream->tjInstance, jpeg_data, content_length, &w, &h, &jpegSubsamp) < 0) {
-            // Dump the bad JPEG data to a file
-            // FILE* fp = fopen("./bad_data4.bin", "wb");
-            // if (fp) {
-            //    fwrite(jpeg_data, 1, content_length, fp);
-            //    fclose(fp);
-            //    printf("Dumped bad JPEG data to bad_data4.bin (%d bytes)\n", content_length);
-            //}
+    printf("GetStreamHandle: Sending HTTP request:\n%s\n", request);
+    send(stream->sock, request, (int)strlen(request), 0);
 
-            free(jpeg_data);
+    // Read until the parser has accepted the response headers
+    printf("GetStreamHandle: Reading HTTP response headers...\n");
+    while (!IsParserStreaming(stream->parser)) {
+        if (!read_stream(stream)) {
+            printf("ERROR: Failed to receive MJPEG response headers\n");
+            CloseStream(stream);
             return NULL;
         }
+    }
 
-        /*// Allocate pixel buffer (RGBA format)
-        int* pixels = (int*)malloc(w * h * sizeof(int));
-        if (!pixels) {
-            free(jpeg_data);
-            printf("cant decode frame: cant allocate pixel buffer\n");
-            return NULL;
+    printf("init tjpeg...\n");
+    // Initialize TurboJPEG decompressor
+    stream->tjInstance = tjInitDecompress();
+    if (!stream->tjInstance) {
+        printf("ERROR: Failed to initialize TurboJPEG decompressor\n");
+        CloseStream(stream);
+        return NULL;
+    }
+
+    printf("GetStreamHandle: Stream successfully initialized\n");
+    return stream;
+}
+
+// Read the next frame from the MJPEG stream into a pooled buffer
+MJPEGFrame* DecodeSharedFrame(MJPEGStream* stream) {
+    if (!stream || stream->sock == SOCKET_INVALID) {
+        printf("cant decode frame: invalid stream state!\n");
+        return NULL;
+    }
+
+    for (;;) {
+        while (stream->ready_count > 0) {
+            MJPEGFrame* frame = stream->ready[0];
+            memmove(stream->ready, stream->ready + 1, (stream->ready_count - 1) * sizeof(MJPEGFrame*));
+            stream->ready_count--;
+
+            // Validate the JPEG and get the image dimensions
+            int jpegSubsamp;
+            if (tjDecompressHeader2(stream->tjInstance, frame->data, (unsigned long)frame->size,
+                                    &frame->width, &frame->height, &jpegSubsamp)
+                < 0) {
+                stream->header_failures++;
+                ReleaseFrame(frame);
+                continue;
+            }
+            return frame;
         }
 
-        // Decode the JPEG
-        if (tjDecompress2(stream->tjInstance, jpeg_data, content_length,
-                         (unsigned char*)pixels, w, w * 4, h, TJPF_RGBA, 0) < 0) {
-            free(pixels);
-            free(pixels);
-            printf("Error decoding JPEG: %s\n", tjGetErrorStr());
+        if (!read_stream(stream)) {
+            printf("cant decode frame: connection lost\n");
             return NULL;
         }
+    }
+}
 
-        free(jpeg_data);*/
+void GetStreamErrorCounts(MJPEGStream* stream, unsigned long* parse_errors, unsigned long* header_failures) {
+    *parse_errors = GetParserErrorCount(stream->parser);
+    *header_failures = stream->header_failures;
+}
 
-        // Set output parameters
-        *width = w;
-        *height = h;
-        *return_size = content_length;
-        *timestamp = timestamp_read;
+// Decode a frame from the MJPEG stream into a caller-owned copy
+unsigned char* DecodeFrame(MJPEGStream* stream, int* width, int* height, uint64_t* timestamp, size_t* return_size) {
+    MJPEGFrame* frame = DecodeSharedFrame(stream);
+    if (!frame) {
+        return NULL;
+    }
 
-        return jpeg_data;
+    unsigned char* jpeg_data = (unsigned char*)malloc(frame->size);
+    if (jpeg_data) {
+        memcpy(jpeg_data, frame->data, frame->size);
+        *width = frame->width;
+        *height = frame->height;
+        *return_size = frame->size;
+        *timestamp = frame->timestamp;
+    } else {
+        printf("cant decode frame: jpeg malloc null\n");
     }
+
+    ReleaseFrame(frame);
+    return jpeg_data;
 }
 
-// Close the stream and free resources
+// Close the stream and free resources. Frames still held by consumers stay
+// valid until they are released.
 void CloseStream(MJPEGStream* stream) {
     if (stream) {
         if (stream->sock != SOCKET_INVALID) {
@@ -789,6 +981,11 @@ void CloseStream(MJPEGStream* stream) {
             tjDestroy(stream->tjInstance);
         }
 
+        for (size_t i = 0; i < stream->ready_count; i++) {
+            ReleaseFrame(stream->ready[i]);
+        }
+
+        DestroyMJPEGParser(stream->parser);
         free(stream);
     }
 
@@ -5,20 +5,62 @@
  * This header provides functions to connect to an HTTP MJPEG stream
  * and decode frames using libjpeg-turbo. It uses standard socket APIs
  * (Winsock on Windows, POSIX sockets on Linux/Unix).
+ *
+ * The blocking stream API is built on an incremental parser that can also be
+ * driven from non-blocking sockets (see StreamReactor).
  */
 
 #ifndef MJPEG_STREAM_H
 #define MJPEG_STREAM_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define MJPEG_MAX_URL_LEN 256 // Host and path buffers passed to ParseStreamURL()
+#define MJPEG_POOL_SIZE   16  // Pooled frames per stream; see the budget in stereo_sync.cpp
+
 /**
  * @brief Opaque handle for an MJPEG stream
  */
 typedef struct MJPEGStream MJPEGStream;
 
+typedef struct MJPEGFramePool MJPEGFramePool;
+
+/**
+ * @brief A reference-counted JPEG frame owned by a stream's frame pool
+ *
+ * The parser reads the JPEG bytes straight from the socket into data, so
+ * handing a frame to several consumers costs a RetainFrame() each instead of
+ * a copy. Frames return to the pool when the last reference is released and
+ * their storage is reused, so steady-state streaming does not allocate.
+ * All fields are read-only for consumers.
+ */
+typedef struct MJPEGFrame {
+    unsigned char* data; // JPEG bytes
+    size_t size;         // Number of valid bytes in data
+    int width;
+    int height;
+    uint64_t timestamp; // X-Timestamp header, 0 if the stream doesn't send one
+
+    // Equalized 8-bit grayscale plane at model resolution, decoded on the
+    // ingestion thread. NULL unless the stream's FrameBuffer has a target
+    // resolution or the decode failed.
+    unsigned char* plane;
+    int plane_width;
+    int plane_height;
+
+    // Internal
+    size_t capacity;
+    unsigned char* plane_storage;
+    size_t plane_capacity;
+    volatile long refcount;
+    MJPEGFramePool* pool; // NULL for overflow frames allocated when the pool is exhausted
+} MJPEGFrame;
+
 /**
  * @brief Connect to an MJPEG stream over HTTP
  *
@@ -33,11 +75,125 @@ MJPEGStream* GetStreamHandle(const char* url);
  * @param stream The stream handle obtained from GetStreamHandle()
  * @param width Pointer to an int that will receive the frame width
  * @param height Pointer to an int that will receive the frame height
- * @return int* Array of RGBA pixel data (4 bytes per pixel), or NULL on error.
+ * @param timestamp Pointer that will receive the X-Timestamp header (0 if absent)
+ * @param return_size Pointer that will receive the JPEG size in bytes
+ * @return unsigned char* A copy of the JPEG bytes, or NULL on error.
  *              The caller is responsible for freeing this memory with free().
+ *              Prefer DecodeSharedFrame(), which avoids the copy.
  */
 unsigned char* DecodeFrame(MJPEGStream* stream, int* width, int* height, uint64_t* timestamp, size_t* return_size);
 
+/**
+ * @brief Read the next frame into a pooled buffer without copying it
+ *
+ * @param stream The stream handle obtained from GetStreamHandle()
+ * @return MJPEGFrame* The frame with one reference held by the caller, or NULL
+ *                     if the connection was closed or went silent. Release it
+ *                     with ReleaseFrame().
+ */
+MJPEGFrame* DecodeSharedFrame(MJPEGStream* stream);
+
+/**
+ * @brief Get the number of bad parts skipped since the stream was opened
+ *
+ * @param parse_errors Receives the malformed multipart parts
+ * @param header_failures Receives the JPEGs rejected by tjDecompressHeader2
+ */
+void GetStreamErrorCounts(MJPEGStream* stream, unsigned long* parse_errors, unsigned long* header_failures);
+
+/**
+ * @brief Add a reference to a frame; safe to call from any thread
+ */
+void RetainFrame(MJPEGFrame* frame);
+
+/**
+ * @brief Drop a reference to a frame; safe to call from any thread and after
+ *        the stream has been closed. NULL is ignored.
+ */
+void ReleaseFrame(MJPEGFrame* frame);
+
+/**
+ * @brief Get storage for a frame's plane, kept with the pool slot like data
+ *
+ * Only for the thread that produced the frame, before it is shared. The
+ * plane stays NULL until the caller has filled the storage and set plane,
+ * plane_width and plane_height.
+ *
+ * @return unsigned char* width * height bytes, or NULL if allocation failed
+ */
+unsigned char* ReserveFramePlane(MJPEGFrame* frame, int width, int height);
+
+/**
+ * @brief Opaque incremental parser for one multipart/x-mixed-replace response
+ *
+ * The parser does no I/O. Bytes are fed in as they arrive, in pieces of any
+ * size, so one thread can drive many non-blocking sockets. It handles the
+ * HTTP response headers, chunked transfer encoding and parts with or without
+ * Content-Length, and resynchronizes on the next boundary after a bad part.
+ * A parser must only be fed from one thread at a time.
+ */
+typedef struct MJPEGParser MJPEGParser;
+
+/**
+ * @brief Receives each complete JPEG from a parser
+ *
+ * The callback takes over the caller's reference and must release the frame.
+ * Width and height are 0: the JPEG has not been validated yet.
+ */
+typedef void (*MJPEGFrameCallback)(MJPEGFrame* frame, void* user);
+
+/**
+ * @brief Create a parser expecting the HTTP response headers first
+ */
+MJPEGParser* CreateMJPEGParser(void);
+
+/**
+ * @brief Free a parser. Frames already handed out stay valid until released.
+ */
+void DestroyMJPEGParser(MJPEGParser* parser);
+
+/**
+ * @brief Run received bytes through the parser
+ *
+ * @param on_frame Called for every frame completed by these bytes
+ * @return int 0 if the response is not an MJPEG stream or the stream ended
+ */
+int FeedMJPEGParser(MJPEGParser* parser, const char* data, size_t len, MJPEGFrameCallback on_frame, void* user);
+
+/**
+ * @brief Get where the rest of the current JPEG body goes, so it can be
+ *        received straight into the frame instead of through a buffer
+ *
+ * @param dst Receives the write position inside the current frame
+ * @return size_t Bytes that may be written at dst, 0 if the parser needs
+ *                data through FeedMJPEGParser() instead
+ */
+size_t GetParserBodyWindow(MJPEGParser* parser, unsigned char** dst);
+
+/**
+ * @brief Account for len bytes written into the body window
+ */
+void CommitParserBody(MJPEGParser* parser, size_t len, MJPEGFrameCallback on_frame, void* user);
+
+/**
+ * @brief Whether the response headers were accepted and parts are being parsed
+ */
+int IsParserStreaming(const MJPEGParser* parser);
+
+/**
+ * @brief Number of malformed parts skipped so far
+ */
+unsigned long GetParserErrorCount(const MJPEGParser* parser);
+
+/**
+ * @brief Split an http:// URL into host, path and port
+ *
+ * @param host Buffer of MJPEG_MAX_URL_LEN bytes
+ * @param path Buffer of MJPEG_MAX_URL_LEN bytes
+ * @return int 0 if the URL is not http://
+ */
+int ParseStreamURL(const char* url, char* host, char* path, int* port);
+
 /**
  * @brief Close the stream and free all associated resources
  *
@@ -0,0 +1,64 @@
+#include "label_ranges.h"
+#include "flags.h"
+
+#include <cmath>
+#include <cstdio>
+
+std::vector<const AlignedFrame*> selectSequenceLabels(const std::vector<AlignedFrame>& frames, size_t sequenceFrames) {
+    std::vector<const AlignedFrame*> labels;
+    if (sequenceFrames == 0) {
+        return labels;
+    }
+
+    for (size_t i = sequenceFrames - 1; i < frames.size(); i++) {
+        if (std::get<11>(frames[i].label_data) & FLAG_GOOD_DATA) {
+            labels.push_back(&frames[i]);
+        }
+    }
+    return labels;
+}
+
+LabelRanges calculateLabelRanges(const std::vector<const AlignedFrame*>& labels) {
+    printf("Calculating dynamic label ranges from dataset...\n");
+
+    if (labels.empty()) {
+        printf("Warning: No valid labels found for range calculation!\n");
+        return { -32.0f, 32.0f, 64.0f, -32.0f, 32.0f, 64.0f, 1.0f };
+    }
+
+    LabelRanges ranges;
+    ranges.pitch_min = ranges.pitch_max = std::get<0>(labels[0]->label_data);
+    ranges.yaw_min = ranges.yaw_max = std::get<1>(labels[0]->label_data);
+    ranges.convergence_max = std::get<2>(labels[0]->label_data);
+    for (const AlignedFrame* label : labels) {
+        const float pitch = std::get<0>(label->label_data);
+        const float yaw = std::get<1>(label->label_data);
+        ranges.pitch_min = std::min(ranges.pitch_min, pitch);
+        ranges.pitch_max = std::max(ranges.pitch_max, pitch);
+        ranges.yaw_min = std::min(ranges.yaw_min, yaw);
+        ranges.yaw_max = std::max(ranges.yaw_max, yaw);
+        ranges.convergence_max = std::max(ranges.convergence_max, std::get<2>(label->label_data));
+    }
+
+    // Calculate symmetric ranges (matching trainerte2.py logic)
+    float pitch_abs_max = std::max(std::abs(ranges.pitch_min), std::abs(ranges.pitch_max));
+    float yaw_abs_max = std::max(std::abs(ranges.yaw_min), std::abs(ranges.yaw_max));
+
+    ranges.pitch_range = 2.0f * pitch_abs_max;
+    ranges.yaw_range = 2.0f * yaw_abs_max;
+
+    // Guard against degenerate case
+    if (ranges.pitch_range < 1e-6f)
+        ranges.pitch_range = 1e-6f;
+    if (ranges.yaw_range < 1e-6f)
+        ranges.yaw_range = 1e-6f;
+    if (ranges.convergence_max < 1e-6f)
+        ranges.convergence_max = 1e-6f;
+
+    printf("Dynamic ranges calculated:\n");
+    printf("  Pitch: [%.3f, %.3f] range=%.3f\n", ranges.pitch_min, ranges.pitch_max, ranges.pitch_range);
+    printf("  Yaw: [%.3f, %.3f] range=%.3f\n", ranges.yaw_min, ranges.yaw_max, ranges.yaw_range);
+    printf("  Convergence max: %.3f\n", ranges.convergence_max);
+
+    return ranges;
+}
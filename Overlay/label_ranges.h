@@ -0,0 +1,43 @@
+#ifndef LABEL_RANGES_H
+#define LABEL_RANGES_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "capture_reader.h"
+
+/**
+ * @brief Label normalization of a training run
+ *
+ * The trainer maps pitch to (pitch - pitchOffset()) / pitch_range before
+ * training, yaw likewise, and divides convergence by convergence_max.
+ * Anything that maps the model's output back to degrees has to use the
+ * ranges of the same frames, so both compute them with the functions below.
+ */
+struct LabelRanges {
+    float pitch_min, pitch_max, pitch_range;
+    float yaw_min, yaw_max, yaw_range;
+    float convergence_max;
+
+    float pitchOffset() const {
+        return std::min(-pitch_max, pitch_min);
+    }
+    float yawOffset() const {
+        return std::min(-yaw_max, yaw_min);
+    }
+};
+
+/**
+ * @brief The frames the trainer takes its labels from
+ *
+ * A training sequence is sequenceFrames consecutive frames whose last one
+ * has FLAG_GOOD_DATA; its label is that last frame's. Returns the last
+ * frame of every such sequence, oldest first.
+ */
+std::vector<const AlignedFrame*> selectSequenceLabels(const std::vector<AlignedFrame>& frames, size_t sequenceFrames);
+
+// Ranges of the given labels, symmetric around zero (matching trainerte2.py); defaults if there are none
+LabelRanges calculateLabelRanges(const std::vector<const AlignedFrame*>& labels);
+
+#endif // LABEL_RANGES_H
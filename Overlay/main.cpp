@@ -7,9 +7,11 @@
 #pragma comment(lib, "ws2_32.lib")
 #endif
 
+#include <atomic>
 #include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -23,14 +25,22 @@
 #include <openvr.h>
 
 #include "capture_data.h"
+#include "capture_scheduler.h"
+#include "capture_writer.h"
 #include "config.h"
 #include "dashboard_ui.h"
 #include "flags.h"
 #include "frame_buffer.h"
+#include "inference_engine.h"
+#include "job_scheduler.h"
+#include "jpeg_stream.h"
 #include "math_utils.h"
+#include "mjpeg_broadcaster.h"
 #include "numpy_io.h"
 #include "overlay_manager.h"
 #include "rest_server.h"
+#include "stereo_sync.h"
+#include "stream_reactor.h"
 #include "trainer_wrapper.h"
 #include <fstream>
 #include <memory>
@@ -38,55 +48,11 @@
 
 #ifdef _WIN32
 #include <windows.h>
-typedef HANDLE FileHandle;
-#define INVALID_HANDLE INVALID_HANDLE_VALUE
 #else
 #include <fcntl.h>
 #include <unistd.h>
-typedef int FileHandle;
-#define INVALID_HANDLE -1
 #endif
 
-FileHandle openCaptureFile(const char* filename) {
-#ifdef _WIN32
-    return CreateFileA(
-        filename,
-        GENERIC_WRITE,
-        0,
-        NULL,
-        CREATE_ALWAYS,
-        FILE_ATTRIBUTE_NORMAL,
-        NULL);
-#else
-    return open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-#endif
-}
-
-bool writeCaptureFrame(FileHandle handle, const void* data, size_t size) {
-#ifdef _WIN32
-    DWORD bytesWritten;
-    return WriteFile(handle, data, (DWORD)size, &bytesWritten, NULL) && bytesWritten == size;
-#else
-    return write(handle, data, size) == size;
-#endif
-}
-
-void closeCaptureFile(FileHandle handle) {
-#ifdef _WIN32
-    CloseHandle(handle);
-#else
-    close(handle);
-#endif
-}
-
-bool isValidHandle(FileHandle handle) {
-#ifdef _WIN32
-    return handle != INVALID_HANDLE_VALUE;
-#else
-    return handle != -1;
-#endif
-}
-
 bool saveJpeg(const char* filename, const int* image, int width, int height, int quality = 90) {
     if (!image || width <= 0 || height <= 0) {
         printf("ERROR: Invalid image parameters: image=%p, width=%d, height=%d\n",
@@ -159,14 +125,17 @@ bool saveJpeg(const char* filename, const int* image, int width, int height, int
 // Global variables
 bool g_bProgramRunning = true;
 OverlayManager g_OverlayManager;
+std::atomic<OverlayManager*> g_CalibrationOverlay(&g_OverlayManager); // Owner of the routine being run; main's overlay once it exists
 float g_fTargetYawOffset = 0.0f;   // Current yaw offset of target from center
 float g_fTargetPitchOffset = 0.0f; // Current pitch offset of target from center
 bool g_bTargetLocked = false;      // Whether the target position is locked
-bool g_Recording = false;          // is recording data
-bool g_runningCalibration = false;
-bool g_isTrained = false;
+// Flags shared with the REST handlers and the trainer's thread
+std::atomic<bool> g_Recording(false); // is recording data
+std::atomic<bool> g_runningCalibration(false);
+std::atomic<bool> g_isTrained(false);
 DashboardUI g_DashboardUI;
 TrainerWrapper g_Trainer;
+InferenceEngine g_InferenceEngine;
 int g_currentFlags = 0;
 
 // Global training progress display (set by subprocess thread, used by main thread)
@@ -174,11 +143,15 @@ std::string g_trainingProgressDisplay = "";
 std::vector<float> g_trainingLossHistory;
 bool g_hasTrainingUpdate = false;
 
-bool g_PreviewRunning = false;
+std::atomic<bool> g_PreviewRunning(false);
 std::string g_PreviewModelPath;
 std::thread g_PreviewThread;
+std::atomic<bool> g_StopPreviewThread(false);
+
+// Calibration requested over REST; the main loop starts it, since it's the one stepping the routine
+std::mutex g_calibrationMutex; // Guards g_outputModelPath and g_pendingRoutine
 std::string g_outputModelPath;
-bool g_StopPreviewThread = false;
+int g_pendingRoutine = -1; // Routine to start, -1 for none
 
 // Function prototypes
 void ProcessKeyboardInput();
@@ -251,33 +224,32 @@ void initEyeConnections(FrameBuffer* frameBufferLeft, FrameBuffer* frameBufferRi
     frameBufferRight->start();
 
     // keep waiting until both streams have valid image data
-    while (true) {
-        int width, height;
-        uint64_t time;
-        size_t size;
-        unsigned char* image = frameBufferLeft->getFrameCopy(&width, &height, &time, &size);
-        if (width < 1 || height < 1) {
-            printf("Waiting for valid image data from both eyes...\n");
-            Sleep(1000); /* TODO: universal sleep (this is windows.h) */
-            free(image);
-            continue;
-        }
-        free(image);
-
-        image = frameBufferRight->getFrameCopy(&width, &height, &time, &size);
-        if (width < 1 || height < 1) {
+    FrameBuffer* buffers[2] = { frameBufferLeft, frameBufferRight };
+    for (FrameBuffer* buffer : buffers) {
+        MJPEGFrame* frame;
+        while (!(frame = buffer->waitForFrame(0, 1000))) {
             printf("Waiting for valid image data from both eyes...\n");
-            Sleep(1000); /* TODO: universal sleep (this is windows.h) */
-            free(image);
-            continue;
         }
-        free(image);
-
-        break;
+        ReleaseFrame(frame);
     }
     printf("Eye streams started up!\n");
 }
 
+// JSON object for one eye's stream health, used by /stream_health
+std::string streamHealthJson(const StreamHealth& health) {
+    return "{\"connected\":" + std::string(health.connected ? "true" : "false") + ", \"fps\":" + std::to_string(health.fps) + ", \"jitterMs\":" + std::to_string(health.jitterMs) + ", \"bytesPerSec\":" + std::to_string(health.bytesPerSec) + ", \"frames\":" + std::to_string(health.frames) + ", \"parseErrors\":" + std::to_string(health.parseErrors) + ", \"headerFailures\":" + std::to_string(health.headerFailures) + ", \"reconnects\":" + std::to_string(health.reconnects) + ", \"lastFrameAgeMs\":" + std::to_string(health.lastFrameAgeMs) + "}";
+}
+
+// One Server-Sent Event for the /events stream
+std::shared_ptr<const std::string> sseEvent(const char* event, const std::string& json) {
+    return std::make_shared<const std::string>(std::string("event: ") + event + "\ndata: " + json + "\n\n");
+}
+
+// JSON object for a trainer progress update, sent as the "training" event
+std::string trainingProgressJson(const TrainerProgress& progress) {
+    return "{\"training\":" + std::string(progress.isTraining ? "true" : "false") + ", \"complete\":" + std::string(progress.isComplete ? "true" : "false") + ", \"error\":" + std::string(progress.hasError ? "true" : "false") + ", \"epoch\":" + std::to_string(progress.currentEpoch) + ", \"totalEpochs\":" + std::to_string(progress.totalEpochs) + ", \"batch\":" + std::to_string(progress.currentBatch) + ", \"totalBatches\":" + std::to_string(progress.totalBatches) + ", \"loss\":" + std::to_string(progress.currentLoss) + ", \"epochAverageLoss\":" + std::to_string(progress.epochAverageLoss) + "}";
+}
+
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -353,18 +325,64 @@ int main(int argc, char* argv[]) {
     // initialize rest server
     HTTPServer server(23950);
 
-    FrameBuffer frameBufferLeft(128, 128, 30);
-    FrameBuffer frameBufferRight(128, 128, 30);
+    // one I/O thread reads both eye streams; declared first so it outlives the frame buffers
+    StreamReactor streamReactor;
+    streamReactor.start();
+
+    // --model-planes decodes reduced planes on the ingestion thread for inference.
+    // Off by default: they come from the DCT-downscaled luma, so the tensors
+    // don't bit-match the PreprocessEyeImage path the model was trained on
+    bool modelPlanes = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--model-planes") == 0) {
+            modelPlanes = true;
+        }
+    }
+
+    const int planeSize = modelPlanes ? PREPROCESS_RESOLUTION : 0;
+    FrameBuffer frameBufferLeft(planeSize, planeSize, 30);
+    FrameBuffer frameBufferRight(planeSize, planeSize, 30);
+    frameBufferLeft.setReactor(&streamReactor);
+    frameBufferRight.setReactor(&streamReactor);
+
+    // --frame-ring shares the eye frames with other local processes (frame_ring.h)
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frame-ring") == 0) {
+            if (!frameBufferLeft.setFrameRing("baballs_left") || !frameBufferRight.setFrameRing("baballs_right")) {
+                printf("WARNING: --frame-ring: couldn't set up the shared-memory frame rings, frames won't be shared\n");
+            }
+        }
+    }
+
+    // pairs left and right frames by X-Timestamp for capture and inference
+    StereoSynchronizer stereoSync(&frameBufferLeft, &frameBufferRight);
+
+    // writes calibration samples on its own thread so disk stalls don't reach the overlay
+    CaptureWriter captureWriter;
+
+    // one record per new stereo pair, labeled with the routine state at the pair's timestamp
+    CaptureScheduler captureScheduler(&stereoSync, &captureWriter, current_time_ms);
+
+    // camera previews as MJPEG, re-served from the frames already received, for any number of viewers
+    MJPEGBroadcaster previewLeft(&server, &frameBufferLeft, "/preview/left");
+    MJPEGBroadcaster previewRight(&server, &frameBufferRight, "/preview/right");
+
+    // Server-Sent Events: "routine" when the calibration step changes, "training" per trainer update, "trained" when done
+    server.register_stream("/events", "text/event-stream");
+
+    // training jobs submitted for other headsets (/submit_job), run side by side within the machine's threads
+    JobScheduler jobScheduler(&server, "job_queue.txt", 0, "/events");
 
     // returns the status of the current calibration. if status=complete, you can use the checkpoint at the path specified in /start_calibration
     server.register_handler("/status", [](const std::unordered_map<std::string, std::string>& params) {
-        std::string sRunning = std::to_string(g_runningCalibration);
-        std::string sRecording = std::to_string(g_Recording);
+        std::string sRunning = std::to_string(g_runningCalibration.load());
+        std::string sRecording = std::to_string(g_Recording.load());
 
-        std::string sIsCalibrationComplete = std::to_string(g_OverlayManager.g_routineController.isComplete() && g_isTrained);
-        std::string sCurrentOpIndex = std::to_string(g_OverlayManager.g_routineController.getCurrentOperationIndex());
-        std::string sMaxOpIndex = std::to_string(g_OverlayManager.g_routineController.getTotalOperationCount());
-        std::string sIstrained = std::to_string(g_isTrained);
+        const RoutineController& routine = g_CalibrationOverlay.load()->g_routineController;
+        std::string sIsCalibrationComplete = std::to_string(routine.isComplete() && g_isTrained.load());
+        std::string sCurrentOpIndex = std::to_string(routine.getCurrentOperationIndex());
+        std::string sMaxOpIndex = std::to_string(routine.getTotalOperationCount());
+        std::string sIstrained = std::to_string(g_isTrained.load());
 
         return "{\"result\":\"ok\", \"running\":\"" + sRunning + "\", \"recording\":\"" + sRecording + "\", \"calibrationComplete\":\"" + sIsCalibrationComplete + "\", \"isTrained\":\"" + sIstrained + "\", \"currentIndex\":" + sCurrentOpIndex + ", \"maxIndex\":" + sMaxOpIndex + "}";
     });
@@ -387,7 +405,7 @@ int main(int argc, char* argv[]) {
         return "{\"result\":\"ok\"}";
     });
 
-    server.register_handler("/start_cameras", [&frameBufferLeft, &frameBufferRight](const std::unordered_map<std::string, std::string>& params) {
+    server.register_handler("/start_cameras", [&frameBufferLeft, &frameBufferRight, &stereoSync](const std::unordered_map<std::string, std::string>& params) {
         printf("Got start_cameras\n");
         int width, height;
         printf("Param counts: %zi %zi\n", params.count("left"), params.count("right"));
@@ -404,6 +422,7 @@ int main(int argc, char* argv[]) {
             printf("Init eye connection...\n");
 
             initEyeConnections(&frameBufferLeft, &frameBufferRight);
+            stereoSync.start();
 
             printf("Get frame copy...\n");
             uint64_t time;
@@ -425,30 +444,28 @@ int main(int argc, char* argv[]) {
             return "{\"result\":\"error\", \"message\":\"please specify a routine_id and onnx_filename\"}";
         }
 
-        std::string decodedPath = params.at("onnx_filename");
-        size_t pos = 0;
-        while ((pos = decodedPath.find('%', pos)) != std::string::npos) {
-            if (pos + 2 < decodedPath.length()) {
-                int hexValue;
-                std::istringstream iss(decodedPath.substr(pos + 1, 2));
-                iss >> std::hex >> hexValue;
-                decodedPath.replace(pos, 3, 1, static_cast<char>(hexValue));
-            } else {
-                break;
-            }
-        }
+        std::string decodedPath = urlDecode(params.at("onnx_filename"));
 
         printf("Starting calibration with routine ID %s and model path %s\n", params.at("routine_id").c_str(), decodedPath.c_str());
 
-        g_outputModelPath = decodedPath;
-
-        g_OverlayManager.StartRoutine((uint32_t)std::stoi(params.at("routine_id")));
-
-        g_runningCalibration = true;
-        g_Recording = true;
+        int routineId = std::stoi(params.at("routine_id"));
+        {
+            std::lock_guard<std::mutex> lock(g_calibrationMutex);
+            g_outputModelPath = decodedPath;
+            g_pendingRoutine = routineId;
+        }
         return "{\"result\":\"ok\"}";
     });
 
+    // kills the trainer started at the end of a calibration
+    server.register_handler("/stop_training", [](const std::unordered_map<std::string, std::string>& params) {
+        if (g_Trainer.cancel()) {
+            return "{\"result\":\"ok\", \"message\":\"Training stopped\"}";
+        } else {
+            return "{\"result\":\"ok\", \"message\":\"No training was running\"}";
+        }
+    });
+
     server.register_handler("/stop_preview", [](const std::unordered_map<std::string, std::string>& params) {
         if (g_PreviewRunning) {
             g_StopPreviewThread = true;
@@ -463,6 +480,67 @@ int main(int argc, char* argv[]) {
         }
     });
 
+    // runs the trained model natively on the camera streams. onnx_filename defaults to the last calibration output
+    server.register_handler("/start_inference", [&stereoSync](const std::unordered_map<std::string, std::string>& params) {
+        std::string modelPath;
+        if (params.count("onnx_filename")) {
+            modelPath = urlDecode(params.at("onnx_filename"));
+        } else {
+            std::lock_guard<std::mutex> lock(g_calibrationMutex);
+            modelPath = g_outputModelPath;
+        }
+        if (modelPath.empty()) {
+            return std::string("{\"result\":\"error\", \"message\":\"please specify an onnx_filename\"}");
+        }
+
+        g_InferenceEngine.stop();
+        if (!g_InferenceEngine.loadModel(modelPath)) {
+            return std::string("{\"result\":\"error\", \"message\":\"failed to load model\"}");
+        }
+        if (!g_InferenceEngine.start(&stereoSync)) {
+            return std::string("{\"result\":\"error\", \"message\":\"failed to start inference\"}");
+        }
+        return std::string("{\"result\":\"ok\"}");
+    });
+
+    server.register_handler("/stop_inference", [](const std::unordered_map<std::string, std::string>& params) {
+        g_InferenceEngine.stop();
+        return "{\"result\":\"ok\"}";
+    });
+
+    // latest native inference result. The endpoints from here on only read thread-safe
+    // stats, so they're registered as concurrent and answer while a slow handler runs
+    server.register_handler("/inference", [](const std::unordered_map<std::string, std::string>& params) {
+        InferenceResult result;
+        if (!g_InferenceEngine.getLatestResult(&result)) {
+            return std::string("{\"result\":\"error\", \"message\":\"no inference result available\"}");
+        }
+
+        return "{\"result\":\"ok\", \"pitch\":" + std::to_string(result.pitch) + ", \"yaw\":" + std::to_string(result.yaw) + ", \"convergence\":" + std::to_string(result.convergence) + ", \"sequence\":" + std::to_string(result.sequence) + ", \"processingMs\":" + std::to_string(result.processingMs) + "}";
+    }, true);
+
+    // stereo pairing statistics; optional tolerance_ms sets the max left/right timestamp difference
+    server.register_handler("/stereo_sync", [&stereoSync](const std::unordered_map<std::string, std::string>& params) {
+        if (params.count("tolerance_ms")) {
+            stereoSync.setTolerance(std::stoull(params.at("tolerance_ms")));
+        }
+
+        StereoSyncStats stats = stereoSync.getStats();
+        return "{\"result\":\"ok\", \"toleranceMs\":" + std::to_string(stereoSync.getTolerance()) + ", \"pairs\":" + std::to_string(stats.pairs) + ", \"droppedLeft\":" + std::to_string(stats.droppedLeft) + ", \"droppedRight\":" + std::to_string(stats.droppedRight) + ", \"lastSkewMs\":" + std::to_string(stats.lastSkewMs) + ", \"maxAbsSkewMs\":" + std::to_string(stats.maxAbsSkewMs) + ", \"meanAbsSkewMs\":" + std::to_string(stats.meanAbsSkewMs) + "}";
+    }, true);
+
+    // per-eye camera stream health, to spot a degraded camera before starting a calibration
+    server.register_handler("/stream_health", [&frameBufferLeft, &frameBufferRight](const std::unordered_map<std::string, std::string>& params) {
+        return "{\"result\":\"ok\", \"left\":" + streamHealthJson(frameBufferLeft.getHealth()) + ", \"right\":" + streamHealthJson(frameBufferRight.getHealth()) + "}";
+    }, true);
+
+    // capture writer queue depth and drops; drops mean samples are missing from the training data
+    server.register_handler("/capture_stats", [&captureWriter, &captureScheduler](const std::unordered_map<std::string, std::string>& params) {
+        CaptureWriterStats stats = captureWriter.getStats();
+        CaptureSchedulerStats schedule = captureScheduler.getStats();
+        return "{\"result\":\"ok\", \"pairs\":" + std::to_string(schedule.pairs) + ", \"unlabeled\":" + std::to_string(schedule.unlabeled) + ", \"arrivalTime\":" + std::to_string(schedule.arrivalTime) + ", \"queueDepth\":" + std::to_string(stats.queueDepth) + ", \"maxQueueDepth\":" + std::to_string(stats.maxQueueDepth) + ", \"records\":" + std::to_string(stats.records) + ", \"bytes\":" + std::to_string(stats.bytes) + ", \"dropped\":" + std::to_string(stats.dropped) + ", \"writeErrors\":" + std::to_string(stats.writeErrors) + ", \"failed\":" + std::string(stats.failed ? "true" : "false") + ", \"syncs\":" + std::to_string(stats.syncs) + , \"deduplicated\":" + std::to_string(stats.deduplicated) + ", \"references\":" + std::to_string(schedule.references) + ", \"unresolved\":" + std::to_string(stats.unresolved) + "}";
+    }, true);
+
     server.register_post_handler("/start_calibration_json", [](const auto& params, const std::string& body) {
         // Process POST request with body
 
@@ -478,6 +556,9 @@ int main(int argc, char* argv[]) {
     });
 
     server.start();
+    previewLeft.start();
+    previewRight.start();
+    jobScheduler.start();
 
     // Sleep(1000000);
 
@@ -551,6 +632,10 @@ int main(int argc, char* argv[]) {
 
     printf("Overlay initialized successfully\n");
 
+    // The calibration routine is stepped by this overlay, so it's the one the endpoints control
+    RoutineController& routine = overlayManager.g_routineController;
+    g_CalibrationOverlay = &overlayManager;
+
     if (!g_DashboardUI.Initialize()) {
         printf("ERROR: Failed to initialize dashboard UI\n");
         // Continue anyway, as this is not critical
@@ -588,11 +673,13 @@ int main(int argc, char* argv[]) {
 
     const char* filename = "user_cal.bin";
 
-    FileHandle captureFile = openCaptureFile(filename);
-    if (!isValidHandle(captureFile)) {
+    if (!captureWriter.open(filename)) {
         printf("ERROR: Failed to open capture file!\n");
+        server.stop();
+        g_CalibrationOverlay = &g_OverlayManager;
         return -1;
     }
+    captureScheduler.start();
 
     // Main application loop
     CaptureFrame frame;
@@ -604,6 +691,7 @@ int main(int argc, char* argv[]) {
     overlayManager.LoadVideo("./video.bin");
 
     int lastStage = -1;
+    std::string lastRoutineJson;
 
     while (!bQuit) {
         // Process SteamVR events
@@ -619,6 +707,19 @@ int main(int argc, char* argv[]) {
             }
         }
 
+        // Start a calibration requested over REST
+        int pendingRoutine;
+        {
+            std::lock_guard<std::mutex> lock(g_calibrationMutex);
+            pendingRoutine = g_pendingRoutine;
+            g_pendingRoutine = -1;
+        }
+        if (pendingRoutine >= 0) {
+            overlayManager.StartRoutine((uint32_t)pendingRoutine);
+            g_runningCalibration = true;
+            g_Recording = true;
+        }
+
         if (g_runningCalibration || g_PreviewRunning || g_Trainer.isRunning()) {
             overlayManager.Update();
         }
@@ -646,15 +747,15 @@ int main(int argc, char* argv[]) {
         frame.rightEyePitch = 0.0f;
         frame.rightEyeYaw = 0.0f;
 
-        if (lastStage != RoutineController::m_routineStage) {
-            printf("Routine stage changed: %d -> %d\n", lastStage, RoutineController::m_routineStage);
-            lastStage = RoutineController::m_routineStage;
+        if (lastStage != routine.getRoutineStage()) {
+            printf("Routine stage changed: %d -> %d\n", lastStage, routine.getRoutineStage());
+            lastStage = routine.getRoutineStage();
         }
         // printf("DEBUG: Current routine stage = %d\n", RoutineController::m_routineStage);
-        switch (RoutineController::m_routineStage) {
+        switch (routine.getRoutineStage()) {
         case 0: // pre-calibration stage
         default:
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             sprintf(str, "   ~~ Gaze Calibration ~~ \n\nDuring this first stage of calibration, follow the dot with your eyes and move your head around as shown in the video.\n\nCalibration will start in %d seconds, and takes about two minutes.", remTime);
             overlayManager.SetDisplayString(str);
             overlayManager.HideTargetCrosshair();
@@ -666,8 +767,7 @@ int main(int argc, char* argv[]) {
         case 2: // scan up-down
             // hack
             printf("\n\nSwapping to fixed position\n\n");
-            RoutineController::m_routineStage = 3;
-            RoutineController::m_stageStartTime = RoutineController::m_globalAdvancedTime;
+            routine.jumpToStage(3);
 
             goodData = false;
             overlayManager.SetDisplayString(NULL); // HACK! Todo: only call once!
@@ -676,7 +776,7 @@ int main(int argc, char* argv[]) {
             // overlayManager.ShowTargetCrosshair();
             break;
         case 3: // notify of closed eyes
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             sprintf(str, "   ~~ Eyelid Calibration ~~ \n\nCountdown: %d seconds!\n\nWhen the countdown finishes, close both your eyes for 5 seconds.", remTime);
             overlayManager.SetDisplayString(str);
             overlayManager.HideTargetCrosshair();
@@ -689,7 +789,7 @@ int main(int argc, char* argv[]) {
             frame.routineRightLid = 1.0f; // Fully closed
             break;
         case 5: // notify of half closed eyes
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             sprintf(str, "   ~~ Eyelid Calibration ~~ \n\nCountdown: %d seconds!\n\nWhen the countdown finishes, do bedroom eyes for 5 seconds (eyes half closed).\nLook straight forward at the crosshair.", remTime);
             overlayManager.SetDisplayString(str);
             overlayManager.ShowTargetCrosshair();
@@ -703,7 +803,7 @@ int main(int argc, char* argv[]) {
             // frame.routineSquint = 0.5f;   // Squinting
             break;
         case 7: // notify of wink left
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             sprintf(str, "   ~~ Eyelid Calibration ~~ \n\nCountdown: %d seconds!\n\nWhen the countdown finishes, close your left eye for 5 seconds.\nLook straight forward at the crosshair.", remTime);
             overlayManager.SetDisplayString(str);
             overlayManager.ShowTargetCrosshair();
@@ -716,7 +816,7 @@ int main(int argc, char* argv[]) {
             frame.routineRightLid = 0.0f; // Right eye open
             break;
         case 9: // notify of wink right
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             sprintf(str, "   ~~ Eyelid Calibration ~~ \n\nCountdown: %d seconds!\n\nWhen the countdown finishes, close your right eye for 5 seconds.\nLook straight forward at the crosshair.", remTime);
             overlayManager.SetDisplayString(str);
             overlayManager.ShowTargetCrosshair();
@@ -729,7 +829,7 @@ int main(int argc, char* argv[]) {
             frame.routineRightLid = 1.0f; // Right eye closed
             break;
         case 11: // notify of eye widen
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             sprintf(str, "   ~~ Eyelid Calibration ~~ \n\nCountdown: %d seconds!\n\nWhen the countdown finishes, widen your eyes for 5 seconds.\n(Surprise face!)\nLook straight forward at the crosshair.", remTime);
             overlayManager.SetDisplayString(str);
             overlayManager.ShowTargetCrosshair();
@@ -741,7 +841,7 @@ int main(int argc, char* argv[]) {
             frame.routineWiden = 1.0f; // Raise eyebrows for surprise
             break;
         case 13: // notify of eye angry
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             sprintf(str, "   ~~ Eyelid Calibration ~~ \n\nCountdown: %d seconds!\n\nWhen the countdown finishes, lower your brow for 5 seconds.\n(Angry eyes!)\nLook straight forward at the crosshair.", remTime);
             overlayManager.SetDisplayString(str);
             overlayManager.ShowTargetCrosshair();
@@ -753,7 +853,7 @@ int main(int argc, char* argv[]) {
             frame.routineBrowAngry = 1.0f; // Lower eyebrows for angry expression
             break;
         case 15: // notify of convergence test
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             sprintf(str, "   ~~ Eye Convergence Test ~~ \n\nCountdown: %d seconds!\n\nWhen the countdown finishes, follow the crosshair as it moves towards and away from you.\nKeep your eyes focused on the crosshair.", remTime);
             overlayManager.SetDisplayString(str);
             overlayManager.HideTargetCrosshair();
@@ -764,7 +864,7 @@ int main(int argc, char* argv[]) {
             overlayManager.ShowTargetCrosshair();
             break;
         case 17: // notify of dilation calibration
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             sprintf(str, "   ~~ Pupil Dilation Calibration ~~ \n\nCountdown: %d seconds!\n\nWhen the countdown finishes, look straight ahead.\nThe screen will show different brightness levels to calibrate pupil dilation.\nThis process should take about a minute.", remTime);
             overlayManager.SetDisplayString(str);
             overlayManager.HideTargetCrosshair();
@@ -776,7 +876,7 @@ int main(int argc, char* argv[]) {
             frame.routineDilate = 1.0f; // Fully dilated
             break;
         case 19: // notify of white screen
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             sprintf(str, "   ~~ Pupil Dilation Calibration ~~ \n\nCountdown: %d seconds!\n\nNext: bright white screen.\nLook straight ahead and let your pupils adjust.", remTime);
             overlayManager.SetDisplayString(str);
             overlayManager.ShowTargetCrosshair();
@@ -788,7 +888,7 @@ int main(int argc, char* argv[]) {
             frame.routineDilate = 0.0f; // Fully constricted
             break;
         case 21: // notify of gradient fade
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             sprintf(str, "   ~~ Pupil Dilation Calibration ~~ \n\nCountdown: %d seconds!\n\nNext: screen will gradually fade from white to black.\nKeep looking straight ahead.", remTime);
             overlayManager.SetDisplayString(str);
             overlayManager.ShowTargetCrosshair();
@@ -799,10 +899,10 @@ int main(int argc, char* argv[]) {
             overlayManager.ShowTargetCrosshair();
             // routineDilate is set dynamically based on screen brightness
             // 0.0 = bright screen (pupils constricted), 1.0 = dark screen (pupils dilated)
-            frame.routineDilate = g_OverlayManager.s_routineFadeProgress; // Uses fade progress from routine controller
+            frame.routineDilate = OverlayManager::s_routineFadeProgress; // Uses fade progress from routine controller
             break;
         case 23: // notify of fixed position test
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             sprintf(str, "   ~~ Fixed Position Head Movement Test ~~ \n\nCountdown: %d seconds!\n\nWhen the countdown finishes, the crosshair will remain fixed in space.\nMove your head around while keeping your eyes focused on the crosshair.", remTime);
             overlayManager.SetDisplayString(str);
             overlayManager.ShowTargetCrosshair();
@@ -812,9 +912,9 @@ int main(int argc, char* argv[]) {
             goodData = true;
             // Enable fixed position mode when entering this stage
             static int lastFixedStage = -1;
-            if (lastFixedStage != RoutineController::m_routineStage) {
+            if (lastFixedStage != routine.getRoutineStage()) {
                 overlayManager.EnableFixedPositionMode(true);
-                lastFixedStage = RoutineController::m_routineStage;
+                lastFixedStage = routine.getRoutineStage();
             }
 
             // Calculate real-time eye gaze predictions
@@ -845,13 +945,13 @@ int main(int argc, char* argv[]) {
             break;
         }
         case 25: // completion stage
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             goodData = false;
             sprintf(str, "   ~~ Eyelid Calibration ~~ \n\nAt the end of the countdown, please keep your eyes closed for 20 seconds. Once completed there will be a beep and haptic feedback.\n\nCountdown: %d seconds!", remTime);
             overlayManager.SetDisplayString(str);
             break;
         case 26: // completion stage
-            remTime = g_OverlayManager.g_routineController.getTimeTillNext();
+            remTime = routine.getTimeTillNext();
             goodData = true;
             sprintf(str, "   ~~ Eyelid Calibration ~~ \n\nRemaining Time: %d seconds!\n\nPlease keep your eyes closed, if you are reading this you may get poor results.", remTime);
             overlayManager.SetDisplayString(str);
@@ -892,15 +992,31 @@ int main(int argc, char* argv[]) {
 
         // printf(str);
 
+        // routine progress for /events subscribers, only when it changes
+        std::string routineJson = "{\"running\":" + std::string(g_runningCalibration ? "true" : "false") + ", \"recording\":" + std::string(g_Recording ? "true" : "false") + ", \"currentIndex\":" + std::to_string(routine.getCurrentOperationIndex()) + ", \"maxIndex\":" + std::to_string(routine.getTotalOperationCount()) + ", \"routineState\":" + std::to_string(OverlayManager::s_routineState) + "}";
+        if (routineJson != lastRoutineJson) {
+            server.publish("/events", sseEvent("routine", routineJson));
+            lastRoutineJson = routineJson;
+        }
+
         OverlayManager::ViewingAngles angles = overlayManager.CalculateCurrentViewingAngle();
         if (g_Recording) {
             if (OverlayManager::s_routineState == FLAG_ROUTINE_COMPLETE) {
                 g_Recording = false;
-                closeCaptureFile(captureFile);
+
+                // the trainer reads the file, so everything queued must be on disk first
+                captureScheduler.stop();
+                captureWriter.close();
 
                 printf("Starting trainer with capture file: %s\n", filename);
 
-                g_Trainer.start(filename, g_outputModelPath, [](const std::string& output) { printf("trainer output: %s", output.c_str()); }, [](const TrainerProgress& progress) {
+                std::string outputModelPath;
+                {
+                    std::lock_guard<std::mutex> lock(g_calibrationMutex);
+                    outputModelPath = g_outputModelPath;
+                }
+
+                g_Trainer.start(filename, outputModelPath, [](const std::string& output) { printf("trainer output: %s", output.c_str()); }, [&server](const TrainerProgress& progress) {
                         printf("DEBUG: Trainer progress callback invoked - isTraining=%d, isComplete=%d, hasError=%d\n",
                             progress.isTraining, progress.isComplete, progress.hasError);
                         // Set global training progress (to be used by main thread)
@@ -989,26 +1105,17 @@ int main(int argc, char* argv[]) {
                         g_trainingLossHistory = progress.lossHistory;
                         g_hasTrainingUpdate = true;
                         printf("DEBUG: Set g_hasTrainingUpdate=true, progressDisplay length=%zu, lossHistory size=%zu\n",
-                            progressDisplay.length(), progress.lossHistory.size()); }, []() {
+                            progressDisplay.length(), progress.lossHistory.size());
+                        server.publish("/events", sseEvent("training", trainingProgressJson(progress))); }, [&server]() {
                         printf("trainer finished!");
-                        g_isTrained = true; });
+                        g_isTrained = true;
+                        server.publish("/events", sseEvent("trained", "{\"isTrained\":true}")); });
             } else {
                 if (true) { // if(OverlayManager::s_routineState == FLAG_RESTING && !RoutineController::m_stepWritten){
                     // OverlayManager::s_routineState = FLAG_IN_MOVEMENT;
                     // RoutineController::m_stepWritten = true;
-                    int width, height;
-                    uint64_t time_left, time_right;
-                    size_t size_left, size_right;
-                    unsigned char* imageLeft = frameBufferLeft.getFrameCopy(&width, &height, &time_left, &size_left);
-                    unsigned char* imageRight = frameBufferRight.getFrameCopy(&width, &height, &time_right, &size_right);
-
-                    /*FILE* fp = fopen("./good_data4.bin", "wb");
-                    printf("Writing good data...\n");
-                    if (fp) {
-                        fwrite(imageLeft, 1, size_left, fp);
-                        fclose(fp);
-                        printf("Dumped bad JPEG data to bad_data4.bin (%u bytes)\n", size_left);
-                    }*/
+                    // Only the label is produced here; captureScheduler writes a record
+                    // whenever the cameras deliver a new pair, labeled for its timestamp
                     uint64_t now = current_time_ms();
 
                     // memcpy(frame.image_data_left, imageLeft, width*height*sizeof(int));
@@ -1037,14 +1144,11 @@ int main(int argc, char* argv[]) {
                     frame.rightEyePitch = eyeGaze.rightEyePitch;
                     frame.rightEyeYaw = eyeGaze.rightEyeYaw;
 
-                    frame.jpeg_data_left_length = (uint32_t)size_left;
-                    frame.jpeg_data_right_length = (uint32_t)size_right;
-
-                    if (!RoutineController::m_stepWritten) {
-                        RoutineController::m_stepWritten = true;
+                    if (!routine.getStepWritten()) {
+                        routine.setStepWritten(true);
                         frame.routineState = FLAG_RESTING;
                     } else {
-                        frame.routineState = FLAG_IN_MOVEMENT | 1 << RoutineController::m_routineStage;
+                        frame.routineState = FLAG_IN_MOVEMENT | 1 << routine.getRoutineStage();
                     }
 
                     if (goodData)
@@ -1053,7 +1157,7 @@ int main(int argc, char* argv[]) {
                     frame.routineLeftLid = 1;
                     frame.routineRightLid = 1;
 
-                    if (RoutineController::m_routineStage == 26) {
+                    if (routine.getRoutineStage() == 26) {
                         // eyes closed
                         frame.routinePitch = 0;
                         frame.routineYaw = 0;
@@ -1082,26 +1186,9 @@ int main(int argc, char* argv[]) {
                     // frame.videoTimestampLow = (uint32_t)(time & 0xFFFFFFFF);
                     // frame.videoTimestampHigh = (uint32_t)((time >> 32) & 0xFFFFFFFF);
 
-                    frame.timestamp = now;
-                    frame.timestamp_left = time_left;
-                    frame.timestamp_right = time_right;
-
                     // printf("frame size: %lld", sizeof(frame)); // Commented out to reduce spam
 
-                    if (!writeCaptureFrame(captureFile, &frame, sizeof(frame))) {
-                        printf("ERROR: Failed to write frame! (metadata)\n");
-                    }
-
-                    if (!writeCaptureFrame(captureFile, imageLeft, size_left)) {
-                        printf("ERROR: Failed to write frame! (left eye)\n");
-                    }
-
-                    if (!writeCaptureFrame(captureFile, imageRight, size_right)) {
-                        printf("ERROR: Failed to write frame! (right eye)\n");
-                    }
-
-                    free(imageLeft);
-                    free(imageRight);
+                    captureScheduler.pushLabel(frame, now);
                 }
             }
         }
@@ -1192,9 +1279,15 @@ int main(int argc, char* argv[]) {
         Sleep(10);
     }
 
-    closeCaptureFile(captureFile);
+    captureWriter.close();
 
-    // Cleanup
+    // Cleanup; the trainer's callbacks use the server, so it must be gone first
+    g_Trainer.cancel();
+    jobScheduler.stop();
+    g_InferenceEngine.stop();
+    // No handler may still be reading overlayManager's routine once it goes out of scope
+    server.stop();
+    g_CalibrationOverlay = &g_OverlayManager;
     overlayManager.Shutdown();
     vr::VR_Shutdown();
 
@@ -0,0 +1,242 @@
+#include "metrics.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+const std::vector<double> MetricsLatencyBuckets = { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0 };
+
+void* MetricsAlignedAlloc(size_t bytes) {
+#ifdef _WIN32
+    void* memory = _aligned_malloc(bytes, METRICS_LINE_BYTES);
+#else
+    void* memory = nullptr;
+    if (posix_memalign(&memory, METRICS_LINE_BYTES, bytes) != 0) {
+        memory = nullptr;
+    }
+#endif
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void MetricsAlignedFree(void* memory) {
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+MetricCounter::MetricCounter() {
+    for (Shard& shard : m_shards) {
+        shard.value.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t MetricCounter::value() const {
+    uint64_t total = 0;
+    for (const Shard& shard : m_shards) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+MetricGauge::MetricGauge()
+    : m_value(0.0) {
+}
+
+void MetricGauge::add(double delta) {
+    double current = m_value.load(std::memory_order_relaxed);
+    while (!m_value.compare_exchange_weak(current, current + delta, std::memory_order_relaxed)) {
+    }
+}
+
+MetricHistogram::MetricHistogram(const std::vector<double>& bounds)
+    : m_bounds(bounds) {
+    const size_t perLine = sizeof(Line::cells) / sizeof(Line::cells[0]);
+    m_linesPerShard = (m_bounds.size() + 2 + perLine - 1) / perLine;
+    m_lines.reset(new Line[m_linesPerShard * METRICS_SHARDS]);
+    for (size_t i = 0; i < m_linesPerShard * METRICS_SHARDS; i++) {
+        for (std::atomic<uint64_t>& value : m_lines[i].cells) {
+            value.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+std::atomic<uint64_t>& MetricHistogram::cell(size_t shard, size_t i) const {
+    const size_t perLine = sizeof(Line::cells) / sizeof(Line::cells[0]);
+    return m_lines[shard * m_linesPerShard + i / perLine].cells[i % perLine];
+}
+
+void MetricHistogram::observe(double seconds) {
+    size_t bucket = 0;
+    while (bucket < m_bounds.size() && seconds > m_bounds[bucket]) {
+        bucket++;
+    }
+
+    const size_t shard = MetricsThreadShard();
+    cell(shard, bucket).fetch_add(1, std::memory_order_relaxed);
+    cell(shard, m_bounds.size() + 1).fetch_add(seconds > 0 ? (uint64_t)std::llround(seconds * 1e9) : 0, std::memory_order_relaxed);
+}
+
+void MetricHistogram::snapshot(std::vector<uint64_t>* counts, double* sum) const {
+    counts->assign(m_bounds.size() + 1, 0);
+    uint64_t sumNs = 0;
+    for (size_t shard = 0; shard < METRICS_SHARDS; shard++) {
+        for (size_t i = 0; i <= m_bounds.size(); i++) {
+            (*counts)[i] += cell(shard, i).load(std::memory_order_relaxed);
+        }
+        sumNs += cell(shard, m_bounds.size() + 1).load(std::memory_order_relaxed);
+    }
+    *sum = sumNs / 1e9;
+}
+
+MetricsRegistry& MetricsRegistry::global() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+// Label values may hold anything; quote them as the exposition format wants
+static std::string renderLabels(const MetricLabels& labels) {
+    std::string rendered;
+    for (const auto& label : labels) {
+        if (!rendered.empty()) {
+            rendered += ",";
+        }
+        rendered += label.first + "=\"";
+        for (char c : label.second) {
+            if (c == '\\' || c == '"') {
+                rendered += '\\';
+                rendered += c;
+            } else if (c == '\n') {
+                rendered += "\\n";
+            } else {
+                rendered += c;
+            }
+        }
+        rendered += "\"";
+    }
+    return rendered;
+}
+
+MetricsRegistry::Series* MetricsRegistry::findSeries(const std::string& name, const std::string& help, Type type, const MetricLabels& labels) {
+    Family* family;
+    auto it = m_byName.find(name);
+    if (it == m_byName.end()) {
+        family = new Family();
+        family->name = name;
+        family->help = help;
+        family->type = type;
+        m_families.emplace_back(family);
+        m_byName[name] = family;
+    } else {
+        family = it->second;
+        if (family->type != type) {
+            printf("MetricsRegistry: %s is already registered as another type\n", name.c_str());
+            return nullptr;
+        }
+    }
+
+    std::string rendered = renderLabels(labels);
+    for (const auto& series : family->series) {
+        if (series->labels == rendered) {
+            return series.get();
+        }
+    }
+    Series* series = new Series();
+    series->labels = rendered;
+    family->series.emplace_back(series);
+    return series;
+}
+
+MetricCounter& MetricsRegistry::counter(const std::string& name, const std::string& help, const MetricLabels& labels) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Series* series = findSeries(name, help, TYPE_COUNTER, labels);
+    if (!series) {
+        m_orphans.emplace_back(series = new Series());
+    }
+    if (!series->counter) {
+        series->counter.reset(new MetricCounter());
+    }
+    return *series->counter;
+}
+
+MetricGauge& MetricsRegistry::gauge(const std::string& name, const std::string& help, const MetricLabels& labels) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Series* series = findSeries(name, help, TYPE_GAUGE, labels);
+    if (!series) {
+        m_orphans.emplace_back(series = new Series());
+    }
+    if (!series->gauge) {
+        series->gauge.reset(new MetricGauge());
+    }
+    return *series->gauge;
+}
+
+MetricHistogram& MetricsRegistry::histogram(const std::string& name, const std::string& help, const std::vector<double>& bounds, const MetricLabels& labels) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Series* series = findSeries(name, help, TYPE_HISTOGRAM, labels);
+    if (!series) {
+        m_orphans.emplace_back(series = new Series());
+    }
+    if (!series->histogram) {
+        series->histogram.reset(new MetricHistogram(bounds));
+    }
+    return *series->histogram;
+}
+
+static std::string formatValue(double value) {
+    if (std::isinf(value)) {
+        return value > 0 ? "+Inf" : "-Inf";
+    }
+    if (std::isnan(value)) {
+        return "NaN";
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.15g", value);
+    return buffer;
+}
+
+std::string MetricsRegistry::render() const {
+    static const char* typeNames[] = { "counter", "gauge", "histogram" };
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::string out;
+    std::vector<uint64_t> counts;
+    for (const auto& family : m_families) {
+        out += "# HELP " + family->name + " " + family->help + "\n";
+        out += "# TYPE " + family->name + " " + typeNames[family->type] + "\n";
+
+        for (const auto& series : family->series) {
+            const std::string braces = series->labels.empty() ? "" : "{" + series->labels + "}";
+            if (family->type == TYPE_COUNTER) {
+                out += family->name + braces + " " + std::to_string(series->counter->value()) + "\n";
+            } else if (family->type == TYPE_GAUGE) {
+                out += family->name + braces + " " + formatValue(series->gauge->value()) + "\n";
+            } else {
+                double sum;
+                series->histogram->snapshot(&counts, &sum);
+                const std::vector<double>& bounds = series->histogram->bounds();
+                const std::string prefix = series->labels.empty() ? "" : series->labels + ",";
+
+                // Buckets are cumulative in the exposition format
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i < counts.size(); i++) {
+                    cumulative += counts[i];
+                    std::string le = i < bounds.size() ? formatValue(bounds[i]) : "+Inf";
+                    out += family->name + "_bucket{" + prefix + "le=\"" + le + "\"} " + std::to_string(cumulative) + "\n";
+                }
+                out += family->name + "_sum" + braces + " " + formatValue(sum) + "\n";
+                out += family->name + "_count" + braces + " " + std::to_string(cumulative) + "\n";
+            }
+        }
+    }
+    return out;
+}
@@ -0,0 +1,180 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define METRICS_SHARDS     16 // Counter and histogram copies; threads spread over them so increments don't contend
+#define METRICS_LINE_BYTES 64 // Shards are this far apart so two threads never write the same cache line
+
+// Name/value pairs identifying one series of a metric, e.g. { { "stream", url } }
+typedef std::vector<std::pair<std::string, std::string>> MetricLabels;
+
+// Memory aligned to METRICS_LINE_BYTES for the sharded metrics; before C++17
+// operator new only guarantees alignof(std::max_align_t), which ignores alignas
+void* MetricsAlignedAlloc(size_t bytes);
+void MetricsAlignedFree(void* memory);
+
+// Shard of the calling thread, fixed on its first use
+inline size_t MetricsThreadShard() {
+    static std::atomic<size_t> nextShard(0);
+    thread_local size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % METRICS_SHARDS;
+    return shard;
+}
+
+/**
+ * @brief Monotonic count, e.g. frames received
+ *
+ * add() is one relaxed atomic add on the calling thread's shard; value()
+ * sums the shards.
+ */
+class MetricCounter {
+public:
+    MetricCounter();
+
+    void add(uint64_t n = 1) {
+        m_shards[MetricsThreadShard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const;
+
+    static void* operator new(size_t bytes) {
+        return MetricsAlignedAlloc(bytes);
+    }
+    static void operator delete(void* memory) {
+        MetricsAlignedFree(memory);
+    }
+
+private:
+    struct alignas(METRICS_LINE_BYTES) Shard {
+        std::atomic<uint64_t> value;
+        char padding[METRICS_LINE_BYTES - sizeof(std::atomic<uint64_t>)];
+    };
+    Shard m_shards[METRICS_SHARDS];
+};
+
+/**
+ * @brief Value that goes up and down, e.g. queue depth; the last set() wins
+ */
+class MetricGauge {
+public:
+    MetricGauge();
+
+    void set(double value) {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+
+    void add(double delta);
+
+    double value() const {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<double> m_value;
+};
+
+/**
+ * @brief Distribution of durations over fixed buckets
+ *
+ * observe() finds the bucket and does two relaxed atomic adds on the
+ * calling thread's shard (bucket and sum).
+ */
+class MetricHistogram {
+public:
+    // bounds: increasing bucket upper bounds in seconds; +Inf is implied
+    explicit MetricHistogram(const std::vector<double>& bounds);
+
+    void observe(double seconds);
+
+    const std::vector<double>& bounds() const {
+        return m_bounds;
+    }
+
+    // Per-bucket (not cumulative) counts, the last one for +Inf, and the sum in seconds
+    void snapshot(std::vector<uint64_t>* counts, double* sum) const;
+
+private:
+    struct alignas(METRICS_LINE_BYTES) Line {
+        std::atomic<uint64_t> cells[METRICS_LINE_BYTES / sizeof(std::atomic<uint64_t>)];
+
+        static void* operator new[](size_t bytes) {
+            return MetricsAlignedAlloc(bytes);
+        }
+        static void operator delete[](void* memory) {
+            MetricsAlignedFree(memory);
+        }
+    };
+
+    // Cell i of a shard: one per bucket, +Inf, then the sum in ns
+    std::atomic<uint64_t>& cell(size_t shard, size_t i) const;
+
+    std::vector<double> m_bounds;
+    size_t m_linesPerShard; // Whole lines, so no two shards share one
+    std::unique_ptr<Line[]> m_lines;
+};
+
+// Bucket bounds for latencies from 100 us to 10 s
+extern const std::vector<double> MetricsLatencyBuckets;
+
+/**
+ * @brief Named metrics, rendered in the Prometheus text format
+ *
+ * Metrics are registered once, typically in a constructor or start(), and
+ * the returned reference is kept; it stays valid for the life of the
+ * process. Registering the same name and labels again returns the same
+ * metric. Only registration and render() take the registry lock; updates
+ * never do, so scraping costs the hot paths nothing.
+ */
+class MetricsRegistry {
+public:
+    // Registry served at /metrics
+    static MetricsRegistry& global();
+
+    MetricCounter& counter(const std::string& name, const std::string& help, const MetricLabels& labels = MetricLabels());
+    MetricGauge& gauge(const std::string& name, const std::string& help, const MetricLabels& labels = MetricLabels());
+    MetricHistogram& histogram(const std::string& name, const std::string& help, const std::vector<double>& bounds, const MetricLabels& labels = MetricLabels());
+
+    // Every metric in the Prometheus text exposition format (version 0.0.4)
+    std::string render() const;
+
+private:
+    enum Type {
+        TYPE_COUNTER,
+        TYPE_GAUGE,
+        TYPE_HISTOGRAM
+    };
+
+    struct Series {
+        std::string labels; // Rendered, e.g. stream="http://...",eye="left"; empty for none
+        std::unique_ptr<MetricCounter> counter;
+        std::unique_ptr<MetricGauge> gauge;
+        std::unique_ptr<MetricHistogram> histogram;
+    };
+
+    struct Family {
+        std::string name;
+        std::string help;
+        Type type;
+        std::vector<std::unique_ptr<Series>> series;
+    };
+
+    // Family and series for name and labels, created if new; nullptr on a type clash
+    Series* findSeries(const std::string& name, const std::string& help, Type type, const MetricLabels& labels);
+
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<Family>> m_families; // In registration order
+    std::map<std::string, Family*> m_byName;
+
+    // Metrics that clashed with an existing name; updated but never rendered
+    std::vector<std::unique_ptr<Series>> m_orphans;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,68 @@
+#include "mjpeg_broadcaster.h"
+#include "frame_buffer.h"
+#include "jpeg_stream.h"
+#include "rest_server.h"
+
+#include <cstdio>
+#include <memory>
+
+MJPEGBroadcaster::MJPEGBroadcaster(HTTPServer* server, FrameBuffer* frames, const std::string& path)
+    : m_server(server)
+    , m_frames(frames)
+    , m_path(path)
+    , m_running(false) {
+    m_server->register_stream(m_path, "multipart/x-mixed-replace; boundary=" MJPEG_BROADCASTER_BOUNDARY);
+}
+
+MJPEGBroadcaster::~MJPEGBroadcaster() {
+    stop();
+}
+
+void MJPEGBroadcaster::start() {
+    if (m_running.exchange(true)) {
+        return; // Already running
+    }
+    m_thread = std::thread(&MJPEGBroadcaster::broadcastLoop, this);
+}
+
+void MJPEGBroadcaster::stop() {
+    if (!m_running.exchange(false)) {
+        return; // Already stopped
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void MJPEGBroadcaster::broadcastLoop() {
+    uint64_t lastSequence = 0;
+
+    while (m_running) {
+        uint64_t sequence;
+        MJPEGFrame* frame = m_frames->waitForFrame(lastSequence, MJPEG_BROADCASTER_WAIT_MS, &sequence);
+        if (!frame) {
+            continue;
+        }
+        lastSequence = sequence;
+
+        // No viewers; a client that connects gets this stream's last part and then the next frame
+        if (m_server->stream_clients(m_path) == 0) {
+            ReleaseFrame(frame);
+            continue;
+        }
+
+        char header[192];
+        int headerLength = snprintf(header, sizeof(header),
+                                    "--" MJPEG_BROADCASTER_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\nX-Timestamp: %llu\r\n\r\n",
+                                    frame->size, (unsigned long long)frame->timestamp);
+
+        std::shared_ptr<std::string> part = std::make_shared<std::string>();
+        part->reserve(headerLength + frame->size + 2);
+        part->append(header, headerLength);
+        part->append(reinterpret_cast<const char*>(frame->data), frame->size);
+        part->append("\r\n");
+        ReleaseFrame(frame);
+
+        m_server->publish(m_path, std::move(part));
+    }
+}
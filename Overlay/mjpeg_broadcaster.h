@@ -0,0 +1,45 @@
+#ifndef MJPEG_BROADCASTER_H
+#define MJPEG_BROADCASTER_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+class FrameBuffer;
+class HTTPServer;
+
+#define MJPEG_BROADCASTER_BOUNDARY "baballsframe" // multipart boundary between JPEGs
+#define MJPEG_BROADCASTER_WAIT_MS  100            // Frame wait before re-checking for stop()
+
+/**
+ * @brief Re-serves a FrameBuffer's camera stream as MJPEG on the REST server
+ *
+ * One thread takes every frame the FrameBuffer publishes and hands its JPEG,
+ * as received from the camera, to an HTTPServer stream. Nothing is decoded
+ * or re-encoded, and every client of the stream shares the same bytes, so
+ * any number of previews cost one copy per frame, and no preview costs
+ * none. Each part carries the frame's X-Timestamp like the camera stream does.
+ */
+class MJPEGBroadcaster {
+public:
+    /**
+     * @brief Register the stream; must be constructed before server->start()
+     * @param path GET path of the stream, e.g. /preview/left
+     */
+    MJPEGBroadcaster(HTTPServer* server, FrameBuffer* frames, const std::string& path);
+    ~MJPEGBroadcaster();
+
+    void start();
+    void stop();
+
+private:
+    void broadcastLoop();
+
+    HTTPServer* m_server;
+    FrameBuffer* m_frames;
+    std::string m_path;
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+};
+
+#endif // MJPEG_BROADCASTER_H
@@ -0,0 +1,432 @@
+// Serves capture files or synthetic JPEGs as multipart/x-mixed-replace
+// camera streams, as a fixture for ingestion throughput and latency tests.
+// Every client gets its own paced stream with X-Timestamp headers (wall
+// clock ms at send time, so receivers on the same machine can measure
+// end-to-end latency) and optional faults. POSIX only.
+//
+// Usage: mjpeg_replay [options] [capture.bin ...]
+//
+// Stream i is requested as http://host:port/i. Each capture file provides two
+// sources (left then right eye); without capture files two synthetic sources
+// are generated. Stream i plays source i modulo the number of sources.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <turbojpeg.h>
+
+#include "capture_reader.h"
+
+#define REPLAY_DEFAULT_PORT       8000
+#define REPLAY_DEFAULT_FPS        60.0
+#define REPLAY_SYNTHETIC_FRAMES   60     // Distinct synthetic frames per source, played in a loop
+#define REPLAY_SYNTHETIC_QUALITY  85
+#define REPLAY_BOUNDARY           "frame"
+#define REPLAY_STATS_INTERVAL_MS  5000
+
+struct ReplayOptions {
+    int port = REPLAY_DEFAULT_PORT;
+    double fps = REPLAY_DEFAULT_FPS; // 0 = as fast as the socket allows
+    double jitterMs = 0.0;           // Each send is moved by a uniform random offset in +-jitterMs
+    bool chunked = false;            // Transfer-Encoding: chunked
+    bool noLength = false;           // Omit Content-Length; parts end at the next boundary
+    size_t splitBytes = 0;           // Write each part in random pieces of at most this many bytes
+    int width = 128;                 // Synthetic frame size
+    int height = 128;
+
+    // Fault injection, per frame
+    double dropRate = 0.0;    // Skip the frame, leaving a gap in the sequence
+    double corruptRate = 0.0; // Send a JPEG with a broken SOI marker (tjDecompressHeader2 fails)
+    double garbageRate = 0.0; // Send a part with an impossible Content-Length (parser resync)
+    long disconnectAfter = 0; // Close the connection after this many parts were sent (camera reboot)
+    long stallAfter = 0;      // Stop sending after this many parts but keep the connection open (camera hang)
+};
+
+typedef std::vector<std::vector<uint8_t>> FrameSource;
+
+static std::atomic<uint64_t> g_framesSent(0);
+static std::atomic<uint64_t> g_bytesSent(0);
+static std::atomic<int> g_clients(0);
+
+static uint64_t wallClockMs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void printUsage(const char* program) {
+    printf("Usage: %s [options] [capture.bin ...]\n", program);
+    printf("  --port N              listen port (default %d); stream i is served at /i\n", REPLAY_DEFAULT_PORT);
+    printf("  --fps F               frames per second per stream, 0 for unpaced (default %.0f)\n", REPLAY_DEFAULT_FPS);
+    printf("  --jitter MS           random +-MS offset on every send time\n");
+    printf("  --chunked             use Transfer-Encoding: chunked\n");
+    printf("  --no-length           omit Content-Length from the parts\n");
+    printf("  --split N             write every part in random pieces of at most N bytes\n");
+    printf("  --size WxH            synthetic frame size (default 128x128)\n");
+    printf("  --drop P              probability of skipping a frame\n");
+    printf("  --corrupt P           probability of sending an undecodable JPEG\n");
+    printf("  --garbage P           probability of sending a malformed part\n");
+    printf("  --disconnect-after N  close each connection after sending N parts (dropped frames don't count)\n");
+    printf("  --stall-after N       stop after sending N parts but keep the connection open\n");
+}
+
+// Moving bar over a gradient, so consecutive frames differ and a stalled
+// receiver is visible when the JPEGs are viewed
+static FrameSource makeSyntheticSource(int width, int height, int seed) {
+    FrameSource source;
+    tjhandle compressor = tjInitCompress();
+    if (!compressor) {
+        fprintf(stderr, "Failed to initialize TurboJPEG compressor\n");
+        return source;
+    }
+
+    std::vector<uint8_t> pixels((size_t)width * height);
+    for (int frame = 0; frame < REPLAY_SYNTHETIC_FRAMES; frame++) {
+        int bar = (frame * width / REPLAY_SYNTHETIC_FRAMES + seed * width / 4) % width;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                pixels[(size_t)y * width + x] = (std::abs(x - bar) < 4) ? 255 : (uint8_t)((x + y) * 127 / (width + height));
+            }
+        }
+
+        unsigned char* jpeg = nullptr;
+        unsigned long jpegSize = 0;
+        if (tjCompress2(compressor, pixels.data(), width, 0, height, TJPF_GRAY, &jpeg, &jpegSize, TJSAMP_GRAY, REPLAY_SYNTHETIC_QUALITY, 0) == 0) {
+            source.emplace_back(jpeg, jpeg + jpegSize);
+        }
+        tjFree(jpeg);
+    }
+
+    tjDestroy(compressor);
+    return source;
+}
+
+class ReplayClient {
+public:
+    ReplayClient(int sock, const FrameSource& source, const ReplayOptions& options, unsigned seed)
+        : m_sock(sock)
+        , m_source(source)
+        , m_options(options)
+        , m_random(seed) {
+    }
+
+    void run() {
+        if (!sendResponseHeaders()) {
+            return;
+        }
+
+        const auto period = std::chrono::duration<double, std::milli>(m_options.fps > 0 ? 1000.0 / m_options.fps : 0.0);
+        auto nextFrame = std::chrono::steady_clock::now();
+
+        long sent = 0; // Parts written; frames skipped by --drop aren't
+        for (long slot = 0;; slot++) {
+            if (m_options.disconnectAfter > 0 && sent >= m_options.disconnectAfter) {
+                printf("Client %d: disconnecting after %ld frames\n", m_sock, sent);
+                return;
+            }
+            if (m_options.stallAfter > 0 && sent >= m_options.stallAfter) {
+                printf("Client %d: stalling after %ld frames\n", m_sock, sent);
+                char discard[256];
+                while (recv(m_sock, discard, sizeof(discard), 0) > 0) {
+                }
+                return;
+            }
+
+            // Pace on an absolute schedule so send time never drifts; jitter
+            // moves single sends without shifting the schedule
+            nextFrame += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+            if (std::chrono::steady_clock::now() - nextFrame > period) {
+                nextFrame = std::chrono::steady_clock::now(); // A slow client skips ahead rather than getting a burst
+            }
+            auto sendAt = nextFrame;
+            if (m_options.jitterMs > 0) {
+                std::uniform_real_distribution<double> offset(-m_options.jitterMs, m_options.jitterMs);
+                sendAt += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(offset(m_random)));
+            }
+            std::this_thread::sleep_until(sendAt);
+
+            if (chance(m_options.dropRate)) {
+                continue;
+            }
+
+            const std::vector<uint8_t>& frame = m_source[slot % m_source.size()];
+            bool ok;
+            if (chance(m_options.garbageRate)) {
+                ok = sendGarbagePart();
+            } else {
+                ok = sendPart(frame, chance(m_options.corruptRate));
+            }
+            if (!ok) {
+                return; // Client went away
+            }
+            sent++;
+        }
+    }
+
+private:
+    bool chance(double probability) {
+        if (probability <= 0.0) {
+            return false;
+        }
+        return std::uniform_real_distribution<double>(0.0, 1.0)(m_random) < probability;
+    }
+
+    bool sendResponseHeaders() {
+        std::string headers = "HTTP/1.1 200 OK\r\n"
+                              "Content-Type: multipart/x-mixed-replace; boundary=" REPLAY_BOUNDARY "\r\n"
+                              "Cache-Control: no-cache\r\n";
+        if (m_options.chunked) {
+            headers += "Transfer-Encoding: chunked\r\n";
+        }
+        headers += "\r\n";
+        return sendAll(headers.data(), headers.size());
+    }
+
+    bool sendPart(const std::vector<uint8_t>& jpeg, bool corrupt) {
+        char header[256];
+        int headerLen;
+        uint64_t timestamp = wallClockMs();
+        if (m_options.noLength) {
+            headerLen = snprintf(header, sizeof(header), "--" REPLAY_BOUNDARY "\r\nContent-Type: image/jpeg\r\nX-Timestamp: %llu\r\n\r\n",
+                                 (unsigned long long)timestamp);
+        } else {
+            headerLen = snprintf(header, sizeof(header), "--" REPLAY_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\nX-Timestamp: %llu\r\n\r\n",
+                                 jpeg.size(), (unsigned long long)timestamp);
+        }
+
+        m_part.assign(header, header + headerLen);
+        m_part.insert(m_part.end(), jpeg.begin(), jpeg.end());
+        if (corrupt && jpeg.size() >= 2) {
+            m_part[headerLen] = 0x00; // No SOI marker
+            m_part[headerLen + 1] = 0x00;
+        }
+        m_part.push_back('\r');
+        m_part.push_back('\n');
+
+        if (!sendFramed(m_part)) {
+            return false;
+        }
+
+        g_framesSent++;
+        g_bytesSent += jpeg.size();
+        return true;
+    }
+
+    bool sendGarbagePart() {
+        // An impossible length makes the receiver drop the part and resync on the next boundary
+        static const char garbage[] = "--" REPLAY_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: 4294967296\r\n\r\n";
+        m_part.assign(garbage, garbage + sizeof(garbage) - 1);
+        return sendFramed(m_part);
+    }
+
+    // Wrap in a chunk if needed and write, optionally in random pieces
+    bool sendFramed(const std::vector<uint8_t>& data) {
+        std::vector<uint8_t> framed;
+        const std::vector<uint8_t>* out = &data;
+        if (m_options.chunked) {
+            char size[32];
+            int sizeLen = snprintf(size, sizeof(size), "%zx\r\n", data.size());
+            framed.reserve(data.size() + sizeLen + 2);
+            framed.insert(framed.end(), size, size + sizeLen);
+            framed.insert(framed.end(), data.begin(), data.end());
+            framed.push_back('\r');
+            framed.push_back('\n');
+            out = &framed;
+        }
+
+        if (m_options.splitBytes == 0) {
+            return sendAll(out->data(), out->size());
+        }
+
+        std::uniform_int_distribution<size_t> piece(1, m_options.splitBytes);
+        for (size_t pos = 0; pos < out->size();) {
+            size_t len = std::min(piece(m_random), out->size() - pos);
+            if (!sendAll(out->data() + pos, len)) {
+                return false;
+            }
+            pos += len;
+        }
+        return true;
+    }
+
+    bool sendAll(const void* data, size_t len) {
+        const char* bytes = static_cast<const char*>(data);
+        while (len > 0) {
+            ssize_t sent = send(m_sock, bytes, len, 0);
+            if (sent <= 0) {
+                return false;
+            }
+            bytes += sent;
+            len -= (size_t)sent;
+        }
+        return true;
+    }
+
+    int m_sock;
+    const FrameSource& m_source;
+    const ReplayOptions& m_options;
+    std::mt19937 m_random;
+    std::vector<uint8_t> m_part;
+};
+
+// Stream index from a request line like "GET /3 HTTP/1.1"
+static size_t requestedStream(const char* request) {
+    const char* path = strchr(request, '/');
+    if (!path) {
+        return 0;
+    }
+    return (size_t)strtoul(path + 1, nullptr, 10);
+}
+
+static void serveClient(int sock, const std::vector<FrameSource>* sources, const ReplayOptions* options, unsigned seed) {
+    g_clients++;
+
+    // Read the request; only the path matters
+    char request[2048];
+    ssize_t received = recv(sock, request, sizeof(request) - 1, 0);
+    if (received > 0) {
+        request[received] = '\0';
+        size_t stream = requestedStream(request);
+        const FrameSource& source = (*sources)[stream % sources->size()];
+        printf("Client %d: serving stream %zu\n", sock, stream);
+
+        ReplayClient client(sock, source, *options, seed);
+        client.run();
+    }
+
+    close(sock);
+    g_clients--;
+}
+
+static void printStats() {
+    uint64_t lastFrames = 0;
+    uint64_t lastBytes = 0;
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(REPLAY_STATS_INTERVAL_MS));
+        uint64_t frames = g_framesSent;
+        uint64_t bytes = g_bytesSent;
+        double seconds = REPLAY_STATS_INTERVAL_MS / 1000.0;
+        printf("[stats] clients %d, %.1f frames/s, %.2f MB/s\n", g_clients.load(),
+               (frames - lastFrames) / seconds, (bytes - lastBytes) / seconds / (1024.0 * 1024.0));
+        lastFrames = frames;
+        lastBytes = bytes;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    ReplayOptions options;
+    std::vector<std::string> capturePaths;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--port") == 0 && hasValue) {
+            options.port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fps") == 0 && hasValue) {
+            options.fps = std::max(0.0, atof(argv[++i]));
+        } else if (strcmp(argv[i], "--jitter") == 0 && hasValue) {
+            options.jitterMs = std::max(0.0, atof(argv[++i]));
+        } else if (strcmp(argv[i], "--chunked") == 0) {
+            options.chunked = true;
+        } else if (strcmp(argv[i], "--no-length") == 0) {
+            options.noLength = true;
+        } else if (strcmp(argv[i], "--split") == 0 && hasValue) {
+            options.splitBytes = (size_t)std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--size") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 || options.width <= 0 || options.height <= 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--drop") == 0 && hasValue) {
+            options.dropRate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--corrupt") == 0 && hasValue) {
+            options.corruptRate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--garbage") == 0 && hasValue) {
+            options.garbageRate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--disconnect-after") == 0 && hasValue) {
+            options.disconnectAfter = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--stall-after") == 0 && hasValue) {
+            options.stallAfter = atol(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            capturePaths.push_back(argv[i]);
+        }
+    }
+
+    // Left and right eye of every capture file, in file order
+    std::vector<FrameSource> sources;
+    for (const std::string& path : capturePaths) {
+        printf("Reading capture file %s...\n", path.c_str());
+        std::vector<AlignedFrame> frames = read_capture_file(path);
+        FrameSource left, right;
+        for (AlignedFrame& frame : frames) {
+            left.push_back(std::move(frame.left_image));
+            right.push_back(std::move(frame.right_image));
+        }
+        if (left.empty()) {
+            fprintf(stderr, "No frames in %s\n", path.c_str());
+            return 1;
+        }
+        sources.push_back(std::move(left));
+        sources.push_back(std::move(right));
+    }
+
+    if (sources.empty()) {
+        printf("Generating synthetic %dx%d frames...\n", options.width, options.height);
+        for (int i = 0; i < 2; i++) {
+            sources.push_back(makeSyntheticSource(options.width, options.height, i));
+            if (sources.back().empty()) {
+                return 1;
+            }
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN); // A client closing mid-send must not kill the server
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((uint16_t)options.port);
+
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        fprintf(stderr, "Failed to listen on port %d\n", options.port);
+        return 1;
+    }
+
+    printf("Serving %zu source(s) on http://0.0.0.0:%d/<stream> at %.1f fps%s%s\n", sources.size(), options.port, options.fps,
+           options.chunked ? ", chunked" : "", options.noLength ? ", no Content-Length" : "");
+
+    std::thread(printStats).detach();
+
+    unsigned seed = 1;
+    while (true) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            continue;
+        }
+
+        int noDelay = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        std::thread(serveClient, client, &sources, &options, seed++).detach();
+    }
+}
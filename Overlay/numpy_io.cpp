@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
@@ -9,6 +10,158 @@
 
 #include "numpy_io.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define NUMPY_MAGIC_BYTES    6  // "\x93NUMPY"
+#define NUMPY_PREAMBLE_BYTES 10 // Magic, version and the version 1.0 header length
+#define NUMPY_HEADER_ALIGN   64 // Data offset multiple, so every element type is aligned
+
+static bool systemIsLittleEndian() {
+    uint16_t endianCheck = 1;
+    return *reinterpret_cast<char*>(&endianCheck) == 1;
+}
+
+// Descriptor in native byte order, e.g. "<f4"; one-byte types have none ("|u1")
+static std::string descrFor(NumPyDataType dataType) {
+    const TypeInfo& typeInfo = TYPE_INFO.find(dataType)->second;
+    char byteOrder = typeInfo.size == 1 ? '|' : (systemIsLittleEndian() ? '<' : '>');
+    return byteOrder + typeInfo.numpyDescr;
+}
+
+// Data type of a descriptor; swapped is set if its byte order isn't ours
+static bool typeForDescr(const std::string& descr, NumPyDataType* dataType, bool* swapped) {
+    if (descr.size() < 2) {
+        return false;
+    }
+    for (const auto& entry : TYPE_INFO) {
+        if (descr.compare(1, std::string::npos, entry.second.numpyDescr) != 0) {
+            continue;
+        }
+        char byteOrder = descr[0];
+        *dataType = entry.first;
+        *swapped = entry.second.size > 1 && byteOrder != '=' && byteOrder != '|' && (byteOrder == '<') != systemIsLittleEndian();
+        return byteOrder == '<' || byteOrder == '>' || byteOrder == '=' || byteOrder == '|';
+    }
+    return false;
+}
+
+/**
+ * Builds the magic string, version, header length and header dict
+ *
+ * @param headerBytes Total length to pad to; 0 for the next multiple of NUMPY_HEADER_ALIGN
+ * @return The header, or an empty string if it doesn't fit headerBytes
+ */
+static std::string buildHeader(const std::string& descr, const std::vector<size_t>& shape, size_t headerBytes) {
+    std::string dict = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': (";
+    for (size_t i = 0; i < shape.size(); ++i) {
+        dict += std::to_string(shape[i]);
+        if (i < shape.size() - 1) {
+            dict += ", ";
+        }
+    }
+    // For single-dimension arrays, add trailing comma to make it a tuple
+    if (shape.size() == 1) {
+        dict += ",";
+    }
+    dict += "), }";
+
+    size_t minimum = NUMPY_PREAMBLE_BYTES + dict.length() + 1; // +1 for newline
+    if (headerBytes == 0) {
+        headerBytes = (minimum + NUMPY_HEADER_ALIGN - 1) / NUMPY_HEADER_ALIGN * NUMPY_HEADER_ALIGN;
+    }
+    if (minimum > headerBytes || headerBytes - NUMPY_PREAMBLE_BYTES > UINT16_MAX) {
+        return std::string();
+    }
+    dict.append(headerBytes - minimum, ' ');
+    dict += '\n';
+
+    // Magic string, version 1.0 and the header length (little endian)
+    uint16_t dictBytes = (uint16_t)dict.length();
+    std::string header("\x93NUMPY\x01\x00", 8);
+    header += (char)(dictBytes & 0xFF);
+    header += (char)(dictBytes >> 8);
+    return header + dict;
+}
+
+/**
+ * Length of the whole header from the first 12 bytes of a file
+ *
+ * @return 0 if this isn't a .npy file
+ */
+static size_t parsePreamble(const unsigned char* bytes, size_t available) {
+    if (available < 12 || memcmp(bytes, "\x93NUMPY", NUMPY_MAGIC_BYTES) != 0) {
+        return 0;
+    }
+    // Version 1.0 has a 16-bit header length; 2.0 and 3.0 widened it to 32 bits
+    if (bytes[6] == 1) {
+        return NUMPY_PREAMBLE_BYTES + (bytes[8] | (bytes[9] << 8));
+    }
+    if (bytes[6] == 2 || bytes[6] == 3) {
+        return 12 + (bytes[8] | (bytes[9] << 8) | (bytes[10] << 16) | ((size_t)bytes[11] << 24));
+    }
+    return 0;
+}
+
+// Descriptor, order and shape from a header dict
+static bool parseHeader(const std::string& header, std::string& descr, bool& fortranOrder, std::vector<size_t>& shape) {
+    size_t descrKey = header.find("'descr':");
+    size_t orderKey = header.find("'fortran_order':");
+    size_t shapeKey = header.find("'shape':");
+    if (descrKey == std::string::npos || orderKey == std::string::npos || shapeKey == std::string::npos) {
+        return false;
+    }
+
+    size_t descrStart = header.find('\'', descrKey + 8);
+    size_t descrEnd = descrStart == std::string::npos ? std::string::npos : header.find('\'', descrStart + 1);
+    if (descrEnd == std::string::npos) {
+        return false;
+    }
+    descr = header.substr(descrStart + 1, descrEnd - descrStart - 1);
+
+    size_t orderStart = header.find_first_not_of(' ', orderKey + 16);
+    fortranOrder = orderStart != std::string::npos && header.compare(orderStart, 4, "True") == 0;
+
+    size_t shapeStart = header.find('(', shapeKey);
+    size_t shapeEnd = shapeStart == std::string::npos ? std::string::npos : header.find(')', shapeStart);
+    if (shapeEnd == std::string::npos) {
+        return false;
+    }
+
+    // Parse shape dimensions; "(3,)" and "()" have empty entries
+    shape.clear();
+    std::string shapeStr = header.substr(shapeStart + 1, shapeEnd - shapeStart - 1);
+    size_t pos = 0;
+    while (pos <= shapeStr.length()) {
+        size_t commaPos = std::min(shapeStr.find(',', pos), shapeStr.length());
+        std::string numStr = shapeStr.substr(pos, commaPos - pos);
+        if (numStr.find_first_not_of(" \t") != std::string::npos) {
+            try {
+                shape.push_back(std::stoull(numStr));
+            } catch (const std::exception&) {
+                return false;
+            }
+        }
+        pos = commaPos + 1;
+    }
+    return true;
+}
+
+static int64_t fileSize(FILE* file) {
+    fseek(file, 0, SEEK_END);
+#ifdef _WIN32
+    return _ftelli64(file);
+#else
+    return (int64_t)ftello(file);
+#endif
+}
+
 /**
  * Saves an array to a NumPy .npy file
  *
@@ -38,56 +191,11 @@ bool NumPyIO::SaveArrayToNumpy(const std::string& filename, const void* data,
         totalElements *= dim;
     }
 
-    // Build shape string for header
-    std::string shapeStr = "(";
-    for (size_t i = 0; i < shape.size(); ++i) {
-        shapeStr += std::to_string(shape[i]);
-        if (i < shape.size() - 1) {
-            shapeStr += ", ";
-        }
-    }
-    // For single-dimension arrays, add trailing comma to make it a tuple
-    if (shape.size() == 1) {
-        shapeStr += ",";
+    // Header padded so the data starts aligned
+    std::string header = buildHeader(descrFor(dataType), shape, 0);
+    if (header.empty()) {
+        return false;
     }
-    shapeStr += ")";
-
-    // Check endianness
-    uint16_t endianCheck = 1;
-    char endianness = *reinterpret_cast<char*>(&endianCheck) ? '<' : '>';
-
-    // Create header
-    std::string header = "{'descr': '";
-    header += endianness;
-    header += typeInfo.numpyDescr;
-    header += "', 'fortran_order': False, 'shape': ";
-    header += shapeStr;
-    header += "}";
-
-    // Pad header to make total length divisible by 64 for alignment
-    size_t headerLen = header.length() + 1;       // +1 for newline
-    size_t padLen = 64 - ((headerLen + 10) % 64); // +10 for magic string, version, header length
-    if (padLen < 64) {
-        headerLen += padLen;
-    }
-    header.append(padLen, ' ');
-    header += '\n';
-
-    // Magic string for .npy format
-    const char magic[] = "\x93NUMPY";
-    file.write(magic, 6);
-
-    // Version 1.0
-    const uint8_t majorVersion = 1;
-    const uint8_t minorVersion = 0;
-    file.write(reinterpret_cast<const char*>(&majorVersion), 1);
-    file.write(reinterpret_cast<const char*>(&minorVersion), 1);
-
-    // Header length (little endian)
-    uint16_t headerLenLE = static_cast<uint16_t>(header.length());
-    file.write(reinterpret_cast<char*>(&headerLenLE), 2);
-
-    // Header
     file.write(header.c_str(), header.length());
 
     // Data
@@ -121,54 +229,30 @@ void* NumPyIO::ReadNumpyToArray(const std::string& filename, void* data,
         throw std::runtime_error("Failed to open file: " + filename);
     }
 
-    // Check magic string
-    char magic[6];
-    file.read(magic, 6);
-    if (memcmp(magic, "\x93NUMPY", 6) != 0) {
+    // Check magic string and version, and get the header length
+    unsigned char preamble[12];
+    file.read(reinterpret_cast<char*>(preamble), sizeof(preamble));
+    size_t headerBytes = parsePreamble(preamble, (size_t)file.gcount());
+    if (headerBytes == 0) {
         throw std::runtime_error("Invalid NumPy file format (incorrect magic string)");
     }
 
-    // Read version
-    uint8_t majorVersion, minorVersion;
-    file.read(reinterpret_cast<char*>(&majorVersion), 1);
-    file.read(reinterpret_cast<char*>(&minorVersion), 1);
-
-    // Read header length
-    uint16_t headerLen;
-    file.read(reinterpret_cast<char*>(&headerLen), 2);
-
     // Read header
-    std::vector<char> headerBuf(headerLen + 1, 0); // +1 for null terminator
-    file.read(headerBuf.data(), headerLen);
-    std::string header(headerBuf.data());
-
-    // Parse shape from header
-    shape.clear();
-    size_t shapeStart = header.find("'shape': (") + 10;
-    size_t shapeEnd = header.find(")", shapeStart);
-    std::string shapeStr = header.substr(shapeStart, shapeEnd - shapeStart);
+    file.seekg(0);
+    std::string header(headerBytes, '\0');
+    file.read(&header[0], headerBytes);
 
-    // Parse shape dimensions
-    size_t pos = 0;
-    while (pos < shapeStr.length()) {
-        size_t commaPos = shapeStr.find(',', pos);
-        if (commaPos == std::string::npos) {
-            // Handle last number or single dimension
-            std::string numStr = shapeStr.substr(pos);
-            if (!numStr.empty() && numStr.find_first_not_of(" \t") != std::string::npos) {
-                shape.push_back(std::stoull(numStr));
-            }
-            break;
-        }
-
-        std::string numStr = shapeStr.substr(pos, commaPos - pos);
-        shape.push_back(std::stoull(numStr));
-        pos = commaPos + 1;
+    std::string descr;
+    bool fortranOrder;
+    if (!file || !parseHeader(header, descr, fortranOrder, shape) || shape.empty()) {
+        throw std::runtime_error("Failed to parse array shape from NumPy header");
     }
 
-    // Verify we have a valid shape
-    if (shape.empty()) {
-        throw std::runtime_error("Failed to parse array shape from NumPy header");
+    // Check data type from header
+    NumPyDataType fileType;
+    bool swapped;
+    if (!typeForDescr(descr, &fileType, &swapped) || fileType != dataType) {
+        throw std::runtime_error("File contains incompatible data type for the requested read");
     }
 
     // Calculate total elements
@@ -177,14 +261,6 @@ void* NumPyIO::ReadNumpyToArray(const std::string& filename, void* data,
         totalElements *= dim;
     }
 
-    // Check data type from header
-    std::string expectedType1 = "'descr': '<" + typeInfo.numpyDescr + "'";
-    std::string expectedType2 = "'descr': '>" + typeInfo.numpyDescr + "'";
-
-    if (header.find(expectedType1) == std::string::npos && header.find(expectedType2) == std::string::npos) {
-        throw std::runtime_error("File contains incompatible data type for the requested read");
-    }
-
     // Allocate memory if needed
     void* resultData = data;
     if (resultData == nullptr) {
@@ -194,26 +270,12 @@ void* NumPyIO::ReadNumpyToArray(const std::string& filename, void* data,
     // Read the actual data
     file.read(reinterpret_cast<char*>(resultData), totalElements * typeInfo.size);
 
-    // Check endianness
-    bool fileIsLittleEndian = (header.find("'descr': '<") != std::string::npos);
-
-    // Check if we need to swap endianness
-    uint16_t endianCheck = 1;
-    bool systemIsLittleEndian = (*reinterpret_cast<char*>(&endianCheck) == 1);
-
     // Swap endianness if needed
-    if (fileIsLittleEndian != systemIsLittleEndian) {
-        // For 4-byte types (float32, int32)
-        if (typeInfo.size == 4) {
-            uint32_t* values = reinterpret_cast<uint32_t*>(resultData);
-            for (size_t i = 0; i < totalElements; i++) {
-                values[i] = ((values[i] & 0xFF) << 24)
-                          | ((values[i] & 0xFF00) << 8)
-                          | ((values[i] & 0xFF0000) >> 8)
-                          | ((values[i] & 0xFF000000) >> 24);
-            }
+    if (swapped) {
+        unsigned char* bytes = reinterpret_cast<unsigned char*>(resultData);
+        for (size_t i = 0; i < totalElements; i++) {
+            std::reverse(bytes + i * typeInfo.size, bytes + (i + 1) * typeInfo.size);
         }
-        // Add more cases for different sizes if needed
     }
 
     return resultData;
@@ -230,131 +292,347 @@ void* NumPyIO::ReadNumpyToArray(const std::string& filename, void* data,
  */
 bool NumPyIO::AppendToNumpyArray(const std::string& filename, const void* data,
                                  size_t elements, NumPyDataType dataType) {
-    const size_t FIXED_HEADER_SIZE = 256; // Fixed size for header with padding
-
-    // Get type information
-    auto typeInfoIt = TYPE_INFO.find(dataType);
-    if (typeInfoIt == TYPE_INFO.end()) {
+    NumPyWriter writer;
+    if (!writer.open(filename, dataType, std::vector<size_t>(), true)) {
         return false;
     }
-    const TypeInfo& typeInfo = typeInfoIt->second;
+    writer.append(data, elements);
+    return writer.close();
+}
 
-    // Check if file exists
-    size_t currentSize = 0;
-    std::ifstream checkFile(filename, std::ios::binary);
-    bool fileExists = checkFile.good();
+// For backward compatibility, provide the original function names
+bool NumPyIO::SaveFloatArrayToNumpy(const std::string& filename, const float* data, const std::vector<size_t>& shape) {
+    return SaveArrayToNumpy(filename, data, shape, NumPyDataType::FLOAT32);
+}
 
-    if (fileExists) {
-        // Skip magic string, version, and header length (10 bytes)
-        checkFile.seekg(10);
+float* NumPyIO::ReadNumpyToFloatArray(const std::string& filename, float* data, std::vector<size_t>& shape) {
+    return static_cast<float*>(ReadNumpyToArray(filename, data, shape, NumPyDataType::FLOAT32));
+}
 
-        // Read header length
-        uint16_t headerLen;
-        checkFile.read(reinterpret_cast<char*>(&headerLen), 2);
+// Add convenience functions for int32
+bool NumPyIO::SaveInt32ArrayToNumpy(const std::string& filename, const int32_t* data, const std::vector<size_t>& shape) {
+    return SaveArrayToNumpy(filename, data, shape, NumPyDataType::INT32);
+}
 
-        // Skip the header
-        checkFile.seekg(headerLen, std::ios::cur);
+int32_t* NumPyIO::ReadNumpyToInt32Array(const std::string& filename, int32_t* data, std::vector<size_t>& shape) {
+    return static_cast<int32_t*>(ReadNumpyToArray(filename, data, shape, NumPyDataType::INT32));
+}
+
+NumPyWriter::NumPyWriter()
+    : m_file(nullptr)
+    , m_rowBytes(0)
+    , m_headerBytes(0)
+    , m_rows(0)
+    , m_headerRows(0)
+    , m_buffered(0)
+    , m_failed(false) {
+}
+
+NumPyWriter::~NumPyWriter() {
+    close();
+}
 
-        // Calculate current size based on file size
-        std::streampos dataStart = checkFile.tellg();
-        checkFile.seekg(0, std::ios::end);
-        std::streampos fileEnd = checkFile.tellg();
+bool NumPyWriter::open(const std::string& filename, NumPyDataType dataType,
+                       const std::vector<size_t>& rowShape, bool append) {
+    close();
 
-        currentSize = (fileEnd - dataStart) / typeInfo.size;
+    auto typeInfoIt = TYPE_INFO.find(dataType);
+    if (typeInfoIt == TYPE_INFO.end()) {
+        return false;
+    }
+    m_descr = descrFor(dataType);
+    m_rowShape = rowShape;
+    m_rowBytes = typeInfoIt->second.size;
+    for (size_t dim : rowShape) {
+        m_rowBytes *= dim;
+    }
+    if (m_rowBytes == 0) {
+        printf("NumPyWriter: %s has an empty row shape\n", filename.c_str());
+        return false;
     }
-    checkFile.close();
 
-    if (!fileExists) {
-        // Create new file
-        std::ofstream file(filename, std::ios::binary);
-        if (!file.is_open()) {
+    // Room for the largest row count, so patching the header never grows it
+    std::vector<size_t> largest(1, SIZE_MAX);
+    largest.insert(largest.end(), rowShape.begin(), rowShape.end());
+
+    m_rows = 0;
+    // Appends are collected in m_buffer, so stdio's buffer would only add a
+    // copy; setvbuf() has to come before any other operation on the file
+    m_file = append ? fopen(filename.c_str(), "r+b") : nullptr;
+    if (m_file) {
+        setvbuf(m_file, nullptr, _IONBF, 0);
+        unsigned char preamble[12];
+        size_t headerBytes = parsePreamble(preamble, fread(preamble, 1, sizeof(preamble), m_file));
+        std::string header(headerBytes, '\0');
+        std::string descr;
+        bool fortranOrder = false;
+        std::vector<size_t> shape;
+        fseek(m_file, 0, SEEK_SET);
+        if (headerBytes == 0 || fread(&header[0], 1, headerBytes, m_file) != headerBytes
+            || !parseHeader(header, descr, fortranOrder, shape)) {
+            printf("NumPyWriter: %s is not a NumPy file\n", filename.c_str());
+            fclose(m_file);
+            m_file = nullptr;
+            return false;
+        }
+        if (descr != m_descr || fortranOrder || shape.size() != rowShape.size() + 1
+            || !std::equal(rowShape.begin(), rowShape.end(), shape.begin() + 1)) {
+            printf("NumPyWriter: %s has another data type or row shape\n", filename.c_str());
+            fclose(m_file);
+            m_file = nullptr;
+            return false;
+        }
+        if (buildHeader(m_descr, largest, headerBytes).empty()) {
+            printf("NumPyWriter: %s has no room in its header to grow\n", filename.c_str());
+            fclose(m_file);
+            m_file = nullptr;
             return false;
         }
 
-        // Create new header
-        writeHeader(file, elements, dataType, FIXED_HEADER_SIZE);
+        // Rows written after the last flush of a crashed writer count too
+        int64_t dataBytes = fileSize(m_file) - (int64_t)headerBytes;
+        if (dataBytes < 0 || (uint64_t)dataBytes % m_rowBytes != 0) {
+            printf("NumPyWriter: %s ends in a partial row\n", filename.c_str());
+            fclose(m_file);
+            m_file = nullptr;
+            return false;
+        }
+        m_headerBytes = headerBytes;
+        m_rows = (uint64_t)dataBytes / m_rowBytes;
+        m_headerRows = shape[0];
+    } else {
+        m_file = fopen(filename.c_str(), "wb");
+        if (!m_file) {
+            printf("NumPyWriter: can't create %s\n", filename.c_str());
+            return false;
+        }
+        setvbuf(m_file, nullptr, _IONBF, 0);
+        m_headerBytes = buildHeader(m_descr, largest, 0).length();
+        m_headerRows = UINT64_MAX; // Written by the flush below
+    }
 
-        // Write data
-        file.write(reinterpret_cast<const char*>(data), elements * typeInfo.size);
+    m_filename = filename;
+    m_buffer.resize(NUMPY_WRITER_BUFFER_BYTES);
+    m_buffered = 0;
+    m_failed = false;
+    return flush();
+}
 
-        return file.good();
-    } else {
-        // Open for append
-        std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
-        if (!file.is_open()) {
+bool NumPyWriter::append(const void* rows, size_t count) {
+    if (!m_file) {
+        return false;
+    }
+
+    size_t bytes = count * m_rowBytes;
+    if (m_buffered + bytes > m_buffer.size() && !writeBuffer()) {
+        return false;
+    }
+    if (bytes >= m_buffer.size()) {
+        // Too big to be worth buffering
+        if (fwrite(rows, 1, bytes, m_file) != bytes) {
+            printf("NumPyWriter: write to %s failed\n", m_filename.c_str());
+            m_failed = true;
             return false;
         }
+    } else {
+        memcpy(m_buffer.data() + m_buffered, rows, bytes);
+        m_buffered += bytes;
+    }
+    m_rows += count;
+    return true;
+}
 
-        // Calculate new size
-        size_t newSize = currentSize + elements;
+bool NumPyWriter::writeBuffer() {
+    if (m_buffered == 0) {
+        return true;
+    }
 
-        // Rewrite the header with the new size
-        file.seekp(0);
-        writeHeader(file, newSize, dataType, FIXED_HEADER_SIZE);
+    bool ok = fwrite(m_buffer.data(), 1, m_buffered, m_file) == m_buffered;
+    if (!ok) {
+        // The header must not count rows that never reached the file
+        printf("NumPyWriter: write to %s failed\n", m_filename.c_str());
+        m_rows -= m_buffered / m_rowBytes;
+        m_failed = true;
+    }
+    m_buffered = 0;
+    return ok;
+}
 
-        // Seek to end and append data
-        file.seekp(0, std::ios::end);
-        file.write(reinterpret_cast<const char*>(data), elements * typeInfo.size);
+bool NumPyWriter::flush() {
+    if (!m_file) {
+        return false;
+    }
 
-        return file.good();
+    bool ok = writeBuffer();
+    if (m_rows != m_headerRows) {
+        std::vector<size_t> shape(1, (size_t)m_rows);
+        shape.insert(shape.end(), m_rowShape.begin(), m_rowShape.end());
+        std::string header = buildHeader(m_descr, shape, m_headerBytes);
+
+        if (fseek(m_file, 0, SEEK_SET) != 0 || fwrite(header.data(), 1, header.length(), m_file) != header.length()
+            || fseek(m_file, 0, SEEK_END) != 0) {
+            printf("NumPyWriter: header update of %s failed\n", m_filename.c_str());
+            m_failed = true;
+            ok = false;
+        } else {
+            m_headerRows = m_rows;
+        }
     }
+    return fflush(m_file) == 0 && ok;
 }
 
-/**
- * Helper function to write a NumPy header with specified size
- */
-void NumPyIO::writeHeader(std::ostream& file, size_t elements, NumPyDataType dataType, size_t fixedHeaderSize) {
-    auto typeInfoIt = TYPE_INFO.find(dataType);
-    const TypeInfo& typeInfo = typeInfoIt->second;
+bool NumPyWriter::close() {
+    if (!m_file) {
+        return false;
+    }
 
-    // Check endianness
-    uint16_t endianCheck = 1;
-    char endianness = *reinterpret_cast<char*>(&endianCheck) ? '<' : '>';
-
-    // Create header with 1D shape
-    std::string header = "{'descr': '";
-    header += endianness;
-    header += typeInfo.numpyDescr;
-    header += "', 'fortran_order': False, 'shape': (";
-    header += std::to_string(elements);
-    header += ",)}";
-
-    // Pad header to fixed size (leave space for one newline)
-    size_t paddingNeeded = fixedHeaderSize - 1 - header.length();
-    header.append(paddingNeeded, ' ');
-    header += '\n';
-
-    // Magic string for .npy format
-    const char magic[] = "\x93NUMPY";
-    file.write(magic, 6);
-
-    // Version 1.0
-    const uint8_t majorVersion = 1;
-    const uint8_t minorVersion = 0;
-    file.write(reinterpret_cast<const char*>(&majorVersion), 1);
-    file.write(reinterpret_cast<const char*>(&minorVersion), 1);
-
-    // Header length (fixed)
-    uint16_t headerLenLE = (uint16_t)fixedHeaderSize;
-    file.write(reinterpret_cast<char*>(&headerLenLE), 2);
-
-    // Header
-    file.write(header.c_str(), header.length());
+    flush();
+    if (fclose(m_file) != 0) {
+        m_failed = true;
+    }
+    m_file = nullptr;
+    m_buffer.clear();
+    m_buffer.shrink_to_fit();
+    return !m_failed;
 }
-// For backward compatibility, provide the original function names
-bool NumPyIO::SaveFloatArrayToNumpy(const std::string& filename, const float* data, const std::vector<size_t>& shape) {
-    return SaveArrayToNumpy(filename, data, shape, NumPyDataType::FLOAT32);
+
+bool NumPyWriter::isOpen() const {
+    return m_file != nullptr;
 }
 
-float* NumPyIO::ReadNumpyToFloatArray(const std::string& filename, float* data, std::vector<size_t>& shape) {
-    return static_cast<float*>(ReadNumpyToArray(filename, data, shape, NumPyDataType::FLOAT32));
+uint64_t NumPyWriter::rows() const {
+    return m_rows;
 }
 
-// Add convenience functions for int32
-bool NumPyIO::SaveInt32ArrayToNumpy(const std::string& filename, const int32_t* data, const std::vector<size_t>& shape) {
-    return SaveArrayToNumpy(filename, data, shape, NumPyDataType::INT32);
+size_t NumPyWriter::rowBytes() const {
+    return m_rowBytes;
 }
 
-int32_t* NumPyIO::ReadNumpyToInt32Array(const std::string& filename, int32_t* data, std::vector<size_t>& shape) {
-    return static_cast<int32_t*>(ReadNumpyToArray(filename, data, shape, NumPyDataType::INT32));
-}
\ No newline at end of file
+NumPyMappedArray::NumPyMappedArray()
+    : m_base(nullptr)
+    , m_size(0)
+#ifdef _WIN32
+    , m_mapping(nullptr)
+#endif
+    , m_data(nullptr)
+    , m_type(NumPyDataType::FLOAT32)
+    , m_elements(0)
+    , m_rowElements(0) {
+}
+
+NumPyMappedArray::~NumPyMappedArray() {
+    close();
+}
+
+bool NumPyMappedArray::open(const std::string& filename) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        printf("NumPyMappedArray: can't open %s (error %lu)\n", filename.c_str(), GetLastError());
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart < 12 || (uint64_t)size.QuadPart > SIZE_MAX) {
+        printf("NumPyMappedArray: %s is not a NumPy file\n", filename.c_str());
+        CloseHandle(file);
+        return false;
+    }
+    m_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!m_mapping) {
+        printf("NumPyMappedArray: can't map %s (error %lu)\n", filename.c_str(), GetLastError());
+        return false;
+    }
+    m_base = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_base) {
+        printf("NumPyMappedArray: can't map %s (error %lu)\n", filename.c_str(), GetLastError());
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+        return false;
+    }
+    m_size = (size_t)size.QuadPart;
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        perror("NumPyMappedArray: open");
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 12) {
+        printf("NumPyMappedArray: %s is not a NumPy file\n", filename.c_str());
+        ::close(fd);
+        return false;
+    }
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        perror("NumPyMappedArray: mmap");
+        return false;
+    }
+    m_base = base;
+    m_size = (size_t)st.st_size;
+#endif
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(m_base);
+    size_t headerBytes = parsePreamble(bytes, m_size);
+    std::string descr;
+    bool fortranOrder = false;
+    bool swapped = false;
+    if (headerBytes == 0 || headerBytes > m_size
+        || !parseHeader(std::string(reinterpret_cast<const char*>(bytes), headerBytes), descr, fortranOrder, m_shape)
+        || m_shape.empty() || !typeForDescr(descr, &m_type, &swapped)) {
+        printf("NumPyMappedArray: %s is not a NumPy file of a supported type\n", filename.c_str());
+        close();
+        return false;
+    }
+
+    // A view can't swap, reorder or realign elements without copying them
+    const size_t itemSize = TYPE_INFO.find(m_type)->second.size;
+    if (swapped || fortranOrder || headerBytes % itemSize != 0) {
+        printf("NumPyMappedArray: %s is byte-swapped, in Fortran order or unaligned; use ReadNumpyToArray\n",
+               filename.c_str());
+        close();
+        return false;
+    }
+
+    m_rowElements = 1;
+    for (size_t i = 1; i < m_shape.size(); i++) {
+        m_rowElements *= m_shape[i];
+    }
+    m_elements = m_shape[0] * m_rowElements;
+    if (m_elements * itemSize > m_size - headerBytes) {
+        printf("NumPyMappedArray: %s is shorter than its shape\n", filename.c_str());
+        close();
+        return false;
+    }
+
+    m_data = bytes + headerBytes;
+    return true;
+}
+
+void NumPyMappedArray::close() {
+    if (!m_base) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(m_base);
+    CloseHandle(m_mapping);
+    m_mapping = nullptr;
+#else
+    munmap(m_base, m_size);
+#endif
+    m_base = nullptr;
+    m_size = 0;
+    m_data = nullptr;
+    m_shape.clear();
+    m_elements = 0;
+    m_rowElements = 0;
+}
+
+bool NumPyMappedArray::isOpen() const {
+    return m_data != nullptr;
+}
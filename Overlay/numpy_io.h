@@ -1,14 +1,23 @@
 #pragma once
 
 #include <cstdint>
+#include <cstdio>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+#define NUMPY_WRITER_BUFFER_BYTES (1024 * 1024) // Appends collected before one write to the file
+
 // Enum for supported NumPy data types
 enum class NumPyDataType {
     FLOAT32,
     INT32,
-    // Add more types as needed
+    UINT8,
+    UINT16,
+    UINT32,
+    FLOAT16, // Stored and viewed as raw uint16_t halves
+    FLOAT64,
 };
 
 // Structure to hold type information
@@ -21,7 +30,39 @@ struct TypeInfo {
 static const std::unordered_map<NumPyDataType, TypeInfo> TYPE_INFO = {
     { NumPyDataType::FLOAT32, { "f4", sizeof(float) } },
     { NumPyDataType::INT32, { "i4", sizeof(int32_t) } },
-    // Add more types as needed
+    { NumPyDataType::UINT8, { "u1", sizeof(uint8_t) } },
+    { NumPyDataType::UINT16, { "u2", sizeof(uint16_t) } },
+    { NumPyDataType::UINT32, { "u4", sizeof(uint32_t) } },
+    { NumPyDataType::FLOAT16, { "f2", sizeof(uint16_t) } },
+    { NumPyDataType::FLOAT64, { "f8", sizeof(double) } },
+};
+
+// C++ element type of each NumPy data type, for typed views
+template <typename T>
+struct NumPyTypeOf;
+template <>
+struct NumPyTypeOf<float> {
+    static const NumPyDataType value = NumPyDataType::FLOAT32;
+};
+template <>
+struct NumPyTypeOf<int32_t> {
+    static const NumPyDataType value = NumPyDataType::INT32;
+};
+template <>
+struct NumPyTypeOf<uint8_t> {
+    static const NumPyDataType value = NumPyDataType::UINT8;
+};
+template <>
+struct NumPyTypeOf<uint16_t> {
+    static const NumPyDataType value = NumPyDataType::UINT16;
+};
+template <>
+struct NumPyTypeOf<uint32_t> {
+    static const NumPyDataType value = NumPyDataType::UINT32;
+};
+template <>
+struct NumPyTypeOf<double> {
+    static const NumPyDataType value = NumPyDataType::FLOAT64;
 };
 
 class NumPyIO {
@@ -47,9 +88,125 @@ public:
     static int32_t* ReadNumpyToInt32Array(const std::string& filename, int32_t* data,
                                           std::vector<size_t>& shape);
 
+    // Opens and closes the file on every call; use NumPyWriter to append repeatedly
     static bool AppendToNumpyArray(const std::string& filename, const void* data,
                                    size_t elements, NumPyDataType dataType);
+};
+
+/**
+ * @brief Appends rows to a .npy file that stays open
+ *
+ * The array's first axis grows with each append; the other axes are the row
+ * shape given to open(). Appends are collected in a NUMPY_WRITER_BUFFER_BYTES
+ * buffer and written in one go, and the header's row count is only patched
+ * on flush() and close(). Until then the file is still a valid .npy; it just
+ * reports the rows of the last flush. The header has room for any row count,
+ * so patching never moves the data.
+ */
+class NumPyWriter {
+public:
+    NumPyWriter();
+    ~NumPyWriter();
+
+    /**
+     * @brief Create the file, or with append continue an existing one
+     *
+     * @param rowShape Shape of one row, e.g. {240, 240} for images; empty for scalars
+     * @param append Keep an existing file's rows; its data type and row shape must match
+     * @return false if the file couldn't be opened or doesn't match
+     */
+    bool open(const std::string& filename, NumPyDataType dataType,
+              const std::vector<size_t>& rowShape = std::vector<size_t>(), bool append = false);
+
+    // Append count rows of rowBytes() each
+    bool append(const void* rows, size_t count);
+
+    // Write buffered rows and patch the header's row count
+    bool flush();
+
+    // Flush and close; false if anything since open() failed to write
+    bool close();
+
+    bool isOpen() const;
+    uint64_t rows() const;
+    size_t rowBytes() const;
 
 private:
-    static void writeHeader(std::ostream& file, size_t elements, NumPyDataType dataType, size_t fixedHeaderSize);
+    bool writeBuffer();
+
+    FILE* m_file;
+    std::string m_filename;
+    std::string m_descr;
+    std::vector<size_t> m_rowShape;
+    size_t m_rowBytes;
+    size_t m_headerBytes; // Preamble, header dict and padding; the data starts here
+    uint64_t m_rows;
+    uint64_t m_headerRows; // Row count the header on disk shows
+    std::vector<char> m_buffer;
+    size_t m_buffered;
+    bool m_failed;
+};
+
+/**
+ * @brief Read-only memory mapping of a .npy file
+ *
+ * data<T>() and row<T>() point straight into the mapping, so nothing is
+ * copied or byte-swapped. Files in the other byte order, in Fortran order or
+ * whose data isn't aligned for its type can't be opened this way; read them
+ * with NumPyIO::ReadNumpyToArray instead.
+ */
+class NumPyMappedArray {
+public:
+    NumPyMappedArray();
+    ~NumPyMappedArray();
+
+    // false if the file can't be mapped (see above)
+    bool open(const std::string& filename);
+    void close();
+    bool isOpen() const;
+
+    NumPyDataType dataType() const {
+        return m_type;
+    }
+
+    const std::vector<size_t>& shape() const {
+        return m_shape;
+    }
+
+    size_t elements() const {
+        return m_elements;
+    }
+
+    // Elements in row order; nullptr if T isn't the file's type
+    template <typename T>
+    const T* data() const {
+        return matches<T>() ? reinterpret_cast<const T*>(m_data) : nullptr;
+    }
+
+    // Row index of the first axis
+    template <typename T>
+    const T* row(size_t index) const {
+        return matches<T>() && index < m_shape[0] ? reinterpret_cast<const T*>(m_data) + index * m_rowElements : nullptr;
+    }
+
+    const void* rawData() const {
+        return m_data;
+    }
+
+private:
+    template <typename T>
+    bool matches() const {
+        return m_data && (m_type == NumPyTypeOf<T>::value || (m_type == NumPyDataType::FLOAT16 && std::is_same<T, uint16_t>::value));
+    }
+
+    void* m_base;
+    size_t m_size;
+#ifdef _WIN32
+    void* m_mapping;
+#endif
+    const unsigned char* m_data;
+    NumPyDataType m_type;
+    std::vector<size_t> m_shape;
+    size_t m_elements;
+    size_t m_rowElements;
 };
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "one_euro_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define ONE_EURO_TWO_PI 6.28318530717958647692f
+#define ONE_EURO_MAX_GAP_MS 3000 // Longer gaps (stalls, reconnects) restart the filter
+
+OneEuroFilterBank::OneEuroFilterBank(size_t channels, float minCutoff, float beta, float dCutoff)
+    : m_channels(channels)
+    , m_minCutoff(channels, minCutoff)
+    , m_beta(channels, beta)
+    , m_dCutoff(channels, dCutoff)
+    , m_xPrev(channels, 0.0f)
+    , m_dxPrev(channels, 0.0f)
+    , m_lastTimestampMs(0)
+    , m_initialized(false) {
+}
+
+void OneEuroFilterBank::setChannelParams(size_t channel, float minCutoff, float beta, float dCutoff) {
+    if (channel >= m_channels) {
+        return;
+    }
+
+    m_minCutoff[channel] = minCutoff;
+    m_beta[channel] = beta;
+    m_dCutoff[channel] = dCutoff;
+}
+
+void OneEuroFilterBank::filter(const float* input, float* output, uint64_t timestampMs) {
+    // A clock that went backwards or a long gap leaves nothing worth smoothing
+    // against; start over from this sample rather than holding a stale output
+    if (m_initialized && (timestampMs < m_lastTimestampMs || timestampMs - m_lastTimestampMs > ONE_EURO_MAX_GAP_MS)) {
+        m_initialized = false;
+    }
+
+    if (!m_initialized) {
+        memmove(output, input, m_channels * sizeof(float));
+        memcpy(m_xPrev.data(), input, m_channels * sizeof(float));
+        std::fill(m_dxPrev.begin(), m_dxPrev.end(), 0.0f);
+        m_lastTimestampMs = timestampMs;
+        m_initialized = true;
+        return;
+    }
+
+    // A duplicate timestamp would divide by zero; hold the last output (the
+    // Python filter skips these samples too)
+    if (timestampMs == m_lastTimestampMs) {
+        memcpy(output, m_xPrev.data(), m_channels * sizeof(float));
+        return;
+    }
+
+    const float te = (timestampMs - m_lastTimestampMs) * 0.001f;
+    const float invTe = 1.0f / te;
+    const float rScale = ONE_EURO_TWO_PI * te;
+    m_lastTimestampMs = timestampMs;
+
+    const float* minCutoff = m_minCutoff.data();
+    const float* beta = m_beta.data();
+    const float* dCutoff = m_dCutoff.data();
+    float* xPrev = m_xPrev.data();
+    float* dxPrev = m_dxPrev.data();
+
+    // Branch-free per-channel math over contiguous arrays
+    for (size_t i = 0; i < m_channels; i++) {
+        const float x = input[i];
+
+        // Filtered derivative
+        const float rd = rScale * dCutoff[i];
+        const float ad = rd / (rd + 1.0f);
+        const float dx = (x - xPrev[i]) * invTe;
+        const float dxHat = ad * dx + (1.0f - ad) * dxPrev[i];
+
+        // Filtered signal with speed-adaptive cutoff
+        const float cutoff = minCutoff[i] + beta[i] * std::fabs(dxHat);
+        const float r = rScale * cutoff;
+        const float a = r / (r + 1.0f);
+        const float xHat = a * x + (1.0f - a) * xPrev[i];
+
+        xPrev[i] = xHat;
+        dxPrev[i] = dxHat;
+        output[i] = xHat;
+    }
+}
+
+void OneEuroFilterBank::reset() {
+    m_initialized = false;
+}
+
+size_t OneEuroFilterBank::getChannelCount() const {
+    return m_channels;
+}
@@ -0,0 +1,66 @@
+#ifndef ONE_EURO_FILTER_H
+#define ONE_EURO_FILTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief One Euro filter over several channels at once
+ *
+ * C++ port of Inference/one_euro_filter.py. Every channel of a frame (pitch,
+ * yaw, convergence, lids, brows...) is filtered in one call. State and
+ * parameters are kept as one array per field so the per-channel loops are
+ * straight float math the compiler can vectorize.
+ *
+ * Timestamps come from the caller, which should use one monotonic clock (e.g.
+ * the host time each frame was picked up) so irregular frame spacing is
+ * handled correctly. A timestamp that goes backwards or jumps by more than a
+ * few seconds resets the filter instead of being dropped.
+ */
+class OneEuroFilterBank {
+public:
+    /**
+     * @brief Create a bank with the same parameters on every channel
+     * @param channels Number of values filtered per call
+     * @param minCutoff Minimum cutoff frequency in Hz
+     * @param beta Speed coefficient; higher values reduce lag on fast movement
+     * @param dCutoff Cutoff frequency for the derivative in Hz
+     */
+    OneEuroFilterBank(size_t channels, float minCutoff = 1.0f, float beta = 0.0f, float dCutoff = 1.0f);
+
+    /**
+     * @brief Override the parameters of one channel
+     */
+    void setChannelParams(size_t channel, float minCutoff, float beta, float dCutoff);
+
+    /**
+     * @brief Filter one frame
+     * @param input getChannelCount() raw values
+     * @param output getChannelCount() filtered values (may alias input)
+     * @param timestampMs Sample time in milliseconds
+     */
+    void filter(const float* input, float* output, uint64_t timestampMs);
+
+    // Forget history; the next sample passes through unfiltered
+    void reset();
+
+    size_t getChannelCount() const;
+
+private:
+    size_t m_channels;
+
+    // Per-channel parameters
+    std::vector<float> m_minCutoff;
+    std::vector<float> m_beta;
+    std::vector<float> m_dCutoff;
+
+    // Per-channel state
+    std::vector<float> m_xPrev;
+    std::vector<float> m_dxPrev;
+
+    uint64_t m_lastTimestampMs;
+    bool m_initialized;
+};
+
+#endif // ONE_EURO_FILTER_H
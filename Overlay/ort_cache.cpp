@@ -0,0 +1,123 @@
+#include "ort_cache.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME        1099511628211ULL
+
+#ifdef _WIN32
+typedef std::wstring OrtPathString;
+#else
+typedef std::string OrtPathString;
+#endif
+
+static OrtPathString toOrtPath(const std::string& path) {
+    return OrtPathString(path.begin(), path.end());
+}
+
+uint64_t HashModelFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return 0;
+    }
+
+    uint64_t hash = FNV_OFFSET_BASIS;
+    std::vector<char> chunk(64 * 1024);
+    while (file) {
+        file.read(chunk.data(), chunk.size());
+        std::streamsize count = file.gcount();
+        for (std::streamsize i = 0; i < count; i++) {
+            hash ^= (uint8_t)chunk[i];
+            hash *= FNV_PRIME;
+        }
+    }
+
+    return hash;
+}
+
+std::string GetOptimizedModelCachePath(const std::string& modelPath) {
+    uint64_t hash = HashModelFile(modelPath);
+    if (hash == 0) {
+        return "";
+    }
+
+    char suffix[128];
+    snprintf(suffix, sizeof(suffix), ".%016" PRIx64 ".ort-%s.opt.onnx", hash, OrtGetApiBase()->GetVersionString());
+    return modelPath + suffix;
+}
+
+bool FileExists(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return file.good();
+}
+
+bool RegisterPresizedCpuArena(const OrtApi* api, OrtEnv* env, OrtSessionOptions* options) {
+    OrtMemoryInfo* memory_info = NULL;
+    OrtArenaCfg* arena_cfg = NULL;
+
+    OrtStatus* status = api->CreateCpuMemoryInfo(OrtArenaAllocator, OrtMemTypeDefault, &memory_info);
+    if (status == NULL) {
+        // max_mem 0 = no limit, strategy 1 = kSameAsRequested, max_dead_bytes -1 = default
+        status = api->CreateArenaCfg(0, 1, ORT_ARENA_INITIAL_CHUNK_BYTES, -1, &arena_cfg);
+    }
+    if (status == NULL) {
+        status = api->CreateAndRegisterAllocator(env, memory_info, arena_cfg);
+    }
+    if (status == NULL) {
+        status = api->AddSessionConfigEntry(options, "session.use_env_allocators", "1");
+    }
+
+    bool ok = (status == NULL);
+    if (!ok) {
+        fprintf(stderr, "Could not pre-size CPU arena: %s\n", api->GetErrorMessage(status));
+        api->ReleaseStatus(status);
+    }
+
+    if (arena_cfg) {
+        api->ReleaseArenaCfg(arena_cfg);
+    }
+    if (memory_info) {
+        api->ReleaseMemoryInfo(memory_info);
+    }
+    return ok;
+}
+
+bool WriteOptimizedModelCache(const OrtApi* api, OrtEnv* env, const std::string& modelPath, const std::string& cachePath) {
+    if (cachePath.empty()) {
+        return false;
+    }
+
+    OrtSessionOptions* options = NULL;
+    OrtSession* session = NULL;
+    OrtPathString ortModelPath = toOrtPath(modelPath);
+    OrtPathString ortCachePath = toOrtPath(cachePath);
+
+    OrtStatus* status = api->CreateSessionOptions(&options);
+    if (status == NULL) {
+        status = api->SetSessionGraphOptimizationLevel(options, ORT_ENABLE_ALL);
+    }
+    if (status == NULL) {
+        status = api->SetOptimizedModelFilePath(options, ortCachePath.c_str());
+    }
+    if (status == NULL) {
+        // Creating the session runs the optimizer and writes the cache file
+        status = api->CreateSession(env, ortModelPath.c_str(), options, &session);
+    }
+
+    bool ok = (status == NULL);
+    if (!ok) {
+        fprintf(stderr, "Could not write optimized model cache %s: %s\n", cachePath.c_str(), api->GetErrorMessage(status));
+        api->ReleaseStatus(status);
+    }
+
+    if (session) {
+        api->ReleaseSession(session);
+    }
+    if (options) {
+        api->ReleaseSessionOptions(options);
+    }
+    return ok;
+}
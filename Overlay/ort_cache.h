@@ -0,0 +1,31 @@
+// ort_cache.h
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <onnxruntime_c_api.h>
+
+// Startup helpers shared by the trainer and the inference engine: an on-disk
+// cache of the ORT_ENABLE_ALL optimized graph and a pre-sized CPU arena.
+
+#define ORT_ARENA_INITIAL_CHUNK_BYTES (16 * 1024 * 1024) // First arena chunk, sized so steady state never extends it
+#define ORT_WARMUP_RUNS               2                  // Dummy runs before real work
+
+// 64-bit FNV-1a of the model file contents, 0 if it can't be read
+uint64_t HashModelFile(const std::string& path);
+
+// Cache file for a model's optimized graph, keyed by content hash and ORT
+// version: <model>.<hash>.ort-<version>.opt.onnx. Empty if the model can't be read.
+std::string GetOptimizedModelCachePath(const std::string& modelPath);
+
+bool FileExists(const std::string& path);
+
+// Register a shared CPU arena with a pre-sized first chunk on env and make
+// sessions created with options allocate from it. On failure the session
+// falls back to ORT's default per-session arena.
+bool RegisterPresizedCpuArena(const OrtApi* api, OrtEnv* env, OrtSessionOptions* options);
+
+// Load modelPath once on the CPU provider with ORT_ENABLE_ALL and write the
+// optimized graph to cachePath, so the next inference launch skips optimization
+bool WriteOptimizedModelCache(const OrtApi* api, OrtEnv* env, const std::string& modelPath, const std::string& cachePath);
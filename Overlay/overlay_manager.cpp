@@ -121,14 +121,11 @@ void OverlayManager::StartRoutine(uint32_t routine) {
 
     }*/
 
-    RoutineController::m_fixedStageDuration = 0.5 + routine;
+    g_routineController.setFixedStageDuration(0.5 + routine);
 
     g_routineController.loadRoutine(routine);
+    // Also resets timing and stage to start calibration from beginning
     g_routineController.reset();
-    // Reset timing variables to start calibration from beginning
-    RoutineController::m_globalAdvancedTime = 0.0;
-    RoutineController::m_stageStartTime = 0.0;
-    RoutineController::m_routineStage = 0;
 }
 
 bool OverlayManager::Initialize() {
@@ -848,7 +845,7 @@ void OverlayManager::Update() {
         if (needsTextureRecreation) {
             // Recreate texture for dilation stages or when transitioning in/out of dilation
             printf("Recreating textures: isDilationStage=%d, lastState=0x%08X, currentState=0x%08X, stage=%d\n",
-                   isDilationStage, lastDilationState, s_routineState, RoutineController::m_routineStage);
+                   isDilationStage, lastDilationState, s_routineState, g_routineController.getRoutineStage());
             CreateTargetTexture();
             UpdateOverlayTexture();
             lastDilationState = s_routineState;
@@ -873,7 +870,7 @@ void OverlayManager::UpdateOverlayTransform(const MU_Vector3& targetPosition) {
 
             // Show text during notification stages but hide during action stages
             // Check current routine stage to determine if we should show text
-            bool isNotificationStage = (RoutineController::m_routineStage == DILATION_NOTIFY_2_STAGE || RoutineController::m_routineStage == DILATION_NOTIFY_3_STAGE);
+            bool isNotificationStage = (g_routineController.getRoutineStage() == DILATION_NOTIFY_2_STAGE || g_routineController.getRoutineStage() == DILATION_NOTIFY_3_STAGE);
             if (isNotificationStage) {
                 vr::VROverlay()->SetOverlayWidthInMeters(m_ulTextOverlayHandle, 2.0f); // Show text overlay during notifications
             } else {
@@ -886,7 +883,7 @@ void OverlayManager::UpdateOverlayTransform(const MU_Vector3& targetPosition) {
             vr::VROverlay()->SetOverlayWidthInMeters(m_ulTextOverlayHandle, 1.0f);
 
             // Show/hide video overlay based on onboarding stage
-            bool showVideo = ShouldShowVideoForStage(RoutineController::m_routineStage);
+            bool showVideo = ShouldShowVideoForStage(g_routineController.getRoutineStage());
             if (showVideo && g_VideoEnabled) {
                 vr::VROverlay()->SetOverlayWidthInMeters(m_ulVideoOverlayHandle, 0.5f);
             } else {
@@ -941,6 +938,9 @@ void OverlayManager::UpdateOverlayTransform(const MU_Vector3& targetPosition) {
             OverlayManager::s_routineYaw = yaw;
             OverlayManager::s_routineDistance = distance;
             g_routineController.step();
+            if (g_routineController.isComplete()) {
+                OverlayManager::s_routineState = FLAG_ROUTINE_COMPLETE;
+            }
         } else {
             // Normal HMD-relative positioning
             if (m_targetIsPreview) {
@@ -959,6 +959,7 @@ void OverlayManager::UpdateOverlayTransform(const MU_Vector3& targetPosition) {
                     OverlayManager::s_routineYaw = yaw;
                     OverlayManager::s_routineDistance = distance;
                     OverlayManager::s_routineState = pos.state;
+                    OverlayManager::s_routineFadeProgress = g_routineController.getFadeProgress();
                 }
             }
 
@@ -1301,7 +1302,7 @@ bool OverlayManager::CreateTargetTexture() {
     GLenum glError = glGetError();
     if (glError != GL_NO_ERROR) {
         printf("DEBUG: OpenGL error %d when creating textures in stage %d\n",
-               glError, RoutineController::m_routineStage);
+               glError, g_routineController.getRoutineStage());
         printf("DEBUG: Texture dimensions: Target=%dx%d, Border=%dx%d, Text=%dx%d\n",
                m_nTextureWidth, m_nTextureHeight,
                m_borderTextureWidth, m_borderTextureHeight,
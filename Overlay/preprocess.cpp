@@ -0,0 +1,105 @@
+#include "preprocess.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Fixed-point luma weights (14-bit), the same ones OpenCV uses for 8-bit input
+#define GRAY_SHIFT    14
+#define GRAY_WEIGHT_0 1868 // byte 0 (treated as B)
+#define GRAY_WEIGHT_1 9617 // byte 1 (G)
+#define GRAY_WEIGHT_2 4899 // byte 2 (treated as R)
+
+void PreprocessToGray(const uint32_t* pixels, int width, int height, uint8_t* gray) {
+    const size_t count = (size_t)width * height;
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(pixels);
+
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* px = src + i * 4;
+        gray[i] = (uint8_t)((px[0] * GRAY_WEIGHT_0 + px[1] * GRAY_WEIGHT_1 + px[2] * GRAY_WEIGHT_2 + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT);
+    }
+}
+
+void PreprocessEqualize(uint8_t* gray, size_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    uint32_t hist[256] = { 0 };
+    for (size_t i = 0; i < count; i++) {
+        hist[gray[i]]++;
+    }
+
+    int first = 0;
+    while (hist[first] == 0) {
+        first++;
+    }
+
+    // Flat image, nothing to stretch
+    if (hist[first] == count) {
+        std::fill(gray, gray + count, (uint8_t)first);
+        return;
+    }
+
+    uint8_t lut[256] = { 0 };
+    const float scale = 255.0f / (float)(count - hist[first]);
+    uint32_t sum = 0;
+    for (int i = first + 1; i < 256; i++) {
+        sum += hist[i];
+        const float value = std::nearbyint(sum * scale);
+        lut[i] = (uint8_t)std::min(255.0f, std::max(0.0f, value));
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        gray[i] = lut[gray[i]];
+    }
+}
+
+void PreprocessResample(const uint8_t* gray, int width, int height, float* dst, int resolution) {
+    const float x_scale = (float)width / resolution;
+    const float y_scale = (float)height / resolution;
+
+    for (int y = 0; y < resolution; y++) {
+        const int src_y = std::max(0, std::min((int)(y * y_scale), height - 1));
+        const uint8_t* src_row = gray + (size_t)src_y * width;
+        float* dst_row = dst + (size_t)y * resolution;
+
+        for (int x = 0; x < resolution; x++) {
+            const int src_x = std::max(0, std::min((int)(x * x_scale), width - 1));
+            dst_row[x] = src_row[src_x] * (1.0f / 255.0f);
+        }
+    }
+}
+
+void PreprocessResampleGray(const uint8_t* gray, int width, int height, uint8_t* dst, int dstWidth, int dstHeight) {
+    const float x_scale = (float)width / dstWidth;
+    const float y_scale = (float)height / dstHeight;
+
+    for (int y = 0; y < dstHeight; y++) {
+        const int src_y = std::max(0, std::min((int)(y * y_scale), height - 1));
+        const uint8_t* src_row = gray + (size_t)src_y * width;
+        uint8_t* dst_row = dst + (size_t)y * dstWidth;
+
+        for (int x = 0; x < dstWidth; x++) {
+            const int src_x = std::max(0, std::min((int)(x * x_scale), width - 1));
+            dst_row[x] = src_row[src_x];
+        }
+    }
+}
+
+void PreprocessPlaneToInput(const uint8_t* plane, size_t count, float* dst) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = plane[i] * (1.0f / 255.0f);
+    }
+}
+
+void PreprocessEyeImage(const uint32_t* pixels, int width, int height,
+                        float* dst, int resolution, std::vector<uint8_t>& scratch) {
+    const size_t count = (size_t)width * height;
+    if (scratch.size() < count) {
+        scratch.resize(count);
+    }
+
+    PreprocessToGray(pixels, width, height, scratch.data());
+    PreprocessEqualize(scratch.data(), count);
+    PreprocessResample(scratch.data(), width, height, dst, resolution);
+}
@@ -0,0 +1,37 @@
+// preprocess.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Shared image preprocessing used by both the trainer and the native
+// inference engine. Training and inference must feed the model identical
+// tensors, so both sides go through these kernels.
+
+#define PREPROCESS_RESOLUTION 128 // Model input width/height
+
+// Convert a 4-byte-per-pixel buffer (as produced by TJPF_RGBX decodes) to
+// 8-bit luma. Channel order matches OpenCV's COLOR_BGRA2GRAY applied to the
+// same bytes, which is what the model was trained on.
+void PreprocessToGray(const uint32_t* pixels, int width, int height, uint8_t* gray);
+
+// In-place histogram equalization, equivalent to cv::equalizeHist
+void PreprocessEqualize(uint8_t* gray, size_t count);
+
+// Nearest-neighbour resample to resolution x resolution, scaled to [0, 1]
+void PreprocessResample(const uint8_t* gray, int width, int height, float* dst, int resolution);
+
+// Same sampling as PreprocessResample, but to an 8-bit dstWidth x dstHeight
+// plane. Used at ingestion so consumers get a ready model-sized frame.
+void PreprocessResampleGray(const uint8_t* gray, int width, int height, uint8_t* dst, int dstWidth, int dstHeight);
+
+// Scale an 8-bit plane from PreprocessResampleGray to [0, 1]; together they
+// give exactly what PreprocessResample produces
+void PreprocessPlaneToInput(const uint8_t* plane, size_t count, float* dst);
+
+// Full eye pipeline: gray -> equalize -> resample into one model input plane.
+// scratch is reused between calls to avoid per-frame allocations.
+void PreprocessEyeImage(const uint32_t* pixels, int width, int height,
+                        float* dst, int resolution, std::vector<uint8_t>& scratch);
+
@@ -1,24 +1,90 @@
 #include "rest_server.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 
 #ifdef _WIN32
 #pragma comment(lib, "ws2_32.lib")
 #define SOCKET_ERROR_VALUE INVALID_SOCKET
 #define close_socket       closesocket
+#define poll               WSAPoll
+typedef WSAPOLLFD pollfd_t;
 #else
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #define SOCKET_ERROR_VALUE (-1)
 #define close_socket       close
+typedef struct pollfd pollfd_t;
 #endif
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SO_NOSIGPIPE on macOS, no SIGPIPE on Windows
+#endif
+
+struct HTTPServer::Connection {
+    socket_t sock;
+    std::string in;                                    // Received bytes not yet taken as a request
+    std::deque<std::shared_ptr<const std::string>> out; // Response bytes not yet sent, shared with other stream clients
+    size_t out_offset = 0;                             // Bytes of out.front() already sent
+    size_t out_bytes = 0;                              // Unsent bytes in out
+    bool busy = false;                                 // A request of this connection is with a worker
+    bool close_after = false;                          // Close once out is sent
+    Stream* stream = nullptr;                          // Stream this connection is a client of
+    uint64_t stream_sequence = 0;                      // Last chunk of the stream queued here
+    uint64_t last_active_ms;
+};
+
+static uint64_t steadyNowMs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool set_non_blocking(socket_t sock) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+static bool would_block() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+static std::string to_lower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return (char)tolower(c); });
+    return value;
+}
+
 HTTPServer::HTTPServer(int port)
     : port_(port)
-    , running_(false) {
+    , running_(false)
+    , listen_socket_(SOCKET_ERROR_VALUE)
+    , wake_socket_(SOCKET_ERROR_VALUE)
+    , next_connection_id_(1) {
+    MetricsRegistry& metrics = MetricsRegistry::global();
+    accepted_metric_ = &metrics.counter("baballs_http_connections_accepted_total", "Connections accepted by the REST server");
+    connections_metric_ = &metrics.gauge("baballs_http_connections", "Open REST server connections, stream clients included");
+    stream_clients_metric_ = &metrics.gauge("baballs_http_stream_clients", "Clients of stream endpoints (events, previews)");
+    protocol_errors_metric_ = &metrics.counter("baballs_http_protocol_errors_total", "Requests rejected as malformed or too large");
+    unknown_requests_metric_ = &metrics.counter("baballs_http_unknown_requests_total", "Requests for a path or method with no handler");
 #ifdef _WIN32
     WSADATA wsaData;
     if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
@@ -34,12 +100,48 @@ HTTPServer::~HTTPServer() {
 #endif
 }
 
-void HTTPServer::register_handler(const std::string& path, RequestHandler handler) {
+void HTTPServer::register_handler(const std::string& path, RequestHandler handler, bool concurrent) {
     get_handlers_[path] = handler;
+    add_route("GET", path, concurrent);
 }
 
-void HTTPServer::register_post_handler(const std::string& path, PostRequestHandler handler) {
+void HTTPServer::register_post_handler(const std::string& path, PostRequestHandler handler, bool concurrent) {
     post_handlers_[path] = handler;
+    add_route("POST", path, concurrent);
+}
+
+void HTTPServer::add_route(const std::string& method, const std::string& path, bool concurrent) {
+    MetricLabels labels = { { "method", method }, { "path", path } };
+    Route& route = routes_[method + " " + path];
+    route.concurrent = concurrent;
+    route.lock.reset(new std::mutex());
+    route.requests = &MetricsRegistry::global().counter("baballs_http_requests_total", "REST requests handled", labels);
+    route.seconds = &MetricsRegistry::global().histogram("baballs_http_request_seconds", "REST handler time, including any wait for another handler to finish", MetricsLatencyBuckets, labels);
+}
+
+void HTTPServer::register_stream(const std::string& path, const std::string& content_type) {
+    std::unique_ptr<Stream>& stream = streams_[path];
+    stream.reset(new Stream());
+    stream->content_type = content_type;
+}
+
+void HTTPServer::publish(const std::string& path, std::shared_ptr<const std::string> data) {
+    auto it = streams_.find(path);
+    if (it == streams_.end() || !data) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        Stream* stream = it->second.get();
+        stream->latest = data;
+        stream->sequence++;
+        if (!running_ || stream->clients == 0) {
+            return;
+        }
+        published_.push_back(Published { stream, stream->sequence, std::move(data) });
+    }
+    wake();
 }
 
 unsigned long ip_address_to_uint(const char* ip_address) {
@@ -50,93 +152,438 @@ unsigned long ip_address_to_uint(const char* ip_address) {
     return addr.s_addr;
 }
 
+size_t HTTPServer::stream_clients(const std::string& path) const {
+    auto it = streams_.find(path);
+    return it == streams_.end() ? 0 : it->second->clients.load();
+}
+
 void HTTPServer::start() {
-    // Start the server in a new thread
-    server_thread = std::thread([this]() {
-        socket_t server_socket = socket(AF_INET, SOCK_STREAM, 0);
-        if (server_socket == SOCKET_ERROR_VALUE) {
-            throw std::runtime_error("Failed to create socket");
+    if (running_) {
+        return;
+    }
+
+    listen_socket_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_socket_ == SOCKET_ERROR_VALUE) {
+        throw std::runtime_error("Failed to create socket");
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = ip_address_to_uint("127.0.0.1");
+    server_addr.sin_port = htons(port_);
+
+    int opt = 1;
+    setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEADDR, (const char*)&opt, sizeof(opt));
+
+    if (bind(listen_socket_, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        close_socket(listen_socket_);
+        throw std::runtime_error("Failed to bind socket");
+    }
+
+    if (listen(listen_socket_, SOMAXCONN) < 0 || !set_non_blocking(listen_socket_)) {
+        close_socket(listen_socket_);
+        throw std::runtime_error("Failed to listen on socket");
+    }
+
+    // poll() can't wait on a condition variable, so workers wake the I/O
+    // thread with a datagram to this socket
+    wake_socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in wake_addr;
+    memset(&wake_addr, 0, sizeof(wake_addr));
+    wake_addr.sin_family = AF_INET;
+    wake_addr.sin_addr.s_addr = ip_address_to_uint("127.0.0.1");
+    socklen_t wake_len = sizeof(wake_addr);
+    if (wake_socket_ == SOCKET_ERROR_VALUE
+        || bind(wake_socket_, (struct sockaddr*)&wake_addr, sizeof(wake_addr)) < 0
+        || getsockname(wake_socket_, (struct sockaddr*)&wake_addr, &wake_len) < 0
+        || connect(wake_socket_, (struct sockaddr*)&wake_addr, wake_len) < 0
+        || !set_non_blocking(wake_socket_)) {
+        if (wake_socket_ != SOCKET_ERROR_VALUE) {
+            close_socket(wake_socket_);
         }
+        close_socket(listen_socket_);
+        throw std::runtime_error("Failed to create wake socket");
+    }
 
-        struct sockaddr_in server_addr;
-        memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_addr.s_addr = ip_address_to_uint("127.0.0.1");
-        server_addr.sin_port = htons(port_);
+    read_buffer_.resize(HTTP_SERVER_READ_BYTES);
+    running_ = true;
+    for (int i = 0; i < HTTP_SERVER_WORKERS; i++) {
+        workers_.emplace_back(&HTTPServer::worker_loop, this);
+    }
+    server_thread = std::thread(&HTTPServer::io_loop, this);
+    std::cout << "Server started on port " << port_ << std::endl;
+}
 
-        int opt = 1;
-        setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, (const char*)&opt, sizeof(opt));
+void HTTPServer::stop() {
+    if (running_) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            running_ = false;
+        }
+        wake();
+        request_condition_.notify_all();
 
-        if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-            close_socket(server_socket);
-            throw std::runtime_error("Failed to bind socket");
+        // Wait for the server threads to finish
+        if (server_thread.joinable()) {
+            server_thread.join();
+        }
+        for (std::thread& worker : workers_) {
+            worker.join();
         }
+        workers_.clear();
 
-        if (listen(server_socket, 10) < 0) {
-            close_socket(server_socket);
-            throw std::runtime_error("Failed to listen on socket");
+        while (!connections_.empty()) {
+            close_connection(connections_.begin());
+        }
+        requests_.clear();
+        responses_.clear();
+        published_.clear();
+        close_socket(listen_socket_);
+        close_socket(wake_socket_);
+        listen_socket_ = SOCKET_ERROR_VALUE;
+        wake_socket_ = SOCKET_ERROR_VALUE;
+        std::cout << "Server stopped" << std::endl;
+    }
+}
+
+void HTTPServer::wake() {
+    char byte = 0;
+    send(wake_socket_, &byte, 1, 0);
+}
+
+void HTTPServer::io_loop() {
+    std::vector<pollfd_t> fds;
+    std::vector<uint64_t> ids; // Connection of each entry in fds past the first two
+
+    while (running_) {
+        fds.clear();
+        ids.clear();
+
+        pollfd_t entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.fd = wake_socket_;
+        entry.events = POLLIN;
+        fds.push_back(entry);
+
+        // At the limit, new connections wait in the backlog
+        entry.fd = listen_socket_;
+        entry.events = connections_.size() < HTTP_SERVER_MAX_CONNECTIONS ? POLLIN : 0;
+        fds.push_back(entry);
+
+        for (auto& it : connections_) {
+            Connection* connection = it.second.get();
+            entry.fd = connection->sock;
+            entry.events = 0;
+            // Stop reading ahead of a busy connection once a full head is buffered
+            if (!connection->close_after && (!connection->busy || connection->in.size() < HTTP_SERVER_MAX_HEADER_BYTES)) {
+                entry.events |= POLLIN;
+            }
+            if (!connection->out.empty()) {
+                entry.events |= POLLOUT;
+            }
+            fds.push_back(entry);
+            ids.push_back(it.first);
         }
 
-        running_ = true;
-        std::cout << "Server started on port " << port_ << std::endl;
+        int ready = poll(fds.data(), (unsigned long)fds.size(), HTTP_SERVER_POLL_MS);
+        if (ready < 0 && !would_block()) {
+            std::cerr << "HTTPServer: poll failed" << std::endl;
+            break;
+        }
+        if (!running_) {
+            break;
+        }
 
-        while (running_) {
-            struct sockaddr_in client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            socket_t client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_len);
+        const uint64_t now = steadyNowMs();
 
-            if (client_socket == SOCKET_ERROR_VALUE) {
-                if (!running_)
-                    break; // Exit cleanly if we're stopping the server
+        // Responses from the workers
+        if (fds[0].revents & POLLIN) {
+            char drain[64];
+            while (recv(wake_socket_, drain, sizeof(drain), 0) > 0) {
+            }
+        }
+        std::vector<Response> responses;
+        std::vector<Published> published;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            responses.swap(responses_);
+            published.swap(published_);
+        }
+        for (Response& response : responses) {
+            auto it = connections_.find(response.connection_id);
+            if (it == connections_.end()) {
+                continue; // The client went away meanwhile
+            }
+            Connection* connection = it->second.get();
+            queue_output(connection, std::make_shared<const std::string>(std::move(response.data)));
+            connection->busy = false;
+            connection->close_after = !response.keep_alive;
+            connection->last_active_ms = now;
+            dispatch_request(it->first, connection);
+        }
+        if (!published.empty()) {
+            for (auto& it : connections_) {
+                Connection* connection = it.second.get();
+                for (Published& chunk : published) {
+                    // A client that joined after the chunk was published already got it as the latest
+                    if (connection->stream != chunk.stream || chunk.sequence <= connection->stream_sequence) {
+                        continue;
+                    }
+                    connection->stream_sequence = chunk.sequence;
+                    if (connection->out_bytes < HTTP_SERVER_STREAM_BACKLOG) {
+                        queue_output(connection, chunk.data);
+                    }
+                }
+            }
+        }
+
+        // Connections already in fds are handled below; new ones next time
+        for (size_t i = 0; i < ids.size(); i++) {
+            auto it = connections_.find(ids[i]);
+            if (it == connections_.end()) {
                 continue;
             }
+            Connection* connection = it->second.get();
+            short revents = fds[i + 2].revents;
+
+            bool alive = true;
+            if (revents & POLLIN) {
+                alive = read_connection(connection);
+                if (alive && connection->stream) {
+                    connection->in.clear(); // Nothing more is expected from a stream client
+                } else if (alive) {
+                    connection->last_active_ms = now;
+                    dispatch_request(it->first, connection);
+                }
+            } else if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                alive = false;
+            }
+            if (alive && !connection->out.empty()) {
+                alive = flush_connection(connection);
+            }
+
+            bool idle = !connection->busy && !connection->stream && connection->out.empty();
+            if (!alive || (idle && connection->close_after) || (idle && now - connection->last_active_ms >= HTTP_SERVER_IDLE_MS)) {
+                close_connection(it);
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            accept_connections();
+        }
+    }
+}
+
+void HTTPServer::accept_connections() {
+    while (connections_.size() < HTTP_SERVER_MAX_CONNECTIONS) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        socket_t client_socket = accept(listen_socket_, (struct sockaddr*)&client_addr, &client_len);
+        if (client_socket == SOCKET_ERROR_VALUE) {
+            return;
+        }
 
-            handle_connection(client_socket);
+        if (!set_non_blocking(client_socket)) {
             close_socket(client_socket);
+            continue;
         }
+        // Responses are small and written whole; don't hold them back
+        int opt = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&opt, sizeof(opt));
+#ifdef SO_NOSIGPIPE
+        setsockopt(client_socket, SOL_SOCKET, SO_NOSIGPIPE, (const char*)&opt, sizeof(opt));
+#endif
 
-        close_socket(server_socket);
-        std::cout << "Server stopped" << std::endl;
-    });
+        std::unique_ptr<Connection> connection(new Connection());
+        connection->sock = client_socket;
+        connection->last_active_ms = steadyNowMs();
+        connections_[next_connection_id_++] = std::move(connection);
+        accepted_metric_->add();
+        connections_metric_->add(1);
+    }
 }
 
-void HTTPServer::stop() {
-    if (running_) {
-        running_ = false;
+void HTTPServer::close_connection(std::map<uint64_t, std::unique_ptr<Connection>>::iterator it) {
+    if (it->second->stream) {
+        it->second->stream->clients--;
+        stream_clients_metric_->add(-1);
+    }
+    connections_metric_->add(-1);
+    close_socket(it->second->sock);
+    connections_.erase(it);
+}
 
-        // Create a connection to ourselves to unblock the accept() call
-        socket_t temp_socket = socket(AF_INET, SOCK_STREAM, 0);
-        if (temp_socket != SOCKET_ERROR_VALUE) {
-            struct sockaddr_in addr;
-            memset(&addr, 0, sizeof(addr));
-            addr.sin_family = AF_INET;
-            addr.sin_port = htons(port_);
-            addr.sin_addr.s_addr = ip_address_to_uint("127.0.0.1");
+void HTTPServer::queue_output(Connection* connection, std::shared_ptr<const std::string> data) {
+    if (data->empty()) {
+        return;
+    }
+    connection->out_bytes += data->size();
+    connection->out.push_back(std::move(data));
+}
 
-            connect(temp_socket, (struct sockaddr*)&addr, sizeof(addr));
-            close_socket(temp_socket);
+bool HTTPServer::read_connection(Connection* connection) {
+    for (;;) {
+        int bytes_read = recv(connection->sock, read_buffer_.data(), (int)read_buffer_.size(), 0);
+        if (bytes_read > 0) {
+            connection->in.append(read_buffer_.data(), bytes_read);
+            if (bytes_read < (int)read_buffer_.size()) {
+                return true;
+            }
+            continue;
+        }
+        if (bytes_read < 0 && would_block()) {
+            return true;
         }
+        return false; // Closed by the peer, or failed
+    }
+}
 
-        // Wait for the server thread to finish
-        if (server_thread.joinable()) {
-            server_thread.join();
+bool HTTPServer::flush_connection(Connection* connection) {
+    while (!connection->out.empty()) {
+        const std::string& chunk = *connection->out.front();
+        size_t remaining = chunk.size() - connection->out_offset;
+        int sent = send(connection->sock, chunk.data() + connection->out_offset, (int)std::min(remaining, (size_t)0x40000000), MSG_NOSIGNAL);
+        if (sent < 0) {
+            return would_block();
+        }
+
+        connection->out_offset += sent;
+        connection->out_bytes -= sent;
+        if (connection->out_offset == chunk.size()) {
+            connection->out.pop_front();
+            connection->out_offset = 0;
+        }
+    }
+    return true;
+}
+
+void HTTPServer::dispatch_request(uint64_t id, Connection* connection) {
+    if (connection->busy || connection->close_after) {
+        return; // One request per connection at a time keeps responses in order
+    }
+
+    Request request;
+    std::string error_response;
+    switch (take_request(connection->in, request, error_response)) {
+    case PARSE_INCOMPLETE:
+        return;
+    case PARSE_ERROR:
+        protocol_errors_metric_->add();
+        queue_output(connection, std::make_shared<const std::string>(std::move(error_response)));
+        connection->close_after = true;
+        return;
+    case PARSE_READY:
+        break;
+    }
+
+    // Streams are answered here; there is no handler to run
+    auto stream_it = request.method == "GET" ? streams_.find(request.path) : streams_.end();
+    if (stream_it != streams_.end()) {
+        Stream* stream = stream_it->second.get();
+        std::string headers = "HTTP/1.1 200 OK\r\nContent-Type: " + stream->content_type + "\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n";
+        queue_output(connection, std::make_shared<const std::string>(std::move(headers)));
+
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (stream->latest) {
+            queue_output(connection, stream->latest);
+        }
+        connection->stream = stream;
+        connection->stream_sequence = stream->sequence;
+        connection->in.clear();
+        stream->clients++;
+        stream_clients_metric_->add(1);
+        return;
+    }
+
+    connection->busy = true;
+    request.connection_id = id;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        requests_.push_back(std::move(request));
+    }
+    request_condition_.notify_one();
+}
+
+HTTPServer::ParseResult HTTPServer::take_request(std::string& buffer, Request& request, std::string& error_response) {
+    // Clients may send blank lines between pipelined requests
+    size_t start = buffer.find_first_not_of("\r\n");
+    if (start == std::string::npos) {
+        buffer.clear();
+        return PARSE_INCOMPLETE;
+    }
+    buffer.erase(0, start);
+
+    size_t head_end = buffer.find("\r\n\r\n");
+    if (head_end == std::string::npos) {
+        if (buffer.size() > HTTP_SERVER_MAX_HEADER_BYTES) {
+            error_response = make_response("431 Request Header Fields Too Large", "{\"ERROR\": \"Request headers too large!\"}", false);
+            return PARSE_ERROR;
+        }
+        return PARSE_INCOMPLETE;
+    }
+    head_end += 4;
+
+    std::string version;
+    std::unordered_map<std::string, std::string> headers;
+    parse_request(buffer.substr(0, head_end), request.method, request.path, version, headers, request.params);
+
+    if (request.method.empty() || version.compare(0, 5, "HTTP/") != 0) {
+        error_response = make_response("400 Bad Request", "{\"ERROR\": \"Malformed request!\"}", false);
+        return PARSE_ERROR;
+    }
+    if (headers.count("transfer-encoding")) {
+        error_response = make_response("501 Not Implemented", "{\"ERROR\": \"Chunked request bodies are not supported!\"}", false);
+        return PARSE_ERROR;
+    }
+
+    // Every method's body is consumed, so the next request starts in the right place
+    size_t content_length = 0;
+    auto content_length_it = headers.find("content-length");
+    if (content_length_it != headers.end()) {
+        const char* value = content_length_it->second.c_str();
+        char* end = nullptr;
+        unsigned long long parsed = strtoull(value, &end, 10);
+        if (end == value || *end != '\0' || value[0] == '-') {
+            error_response = make_response("400 Bad Request", "{\"ERROR\": \"Invalid Content-Length!\"}", false);
+            return PARSE_ERROR;
+        }
+        if (parsed > HTTP_SERVER_MAX_BODY_BYTES) {
+            error_response = make_response("413 Payload Too Large", "{\"ERROR\": \"Request body too large!\"}", false);
+            return PARSE_ERROR;
         }
+        content_length = (size_t)parsed;
+    }
+    if (buffer.size() < head_end + content_length) {
+        return PARSE_INCOMPLETE;
     }
+
+    request.body = buffer.substr(head_end, content_length);
+    buffer.erase(0, head_end + content_length);
+
+    // HTTP/1.1 keeps the connection unless told otherwise, HTTP/1.0 closes it
+    auto connection_it = headers.find("connection");
+    std::string connection_header = connection_it != headers.end() ? to_lower(connection_it->second) : "";
+    if (version == "HTTP/1.0") {
+        request.keep_alive = connection_header == "keep-alive";
+    } else {
+        request.keep_alive = connection_header != "close";
+    }
+    return PARSE_READY;
 }
 
-void HTTPServer::parse_request(const std::string& request,
+void HTTPServer::parse_request(const std::string& head,
                                std::string& method,
                                std::string& path,
+                               std::string& version,
                                std::unordered_map<std::string, std::string>& headers,
-                               std::unordered_map<std::string, std::string>& params,
-                               std::string& body) {
-    std::istringstream request_stream(request);
+                               std::unordered_map<std::string, std::string>& params) {
+    std::istringstream request_stream(head);
     std::string line;
 
     // Parse request line
     std::getline(request_stream, line);
     std::istringstream request_line(line);
-    std::string version;
     request_line >> method >> path >> version;
 
     // Parse query parameters if present
@@ -157,87 +604,109 @@ void HTTPServer::parse_request(const std::string& request,
         }
     }
 
-    // Parse headers
+    // Parse headers; names are case-insensitive, so they're stored lowercase
     while (std::getline(request_stream, line) && line != "\r") {
         size_t colon_pos = line.find(':');
         if (colon_pos != std::string::npos) {
-            std::string key = line.substr(0, colon_pos);
+            std::string key = to_lower(line.substr(0, colon_pos));
             // Skip the colon and any leading whitespace
             size_t value_start = line.find_first_not_of(" \t", colon_pos + 1);
             if (value_start != std::string::npos) {
                 std::string value = line.substr(value_start);
-                // Remove trailing \r if present
-                if (!value.empty() && value.back() == '\r') {
-                    value.pop_back();
-                }
+                // Remove trailing \r and whitespace if present
+                size_t value_end = value.find_last_not_of(" \t\r");
+                value.erase(value_end + 1);
                 headers[key] = value;
             }
         }
     }
+}
 
-    // Extract body if present
-    if (method == "POST" || method == "PUT") {
-        // Find the content length header
-        auto content_length_it = headers.find("Content-Length");
-        if (content_length_it != headers.end()) {
-            int content_length = std::stoi(content_length_it->second);
-
-            // The body starts after the empty line (headers and body separator)
-            size_t body_start = request.find("\r\n\r\n");
-            if (body_start != std::string::npos) {
-                body_start += 4; // Skip the \r\n\r\n
-                body = request.substr(body_start, content_length);
+void HTTPServer::worker_loop() {
+    for (;;) {
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            request_condition_.wait(lock, [this]() { return !requests_.empty() || !running_; });
+            if (!running_) {
+                return;
             }
+            request = std::move(requests_.front());
+            requests_.pop_front();
         }
-    }
-}
 
-void HTTPServer::handle_connection(socket_t client_socket) {
-    char buffer[8192] = { 0 }; // Increased buffer size for larger requests
-    int bytes_read = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-
-    if (bytes_read <= 0) {
-        return;
+        Response response;
+        response.connection_id = request.connection_id;
+        response.keep_alive = request.keep_alive;
+        if (request.method == "GET" && request.path == "/metrics") {
+            response.data = make_response("200 OK", MetricsRegistry::global().render(), request.keep_alive, "text/plain; version=0.0.4");
+        } else {
+            response.data = make_response("200 OK", handle_request(request), request.keep_alive);
+        }
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            responses_.push_back(std::move(response));
+        }
+        wake();
     }
+}
 
-    // Parse HTTP request
-    std::string request(buffer);
-    std::string method, path, body;
-    std::unordered_map<std::string, std::string> headers;
-    std::unordered_map<std::string, std::string> params;
-
-    parse_request(request, method, path, headers, params, body);
-
+std::string HTTPServer::handle_request(const Request& request) {
     // Find and call the appropriate handler
-    std::string response_body;
-
-    if (method == "GET") {
-        auto it = get_handlers_.find(path);
-        if (it != get_handlers_.end()) {
-            response_body = it->second(params);
-        } else {
-            response_body = "{\"ERROR\": \"Path not found for GET request!\"}";
+    auto route_it = routes_.find(request.method + " " + request.path);
+    if (route_it == routes_.end()) {
+        unknown_requests_metric_->add();
+        if (request.method == "GET") {
+            return "{\"ERROR\": \"Path not found for GET request!\"}";
+        } else if (request.method == "POST") {
+            return "{\"ERROR\": \"Path not found for POST request!\"}";
         }
-    } else if (method == "POST") {
-        auto it = post_handlers_.find(path);
-        if (it != post_handlers_.end()) {
-            response_body = it->second(params, body);
-        } else {
-            response_body = "{\"ERROR\": \"Path not found for POST request!\"}";
+        return "{\"ERROR\": \"Method not supported!\"}";
+    }
+
+    Route& route = route_it->second;
+    auto started = std::chrono::steady_clock::now();
+    std::string body;
+    {
+        std::lock_guard<std::mutex> lock(route.concurrent ? *route.lock : handler_mutex_);
+        try {
+            if (request.method == "GET") {
+                body = get_handlers_.find(request.path)->second(request.params);
+            } else {
+                body = post_handlers_.find(request.path)->second(request.params, request.body);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "HTTPServer: handler for " << request.path << " failed: " << e.what() << std::endl;
+            body = "{\"ERROR\": \"Handler failed!\"}";
         }
-    } else {
-        response_body = "{\"ERROR\": \"Method not supported!\"}";
     }
+    route.requests->add();
+    route.seconds->observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+    return body;
+}
 
-    // Send response
+std::string HTTPServer::make_response(const char* status, const std::string& body, bool keep_alive, const char* content_type) {
     std::stringstream response;
-    response << "HTTP/1.1 200 OK\r\n";
-    response << "Content-Type: application/json\r\n";
-    response << "Content-Length: " << response_body.length() << "\r\n";
-    response << "Connection: close\r\n";
+    response << "HTTP/1.1 " << status << "\r\n";
+    response << "Content-Type: " << content_type << "\r\n";
+    response << "Content-Length: " << body.length() << "\r\n";
+    response << "Connection: " << (keep_alive ? "keep-alive" : "close") << "\r\n";
     response << "\r\n";
-    response << response_body;
+    response << body;
+    return response.str();
+}
 
-    std::string response_str = response.str();
-    send(client_socket, response_str.c_str(), (int)response_str.length(), 0);
-}
\ No newline at end of file
+std::string urlDecode(std::string value) {
+    size_t pos = 0;
+    while ((pos = value.find('%', pos)) != std::string::npos) {
+        if (pos + 2 < value.length()) {
+            int hexValue;
+            std::istringstream iss(value.substr(pos + 1, 2));
+            iss >> std::hex >> hexValue;
+            value.replace(pos, 3, 1, static_cast<char>(hexValue));
+        } else {
+            break;
+        }
+    }
+    return value;
+}
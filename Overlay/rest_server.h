@@ -1,9 +1,17 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -13,6 +21,46 @@ typedef SOCKET socket_t;
 typedef int socket_t;
 #endif
 
+class MetricCounter;
+class MetricGauge;
+class MetricHistogram;
+
+#define HTTP_SERVER_WORKERS          4        // Threads running handlers
+#define HTTP_SERVER_MAX_CONNECTIONS  64       // Open connections before new ones wait in the listen backlog
+#define HTTP_SERVER_MAX_HEADER_BYTES 65536    // Request line and headers; larger requests get 431
+#define HTTP_SERVER_MAX_BODY_BYTES   16777216 // Largest Content-Length accepted; larger requests get 413
+#define HTTP_SERVER_READ_BYTES       65536    // Receive buffer shared by all connections
+#define HTTP_SERVER_IDLE_MS          30000    // Keep-alive connections with no request for this long are closed
+#define HTTP_SERVER_POLL_MS          1000     // Longest I/O wait before checking for idle connections
+#define HTTP_SERVER_STREAM_BACKLOG   1048576  // Unsent bytes of a stream client before new chunks skip it
+
+/**
+ * @brief HTTP/1.1 server for the REST API
+ *
+ * One I/O thread multiplexes the listening socket and every connection with
+ * poll (WSAPoll on Windows). Connections stay open between requests
+ * (keep-alive) unless the client asks for Connection: close or speaks
+ * HTTP/1.0 without keep-alive. Bodies are read up to their Content-Length
+ * however many receives that takes, and whatever follows is kept as the
+ * start of the next request, so pipelined requests are handled in order.
+ *
+ * Complete requests are handed to a pool of HTTP_SERVER_WORKERS threads.
+ * Handlers are serialized by default: one runs at a time, as on a single
+ * server thread, so handlers sharing unsynchronized state need no locking of
+ * their own. A handler registered as concurrent only touches thread-safe
+ * state; it runs alongside the others, so a slow serialized handler doesn't
+ * hold it up. A handler never runs concurrently with itself.
+ *
+ * Stream endpoints (register_stream) answer a GET with a response that
+ * stays open until the client leaves. Every chunk passed to publish() is
+ * shared, not copied, by all clients of the stream; one producer serves any
+ * number of them. A client whose unsent data exceeds
+ * HTTP_SERVER_STREAM_BACKLOG skips chunks until it catches up, so a slow
+ * client never holds up the producer or the other clients.
+ *
+ * GET /metrics serves MetricsRegistry::global() in the Prometheus text
+ * format, including the server's own request counts and latencies.
+ */
 class HTTPServer {
 public:
     // Handler for GET requests
@@ -26,27 +74,149 @@ public:
     HTTPServer(int port);
     ~HTTPServer();
 
-    // Register GET handler
-    void register_handler(const std::string& path, RequestHandler handler);
+    // Register GET handler; must be called before start(). concurrent: see the class comment
+    void register_handler(const std::string& path, RequestHandler handler, bool concurrent = false);
+
+    // Register POST handler with body support; must be called before start()
+    void register_post_handler(const std::string& path, PostRequestHandler handler, bool concurrent = false);
+
+    /**
+     * @brief Register a streaming GET endpoint; must be called before start()
+     *
+     * Clients get the headers, the most recent chunk (if any) and then every
+     * chunk published afterwards, until they disconnect.
+     *
+     * @param content_type e.g. text/event-stream or multipart/x-mixed-replace;boundary=frame
+     */
+    void register_stream(const std::string& path, const std::string& content_type);
 
-    // Register POST handler with body support
-    void register_post_handler(const std::string& path, PostRequestHandler handler);
+    // Send data to every client of a stream; a whole SSE event or MJPEG part.
+    // Safe to call from any thread.
+    void publish(const std::string& path, std::shared_ptr<const std::string> data);
+
+    // Clients connected to a stream, so a producer can skip building chunks no one gets.
+    // Safe to call from any thread.
+    size_t stream_clients(const std::string& path) const;
 
     void start();
     void stop();
 
 private:
+    struct Connection;
+
+    struct Route {
+        bool concurrent;
+        std::unique_ptr<std::mutex> lock; // Held while a concurrent handler runs
+        MetricCounter* requests;
+        MetricHistogram* seconds;
+    };
+
+    struct Stream {
+        std::string content_type;
+        std::shared_ptr<const std::string> latest; // Guarded by queue_mutex_
+        uint64_t sequence = 0;                     // Chunks published so far, guarded by queue_mutex_
+        std::atomic<size_t> clients { 0 };
+    };
+
+    // A chunk waiting for the I/O thread to hand it to the stream's clients
+    struct Published {
+        Stream* stream;
+        uint64_t sequence;
+        std::shared_ptr<const std::string> data;
+    };
+
+    // A parsed request waiting for a worker
+    struct Request {
+        uint64_t connection_id;
+        std::string method;
+        std::string path;
+        std::unordered_map<std::string, std::string> params;
+        std::string body;
+        bool keep_alive;
+    };
+
+    // A worker's reply waiting for the I/O thread
+    struct Response {
+        uint64_t connection_id;
+        std::string data;
+        bool keep_alive;
+    };
+
+    enum ParseResult {
+        PARSE_INCOMPLETE,
+        PARSE_READY,
+        PARSE_ERROR
+    };
+
     int port_;
-    bool running_;
+    std::atomic<bool> running_;
     std::thread server_thread;
+    std::vector<std::thread> workers_;
     std::unordered_map<std::string, RequestHandler> get_handlers_;
     std::unordered_map<std::string, PostRequestHandler> post_handlers_;
+    std::unordered_map<std::string, Route> routes_; // "GET /path"
+    std::unordered_map<std::string, std::unique_ptr<Stream>> streams_;
+
+    socket_t listen_socket_;
+    socket_t wake_socket_; // UDP socket connected to itself; a datagram wakes the I/O thread
+
+    // Held while any handler that isn't concurrent runs
+    std::mutex handler_mutex_;
 
-    void handle_connection(socket_t client_socket);
-    void parse_request(const std::string& request,
+    // Guards requests_, responses_, published_ and each Stream's latest
+    std::mutex queue_mutex_;
+    std::condition_variable request_condition_;
+    std::deque<Request> requests_;
+    std::vector<Response> responses_;
+    std::vector<Published> published_;
+
+    // Owned by the I/O thread
+    std::map<uint64_t, std::unique_ptr<Connection>> connections_;
+    uint64_t next_connection_id_;
+    std::vector<char> read_buffer_;
+
+    MetricCounter* accepted_metric_;
+    MetricGauge* connections_metric_;
+    MetricGauge* stream_clients_metric_;
+    MetricCounter* protocol_errors_metric_;
+    MetricCounter* unknown_requests_metric_;
+
+    // Route for a registered handler, with its metrics
+    void add_route(const std::string& method, const std::string& path, bool concurrent);
+
+    void io_loop();
+    void worker_loop();
+    void wake();
+
+    void accept_connections();
+    void close_connection(std::map<uint64_t, std::unique_ptr<Connection>>::iterator it);
+
+    // Queue bytes to send on a connection
+    static void queue_output(Connection* connection, std::shared_ptr<const std::string> data);
+
+    // Receive what is available; false once the peer has closed or failed
+    bool read_connection(Connection* connection);
+
+    // Send queued response bytes; false if the connection failed
+    bool flush_connection(Connection* connection);
+
+    // Hand the next complete request of an idle connection to the workers
+    void dispatch_request(uint64_t id, Connection* connection);
+
+    // Take one complete request off the front of buffer. On PARSE_ERROR
+    // error_response is set and the connection must be closed after it.
+    ParseResult take_request(std::string& buffer, Request& request, std::string& error_response);
+
+    void parse_request(const std::string& head,
                        std::string& method,
                        std::string& path,
+                       std::string& version,
                        std::unordered_map<std::string, std::string>& headers,
-                       std::unordered_map<std::string, std::string>& params,
-                       std::string& body);
-};
\ No newline at end of file
+                       std::unordered_map<std::string, std::string>& params);
+
+    std::string handle_request(const Request& request);
+    static std::string make_response(const char* status, const std::string& body, bool keep_alive, const char* content_type = "application/json");
+};
+
+// Decode %XX escapes; query parameters reach handlers exactly as sent
+std::string urlDecode(std::string value);
@@ -1,14 +1,15 @@
 #include "routine.h"
 #include "config.h"
 #include "flags.h"
-#include "overlay_manager.h"
+#include "routine_compiler.h"
 #include "routines.h" // Your header with the calibration routines
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <cmath>
 #include <iostream>
 #include <random>
-#include <regex>
-#include <sstream>
+#include <utility>
 
 #include <stdio.h>
 
@@ -47,18 +48,57 @@ constexpr float MAX_PITCH_ANGLE = 30.0f; // Maximum pitch angle in degrees
 #define DILATION_ACTION_DURATION    10.0f // 10 seconds for black/white screens
 #define DILATION_GRADIENT_DURATION  30.0f // 30 seconds for white-to-black fade
 
-bool RoutineController::m_stepWritten = false;
-double_t RoutineController::m_globalAdvancedTime = 0.0;
-int RoutineController::m_routineStage = 0;
-double_t RoutineController::m_stageStartTime = 0.0;
-double_t RoutineController::m_fixedStageDuration = 0.0;
+// Per-step progress output, silenced for headless runs
+#define ROUTINE_LOG(...)         \
+    do {                         \
+        if (!m_headless)         \
+            printf(__VA_ARGS__); \
+    } while (0)
 
-RoutineController::RoutineController(float maxMoveSpeed)
-    : m_currentOpIndex(0)
+double SteadyRoutineClock::now() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static SteadyRoutineClock s_steadyClock;
+
+// The built-in routines, compiled into Operation arrays at build time; a
+// malformed one stops the build (see compileRoutine)
+static constexpr const char* s_routineTexts[] = ALL_ROUTINES;
+static_assert(sizeof(s_routineTexts) / sizeof(s_routineTexts[0]) == NUM_CALIBRATION_ROUTINES, "NUM_CALIBRATION_ROUTINES doesn't match ALL_ROUTINES");
+
+template <size_t Index>
+static constexpr auto s_compiledRoutine = compileRoutine<routineCapacity(s_routineTexts[Index])>(s_routineTexts[Index]);
+
+struct CompiledRoutineView {
+    const Operation* operations;
+    size_t count;
+};
+
+template <size_t... Index>
+static constexpr std::array<CompiledRoutineView, sizeof...(Index)> compiledRoutineTable(std::index_sequence<Index...>) {
+    return { { CompiledRoutineView { s_compiledRoutine<Index>.operations, s_compiledRoutine<Index>.count }... } };
+}
+
+static constexpr std::array<CompiledRoutineView, NUM_CALIBRATION_ROUTINES> s_compiledRoutines = compiledRoutineTable(std::make_index_sequence<NUM_CALIBRATION_ROUTINES>());
+
+RoutineController::RoutineController(float maxMoveSpeed, RoutineClock* clock)
+    : m_operations(nullptr)
+    , m_operationCount(0)
+    , m_operationElapsed(0.0f)
+    , m_currentOpIndex(0)
+    , m_clock(clock)
+    , m_lastUpdateTime(0.0)
     , m_routineStarted(false)
+    , m_headless(false)
     , m_maxMoveSpeed(maxMoveSpeed)
     , m_elapsedTime(0.0)
-    , m_lastRandomPointTime(0.0) {
+    , m_lastRandomPointTime(0.0)
+    , m_routineStage(0)
+    , m_stageStartTime(0.0)
+    , m_fixedStageDuration(0.0)
+    , m_stepWritten(false)
+    , m_fadeProgress(0.0f)
+    , m_lastDebugStage(-1) {
     // Initialize positions
     TargetPosition current;
     TargetPosition target;
@@ -71,6 +111,20 @@ RoutineController::RoutineController(float maxMoveSpeed)
     m_targetPosition = target;
 }
 
+void RoutineController::setClock(RoutineClock* clock) {
+    m_clock = clock;
+    m_routineStarted = false; // The next step() starts timing from the new clock
+}
+
+double RoutineController::now() const {
+    return m_clock ? m_clock->now() : s_steadyClock.now();
+}
+
+void RoutineController::jumpToStage(int stage) {
+    m_routineStage = stage;
+    m_stageStartTime = m_elapsedTime;
+}
+
 float getRandomFloat() {
     return -1.0f + 2.0f * (static_cast<float>(rand()) / RAND_MAX);
 }
@@ -89,8 +143,8 @@ uint32_t RoutineController::getStateFlags() const {
     }
 
     // Determine current state directly
-    if (!m_operations.empty() && m_currentOpIndex < m_operations.size()) {
-        const Operation& op = m_operations[m_currentOpIndex];
+    if (m_currentOpIndex < m_operationCount) {
+        const Operation& op = operations()[m_currentOpIndex];
 
         if (op.type == OperationType::REST) {
             flags = flags | FLAG_RESTING; // Explicit OR operation
@@ -107,11 +161,11 @@ uint32_t RoutineController::getStateFlags() const {
 int RoutineController::getTimeTillNext() {
     // For stages 0-2, use the original logic
     if (m_routineStage <= 2) {
-        return TIME_BETWEEN_ROUTINES - (int)(m_globalAdvancedTime);
+        return TIME_BETWEEN_ROUTINES - (int)(m_elapsedTime);
     }
 
     // For stages 3+, calculate time remaining in current stage
-    double_t stageElapsed = m_globalAdvancedTime - m_stageStartTime;
+    double_t stageElapsed = m_elapsedTime - m_stageStartTime;
     float stageDuration = STAGE_NOTIFICATION_DURATION; // Default for notification stages
 
     // Action stages have different duration
@@ -136,32 +190,29 @@ int RoutineController::getTimeTillNext() {
 
 bool RoutineController::parseRoutine(const std::string& routineStr) {
     // Clear any existing operations
-    m_operations.clear();
+    m_operations = nullptr;
+    m_operationCount = 0;
+    m_parsedOperations.assign(routineCapacity(routineStr.c_str()), Operation());
     m_currentOpIndex = 0;
+    m_operationElapsed = 0.0f;
     m_routineStarted = false;
 
-    // Split the routine string by semicolons
-    std::istringstream stream(routineStr);
-    std::string opStr;
-
-    while (std::getline(stream, opStr, ';')) {
-        if (!opStr.empty()) {
-            if (!parseOperation(opStr)) {
-                std::cerr << "Failed to parse operation: " << opStr << std::endl;
-                m_operations.clear();
-                return false;
-            }
-        }
+    RoutineParser parser(routineStr.c_str(), routineStr.size());
+    RoutineParseResult result = parser.parse(m_parsedOperations.data(), m_parsedOperations.size());
+    if (result.error) {
+        std::cerr << "Failed to parse routine at character " << result.offset << ": " << result.error << std::endl;
+        m_parsedOperations.clear();
+        return false;
     }
 
-    return !m_operations.empty();
+    m_parsedOperations.resize(result.count);
+    m_operationCount = result.count;
+    return true;
 }
 
 bool RoutineController::loadRoutine(int routineIndex) {
 
-    printf("Loading routine %i\n", routineIndex);
-    // Array of routine strings
-    const char* routines[] = ALL_ROUTINES;
+    ROUTINE_LOG("Loading routine %i\n", routineIndex);
 
     // Check if index is valid
     if (routineIndex < 0 || routineIndex >= NUM_CALIBRATION_ROUTINES) {
@@ -172,105 +223,46 @@ bool RoutineController::loadRoutine(int routineIndex) {
     // Store the loaded routine index
     m_loadedRoutineIndex = routineIndex;
 
-    // Parse the selected routine
-    return parseRoutine(routines[routineIndex]);
+    // Compiled at build time, so there's nothing to parse
+    m_operations = s_compiledRoutines[routineIndex].operations;
+    m_operationCount = s_compiledRoutines[routineIndex].count;
+    m_parsedOperations.clear();
+    m_currentOpIndex = 0;
+    m_operationElapsed = 0.0f;
+    m_routineStarted = false;
+    return true;
 }
 
-bool RoutineController::parseOperation(const std::string& opStr) {
-    Operation op;
-    op.elapsedTime = 0.0f;
-
-    // Regular expressions for different operation types
-    static const std::regex moveRegex(R"(move\s*\(\s*([0-9]+\.[0-9]+)\s*,\s*([0-9]+\.[0-9]+)\s*\))");
-    static const std::regex restRegex(R"(rest\s*\(\s*([0-9]+\.[0-9]+)\s*\))");
-    static const std::regex smoothRegex(R"(smooth\s*\(\s*([0-9]+\.[0-9]+)\s*,\s*([0-9]+\.[0-9]+)\s*,\s*([0-9]+\.[0-9]+)\s*,\s*([0-9]+\.[0-9]+)\s*,\s*([0-9]+\.[0-9]+)\s*\))");
-    static const std::regex circleRegex(R"(smoothCircle\s*\(\s*([0-9]+\.[0-9]+)\s*,\s*([0-9]+\.[0-9]+)\s*,\s*([0-9]+\.[0-9]+)\s*,\s*([0-9]+\.[0-9]+)\s*,\s*([0-1])\s*\))");
-    static const std::regex depthRegex(R"(moveDepth\s*\(\s*([0-9]+\.[0-9]+)\s*,\s*([0-9]+\.[0-9]+)\s*,\s*([0-9]+\.[0-9]+)\s*,\s*([0-9]+\.[0-9]+)\s*,\s*([0-9]+\.[0-9]+)\s*\))");
-
-    std::smatch matches;
-
-    // Try to match move operation
-    if (std::regex_search(opStr, matches, moveRegex) && matches.size() == 3) {
-        op.type = OperationType::MOVE;
-        op.params.move.x = std::stof(matches[1].str());
-        op.params.move.y = std::stof(matches[2].str());
-        op.duration = 0.0f; // Instant
-    }
-    // Try to match rest operation
-    else if (std::regex_search(opStr, matches, restRegex) && matches.size() == 2) {
-        op.type = OperationType::REST;
-        op.params.rest.seconds = std::stof(matches[1].str());
-        op.duration = op.params.rest.seconds;
-    }
-    // Try to match smooth operation
-    else if (std::regex_search(opStr, matches, smoothRegex) && matches.size() == 6) {
-        op.type = OperationType::SMOOTH;
-        op.params.smooth.x1 = std::stof(matches[1].str());
-        op.params.smooth.y1 = std::stof(matches[2].str());
-        op.params.smooth.x2 = std::stof(matches[3].str());
-        op.params.smooth.y2 = std::stof(matches[4].str());
-        op.params.smooth.seconds = std::stof(matches[5].str());
-        op.duration = op.params.smooth.seconds;
-    }
-    // Try to match circle operation
-    else if (std::regex_search(opStr, matches, circleRegex) && matches.size() == 6) {
-        op.type = OperationType::SMOOTH_CIRCLE;
-        op.params.circle.centerX = std::stof(matches[1].str());
-        op.params.circle.centerY = std::stof(matches[2].str());
-        op.params.circle.radius = std::stof(matches[3].str());
-        op.params.circle.seconds = std::stof(matches[4].str());
-        op.params.circle.clockwise = (std::stoi(matches[5].str()) == 1);
-        op.duration = op.params.circle.seconds;
-    }
-    // Try to match depth operation
-    else if (std::regex_search(opStr, matches, depthRegex) && matches.size() == 6) {
-        op.type = OperationType::MOVE_AWAY_TOWARD;
-        op.params.depth.x = std::stof(matches[1].str());
-        op.params.depth.y = std::stof(matches[2].str());
-        op.params.depth.startDistance = std::stof(matches[3].str());
-        op.params.depth.endDistance = std::stof(matches[4].str());
-        op.params.depth.seconds = std::stof(matches[5].str());
-        op.duration = op.params.depth.seconds;
-    } else {
-        return false; // No match found
-    }
-
-    m_operations.push_back(op);
-    return true;
+const Operation* RoutineController::operations() const {
+    return m_operations ? m_operations : m_parsedOperations.data();
 }
 
 TargetPosition RoutineController::step() {
     // Initialize timing if this is the first call
     if (!m_routineStarted) {
-        m_lastUpdateTime = std::chrono::high_resolution_clock::now();
+        m_lastUpdateTime = now();
         m_routineStarted = true;
     }
 
     // Calculate elapsed time since last update
-    auto currentTime = std::chrono::high_resolution_clock::now();
-    float deltaTime = std::chrono::duration<float>(currentTime - m_lastUpdateTime).count();
+    double currentTime = now();
+    float deltaTime = (float)(currentTime - m_lastUpdateTime);
     m_lastUpdateTime = currentTime;
 
     m_elapsedTime += (double_t)deltaTime;
-    RoutineController::m_globalAdvancedTime = m_elapsedTime;
 
     // If we have operations to process
-    if (!m_operations.empty() && m_currentOpIndex < m_operations.size()) {
-        Operation& currentOp = m_operations[m_currentOpIndex];
+    if (m_currentOpIndex < m_operationCount) {
+        const Operation& currentOp = operations()[m_currentOpIndex];
 
         // Update elapsed time for current operation
-        currentOp.elapsedTime += deltaTime;
+        m_operationElapsed += deltaTime;
 
         // Check if we need to move to the next operation
-        if (currentOp.elapsedTime >= currentOp.duration) {
-            // Move to next operation
+        if (m_operationElapsed >= currentOp.duration) {
+            // Move to next operation, which starts from zero
             m_currentOpIndex++;
-
-            // If we have more operations, initialize the next one
-            if (m_currentOpIndex < m_operations.size()) {
-                currentOp = m_operations[m_currentOpIndex];
-                currentOp.elapsedTime = 0.0f;
-            }
+            m_operationElapsed = 0.0f;
         }
     }
 
@@ -290,26 +282,26 @@ TargetPosition RoutineController::calculatePosition() {
     }
 
     // Handle stage progression for stages 3 and above, but not if already complete
-    if (RoutineController::m_routineStage >= 3 && RoutineController::m_routineStage <= MAX_ROUTINE_STAGE) {
+    if (m_routineStage >= 3 && m_routineStage <= MAX_ROUTINE_STAGE) {
         handleStageProgression();
 
         // Handle convergence test stages
-        if (RoutineController::m_routineStage >= CONVERGENCE_NOTIFY_STAGE && RoutineController::m_routineStage <= CONVERGENCE_STAGE) {
-            if (RoutineController::m_routineStage == CONVERGENCE_STAGE) {
+        if (m_routineStage >= CONVERGENCE_NOTIFY_STAGE && m_routineStage <= CONVERGENCE_STAGE) {
+            if (m_routineStage == CONVERGENCE_STAGE) {
                 // printf("In convergence stage %d, calling calculateConvergencePosition()\n", CONVERGENCE_STAGE);
             }
             return calculateConvergencePosition();
         }
 
         // Handle dilation test stages
-        if (RoutineController::m_routineStage >= DILATION_STAGE_START && RoutineController::m_routineStage <= DILATION_STAGE_END) {
-            // printf("In dilation stage %d\n", RoutineController::m_routineStage);
+        if (m_routineStage >= DILATION_STAGE_START && m_routineStage <= DILATION_STAGE_END) {
+            // printf("In dilation stage %d\n", m_routineStage);
             return calculateDilationPosition();
         }
 
         // Handle fixed position test stages
-        if (RoutineController::m_routineStage >= FIXED_POSITION_NOTIFY_STAGE && RoutineController::m_routineStage <= FIXED_POSITION_STAGE) {
-            printf("In fixed position stage %d\n", RoutineController::m_routineStage);
+        if (m_routineStage >= FIXED_POSITION_NOTIFY_STAGE && m_routineStage <= FIXED_POSITION_STAGE) {
+            ROUTINE_LOG("In fixed position stage %d\n", m_routineStage);
             // Keep crosshair at center for both notification and test stages
             m_currentPosition.pitch = 0.0f;
             m_currentPosition.yaw = 0.0f;
@@ -319,7 +311,7 @@ TargetPosition RoutineController::calculatePosition() {
         }
 
         // For other stages before convergence test, keep crosshair at center
-        if (RoutineController::m_routineStage >= 3 && RoutineController::m_routineStage < CONVERGENCE_NOTIFY_STAGE) {
+        if (m_routineStage >= 3 && m_routineStage < CONVERGENCE_NOTIFY_STAGE) {
             m_currentPosition.pitch = 0.0f;
             m_currentPosition.yaw = 0.0f;
             m_currentPosition.distance = TARGET_DEFAULT_DISTANCE;
@@ -334,7 +326,7 @@ TargetPosition RoutineController::calculatePosition() {
     }
 
     // Don't run S-pattern code if we've already advanced to later stages
-    if (RoutineController::m_routineStage >= 3) {
+    if (m_routineStage >= 3) {
         return m_currentPosition; // Position already set by earlier stage handlers
     }
 
@@ -344,20 +336,21 @@ TargetPosition RoutineController::calculatePosition() {
         m_currentPosition.pitch = 0.0;
         m_currentPosition.yaw = 0.0;
         m_currentPosition.state = FLAG_IN_MOVEMENT;
-        RoutineController::m_routineStage = 0;
+        m_routineStage = 0;
         return m_currentPosition;
-    } else if (RoutineController::m_routineStage == 0) {
-        beep(174, 500);
-        RoutineController::m_routineStage = 1;
+    } else if (m_routineStage == 0) {
+        if (!m_headless)
+            beep(174, 500);
+        m_routineStage = 1;
     }
 
     // STRIPPED S-PATTERN LOGIC - Jump directly to fixed position test
     float scanTime = (float)(m_elapsedTime - TIME_BETWEEN_ROUTINES);
 
     // Show brief crosshair movement for 5 seconds, then jump to fixed position
-    /*if(scanTime > 5.0f && RoutineController::m_routineStage < FIXED_POSITION_NOTIFY_STAGE){
-        RoutineController::m_routineStage = FIXED_POSITION_NOTIFY_STAGE;
-        RoutineController::m_stageStartTime = m_elapsedTime;
+    /*if(scanTime > 5.0f && m_routineStage < FIXED_POSITION_NOTIFY_STAGE){
+        m_routineStage = FIXED_POSITION_NOTIFY_STAGE;
+        m_stageStartTime = m_elapsedTime;
         beep(174, 500);
         printf("Jumping to fixed position test at stage %d\n", FIXED_POSITION_NOTIFY_STAGE);
     }*/
@@ -396,27 +389,27 @@ TargetPosition RoutineController::screenToAngles(float x, float y) const {
 void RoutineController::reset() {
     m_currentOpIndex = 0;
     m_routineStarted = false;
-
-    // Reset elapsed time for all operations
-    for (auto& op : m_operations) {
-        op.elapsedTime = 0.0f;
-    }
-
-    // Reset position to center if we have operations
-    if (!m_operations.empty()) {
-        // Find the first move operation to set initial position
-        for (const auto& op : m_operations) {
-            if (op.type == OperationType::MOVE) {
-                m_currentPosition = screenToAngles(op.params.move.x, op.params.move.y);
-                break;
-            }
+    m_elapsedTime = 0.0;
+    m_routineStage = 0;
+    m_stageStartTime = 0.0;
+    m_stepWritten = false;
+    m_fadeProgress = 0.0f;
+    m_lastDebugStage = -1;
+    m_operationElapsed = 0.0f;
+
+    // Find the first move operation to set initial position
+    for (size_t i = 0; i < m_operationCount; i++) {
+        const Operation& op = operations()[i];
+        if (op.type == OperationType::MOVE) {
+            m_currentPosition = screenToAngles(op.params.move.x, op.params.move.y);
+            break;
         }
     }
 }
 
 bool RoutineController::isComplete() const {
     // Routine is complete when we've finished all stages (beyond MAX_ROUTINE_STAGE)
-    return RoutineController::m_routineStage > MAX_ROUTINE_STAGE;
+    return m_routineStage > MAX_ROUTINE_STAGE;
 }
 
 size_t RoutineController::getCurrentOperationIndex() const {
@@ -424,7 +417,7 @@ size_t RoutineController::getCurrentOperationIndex() const {
 }
 
 size_t RoutineController::getTotalOperationCount() const {
-    return m_operations.size();
+    return m_operationCount;
 }
 
 std::vector<std::string> RoutineController::getRoutineNames() {
@@ -440,7 +433,7 @@ TargetPosition RoutineController::calculateConvergencePosition() {
     const float cycleTime = 4.0f;    // 4 seconds for one complete in-out cycle
 
     // Notification stage (handled by main stage progression system)
-    if (RoutineController::m_routineStage == CONVERGENCE_NOTIFY_STAGE) {
+    if (m_routineStage == CONVERGENCE_NOTIFY_STAGE) {
         // Keep crosshair at center, default distance during countdown
         m_currentPosition.pitch = 0.0f;
         m_currentPosition.yaw = 0.0f;
@@ -450,11 +443,11 @@ TargetPosition RoutineController::calculateConvergencePosition() {
     }
 
     // Active convergence test
-    if (RoutineController::m_routineStage == CONVERGENCE_STAGE) {
+    if (m_routineStage == CONVERGENCE_STAGE) {
         // Calculate elapsed time in current stage (not total elapsed time)
-        float testTime = (float)(m_elapsedTime - RoutineController::m_stageStartTime);
-        printf("Stage %d: testTime=%.2f, stageStartTime=%.2f, totalElapsed=%.2f\n",
-               CONVERGENCE_STAGE, testTime, RoutineController::m_stageStartTime, m_elapsedTime);
+        float testTime = (float)(m_elapsedTime - m_stageStartTime);
+        ROUTINE_LOG("Stage %d: testTime=%.2f, stageStartTime=%.2f, totalElapsed=%.2f\n",
+               CONVERGENCE_STAGE, testTime, m_stageStartTime, m_elapsedTime);
 
         // Calculate distance using smooth sinusoidal animation
         // This creates a smooth in-out motion that tests convergence
@@ -485,43 +478,43 @@ TargetPosition RoutineController::calculateDilationPosition() {
     m_currentPosition.distance = TARGET_DEFAULT_DISTANCE;
 
     // Set special state flags to control overlay rendering
-    if (RoutineController::m_routineStage == DILATION_BLACK_STAGE) {
+    if (m_routineStage == DILATION_BLACK_STAGE) {
         // Black screen for full dilation
         m_currentPosition.state = FLAG_DILATION_BLACK;
-        printf("Stage %d: Setting FLAG_DILATION_BLACK\n", DILATION_BLACK_STAGE);
-    } else if (RoutineController::m_routineStage == DILATION_WHITE_STAGE) {
+        ROUTINE_LOG("Stage %d: Setting FLAG_DILATION_BLACK\n", DILATION_BLACK_STAGE);
+    } else if (m_routineStage == DILATION_WHITE_STAGE) {
         // White screen for full constriction
         m_currentPosition.state = FLAG_DILATION_WHITE;
-        printf("Stage %d: Setting FLAG_DILATION_WHITE\n", DILATION_WHITE_STAGE);
-    } else if (RoutineController::m_routineStage == DILATION_GRADIENT_STAGE) {
+        ROUTINE_LOG("Stage %d: Setting FLAG_DILATION_WHITE\n", DILATION_WHITE_STAGE);
+    } else if (m_routineStage == DILATION_GRADIENT_STAGE) {
         // Gradient fade from white to black
-        float testTime = (float)(m_elapsedTime - RoutineController::m_stageStartTime);
+        float testTime = (float)(m_elapsedTime - m_stageStartTime);
         float fadeProgress = testTime / DILATION_GRADIENT_DURATION; // 0.0 to 1.0
         fadeProgress = (fadeProgress < 0.0f) ? 0.0f : (fadeProgress > 1.0f) ? 1.0f
                                                                             : fadeProgress; // Clamp to [0,1]
 
-        // Set fade progress in the overlay manager static variable
-        OverlayManager::s_routineFadeProgress = fadeProgress; // 0.0 = white, 1.0 = black
+        // Picked up by the overlay manager after the step
+        m_fadeProgress = fadeProgress; // 0.0 = white, 1.0 = black
         m_currentPosition.state = FLAG_DILATION_GRADIENT;
-        printf("Stage %d: Setting FLAG_DILATION_GRADIENT, progress=%.2f\n", DILATION_GRADIENT_STAGE, fadeProgress);
+        ROUTINE_LOG("Stage %d: Setting FLAG_DILATION_GRADIENT, progress=%.2f\n", DILATION_GRADIENT_STAGE, fadeProgress);
     } else {
         // Notification stages - maintain dilation state for pupil consistency
-        if (RoutineController::m_routineStage == DILATION_NOTIFY_1_STAGE) {
+        if (m_routineStage == DILATION_NOTIFY_1_STAGE) {
             // Before black screen - maintain neutral/previous state
             m_currentPosition.state = FLAG_IN_MOVEMENT;
-            printf("Stage %d: Pre-black screen notification\n", DILATION_NOTIFY_1_STAGE);
-        } else if (RoutineController::m_routineStage == DILATION_NOTIFY_2_STAGE) {
+            ROUTINE_LOG("Stage %d: Pre-black screen notification\n", DILATION_NOTIFY_1_STAGE);
+        } else if (m_routineStage == DILATION_NOTIFY_2_STAGE) {
             // After black screen, before white - maintain black to keep pupils dilated
             m_currentPosition.state = FLAG_DILATION_BLACK;
-            printf("Stage %d: Maintaining black screen for pupil consistency\n", DILATION_NOTIFY_2_STAGE);
-        } else if (RoutineController::m_routineStage == DILATION_NOTIFY_3_STAGE) {
+            ROUTINE_LOG("Stage %d: Maintaining black screen for pupil consistency\n", DILATION_NOTIFY_2_STAGE);
+        } else if (m_routineStage == DILATION_NOTIFY_3_STAGE) {
             // After white screen, before fade - maintain white to keep pupils constricted
             m_currentPosition.state = FLAG_DILATION_WHITE;
-            printf("Stage %d: Maintaining white screen for pupil consistency\n", DILATION_NOTIFY_3_STAGE);
+            ROUTINE_LOG("Stage %d: Maintaining white screen for pupil consistency\n", DILATION_NOTIFY_3_STAGE);
         } else {
             // Fallback for any other notification stages
             m_currentPosition.state = FLAG_IN_MOVEMENT;
-            printf("Stage %d: Default notification stage\n", RoutineController::m_routineStage);
+            ROUTINE_LOG("Stage %d: Default notification stage\n", m_routineStage);
         }
     }
 
@@ -530,19 +523,18 @@ TargetPosition RoutineController::calculateDilationPosition() {
 
 void RoutineController::handleStageProgression() {
     // Don't progress if already complete
-    if (RoutineController::m_routineStage > MAX_ROUTINE_STAGE) {
+    if (m_routineStage > MAX_ROUTINE_STAGE) {
         return;
     }
 
     // Calculate time elapsed in current stage
-    double_t stageElapsed = m_elapsedTime - RoutineController::m_stageStartTime;
+    double_t stageElapsed = m_elapsedTime - m_stageStartTime;
 
     // Debug output
-    static int lastDebugStage = -1;
-    if (lastDebugStage != RoutineController::m_routineStage) {
-        printf("Stage %d: elapsed=%.2f, stageStart=%.2f, totalElapsed=%.2f\n",
-               RoutineController::m_routineStage, stageElapsed, RoutineController::m_stageStartTime, m_elapsedTime);
-        lastDebugStage = RoutineController::m_routineStage;
+    if (m_lastDebugStage != m_routineStage) {
+        ROUTINE_LOG("Stage %d: elapsed=%.2f, stageStart=%.2f, totalElapsed=%.2f\n",
+               m_routineStage, stageElapsed, m_stageStartTime, m_elapsedTime);
+        m_lastDebugStage = m_routineStage;
     }
 
     // Determine if current stage should advance
@@ -551,24 +543,24 @@ void RoutineController::handleStageProgression() {
 
     // Notification stages (odd numbers 3, 5, 7, 9, 11, 13, CONVERGENCE_NOTIFY_STAGE, DILATION_NOTIFY_*): countdown stages
     // Exclude completion stage from normal progression
-    if (RoutineController::m_routineStage % 2 == 1 && RoutineController::m_routineStage >= 3 && RoutineController::m_routineStage < COMPLETION_STAGE) {
+    if (m_routineStage % 2 == 1 && m_routineStage >= 3 && m_routineStage < COMPLETION_STAGE) {
         stageDuration = STAGE_NOTIFICATION_DURATION;
         shouldAdvance = (stageElapsed >= stageDuration);
     }
     // Action stages (even numbers 4, 6, 8, 10, 12, 14, CONVERGENCE_STAGE, DILATION_BLACK_STAGE, DILATION_WHITE_STAGE, DILATION_GRADIENT_STAGE): user action stages
-    else if (RoutineController::m_routineStage % 2 == 0 && RoutineController::m_routineStage >= 4) {
+    else if (m_routineStage % 2 == 0 && m_routineStage >= 4) {
         // Special durations for different test types
-        if (RoutineController::m_routineStage == CONVERGENCE_STAGE) {
+        if (m_routineStage == CONVERGENCE_STAGE) {
             stageDuration = CONVERGENCE_TEST_DURATION;
-            printf("Stage %d (convergence): elapsed=%.2f, duration=%.2f, shouldAdvance=%d\n",
+            ROUTINE_LOG("Stage %d (convergence): elapsed=%.2f, duration=%.2f, shouldAdvance=%d\n",
                    CONVERGENCE_STAGE, stageElapsed, stageDuration, (stageElapsed >= stageDuration));
-        } else if (RoutineController::m_routineStage == DILATION_BLACK_STAGE || RoutineController::m_routineStage == DILATION_WHITE_STAGE) {
+        } else if (m_routineStage == DILATION_BLACK_STAGE || m_routineStage == DILATION_WHITE_STAGE) {
             stageDuration = DILATION_ACTION_DURATION; // Black/white screens
-        } else if (RoutineController::m_routineStage == DILATION_GRADIENT_STAGE) {
+        } else if (m_routineStage == DILATION_GRADIENT_STAGE) {
             stageDuration = DILATION_GRADIENT_DURATION; // Gradient fade
             // printf("STAGE22_DEBUG: elapsed=%.2f, duration=%.2f, shouldAdvance=%d\n",
             //        stageElapsed, stageDuration, (stageElapsed >= stageDuration));
-        } else if (RoutineController::m_routineStage == FIXED_POSITION_STAGE) {
+        } else if (m_routineStage == FIXED_POSITION_STAGE) {
             stageDuration = 120.0f; // 120 seconds for fixed position test
         } else {
             stageDuration = STAGE_ACTION_DURATION;
@@ -576,25 +568,25 @@ void RoutineController::handleStageProgression() {
         shouldAdvance = (stageElapsed >= stageDuration);
     }
 
-    printf("Stage %d : elapsed=%.2f, duration=%.2f, shouldAdvance=%d\n",
-           RoutineController::m_routineStage, stageElapsed, stageDuration, shouldAdvance);
+    ROUTINE_LOG("Stage %d : elapsed=%.2f, duration=%.2f, shouldAdvance=%d\n",
+           m_routineStage, stageElapsed, stageDuration, shouldAdvance);
 
     // Advance to next stage if time is up
     if (shouldAdvance) {
-        RoutineController::m_routineStage++;
-        RoutineController::m_stageStartTime = m_elapsedTime; // Reset stage timer
-        RoutineController::m_stepWritten = false;            // Reset step written flag for new stage
+        m_routineStage++;
+        m_stageStartTime = m_elapsedTime; // Reset stage timer
+        m_stepWritten = false;            // Reset step written flag for new stage
 
-        printf("Advanced to stage %d at time %.2f\n", RoutineController::m_routineStage, m_elapsedTime);
+        ROUTINE_LOG("Advanced to stage %d at time %.2f\n", m_routineStage, m_elapsedTime);
 
         // End routine after fixed position test
-        if (RoutineController::m_routineStage > MAX_ROUTINE_STAGE) {
-            printf("COMPLETION_DEBUG: Stage %d > MAX_ROUTINE_STAGE(%d), setting to COMPLETION_STAGE(%d)\n",
-                   RoutineController::m_routineStage, MAX_ROUTINE_STAGE, COMPLETION_STAGE);
-            RoutineController::m_routineStage = COMPLETION_STAGE; // Mark as complete
-            OverlayManager::s_routineState = FLAG_ROUTINE_COMPLETE;
-            printf("COMPLETION_DEBUG: Set FLAG_ROUTINE_COMPLETE\n");
-        } else {
+        if (m_routineStage > MAX_ROUTINE_STAGE) {
+            ROUTINE_LOG("COMPLETION_DEBUG: Stage %d > MAX_ROUTINE_STAGE(%d), setting to COMPLETION_STAGE(%d)\n",
+                   m_routineStage, MAX_ROUTINE_STAGE, COMPLETION_STAGE);
+            m_routineStage = COMPLETION_STAGE; // Mark as complete
+            m_currentPosition.state = FLAG_ROUTINE_COMPLETE;
+            ROUTINE_LOG("COMPLETION_DEBUG: Set FLAG_ROUTINE_COMPLETE\n");
+        } else if (!m_headless) {
             // Only beep for stage transitions, not for completion
             beep(174, 500); // Audio feedback for stage transitions
         }
@@ -1,13 +1,58 @@
 #ifndef ROUTINE_H
 #define ROUTINE_H
 
-#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <string>
 #include <vector>
 
 // Forward declaration
 class RoutineController;
 
+/**
+ * @brief Time source for a RoutineController
+ *
+ * The controller only ever looks at differences between readings, so the
+ * origin doesn't matter. The default clock follows real time; a simulator
+ * injects a VirtualRoutineClock and advances it itself.
+ */
+class RoutineClock {
+public:
+    virtual ~RoutineClock() = default;
+
+    // Current time in seconds
+    virtual double now() const = 0;
+};
+
+// Real time, from the steady clock
+class SteadyRoutineClock : public RoutineClock {
+public:
+    double now() const override;
+};
+
+// Time that only moves when told to, for stepping a routine faster than real time
+class VirtualRoutineClock : public RoutineClock {
+public:
+    explicit VirtualRoutineClock(double start = 0.0)
+        : m_now(start) {
+    }
+
+    double now() const override {
+        return m_now;
+    }
+
+    void advance(double seconds) {
+        m_now += seconds;
+    }
+
+    void set(double seconds) {
+        m_now = seconds;
+    }
+
+private:
+    double m_now;
+};
+
 // Operation types
 enum class OperationType {
     MOVE,             // Instant movement to position
@@ -38,39 +83,78 @@ constexpr float TARGET_DEFAULT_DISTANCE = 2.0f; // Default distance in meters
 #define DILATION_NOTIFY_3_STAGE 21 // Pre-gradient notification
 #define DILATION_GRADIENT_STAGE 22 // Gradient fade stage
 
-// Structure to represent a single operation
+// Structure to represent a single operation; constexpr so routines can be compiled at build time
 struct Operation {
-    OperationType type;
+    struct MoveParams {
+        float x, y;
+    };
+    struct RestParams {
+        float seconds;
+    };
+    struct SmoothParams {
+        float x1, y1, x2, y2, seconds;
+    };
+    struct CircleParams {
+        float centerX, centerY, radius, seconds;
+        bool clockwise;
+    };
+    struct DepthParams {
+        float x, y;          // Fixed screen position
+        float startDistance; // Starting distance in meters
+        float endDistance;   // Ending distance in meters
+        float seconds;       // Duration of movement
+    };
+    struct FixedPosParams {
+        float seconds; // Duration to maintain fixed position
+    };
 
     // Parameters for different operations
-    union {
-        struct {
-            float x, y;
-        } move;
-        struct {
-            float seconds;
-        } rest;
-        struct {
-            float x1, y1, x2, y2, seconds;
-        } smooth;
-        struct {
-            float centerX, centerY, radius, seconds;
-            bool clockwise;
-        } circle;
-        struct {
-            float x, y;          // Fixed screen position
-            float startDistance; // Starting distance in meters
-            float endDistance;   // Ending distance in meters
-            float seconds;       // Duration of movement
-        } depth;
-        struct {
-            float seconds; // Duration to maintain fixed position
-        } fixedPos;
-    } params;
+    union Params {
+        constexpr Params()
+            : rest { 0.0f } {
+        }
+        constexpr Params(MoveParams p)
+            : move(p) {
+        }
+        constexpr Params(RestParams p)
+            : rest(p) {
+        }
+        constexpr Params(SmoothParams p)
+            : smooth(p) {
+        }
+        constexpr Params(CircleParams p)
+            : circle(p) {
+        }
+        constexpr Params(DepthParams p)
+            : depth(p) {
+        }
+        constexpr Params(FixedPosParams p)
+            : fixedPos(p) {
+        }
+
+        MoveParams move;
+        RestParams rest;
+        SmoothParams smooth;
+        CircleParams circle;
+        DepthParams depth;
+        FixedPosParams fixedPos;
+    };
+
+    OperationType type;
+    Params params;
 
     // Time tracking
-    float duration;    // How long this operation should take
-    float elapsedTime; // How much time has elapsed in this operation
+    float duration; // How long this operation should take
+
+    constexpr Operation()
+        : type(OperationType::REST)
+        , duration(0.0f) {
+    }
+    constexpr Operation(OperationType type, Params params, float duration)
+        : type(type)
+        , params(params)
+        , duration(duration) {
+    }
 };
 
 // Position structure for current target
@@ -87,10 +171,18 @@ class RoutineController {
 public:
     uint32_t getStateFlags() const;
 
-    // Constructor with configurable movement speed
-    RoutineController(float maxMoveSpeed = 1.0f);
+    // Constructor with configurable movement speed; a null clock follows real time
+    RoutineController(float maxMoveSpeed = 1.0f, RoutineClock* clock = nullptr);
+
+    // Clock that step() reads; not owned, and null goes back to real time
+    void setClock(RoutineClock* clock);
+
+    // Don't beep or log every step, for running routines without the overlay
+    void setHeadless(bool headless) {
+        m_headless = headless;
+    }
 
-    // Parse a routine string into operations
+    // Parse a routine string into operations; the built-in routines are compiled at build time instead
     bool parseRoutine(const std::string& routineStr);
 
     // Load a routine from the predefined list by index
@@ -99,7 +191,7 @@ public:
     // Step through the routine, returns target position
     TargetPosition step();
 
-    // Reset the routine to start from the beginning
+    // Reset the routine, its timing and its stage to start from the beginning
     void reset();
 
     // Check if routine is complete
@@ -113,17 +205,49 @@ public:
 
     int getTimeTillNext();
 
+    // Current calibration stage, 0 until the intro is over and COMPLETION_STAGE at the end
+    int getRoutineStage() const {
+        return m_routineStage;
+    }
+
+    // Move to a stage now, restarting its timer
+    void jumpToStage(int stage);
+
+    // Seconds the routine has run for, and when the current stage started
+    double_t getElapsedTime() const {
+        return m_elapsedTime;
+    }
+    double_t getStageStartTime() const {
+        return m_stageStartTime;
+    }
+
+    // Whether the first sample of the current stage has been recorded; cleared on every stage change
+    bool getStepWritten() const {
+        return m_stepWritten;
+    }
+    void setStepWritten(bool written) {
+        m_stepWritten = written;
+    }
+
+    void setFixedStageDuration(double_t duration) {
+        m_fixedStageDuration = duration;
+    }
+
+    // Progress of the dilation gradient, 0 = white to 1 = black
+    float getFadeProgress() const {
+        return m_fadeProgress;
+    }
+
     // Get available routine names
     static std::vector<std::string> getRoutineNames();
-    static bool m_stepWritten;
-    static double_t m_globalAdvancedTime;
-    static int m_routineStage;
-    static double_t m_stageStartTime;
-    static double_t m_fixedStageDuration;
 
 private:
-    // Operation list for the current routine
-    std::vector<Operation> m_operations;
+    // Operation list for the current routine: a compiled built-in one, or
+    // null when a routine string was parsed into m_parsedOperations
+    const Operation* m_operations;
+    size_t m_operationCount;
+    std::vector<Operation> m_parsedOperations;
+    float m_operationElapsed; // Time spent in the current operation
 
     // Current state
     size_t m_currentOpIndex;
@@ -132,8 +256,10 @@ private:
     int m_loadedRoutineIndex = -1; // -1 indicates no routine loaded
 
     // Timing
-    std::chrono::time_point<std::chrono::high_resolution_clock> m_lastUpdateTime;
+    RoutineClock* m_clock; // Null for real time
+    double m_lastUpdateTime;
     bool m_routineStarted;
+    bool m_headless;
 
     // Configuration
     float m_maxMoveSpeed; // Maximum movement speed in units per second
@@ -141,12 +267,21 @@ private:
     double_t m_elapsedTime;
     double_t m_lastRandomPointTime;
 
+    // Stage progression
+    int m_routineStage;
+    double_t m_stageStartTime;
+    double_t m_fixedStageDuration;
+    bool m_stepWritten;
+    float m_fadeProgress;
+    int m_lastDebugStage;
+
     // Helper methods
-    bool parseOperation(const std::string& opStr);
+    const Operation* operations() const;
     TargetPosition calculatePosition();
     TargetPosition calculateConvergencePosition();
     TargetPosition calculateDilationPosition();
     void handleStageProgression();
+    double now() const;
 
     // Convert screen coordinates (0-1) to yaw/pitch angles
     TargetPosition screenToAngles(float x, float y) const;
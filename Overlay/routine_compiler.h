@@ -0,0 +1,263 @@
+#ifndef ROUTINE_COMPILER_H
+#define ROUTINE_COMPILER_H
+
+#include <cstddef>
+#include <stdexcept>
+
+#include "routine.h"
+
+// Outcome of parsing a routine string
+struct RoutineParseResult {
+    size_t count = 0;            // Operations written
+    const char* error = nullptr; // What's wrong, or null if the routine parsed
+    size_t offset = 0;           // Character the error was found at
+};
+
+/**
+ * @brief Parser for routine strings such as "move(0.5,0.5);rest(1.0);"
+ *
+ * Operations are separated by semicolons; empty ones are ignored. The
+ * grammar is that of the original regex parser:
+ *   move(x, y)                          instant move to a screen position
+ *   rest(seconds)
+ *   smooth(x1, y1, x2, y2, seconds)     linear move
+ *   smoothCircle(cx, cy, r, seconds, 0|1)
+ *   moveDepth(x, y, start, end, seconds)
+ * where every number is written with a decimal point, e.g. 1.0.
+ *
+ * Everything is constexpr, so the same code parses a routine at runtime
+ * and compiles the built-in ones at build time (see compileRoutine).
+ */
+class RoutineParser {
+public:
+    constexpr RoutineParser(const char* text, size_t length)
+        : m_text(text)
+        , m_length(length)
+        , m_pos(0)
+        , m_error(nullptr) {
+    }
+
+    // Parse into out; fails if there are more than capacity operations
+    constexpr RoutineParseResult parse(Operation* out, size_t capacity) {
+        RoutineParseResult result;
+        while (!m_error) {
+            skipSpace();
+            if (m_pos >= m_length) {
+                break;
+            }
+            if (peek() == ';') {
+                m_pos++;
+                continue;
+            }
+
+            Operation op = operation();
+            skipSpace();
+            if (!m_error && m_pos < m_length && peek() != ';') {
+                fail("expected ';' after an operation");
+            }
+            if (m_error) {
+                break;
+            }
+            if (result.count >= capacity) {
+                fail("too many operations");
+                break;
+            }
+            out[result.count++] = op;
+        }
+        if (!m_error && result.count == 0) {
+            fail("routine has no operations");
+        }
+
+        result.error = m_error;
+        result.offset = m_pos;
+        return result;
+    }
+
+private:
+    constexpr char peek() const {
+        return m_pos < m_length ? m_text[m_pos] : '\0';
+    }
+
+    constexpr void fail(const char* error) {
+        if (!m_error) {
+            m_error = error;
+        }
+    }
+
+    constexpr void skipSpace() {
+        while (m_pos < m_length && (peek() == ' ' || peek() == '\t' || peek() == '\r' || peek() == '\n')) {
+            m_pos++;
+        }
+    }
+
+    constexpr bool consume(char c) {
+        skipSpace();
+        if (peek() != c) {
+            return false;
+        }
+        m_pos++;
+        return true;
+    }
+
+    constexpr void expect(char c, const char* error) {
+        if (!m_error && !consume(c)) {
+            fail(error);
+        }
+    }
+
+    // Operation name; the whole word has to match, so "smooth" doesn't match "smoothCircle"
+    constexpr bool name(const char* word) {
+        size_t i = 0;
+        while (word[i] != '\0') {
+            if (m_pos + i >= m_length || m_text[m_pos + i] != word[i]) {
+                return false;
+            }
+            i++;
+        }
+        const char next = m_pos + i < m_length ? m_text[m_pos + i] : '\0';
+        if ((next >= 'a' && next <= 'z') || (next >= 'A' && next <= 'Z') || (next >= '0' && next <= '9') || next == '_') {
+            return false;
+        }
+        m_pos += i;
+        return true;
+    }
+
+    // Unsigned decimal with at least one digit on each side of the point
+    constexpr float number() {
+        skipSpace();
+        double value = 0.0;
+        size_t digits = 0;
+        while (peek() >= '0' && peek() <= '9') {
+            value = value * 10.0 + (peek() - '0');
+            m_pos++;
+            digits++;
+        }
+        if (digits == 0 || peek() != '.') {
+            fail("expected a number like 1.0");
+            return 0.0f;
+        }
+        m_pos++;
+
+        double scale = 1.0;
+        digits = 0;
+        while (peek() >= '0' && peek() <= '9') {
+            value = value * 10.0 + (peek() - '0');
+            scale *= 10.0;
+            m_pos++;
+            digits++;
+        }
+        if (digits == 0) {
+            fail("expected a digit after the decimal point");
+            return 0.0f;
+        }
+        return (float)(value / scale);
+    }
+
+    // number() followed by ',' or, for the last argument, ')'
+    constexpr float argument(bool last) {
+        const float value = number();
+        expect(last ? ')' : ',', last ? "expected ')'" : "expected ','");
+        return value;
+    }
+
+    constexpr Operation operation() {
+        if (name("smoothCircle")) {
+            expect('(', "expected '('");
+            const float centerX = argument(false);
+            const float centerY = argument(false);
+            const float radius = argument(false);
+            const float seconds = argument(false);
+            skipSpace();
+            const char direction = peek();
+            if (direction != '0' && direction != '1') {
+                fail("expected 0 or 1 for the direction");
+            }
+            m_pos++;
+            expect(')', "expected ')'");
+            return Operation(OperationType::SMOOTH_CIRCLE, Operation::CircleParams { centerX, centerY, radius, seconds, direction == '1' }, seconds);
+        }
+        if (name("smooth")) {
+            expect('(', "expected '('");
+            const float x1 = argument(false);
+            const float y1 = argument(false);
+            const float x2 = argument(false);
+            const float y2 = argument(false);
+            const float seconds = argument(true);
+            return Operation(OperationType::SMOOTH, Operation::SmoothParams { x1, y1, x2, y2, seconds }, seconds);
+        }
+        if (name("moveDepth")) {
+            expect('(', "expected '('");
+            const float x = argument(false);
+            const float y = argument(false);
+            const float startDistance = argument(false);
+            const float endDistance = argument(false);
+            const float seconds = argument(true);
+            return Operation(OperationType::MOVE_AWAY_TOWARD, Operation::DepthParams { x, y, startDistance, endDistance, seconds }, seconds);
+        }
+        if (name("move")) {
+            expect('(', "expected '('");
+            const float x = argument(false);
+            const float y = argument(true);
+            return Operation(OperationType::MOVE, Operation::MoveParams { x, y }, 0.0f); // Instant
+        }
+        if (name("rest")) {
+            expect('(', "expected '('");
+            const float seconds = argument(true);
+            return Operation(OperationType::REST, Operation::RestParams { seconds }, seconds);
+        }
+        fail("unknown operation");
+        return Operation();
+    }
+
+    const char* m_text;
+    size_t m_length;
+    size_t m_pos;
+    const char* m_error;
+};
+
+constexpr size_t routineLength(const char* text) {
+    size_t length = 0;
+    while (text[length] != '\0') {
+        length++;
+    }
+    return length;
+}
+
+// Upper bound on the operations in a routine string, to size its compiled array
+constexpr size_t routineCapacity(const char* text) {
+    size_t separators = 0;
+    for (size_t i = 0; text[i] != '\0'; i++) {
+        separators += text[i] == ';' ? 1 : 0;
+    }
+    return separators + 1;
+}
+
+// Operations of a routine compiled at build time
+template <size_t Capacity>
+struct CompiledRoutine {
+    Operation operations[Capacity];
+    size_t count;
+};
+
+/**
+ * @brief Parse a routine string at compile time
+ *
+ * Used to initialize a constexpr variable, a malformed routine doesn't
+ * compile: the throw below can't be evaluated in a constant expression,
+ * and the compiler points at it along with the routine being compiled.
+ *
+ * @tparam Capacity At least routineCapacity(text)
+ */
+template <size_t Capacity>
+constexpr CompiledRoutine<Capacity> compileRoutine(const char* text) {
+    CompiledRoutine<Capacity> routine {};
+    RoutineParser parser(text, routineLength(text));
+    const RoutineParseResult result = parser.parse(routine.operations, Capacity);
+    if (result.error) {
+        throw std::invalid_argument(result.error); // Malformed calibration routine
+    }
+    routine.count = result.count;
+    return routine;
+}
+
+#endif // ROUTINE_COMPILER_H
@@ -0,0 +1,229 @@
+// Runs calibration routines without SteamVR, on a virtual clock, to check
+// them and to see the labels they produce long before anyone puts on a
+// headset. A full calibration takes several minutes of real time and is
+// simulated in a fraction of a second.
+//
+// Usage: routine_sim [--routine N | --all] [--rate HZ] [--max-seconds S] [--csv out.csv]
+//
+// Every routine is stepped at a fixed rate, the way the overlay steps it
+// once per frame, including the overlay's jump past the scan stages. It
+// fails (exit code 1) if a routine doesn't complete in time, skips or
+// repeats a stage, or produces a target that isn't finite or in front of
+// the viewer. With --csv the trajectory of one routine is written as
+//   time,stage,yaw,pitch,distance,state,fade
+// with one row per step; "-" writes it to stdout.
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "routine.h"
+
+#define SIM_DEFAULT_RATE        100.0  // Steps per second; the overlay's main loop runs at about this
+#define SIM_DEFAULT_MAX_SECONDS 3600.0 // Simulated time after which a routine counts as stuck
+
+struct SimOptions {
+    int routine = 0;
+    bool all = false;
+    double rate = SIM_DEFAULT_RATE;
+    double maxSeconds = SIM_DEFAULT_MAX_SECONDS;
+    std::string csvPath;
+};
+
+// Outcome of simulating one routine
+struct SimResult {
+    bool ok = true;
+    bool completed = false;
+    uint64_t steps = 0;
+    double simulatedSeconds = 0.0;
+    double wallSeconds = 0.0;
+    std::vector<double> stageEntered; // Simulated time each stage was entered, -1 if never
+    std::string error;
+};
+
+static bool fail(SimResult& result, const char* message, int stage, double time) {
+    if (result.ok) {
+        char text[160];
+        snprintf(text, sizeof(text), "%s (stage %d, t=%.2fs)", message, stage, time);
+        result.error = text;
+    }
+    result.ok = false;
+    return false;
+}
+
+static SimResult simulate(int routineIndex, const SimOptions& options, FILE* csv) {
+    SimResult result;
+    result.stageEntered.assign(COMPLETION_STAGE + 1, -1.0);
+
+    VirtualRoutineClock clock;
+    RoutineController controller(1.15f, &clock); // Same speed as the overlay's controller
+    controller.setHeadless(true);
+    if (!controller.loadRoutine(routineIndex)) {
+        fail(result, "routine doesn't load", 0, 0.0);
+        return result;
+    }
+    controller.reset();
+
+    const double dt = 1.0 / options.rate;
+    const uint64_t maxSteps = (uint64_t)(options.maxSeconds * options.rate);
+    int lastStage = -1;
+    const auto start = std::chrono::steady_clock::now();
+
+    for (uint64_t step = 0; step <= maxSteps; step++) {
+        TargetPosition pos = controller.step();
+        const double time = controller.getElapsedTime();
+        int stage = controller.getRoutineStage();
+
+        if (stage != lastStage) {
+            // Stages only ever move forward, one at a time, except for the jump past the scan stages
+            const bool next = lastStage < 0 ? stage == 0 : stage == lastStage + 1 || (lastStage <= 2 && stage == 3);
+            if (!next || stage > COMPLETION_STAGE) {
+                fail(result, "stage out of order", stage, time);
+                break;
+            }
+            result.stageEntered[stage] = time;
+            lastStage = stage;
+        }
+
+        if (!std::isfinite(pos.yaw) || !std::isfinite(pos.pitch) || !std::isfinite(pos.distance) || pos.distance <= 0.0f) {
+            fail(result, "target isn't finite or not in front of the viewer", stage, time);
+            break;
+        }
+
+        if (csv) {
+            fprintf(csv, "%.4f,%d,%.4f,%.4f,%.4f,%u,%.4f\n",
+                    time, stage, pos.yaw, pos.pitch, pos.distance, pos.state, controller.getFadeProgress());
+        }
+
+        result.steps++;
+        if (controller.isComplete()) {
+            result.completed = true;
+            break;
+        }
+
+        // The overlay skips the scan stages as soon as it sees them
+        if (stage == 1 || stage == 2) {
+            controller.jumpToStage(3);
+        }
+        clock.advance(dt);
+    }
+
+    result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.simulatedSeconds = controller.getElapsedTime();
+    if (result.ok && !result.completed) {
+        fail(result, "routine didn't complete", controller.getRoutineStage(), result.simulatedSeconds);
+    }
+    return result;
+}
+
+static void printResult(int routineIndex, const SimResult& result) {
+    const std::string name = RoutineController::getRoutineNames()[routineIndex];
+    printf("Routine %d (%s): %s\n", routineIndex, name.c_str(), result.ok ? "ok" : result.error.c_str());
+    if (result.steps == 0) {
+        return;
+    }
+    printf("  %llu steps, %.1f s simulated in %.3f s (%.0fx real time)\n",
+           (unsigned long long)result.steps, result.simulatedSeconds, result.wallSeconds,
+           result.wallSeconds > 0.0 ? result.simulatedSeconds / result.wallSeconds : 0.0);
+}
+
+static void printStages(const SimResult& result) {
+    if (result.steps == 0) {
+        return;
+    }
+    printf("  stage  start (s)  duration (s)\n");
+    for (size_t stage = 0; stage < result.stageEntered.size(); stage++) {
+        if (result.stageEntered[stage] < 0.0) {
+            continue;
+        }
+        // A stage lasts until the next one that was entered
+        double end = result.simulatedSeconds;
+        for (size_t next = stage + 1; next < result.stageEntered.size(); next++) {
+            if (result.stageEntered[next] >= 0.0) {
+                end = result.stageEntered[next];
+                break;
+            }
+        }
+        printf("  %5zu  %9.2f  %12.2f\n", stage, result.stageEntered[stage], end - result.stageEntered[stage]);
+    }
+}
+
+static void printUsage(const char* program, int routines) {
+    printf("Usage: %s [--routine N | --all] [--rate HZ] [--max-seconds S] [--csv out.csv]\n", program);
+    printf("  --routine N      routine to simulate (default 0, 0-%d)\n", routines - 1);
+    printf("  --all            simulate every routine and print a line for each\n");
+    printf("  --rate HZ        steps per simulated second (default %.0f)\n", SIM_DEFAULT_RATE);
+    printf("  --max-seconds S  simulated time after which a routine counts as stuck (default %.0f)\n", SIM_DEFAULT_MAX_SECONDS);
+    printf("  --csv PATH       write the trajectory of the routine, one row per step; - for stdout\n");
+}
+
+int main(int argc, char* argv[]) {
+    const int routines = (int)RoutineController::getRoutineNames().size();
+    SimOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--routine") == 0 && i + 1 < argc) {
+            options.routine = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--all") == 0) {
+            options.all = true;
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            options.rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-seconds") == 0 && i + 1 < argc) {
+            options.maxSeconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            options.csvPath = argv[++i];
+        } else {
+            printUsage(argv[0], routines);
+            return 1;
+        }
+    }
+    if (options.rate <= 0.0 || options.maxSeconds <= 0.0 || options.routine < 0 || options.routine >= routines || (options.all && !options.csvPath.empty())) {
+        printUsage(argv[0], routines);
+        return 1;
+    }
+
+    if (options.all) {
+        int failed = 0;
+        for (int routine = 0; routine < routines; routine++) {
+            SimResult result = simulate(routine, options, nullptr);
+            printResult(routine, result);
+            failed += result.ok ? 0 : 1;
+        }
+        printf("%d of %d routines passed\n", routines - failed, routines);
+        return failed ? 1 : 0;
+    }
+
+    FILE* csv = nullptr;
+    const bool toStdout = options.csvPath == "-";
+    if (toStdout) {
+        csv = stdout;
+    } else if (!options.csvPath.empty()) {
+        csv = fopen(options.csvPath.c_str(), "w");
+        if (!csv) {
+            printf("Can't create %s\n", options.csvPath.c_str());
+            return 1;
+        }
+    }
+    if (csv) {
+        fprintf(csv, "time,stage,yaw,pitch,distance,state,fade\n");
+    }
+
+    SimResult result = simulate(options.routine, options, csv);
+
+    if (csv && !toStdout) {
+        fclose(csv);
+    }
+    // Keep stdout to the CSV when it's going there
+    if (!toStdout) {
+        printResult(options.routine, result);
+        printStages(result);
+    } else if (!result.ok) {
+        fprintf(stderr, "%s\n", result.error.c_str());
+    }
+    return result.ok ? 0 : 1;
+}
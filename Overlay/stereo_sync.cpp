@@ -0,0 +1,238 @@
+#include "stereo_sync.h"
+#include "frame_buffer.h"
+#include "jpeg_stream.h"
+#include "stream_reactor.h"
+
+#include <chrono>
+
+#define STEREO_SYNC_POOL_CONSUMERS 3 // Capture, inference and the preview, each still holding an older frame
+
+// Every holder of a stream's frames must fit in its pool, or the parser falls
+// back to a one-off allocation per frame while the other eye stalls: the frame
+// being parsed, the reactor's validation queue and the frame a worker is
+// publishing (the threaded reader's ready queue is no deeper), the
+// FrameBuffer front frame, this queue, the published pair and the consumers
+static_assert(1 + STREAM_REACTOR_VALIDATE_QUEUE + 1 + 1 + STEREO_SYNC_QUEUE_LENGTH + 1 + STEREO_SYNC_POOL_CONSUMERS <= MJPEG_POOL_SIZE,
+              "MJPEG_POOL_SIZE doesn't cover every holder of a stream's frames");
+
+static uint64_t steadyNowMs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t absDiff(uint64_t a, uint64_t b) {
+    return a > b ? a - b : b - a;
+}
+
+StereoSynchronizer::StereoSynchronizer(FrameBuffer* left, FrameBuffer* right, uint64_t toleranceMs)
+    : m_left(left)
+    , m_right(right)
+    , m_running(false)
+    , m_toleranceMs(toleranceMs)
+    , m_sequence(0)
+    , m_absSkewSum(0) {
+}
+
+StereoSynchronizer::~StereoSynchronizer() {
+    stop();
+    releasePair(&m_latest);
+}
+
+void StereoSynchronizer::start() {
+    if (m_running.exchange(true)) {
+        return; // Already running
+    }
+
+    resetStats();
+    m_leftThread = std::thread(&StereoSynchronizer::collectLoop, this, m_left, &m_leftQueue, &m_stats.droppedLeft);
+    m_rightThread = std::thread(&StereoSynchronizer::collectLoop, this, m_right, &m_rightQueue, &m_stats.droppedRight);
+}
+
+void StereoSynchronizer::stop() {
+    if (!m_running.exchange(false)) {
+        return; // Already stopped
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pairCondition.notify_all();
+    }
+
+    if (m_leftThread.joinable()) {
+        m_leftThread.join();
+    }
+    if (m_rightThread.joinable()) {
+        m_rightThread.join();
+    }
+
+    // Frames still waiting for a partner
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (QueuedFrame& queued : m_leftQueue) {
+        ReleaseFrame(queued.frame);
+    }
+    for (QueuedFrame& queued : m_rightQueue) {
+        ReleaseFrame(queued.frame);
+    }
+    m_leftQueue.clear();
+    m_rightQueue.clear();
+}
+
+bool StereoSynchronizer::isRunning() const {
+    return m_running;
+}
+
+void StereoSynchronizer::setTolerance(uint64_t toleranceMs) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_toleranceMs = toleranceMs;
+}
+
+uint64_t StereoSynchronizer::getTolerance() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_toleranceMs;
+}
+
+bool StereoSynchronizer::acquireLatestPair(StereoPair* pair) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_latest.left) {
+        return false;
+    }
+
+    *pair = m_latest;
+    RetainFrame(pair->left);
+    RetainFrame(pair->right);
+    return true;
+}
+
+bool StereoSynchronizer::waitForPair(uint64_t afterSequence, int timeoutMs, StereoPair* pair) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // Same rules as FrameBuffer::waitForFrame: stop() cuts the wait short,
+    // a synchronizer that isn't running waits the full timeout
+    bool wasRunning = m_running;
+    m_pairCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&]() {
+        return (wasRunning && !m_running) || m_latest.sequence > afterSequence;
+    });
+
+    if (m_latest.sequence <= afterSequence || !m_latest.left) {
+        return false;
+    }
+
+    *pair = m_latest;
+    RetainFrame(pair->left);
+    RetainFrame(pair->right);
+    return true;
+}
+
+void StereoSynchronizer::releasePair(StereoPair* pair) {
+    ReleaseFrame(pair->left);
+    ReleaseFrame(pair->right);
+    *pair = StereoPair();
+}
+
+StereoSyncStats StereoSynchronizer::getStats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void StereoSynchronizer::resetStats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats = StereoSyncStats();
+    m_absSkewSum = 0;
+}
+
+void StereoSynchronizer::collectLoop(FrameBuffer* buffer, std::deque<QueuedFrame>* queue, uint64_t* dropped) {
+    uint64_t lastSequence = 0;
+
+    while (m_running) {
+        uint64_t sequence;
+        MJPEGFrame* frame = buffer->waitForFrame(lastSequence, STEREO_SYNC_WAIT_MS, &sequence);
+        if (!frame) {
+            continue;
+        }
+        lastSequence = sequence;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        queue->push_back({ frame, steadyNowMs() });
+
+        // The other eye has stalled; don't hold on to frames indefinitely
+        if (queue->size() > STEREO_SYNC_QUEUE_LENGTH) {
+            dropFront(queue, dropped);
+        }
+
+        matchQueues();
+    }
+}
+
+bool StereoSynchronizer::useCameraTime(const QueuedFrame& left, const QueuedFrame& right) const {
+    return left.frame->timestamp != 0 && right.frame->timestamp != 0;
+}
+
+void StereoSynchronizer::matchQueues() {
+    auto timeOf = [](const QueuedFrame& queued, bool cameraTime) {
+        return cameraTime ? queued.frame->timestamp : queued.arrivalMs;
+    };
+
+    while (!m_leftQueue.empty() && !m_rightQueue.empty()) {
+        const QueuedFrame& left = m_leftQueue.front();
+        const QueuedFrame& right = m_rightQueue.front();
+
+        bool cameraTime = useCameraTime(left, right);
+        uint64_t leftTime = timeOf(left, cameraTime);
+        uint64_t rightTime = timeOf(right, cameraTime);
+        uint64_t skew = absDiff(leftTime, rightTime);
+
+        if (skew > m_toleranceMs) {
+            // Both queues are in arrival order, so nothing still to come from
+            // the other eye is closer to the older head than the current one
+            if (leftTime < rightTime) {
+                dropFront(&m_leftQueue, &m_stats.droppedLeft);
+            } else {
+                dropFront(&m_rightQueue, &m_stats.droppedRight);
+            }
+            continue;
+        }
+
+        // Within tolerance, but the other eye's next frame may be a closer match
+        if (m_rightQueue.size() > 1 && useCameraTime(left, m_rightQueue[1]) == cameraTime
+            && absDiff(leftTime, timeOf(m_rightQueue[1], cameraTime)) < skew) {
+            dropFront(&m_rightQueue, &m_stats.droppedRight);
+            continue;
+        }
+        if (m_leftQueue.size() > 1 && useCameraTime(m_leftQueue[1], right) == cameraTime
+            && absDiff(timeOf(m_leftQueue[1], cameraTime), rightTime) < skew) {
+            dropFront(&m_leftQueue, &m_stats.droppedLeft);
+            continue;
+        }
+
+        publishPair(left, right, leftTime, rightTime);
+        m_leftQueue.pop_front();
+        m_rightQueue.pop_front();
+    }
+}
+
+void StereoSynchronizer::dropFront(std::deque<QueuedFrame>* queue, uint64_t* dropped) {
+    ReleaseFrame(queue->front().frame);
+    queue->pop_front();
+    (*dropped)++;
+}
+
+void StereoSynchronizer::publishPair(const QueuedFrame& left, const QueuedFrame& right, uint64_t leftTime, uint64_t rightTime) {
+    // The pair takes over the queue's references
+    releasePair(&m_latest);
+    m_latest.left = left.frame;
+    m_latest.right = right.frame;
+    m_latest.timestampLeft = leftTime;
+    m_latest.timestampRight = rightTime;
+    m_latest.skewMs = (int64_t)leftTime - (int64_t)rightTime;
+    m_latest.sequence = ++m_sequence;
+
+    uint64_t absSkew = absDiff(leftTime, rightTime);
+    m_absSkewSum += absSkew;
+    m_stats.pairs++;
+    m_stats.lastSkewMs = m_latest.skewMs;
+    if (absSkew > m_stats.maxAbsSkewMs) {
+        m_stats.maxAbsSkewMs = absSkew;
+    }
+    m_stats.meanAbsSkewMs = (double)m_absSkewSum / m_stats.pairs;
+
+    m_pairCondition.notify_all();
+}
@@ -0,0 +1,131 @@
+#ifndef STEREO_SYNC_H
+#define STEREO_SYNC_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+class FrameBuffer;
+struct MJPEGFrame;
+
+#define STEREO_SYNC_DEFAULT_TOLERANCE_MS 16  // Max |left - right| timestamp difference for a pair (one frame at 60 fps)
+#define STEREO_SYNC_QUEUE_LENGTH         5   // Unmatched frames kept per eye while waiting for the other; comes out of the stream's frame pool
+#define STEREO_SYNC_WAIT_MS              100 // Collector wait before re-checking for stop()
+
+/**
+ * @brief A left and right frame taken at (nearly) the same time
+ *
+ * Holds one reference to each frame; release it with StereoSynchronizer::releasePair().
+ */
+struct StereoPair {
+    MJPEGFrame* left = nullptr;
+    MJPEGFrame* right = nullptr;
+    uint64_t timestampLeft = 0;  // Time the pair was matched on (X-Timestamp, or arrival if a stream has none)
+    uint64_t timestampRight = 0;
+    int64_t skewMs = 0;          // timestampLeft - timestampRight
+    uint64_t sequence = 0;       // Increments once per matched pair
+};
+
+/**
+ * @brief Pairing counters since start() or resetStats()
+ */
+struct StereoSyncStats {
+    uint64_t pairs = 0;
+    uint64_t droppedLeft = 0;  // Left frames with no right frame within tolerance
+    uint64_t droppedRight = 0; // Right frames with no left frame within tolerance
+    int64_t lastSkewMs = 0;
+    uint64_t maxAbsSkewMs = 0;
+    double meanAbsSkewMs = 0.0;
+};
+
+/**
+ * @brief Pairs the two eye streams by camera timestamp in real time
+ *
+ * One collector thread per eye takes every frame its FrameBuffer publishes
+ * and queues it. Queued frames are matched oldest-first: the older of the two
+ * queue heads is dropped when the other eye has nothing within the tolerance
+ * for it, and a head is skipped when the next frame of the other eye is a
+ * closer match. Frames are held by reference, never copied.
+ *
+ * Timestamps are the X-Timestamp of each frame. If either stream doesn't send
+ * one, frames are paired by arrival time instead.
+ */
+class StereoSynchronizer {
+public:
+    /**
+     * @param left FrameBuffer of the left eye
+     * @param right FrameBuffer of the right eye
+     * @param toleranceMs Largest timestamp difference accepted as a pair
+     */
+    StereoSynchronizer(FrameBuffer* left, FrameBuffer* right, uint64_t toleranceMs = STEREO_SYNC_DEFAULT_TOLERANCE_MS);
+    ~StereoSynchronizer();
+
+    // Start the collector threads. The FrameBuffers may be started before or after.
+    void start();
+    void stop();
+    bool isRunning() const;
+
+    void setTolerance(uint64_t toleranceMs);
+    uint64_t getTolerance() const;
+
+    /**
+     * @brief Get the most recent matched pair without waiting
+     * @param pair Receives the pair; release it with releasePair()
+     * @return false if no pair has been matched yet
+     */
+    bool acquireLatestPair(StereoPair* pair);
+
+    /**
+     * @brief Block until a pair newer than afterSequence is matched
+     * @param afterSequence Sequence of the last pair the caller handled, 0 for none
+     * @param timeoutMs Longest time to wait
+     * @param pair Receives the pair; release it with releasePair()
+     * @return false on timeout or when stop() is called
+     */
+    bool waitForPair(uint64_t afterSequence, int timeoutMs, StereoPair* pair);
+
+    // Drop the references held by pair and clear it
+    static void releasePair(StereoPair* pair);
+
+    StereoSyncStats getStats() const;
+    void resetStats();
+
+private:
+    struct QueuedFrame {
+        MJPEGFrame* frame;
+        uint64_t arrivalMs;
+    };
+
+    void collectLoop(FrameBuffer* buffer, std::deque<QueuedFrame>* queue, uint64_t* dropped);
+    void matchQueues();
+    void dropFront(std::deque<QueuedFrame>* queue, uint64_t* dropped);
+    void publishPair(const QueuedFrame& left, const QueuedFrame& right, uint64_t leftTime, uint64_t rightTime);
+
+    // Timestamps both sides are compared on: camera time when both streams have it
+    bool useCameraTime(const QueuedFrame& left, const QueuedFrame& right) const;
+
+    FrameBuffer* m_left;
+    FrameBuffer* m_right;
+
+    std::atomic<bool> m_running;
+    std::thread m_leftThread;
+    std::thread m_rightThread;
+
+    // Guards everything below
+    mutable std::mutex m_mutex;
+    std::condition_variable m_pairCondition;
+
+    uint64_t m_toleranceMs;
+    std::deque<QueuedFrame> m_leftQueue;
+    std::deque<QueuedFrame> m_rightQueue;
+
+    StereoPair m_latest; // Holds its own references
+    uint64_t m_sequence;
+    StereoSyncStats m_stats;
+    uint64_t m_absSkewSum;
+};
+
+#endif // STEREO_SYNC_H
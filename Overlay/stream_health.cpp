@@ -0,0 +1,97 @@
+#include "stream_health.h"
+
+#include <chrono>
+
+static uint64_t steadyNowMs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+StreamHealthMonitor::StreamHealthMonitor()
+    : m_lastFrameMs(0)
+    , m_lastIntervalMs(0)
+    , m_windowStartMs(0)
+    , m_windowFrames(0)
+    , m_windowBytes(0) {
+}
+
+void StreamHealthMonitor::onFrame(size_t bytes) {
+    uint64_t now = steadyNowMs();
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_health.frames > 0) {
+        uint64_t interval = now - m_lastFrameMs;
+        if (m_health.frames > 1) {
+            // J += (|D| - J) / 16, D being the change in frame interval
+            double change = (double)interval - (double)m_lastIntervalMs;
+            double absChange = change < 0 ? -change : change;
+            m_health.jitterMs += (absChange - m_health.jitterMs) / 16.0;
+        }
+        m_lastIntervalMs = interval;
+    } else {
+        m_windowStartMs = now;
+    }
+
+    m_lastFrameMs = now;
+    m_health.frames++;
+    m_windowFrames++;
+    m_windowBytes += bytes;
+
+    uint64_t elapsed = now - m_windowStartMs;
+    if (elapsed >= STREAM_HEALTH_WINDOW_MS) {
+        m_health.fps = m_windowFrames * 1000.0 / elapsed;
+        m_health.bytesPerSec = m_windowBytes * 1000.0 / elapsed;
+        m_windowStartMs = now;
+        m_windowFrames = 0;
+        m_windowBytes = 0;
+    }
+}
+
+void StreamHealthMonitor::onParseErrors(uint64_t count) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_health.parseErrors += count;
+}
+
+void StreamHealthMonitor::onHeaderFailure() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_health.headerFailures++;
+}
+
+void StreamHealthMonitor::onReconnect() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_health.reconnects++;
+}
+
+void StreamHealthMonitor::setConnected(bool connected) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_health.connected = connected;
+}
+
+StreamHealth StreamHealthMonitor::getHealth() const {
+    uint64_t now = steadyNowMs();
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    StreamHealth health = m_health;
+    if (health.frames > 0) {
+        health.lastFrameAgeMs = (int64_t)(now - m_lastFrameMs);
+
+        // The rates are only updated by frames; a stream that stopped
+        // sending must not keep showing its old rate
+        if (now - m_lastFrameMs >= STREAM_HEALTH_WINDOW_MS) {
+            health.fps = 0.0;
+            health.bytesPerSec = 0.0;
+        }
+    }
+    return health;
+}
+
+void StreamHealthMonitor::reset() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool connected = m_health.connected;
+    m_health = StreamHealth();
+    m_health.connected = connected;
+    m_lastFrameMs = 0;
+    m_lastIntervalMs = 0;
+    m_windowStartMs = 0;
+    m_windowFrames = 0;
+    m_windowBytes = 0;
+}
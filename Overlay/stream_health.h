@@ -0,0 +1,56 @@
+#ifndef STREAM_HEALTH_H
+#define STREAM_HEALTH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#define STREAM_HEALTH_WINDOW_MS 1000 // Period fps and bytes/sec are averaged over
+
+/**
+ * @brief Snapshot of one camera stream's health
+ */
+struct StreamHealth {
+    bool connected = false;
+    double fps = 0.0;            // Frames per second over the last window
+    double jitterMs = 0.0;       // Smoothed variation of the frame interval (RFC 3550 style)
+    double bytesPerSec = 0.0;    // JPEG bytes per second over the last window
+    uint64_t frames = 0;         // Valid frames delivered
+    uint64_t parseErrors = 0;    // Malformed multipart parts skipped
+    uint64_t headerFailures = 0; // Parts tjDecompressHeader2 rejected
+    uint64_t reconnects = 0;     // Successful reconnects after a lost connection
+    int64_t lastFrameAgeMs = -1; // Time since the last frame, -1 before the first
+};
+
+/**
+ * @brief Thread-safe counters behind a StreamHealth
+ *
+ * Fed by whatever reads the stream (the StreamReactor or a FrameBuffer
+ * thread). Counters survive reconnects so a flapping camera shows up.
+ */
+class StreamHealthMonitor {
+public:
+    StreamHealthMonitor();
+
+    // A valid frame of the given JPEG size arrived now
+    void onFrame(size_t bytes);
+    void onParseErrors(uint64_t count);
+    void onHeaderFailure();
+    void onReconnect();
+    void setConnected(bool connected);
+
+    StreamHealth getHealth() const;
+    void reset();
+
+private:
+    mutable std::mutex m_mutex;
+    StreamHealth m_health;
+
+    uint64_t m_lastFrameMs;
+    uint64_t m_lastIntervalMs;
+    uint64_t m_windowStartMs;
+    uint64_t m_windowFrames;
+    uint64_t m_windowBytes;
+};
+
+#endif // STREAM_HEALTH_H
@@ -0,0 +1,719 @@
+#include "stream_reactor.h"
+#include "jpeg_stream.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <turbojpeg.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET socket_t;
+#define SOCKET_INVALID INVALID_SOCKET
+#define CLOSE_SOCKET   closesocket
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int socket_t;
+#define SOCKET_INVALID -1
+#define CLOSE_SOCKET   close
+#endif
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define STREAM_REACTOR_EPOLL
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+#include <sys/event.h>
+#define STREAM_REACTOR_KQUEUE
+#else
+#ifndef _WIN32
+#include <poll.h>
+typedef struct pollfd WSAPOLLFD;
+#define WSAPoll poll
+#endif
+#define STREAM_REACTOR_POLL
+#endif
+
+// Everything about a stream that outlives its current connection. Shared
+// with queued frames so removeStream() can cut the handler off while workers
+// still hold frames of the stream.
+struct StreamReactor::StreamState {
+    std::mutex mutex; // Held while the handler runs
+    bool active = true;
+    FrameHandler onFrame;
+    size_t queued = 0; // Frames waiting for validation, guarded by the worker's mutex
+
+    std::string host;
+    std::string path;
+    int port = 0;
+    std::atomic<int> backoffMs { STREAM_REACTOR_RECONNECT_MIN_MS };
+    bool everConnected = false; // Guarded by the reactor's m_mutex
+    StreamHealthMonitor health;
+};
+
+struct StreamReactor::Connection {
+    StreamReactor* reactor;
+    int id;
+    socket_t sock;
+    MJPEGParser* parser;
+    std::shared_ptr<StreamState> state;
+    uint64_t lastReceiveMs;
+    unsigned long reportedParseErrors; // Parser errors already added to the health counters
+};
+
+struct StreamReactor::Job {
+    MJPEGFrame* frame;
+    std::shared_ptr<StreamState> state;
+};
+
+struct StreamReactor::Worker {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Job> queue;
+    tjhandle tjInstance = nullptr;
+};
+
+static uint64_t steadyNowMs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool wouldBlock() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+static bool setNonBlocking(socket_t sock) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+// Blocking connect; the socket is switched to non-blocking afterwards
+static socket_t connectStream(const char* host, int port) {
+    struct addrinfo hints, *result = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    char portString[16];
+    snprintf(portString, sizeof(portString), "%d", port);
+    if (getaddrinfo(host, portString, &hints, &result) != 0) {
+        return SOCKET_INVALID;
+    }
+
+    socket_t sock = SOCKET_INVALID;
+    for (struct addrinfo* ptr = result; ptr != NULL; ptr = ptr->ai_next) {
+        sock = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
+        if (sock == SOCKET_INVALID) {
+            continue;
+        }
+        if (connect(sock, ptr->ai_addr, (int)ptr->ai_addrlen) == 0) {
+            break;
+        }
+        CLOSE_SOCKET(sock);
+        sock = SOCKET_INVALID;
+    }
+
+    freeaddrinfo(result);
+    return sock;
+}
+
+// Connect, request the stream and switch the socket to non-blocking
+static socket_t openStream(const std::string& host, const std::string& path, int port) {
+    socket_t sock = connectStream(host.c_str(), port);
+    if (sock == SOCKET_INVALID) {
+        return SOCKET_INVALID;
+    }
+
+    char request[1024];
+    snprintf(request, sizeof(request),
+             "GET %s HTTP/1.1\r\n"
+             "Host: %s\r\n"
+             "Connection: keep-alive\r\n\r\n",
+             path.c_str(), host.c_str());
+
+    if (send(sock, request, (int)strlen(request), 0) <= 0 || !setNonBlocking(sock)) {
+        CLOSE_SOCKET(sock);
+        return SOCKET_INVALID;
+    }
+    return sock;
+}
+
+StreamReactor::StreamReactor(int decodeThreads)
+    : m_decodeThreads(decodeThreads > 0 ? decodeThreads : 1)
+    , m_running(false)
+    , m_nextId(1)
+    , m_readBuffer(STREAM_REACTOR_READ_BYTES)
+    , m_poller(-1) {
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+}
+
+StreamReactor::~StreamReactor() {
+    stop();
+
+    // Streams added but never picked up by a running reactor
+    for (Connection* connection : m_added) {
+        closeConnection(connection);
+    }
+    m_added.clear();
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+void StreamReactor::start() {
+    if (m_running.exchange(true)) {
+        return; // Already running
+    }
+
+    if (!openPoller()) {
+        printf("StreamReactor: ERROR - Failed to create poller\n");
+        m_running = false;
+        return;
+    }
+
+    for (int i = 0; i < m_decodeThreads; i++) {
+        std::unique_ptr<Worker> worker(new Worker());
+        worker->tjInstance = tjInitDecompress();
+        m_workers.push_back(std::move(worker));
+    }
+    for (auto& worker : m_workers) {
+        worker->thread = std::thread(&StreamReactor::workerLoop, this, worker.get());
+    }
+
+    m_ioThread = std::thread(&StreamReactor::ioLoop, this);
+    m_reconnectThread = std::thread(&StreamReactor::reconnectLoop, this);
+}
+
+void StreamReactor::stop() {
+    if (!m_running.exchange(false)) {
+        return; // Already stopped
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_reconnects.clear();
+        m_reconnectCondition.notify_all();
+    }
+    if (m_reconnectThread.joinable()) {
+        m_reconnectThread.join();
+    }
+    if (m_ioThread.joinable()) {
+        m_ioThread.join();
+    }
+
+    for (auto& entry : m_connections) {
+        unwatchConnection(entry.second);
+        closeConnection(entry.second);
+    }
+    m_connections.clear();
+    closePoller();
+
+    for (auto& worker : m_workers) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->condition.notify_all();
+        }
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+
+        for (Job& job : worker->queue) {
+            ReleaseFrame(job.frame);
+        }
+        if (worker->tjInstance) {
+            tjDestroy(worker->tjInstance);
+        }
+    }
+    m_workers.clear();
+}
+
+bool StreamReactor::isRunning() const {
+    return m_running;
+}
+
+int StreamReactor::addStream(const std::string& url, FrameHandler onFrame) {
+    char host[MJPEG_MAX_URL_LEN];
+    char path[MJPEG_MAX_URL_LEN];
+    int port;
+    if (!ParseStreamURL(url.c_str(), host, path, &port)) {
+        printf("StreamReactor: ERROR - Failed to parse URL: %s\n", url.c_str());
+        return -1;
+    }
+
+    std::shared_ptr<StreamState> state = std::make_shared<StreamState>();
+    state->host = host;
+    state->path = path;
+    state->port = port;
+    state->onFrame = std::move(onFrame);
+
+    socket_t sock = openStream(state->host, state->path, state->port);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int id = m_nextId++;
+    m_streams[id] = state;
+
+    // A camera that isn't up yet is retried like one that was lost
+    Connection* connection = (sock != SOCKET_INVALID) ? createConnection(id, state) : nullptr;
+    if (!connection) {
+        printf("StreamReactor: can't connect to %s yet\n", url.c_str());
+        if (sock != SOCKET_INVALID) {
+            CLOSE_SOCKET(sock);
+        }
+        scheduleReconnect(id, state.get());
+        return id;
+    }
+    connection->sock = sock;
+
+    state->everConnected = true;
+    state->health.setConnected(true);
+    m_added.push_back(connection);
+    return id;
+}
+
+void StreamReactor::removeStream(int id) {
+    std::shared_ptr<StreamState> state;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_streams.find(id);
+        if (it == m_streams.end()) {
+            return;
+        }
+        state = it->second;
+        m_streams.erase(it);
+        m_removed.push_back(id);
+    }
+
+    // Waits for a handler call in progress
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->active = false;
+}
+
+bool StreamReactor::getStreamHealth(int id, StreamHealth* health) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_streams.find(id);
+    if (it == m_streams.end()) {
+        return false;
+    }
+
+    *health = it->second->health.getHealth();
+    return true;
+}
+
+StreamReactor::Connection* StreamReactor::createConnection(int id, const std::shared_ptr<StreamState>& state) {
+    MJPEGParser* parser = CreateMJPEGParser();
+    if (!parser) {
+        return nullptr;
+    }
+
+    Connection* connection = new Connection();
+    connection->reactor = this;
+    connection->id = id;
+    connection->sock = SOCKET_INVALID;
+    connection->parser = parser;
+    connection->state = state;
+    connection->lastReceiveMs = steadyNowMs();
+    connection->reportedParseErrors = 0;
+    return connection;
+}
+
+void StreamReactor::applyChanges() {
+    std::vector<Connection*> added;
+    std::vector<int> removed;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        added.swap(m_added);
+        removed.swap(m_removed);
+    }
+
+    for (Connection* connection : added) {
+        if (!watchConnection(connection)) {
+            printf("StreamReactor: ERROR - Failed to watch stream %d\n", connection->id);
+            closeConnection(connection);
+            continue;
+        }
+        m_connections[connection->id] = connection;
+    }
+
+    for (int id : removed) {
+        auto it = m_connections.find(id);
+        if (it != m_connections.end()) {
+            unwatchConnection(it->second);
+            closeConnection(it->second);
+            m_connections.erase(it);
+        }
+    }
+}
+
+void StreamReactor::ioLoop() {
+    std::vector<int> ready;
+
+    while (m_running) {
+        applyChanges();
+
+        waitReadable(&ready);
+        for (int id : ready) {
+            auto it = m_connections.find(id);
+            if (it != m_connections.end() && !readConnection(it->second)) {
+                dropConnection(it->second, "disconnected");
+            }
+        }
+
+        // A camera that lost power never closes its end of the connection
+        uint64_t now = steadyNowMs();
+        std::vector<Connection*> stalled;
+        for (auto& entry : m_connections) {
+            if (now - entry.second->lastReceiveMs > STREAM_REACTOR_STALL_MS) {
+                stalled.push_back(entry.second);
+            }
+        }
+        for (Connection* connection : stalled) {
+            dropConnection(connection, "stalled");
+        }
+    }
+}
+
+void StreamReactor::dropConnection(Connection* connection, const char* reason) {
+    printf("StreamReactor: stream %d %s\n", connection->id, reason);
+
+    int id = connection->id;
+    std::shared_ptr<StreamState> state = connection->state;
+    state->health.setConnected(false);
+
+    unwatchConnection(connection);
+    closeConnection(connection);
+    m_connections.erase(id);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running && m_streams.count(id)) {
+        scheduleReconnect(id, state.get());
+    }
+}
+
+void StreamReactor::scheduleReconnect(int id, StreamState* state) {
+    int delayMs = state->backoffMs;
+    state->backoffMs = (delayMs * 2 < STREAM_REACTOR_RECONNECT_MAX_MS) ? delayMs * 2 : STREAM_REACTOR_RECONNECT_MAX_MS;
+
+    printf("StreamReactor: reconnecting stream %d in %d ms\n", id, delayMs);
+    m_reconnects.push_back({ id, steadyNowMs() + delayMs });
+    m_reconnectCondition.notify_all();
+}
+
+void StreamReactor::reconnectLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_running) {
+        // Take the first attempt that is due
+        uint64_t now = steadyNowMs();
+        uint64_t nextDueMs = UINT64_MAX;
+        int id = -1;
+        for (auto it = m_reconnects.begin(); it != m_reconnects.end(); ++it) {
+            if (it->dueMs <= now) {
+                id = it->id;
+                m_reconnects.erase(it);
+                break;
+            }
+            nextDueMs = (it->dueMs < nextDueMs) ? it->dueMs : nextDueMs;
+        }
+
+        if (id < 0) {
+            if (nextDueMs == UINT64_MAX) {
+                m_reconnectCondition.wait(lock);
+            } else {
+                m_reconnectCondition.wait_for(lock, std::chrono::milliseconds(nextDueMs - now));
+            }
+            continue;
+        }
+
+        auto stream = m_streams.find(id);
+        if (stream == m_streams.end()) {
+            continue; // Removed while waiting
+        }
+        std::shared_ptr<StreamState> state = stream->second;
+
+        // Connect without holding the lock; this may block for a while
+        lock.unlock();
+        socket_t sock = openStream(state->host, state->path, state->port);
+        lock.lock();
+
+        if (!m_running || !m_streams.count(id)) {
+            if (sock != SOCKET_INVALID) {
+                CLOSE_SOCKET(sock);
+            }
+            continue;
+        }
+
+        Connection* connection = (sock != SOCKET_INVALID) ? createConnection(id, state) : nullptr;
+        if (!connection) {
+            if (sock != SOCKET_INVALID) {
+                CLOSE_SOCKET(sock);
+            }
+            scheduleReconnect(id, state.get());
+            continue;
+        }
+        connection->sock = sock;
+
+        if (state->everConnected) {
+            printf("StreamReactor: stream %d reconnected\n", id);
+            state->health.onReconnect();
+        } else {
+            printf("StreamReactor: stream %d connected\n", id);
+            state->everConnected = true;
+        }
+        state->health.setConnected(true);
+        m_added.push_back(connection);
+    }
+}
+
+bool StreamReactor::readConnection(Connection* connection) {
+    for (int i = 0; i < STREAM_REACTOR_READS_PER_WAKE; i++) {
+        unsigned char* window;
+        size_t windowSize = GetParserBodyWindow(connection->parser, &window);
+
+        int received;
+        if (windowSize > 0) {
+            // JPEG body: receive straight into the frame
+            received = recv(connection->sock, (char*)window, windowSize > 0x7fffffff ? 0x7fffffff : (int)windowSize, 0);
+            if (received > 0) {
+                CommitParserBody(connection->parser, (size_t)received, onParsedFrame, connection);
+            }
+        } else {
+            received = recv(connection->sock, m_readBuffer.data(), (int)m_readBuffer.size(), 0);
+            if (received > 0 && !FeedMJPEGParser(connection->parser, m_readBuffer.data(), (size_t)received, onParsedFrame, connection)) {
+                return false;
+            }
+        }
+
+        if (received == 0) {
+            return false; // Closed by the camera
+        }
+        if (received < 0) {
+            return wouldBlock();
+        }
+
+        connection->lastReceiveMs = steadyNowMs();
+
+        unsigned long parseErrors = GetParserErrorCount(connection->parser);
+        if (parseErrors != connection->reportedParseErrors) {
+            connection->state->health.onParseErrors(parseErrors - connection->reportedParseErrors);
+            connection->reportedParseErrors = parseErrors;
+        }
+    }
+
+    return true;
+}
+
+void StreamReactor::closeConnection(Connection* connection) {
+    CLOSE_SOCKET(connection->sock);
+    DestroyMJPEGParser(connection->parser);
+    delete connection;
+}
+
+void StreamReactor::onParsedFrame(MJPEGFrame* frame, void* user) {
+    Connection* connection = static_cast<Connection*>(user);
+    connection->reactor->dispatchFrame(connection, frame);
+}
+
+void StreamReactor::dispatchFrame(Connection* connection, MJPEGFrame* frame) {
+    Worker* worker = m_workers[connection->id % m_workers.size()].get();
+
+    MJPEGFrame* dropped = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        if (connection->state->queued >= STREAM_REACTOR_VALIDATE_QUEUE) {
+            // The worker fell behind; this stream's newer frames are worth
+            // more than its old ones
+            for (auto it = worker->queue.begin(); it != worker->queue.end(); ++it) {
+                if (it->state == connection->state) {
+                    dropped = it->frame;
+                    worker->queue.erase(it);
+                    connection->state->queued--;
+                    break;
+                }
+            }
+        }
+        worker->queue.push_back({ frame, connection->state });
+        connection->state->queued++;
+    }
+    worker->condition.notify_one();
+
+    ReleaseFrame(dropped);
+}
+
+void StreamReactor::workerLoop(Worker* worker) {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(worker->mutex);
+            worker->condition.wait(lock, [&]() {
+                return !m_running || !worker->queue.empty();
+            });
+            if (!m_running) {
+                return;
+            }
+            job = std::move(worker->queue.front());
+            worker->queue.pop_front();
+            job.state->queued--;
+        }
+
+        // Validate the JPEG and get the image dimensions
+        MJPEGFrame* frame = job.frame;
+        int jpegSubsamp;
+        if (!worker->tjInstance
+            || tjDecompressHeader2(worker->tjInstance, frame->data, (unsigned long)frame->size,
+                                   &frame->width, &frame->height, &jpegSubsamp)
+                < 0) {
+            job.state->health.onHeaderFailure();
+            ReleaseFrame(frame);
+            continue;
+        }
+
+        // The stream works again; the next outage starts with a short delay
+        job.state->backoffMs = STREAM_REACTOR_RECONNECT_MIN_MS;
+        job.state->health.onFrame(frame->size);
+
+        std::lock_guard<std::mutex> lock(job.state->mutex);
+        if (job.state->active) {
+            job.state->onFrame(frame);
+        } else {
+            ReleaseFrame(frame);
+        }
+    }
+}
+
+#if defined(STREAM_REACTOR_EPOLL)
+
+bool StreamReactor::openPoller() {
+    m_poller = epoll_create1(0);
+    return m_poller >= 0;
+}
+
+void StreamReactor::closePoller() {
+    if (m_poller >= 0) {
+        close((int)m_poller);
+        m_poller = -1;
+    }
+}
+
+bool StreamReactor::watchConnection(Connection* connection) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = (uint64_t)connection->id;
+    return epoll_ctl((int)m_poller, EPOLL_CTL_ADD, connection->sock, &event) == 0;
+}
+
+void StreamReactor::unwatchConnection(Connection* connection) {
+    epoll_ctl((int)m_poller, EPOLL_CTL_DEL, connection->sock, NULL);
+}
+
+void StreamReactor::waitReadable(std::vector<int>* ids) {
+    struct epoll_event events[64];
+    ids->clear();
+
+    int count = epoll_wait((int)m_poller, events, 64, STREAM_REACTOR_POLL_MS);
+    for (int i = 0; i < count; i++) {
+        ids->push_back((int)events[i].data.u64);
+    }
+}
+
+#elif defined(STREAM_REACTOR_KQUEUE)
+
+bool StreamReactor::openPoller() {
+    m_poller = kqueue();
+    return m_poller >= 0;
+}
+
+void StreamReactor::closePoller() {
+    if (m_poller >= 0) {
+        close((int)m_poller);
+        m_poller = -1;
+    }
+}
+
+bool StreamReactor::watchConnection(Connection* connection) {
+    struct kevent change;
+    EV_SET(&change, connection->sock, EVFILT_READ, EV_ADD, 0, 0, (void*)(intptr_t)connection->id);
+    return kevent((int)m_poller, &change, 1, NULL, 0, NULL) == 0;
+}
+
+void StreamReactor::unwatchConnection(Connection* connection) {
+    struct kevent change;
+    EV_SET(&change, connection->sock, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    kevent((int)m_poller, &change, 1, NULL, 0, NULL);
+}
+
+void StreamReactor::waitReadable(std::vector<int>* ids) {
+    struct kevent events[64];
+    struct timespec timeout = { 0, STREAM_REACTOR_POLL_MS * 1000000L };
+    ids->clear();
+
+    int count = kevent((int)m_poller, NULL, 0, events, 64, &timeout);
+    for (int i = 0; i < count; i++) {
+        ids->push_back((int)(intptr_t)events[i].udata);
+    }
+}
+
+#else // STREAM_REACTOR_POLL
+
+// WSAPoll takes the whole descriptor list on every call, so there is nothing
+// to register; the list is rebuilt from m_connections
+
+bool StreamReactor::openPoller() {
+    return true;
+}
+
+void StreamReactor::closePoller() {
+}
+
+bool StreamReactor::watchConnection(Connection*) {
+    return true;
+}
+
+void StreamReactor::unwatchConnection(Connection*) {
+}
+
+void StreamReactor::waitReadable(std::vector<int>* ids) {
+    std::vector<WSAPOLLFD> fds;
+    std::vector<int> fdIds;
+    ids->clear();
+
+    for (auto& entry : m_connections) {
+        WSAPOLLFD fd;
+        fd.fd = entry.second->sock;
+        fd.events = POLLIN;
+        fd.revents = 0;
+        fds.push_back(fd);
+        fdIds.push_back(entry.first);
+    }
+
+    if (fds.empty()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(STREAM_REACTOR_POLL_MS));
+        return;
+    }
+
+    int count = WSAPoll(fds.data(), (unsigned long)fds.size(), STREAM_REACTOR_POLL_MS);
+    for (int i = 0; count > 0 && i < (int)fds.size(); i++) {
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ids->push_back(fdIds[i]);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef STREAM_REACTOR_H
+#define STREAM_REACTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stream_health.h"
+
+struct MJPEGFrame;
+
+#define STREAM_REACTOR_POLL_MS          50    // Longest I/O wait before picking up added or removed streams
+#define STREAM_REACTOR_READ_BYTES       65536 // Shared receive buffer for everything but JPEG bodies
+#define STREAM_REACTOR_READS_PER_WAKE   8     // Reads per ready socket before moving on to the next one
+#define STREAM_REACTOR_VALIDATE_QUEUE   4     // Frames of one stream waiting for validation before its oldest is dropped
+#define STREAM_REACTOR_STALL_MS         3000  // A connection that receives nothing for this long is dropped
+#define STREAM_REACTOR_RECONNECT_MIN_MS 250   // First reconnect delay, doubled after every failed attempt
+#define STREAM_REACTOR_RECONNECT_MAX_MS 8000  // Longest reconnect delay
+
+/**
+ * @brief Drives many MJPEG camera connections from one I/O thread
+ *
+ * Sockets are non-blocking and multiplexed with epoll (Linux), kqueue
+ * (macOS/BSD) or WSAPoll (Windows). Each connection has its own incremental
+ * MJPEGParser, so a stream costs a socket and a parser instead of a blocked
+ * thread. JPEG bodies are received straight into pooled frames.
+ *
+ * Complete frames are handed to a small pool of workers that validate them
+ * with tjDecompressHeader2 and call the stream's handler. A stream always
+ * goes to the same worker, so its frames arrive in order.
+ *
+ * A stream that closes, stops parsing or goes silent (e.g. a rebooting
+ * camera), or that couldn't be reached when it was added, is reconnected
+ * with exponential backoff on a separate thread, so name lookup and connect
+ * never block the I/O thread. The stream id and its health counters stay
+ * the same across reconnects.
+ */
+class StreamReactor {
+public:
+    // Receives one reference to a validated frame; must release it with ReleaseFrame()
+    typedef std::function<void(MJPEGFrame* frame)> FrameHandler;
+
+    /**
+     * @param decodeThreads Number of validation workers
+     */
+    explicit StreamReactor(int decodeThreads = 1);
+    ~StreamReactor();
+
+    void start();
+
+    // Disconnects every stream; their ids stay valid for removeStream()
+    void stop();
+    bool isRunning() const;
+
+    /**
+     * @brief Connect to an MJPEG stream and start reading it
+     *
+     * The first name lookup and connect happen on the calling thread;
+     * everything after that runs on the reactor. If that connect fails the
+     * stream is still added and retried with the same backoff as a lost
+     * connection. Streams may be added before start().
+     *
+     * @param url http:// URL of the stream
+     * @param onFrame Called from a worker thread for every valid frame
+     * @return int Stream id, or -1 if the URL can't be parsed
+     */
+    int addStream(const std::string& url, FrameHandler onFrame);
+
+    /**
+     * @brief Disconnect a stream
+     *
+     * Once this returns, onFrame is not called again for the stream. Must not
+     * be called from inside onFrame.
+     */
+    void removeStream(int id);
+
+    /**
+     * @brief Get the health counters of a stream
+     * @return false if there is no stream with this id
+     */
+    bool getStreamHealth(int id, StreamHealth* health) const;
+
+private:
+    struct StreamState;
+    struct Connection;
+    struct Job;
+    struct Worker;
+
+    struct PendingReconnect {
+        int id;
+        uint64_t dueMs;
+    };
+
+    void ioLoop();
+    void workerLoop(Worker* worker);
+    void reconnectLoop();
+
+    // Apply addStream()/removeStream() calls made since the last wake
+    void applyChanges();
+
+    // Parser and bookkeeping for a new connection; the caller sets its socket
+    Connection* createConnection(int id, const std::shared_ptr<StreamState>& state);
+
+    // Read what is available; false when the connection is finished
+    bool readConnection(Connection* connection);
+    void closeConnection(Connection* connection);
+
+    // Close a live connection and schedule its reconnect (I/O thread)
+    void dropConnection(Connection* connection, const char* reason);
+
+    // Queue the next attempt for a stream; m_mutex must be held
+    void scheduleReconnect(int id, StreamState* state);
+
+    static void onParsedFrame(MJPEGFrame* frame, void* user);
+    void dispatchFrame(Connection* connection, MJPEGFrame* frame);
+
+    // Platform poller
+    bool openPoller();
+    void closePoller();
+    bool watchConnection(Connection* connection);
+    void unwatchConnection(Connection* connection);
+    void waitReadable(std::vector<int>* ids);
+
+    int m_decodeThreads;
+    std::atomic<bool> m_running;
+    std::thread m_ioThread;
+    std::thread m_reconnectThread;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    // Guards the pending changes, m_streams and m_reconnects
+    mutable std::mutex m_mutex;
+    std::condition_variable m_reconnectCondition;
+    std::vector<Connection*> m_added;
+    std::vector<int> m_removed;
+    std::map<int, std::shared_ptr<StreamState>> m_streams;
+    std::vector<PendingReconnect> m_reconnects;
+    int m_nextId;
+
+    // Owned by the I/O thread
+    std::map<int, Connection*> m_connections;
+    std::vector<char> m_readBuffer;
+    intptr_t m_poller; // epoll or kqueue descriptor, unused with WSAPoll
+};
+
+#endif // STREAM_REACTOR_H
@@ -1,89 +1,173 @@
 #include "subprocess.h"
-#include <array>
-#include <iostream>
-#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 
 #ifdef _WIN32
 #include <windows.h>
+#undef min
+#undef max
 #else
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #endif
 
-bool spawnProcess(
-    const std::string& program,
-    const std::vector<std::string>& params,
-    std::function<void(const std::string&)> onStdOut,
-    std::function<void(const std::string&)> onStdErr,
-    std::function<void(int)> onComplete) {
-    return ProcessRunner::spawnProcess(program, params, onStdOut, onStdErr, onComplete);
-}
-
-bool ProcessRunner::spawnProcess(
-    const std::string& program,
-    const std::vector<std::string>& args,
-    OutputCallback onStdOut,
-    OutputCallback onStdErr,
-    CompletionCallback onComplete) {
+ProcessRunner::ProcessRunner()
+    : m_running(false)
+    , m_killed(false)
+    , m_exitCode(0)
 #ifdef _WIN32
-    return spawnProcessWindows(program, args, onStdOut, onStdErr, onComplete);
+    , m_process(NULL)
 #else
-    return spawnProcessUnix(program, args, onStdOut, onStdErr, onComplete);
+    , m_pid(-1)
+    , m_reaped(true)
 #endif
+{
+}
+
+ProcessRunner::~ProcessRunner() {
+    kill();
+    wait();
+}
+
+bool ProcessRunner::isRunning() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_running;
+}
+
+bool ProcessRunner::wasKilled() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_killed;
+}
+
+bool ProcessRunner::wait(int timeoutMs) {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (timeoutMs < 0) {
+            m_finished.wait(lock, [this] { return !m_running; });
+        } else if (!m_finished.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return !m_running; })) {
+            return false;
+        }
+    }
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    return true;
+}
+
+int ProcessRunner::exitCode() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_exitCode;
+}
+
+void ProcessRunner::deliverOutput(OutputStream& stream, const char* data, size_t size) {
+    size_t start = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] != '\n') {
+            continue;
+        }
+        stream.pending.append(data + start, i - start);
+        if (!stream.pending.empty() && stream.pending.back() == '\r') {
+            stream.pending.pop_back();
+        }
+        stream.callback(stream.pending);
+        stream.pending.clear();
+        start = i + 1;
+    }
+
+    // Keep the partial line, in pieces no longer than the limit
+    while (size - start > 0) {
+        size_t take = std::min(size - start, SUBPROCESS_MAX_LINE_BYTES - stream.pending.size());
+        stream.pending.append(data + start, take);
+        start += take;
+        if (stream.pending.size() == SUBPROCESS_MAX_LINE_BYTES) {
+            stream.callback(stream.pending);
+            stream.pending.clear();
+        }
+    }
+}
+
+void ProcessRunner::flushOutput(OutputStream& stream) {
+    if (!stream.pending.empty()) {
+        stream.callback(stream.pending);
+        stream.pending.clear();
+    }
 }
 
 #ifdef _WIN32
-bool ProcessRunner::spawnProcessWindows(
+bool ProcessRunner::start(
     const std::string& program,
     const std::vector<std::string>& args,
     OutputCallback onStdOut,
     OutputCallback onStdErr,
     CompletionCallback onComplete) {
+    if (isRunning()) {
+        return false;
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
     // Build command line
     std::string cmdLine = "\"" + program + "\"";
     for (const auto& arg : args) {
         cmdLine += " \"" + arg + "\"";
     }
 
-    // Set up security attributes for pipes
+    // Set up security attributes for the child's pipe ends
     SECURITY_ATTRIBUTES saAttr;
     saAttr.nLength = sizeof(SECURITY_ATTRIBUTES);
     saAttr.bInheritHandle = TRUE;
     saAttr.lpSecurityDescriptor = NULL;
 
-    // Create pipes for stdout and stderr
-    HANDLE stdoutRead, stdoutWrite;
-    HANDLE stderrRead, stderrWrite;
-
-    if (!CreatePipe(&stdoutRead, &stdoutWrite, &saAttr, 0) || !CreatePipe(&stderrRead, &stderrWrite, &saAttr, 0)) {
+    // Anonymous pipes can't do overlapped reads, so stdout and stderr are
+    // unique named pipes; our read ends aren't inherited
+    static volatile LONG pipeCounter = 0;
+    HANDLE readEnds[2] = { INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE };
+    HANDLE writeEnds[2] = { INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE };
+    for (int i = 0; i < 2; i++) {
+        char name[128];
+        snprintf(name, sizeof(name), "\\\\.\\pipe\\baballs-%lu-%ld", GetCurrentProcessId(), InterlockedIncrement(&pipeCounter));
+        readEnds[i] = CreateNamedPipeA(name, PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                                       PIPE_TYPE_BYTE | PIPE_WAIT, 1, 0, SUBPROCESS_READ_BYTES, 0, NULL);
+        if (readEnds[i] != INVALID_HANDLE_VALUE) {
+            writeEnds[i] = CreateFileA(name, GENERIC_WRITE, 0, &saAttr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        }
+    }
+    if (writeEnds[0] == INVALID_HANDLE_VALUE || writeEnds[1] == INVALID_HANDLE_VALUE) {
+        printf("ProcessRunner: can't create pipes (error %lu)\n", GetLastError());
+        for (int i = 0; i < 2; i++) {
+            if (readEnds[i] != INVALID_HANDLE_VALUE) {
+                CloseHandle(readEnds[i]);
+            }
+            if (writeEnds[i] != INVALID_HANDLE_VALUE) {
+                CloseHandle(writeEnds[i]);
+            }
+        }
         return false;
     }
 
-    // Ensure the read handles are not inherited
-    SetHandleInformation(stdoutRead, HANDLE_FLAG_INHERIT, 0);
-    SetHandleInformation(stderrRead, HANDLE_FLAG_INHERIT, 0);
-
     // Set up process startup info
     STARTUPINFOA si;
     ZeroMemory(&si, sizeof(si));
     si.cb = sizeof(si);
     si.dwFlags = STARTF_USESTDHANDLES;
-    si.hStdOutput = stdoutWrite;
-    si.hStdError = stderrWrite;
+    si.hStdOutput = writeEnds[0];
+    si.hStdError = writeEnds[1];
     si.hStdInput = NULL;
 
-    // Set up process info
     PROCESS_INFORMATION pi;
     ZeroMemory(&pi, sizeof(pi));
 
-    // Debug: Print command line
-    printf("DEBUG: Attempting to spawn process: %s\n", cmdLine.c_str());
+    printf("ProcessRunner: starting %s\n", cmdLine.c_str());
 
-    // Create the child process
     BOOL success = CreateProcessA(
         NULL,                               // No module name (use command line)
         const_cast<LPSTR>(cmdLine.c_str()), // Command line
@@ -97,91 +181,167 @@ bool ProcessRunner::spawnProcessWindows(
         &pi                                 // Pointer to PROCESS_INFORMATION
     );
 
-    printf("DEBUG: CreateProcessA result: %s\n", success ? "SUCCESS" : "FAILED");
-
-    // Close pipe write-ends as we don't need them
-    CloseHandle(stdoutWrite);
-    CloseHandle(stderrWrite);
+    // The child has its own copies of the write ends
+    CloseHandle(writeEnds[0]);
+    CloseHandle(writeEnds[1]);
 
     if (!success) {
-        DWORD error = GetLastError();
-        printf("DEBUG: CreateProcessA failed with error code: %lu\n", error);
-        CloseHandle(stdoutRead);
-        CloseHandle(stderrRead);
+        printf("ProcessRunner: CreateProcessA failed with error code %lu\n", GetLastError());
+        CloseHandle(readEnds[0]);
+        CloseHandle(readEnds[1]);
         return false;
     }
+    CloseHandle(pi.hThread);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_process = pi.hProcess;
+        m_output[0] = readEnds[0];
+        m_output[1] = readEnds[1];
+        m_running = true;
+        m_killed = false;
+        m_exitCode = 0;
+    }
+    m_thread = std::thread(&ProcessRunner::ioLoop, this, onStdOut, onStdErr, onComplete);
+    return true;
+}
 
-    // Create threads to read from pipes
-    std::thread stdoutThread([stdoutRead, onStdOut]() {
-        printf("DEBUG: stdout reading thread started\n");
-        char buffer[4096];
-        DWORD bytesRead;
-        bool firstRead = true;
-        while (ReadFile(stdoutRead, buffer, sizeof(buffer) - 1, &bytesRead, NULL) && bytesRead > 0) {
-            if (firstRead) {
-                printf("DEBUG: First stdout data received (%lu bytes)\n", bytesRead);
-                firstRead = false;
-            }
-            buffer[bytesRead] = '\0';
-            onStdOut(std::string(buffer, bytesRead));
+bool ProcessRunner::kill() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_process) {
+        return false;
+    }
+    m_killed = m_killed || TerminateProcess(m_process, SUBPROCESS_KILLED_EXIT_CODE) != 0;
+    return m_killed;
+}
+
+void ProcessRunner::ioLoop(OutputCallback onStdOut, OutputCallback onStdErr, CompletionCallback onComplete) {
+    OutputStream streams[2];
+    streams[0].callback = onStdOut;
+    streams[1].callback = onStdErr;
+
+    OVERLAPPED overlapped[2];
+    char buffers[2][SUBPROCESS_READ_BYTES];
+    bool open[2] = { true, true };
+
+    // Start an overlapped read; its event is set when data (or the end) arrives
+    auto startRead = [&](int i) {
+        ZeroMemory(&overlapped[i], sizeof(OVERLAPPED));
+        overlapped[i].hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+        if (!ReadFile(m_output[i], buffers[i], sizeof(buffers[i]), NULL, &overlapped[i]) && GetLastError() != ERROR_IO_PENDING) {
+            CloseHandle(overlapped[i].hEvent);
+            open[i] = false;
         }
-        printf("DEBUG: stdout reading thread ending (ReadFile returned false or 0 bytes)\n");
-        CloseHandle(stdoutRead);
-    });
-
-    std::thread stderrThread([stderrRead, onStdErr]() {
-        printf("DEBUG: stderr reading thread started\n");
-        char buffer[4096];
-        DWORD bytesRead;
-        bool firstRead = true;
-        while (ReadFile(stderrRead, buffer, sizeof(buffer) - 1, &bytesRead, NULL) && bytesRead > 0) {
-            if (firstRead) {
-                printf("DEBUG: First stderr data received (%lu bytes)\n", bytesRead);
-                firstRead = false;
+    };
+    startRead(0);
+    startRead(1);
+
+    bool exited = false;
+    while (open[0] || open[1]) {
+        HANDLE handles[3];
+        int streamOf[3];
+        DWORD count = 0;
+        for (int i = 0; i < 2; i++) {
+            if (open[i]) {
+                streamOf[count] = i;
+                handles[count++] = overlapped[i].hEvent;
             }
-            buffer[bytesRead] = '\0';
-            onStdErr(std::string(buffer, bytesRead));
         }
-        printf("DEBUG: stderr reading thread ending (ReadFile returned false or 0 bytes)\n");
-        CloseHandle(stderrRead);
-    });
+        if (!exited) {
+            streamOf[count] = -1;
+            handles[count++] = m_process;
+        }
 
-    // Wait for process to complete
-    std::thread completionThread([pi, onComplete]() {
-        printf("DEBUG: completion thread started, waiting for process...\n");
-        WaitForSingleObject(pi.hProcess, INFINITE);
+        DWORD result = WaitForMultipleObjects(count, handles, FALSE, exited ? SUBPROCESS_DRAIN_MS : INFINITE);
+        if (result == WAIT_TIMEOUT || result == WAIT_FAILED) {
+            // The child is gone but something it started still holds the pipes
+            break;
+        }
 
-        DWORD exitCode = 0;
-        GetExitCodeProcess(pi.hProcess, &exitCode);
-        printf("DEBUG: process completed with exit code: %lu\n", exitCode);
+        int index = streamOf[result - WAIT_OBJECT_0];
+        if (index < 0) {
+            exited = true;
+            continue;
+        }
 
-        CloseHandle(pi.hProcess);
-        CloseHandle(pi.hThread);
+        DWORD bytesRead = 0;
+        BOOL ok = GetOverlappedResult(m_output[index], &overlapped[index], &bytesRead, FALSE);
+        CloseHandle(overlapped[index].hEvent);
+        if (ok && bytesRead > 0) {
+            deliverOutput(streams[index], buffers[index], bytesRead);
+            startRead(index);
+        } else if (ok) {
+            startRead(index);
+        } else {
+            open[index] = false;
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (open[i]) {
+            DWORD bytesRead;
+            CancelIo(m_output[i]);
+            GetOverlappedResult(m_output[i], &overlapped[i], &bytesRead, TRUE);
+            CloseHandle(overlapped[i].hEvent);
+        }
+        CloseHandle(m_output[i]);
+        flushOutput(streams[i]);
+    }
 
-        onComplete(static_cast<int>(exitCode));
-    });
+    WaitForSingleObject(m_process, INFINITE);
+    DWORD exitCode = 0;
+    GetExitCodeProcess(m_process, &exitCode);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        CloseHandle(m_process);
+        m_process = NULL;
+        m_exitCode = static_cast<int>(exitCode);
+    }
 
-    // Detach threads to let them run independently
-    stdoutThread.detach();
-    stderrThread.detach();
-    completionThread.detach();
+    onComplete(static_cast<int>(exitCode));
 
-    return true;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+    m_finished.notify_all();
 }
 #else
-bool ProcessRunner::spawnProcessUnix(
+bool ProcessRunner::start(
     const std::string& program,
     const std::vector<std::string>& args,
     OutputCallback onStdOut,
     OutputCallback onStdErr,
     CompletionCallback onComplete) {
-    // Create pipes for stdout and stderr
+    if (isRunning()) {
+        return false;
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    // Create pipes for stdout and stderr, not inherited by other children
     int stdoutPipe[2];
     int stderrPipe[2];
 
-    if (pipe(stdoutPipe) == -1 || pipe(stderrPipe) == -1) {
+    if (pipe(stdoutPipe) == -1) {
+        return false;
+    }
+    if (pipe(stderrPipe) == -1) {
+        close(stdoutPipe[0]);
+        close(stdoutPipe[1]);
         return false;
     }
+    for (int fd : { stdoutPipe[0], stdoutPipe[1], stderrPipe[0], stderrPipe[1] }) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    // Prepare arguments for exec before forking; the child may only call
+    // async-signal-safe functions
+    std::vector<char*> cargs;
+    cargs.push_back(const_cast<char*>(program.c_str()));
+    for (const auto& arg : args) {
+        cargs.push_back(const_cast<char*>(arg.c_str()));
+    }
+    cargs.push_back(nullptr); // Null-terminate the array
 
     // Fork the process
     pid_t pid = fork();
@@ -196,100 +356,133 @@ bool ProcessRunner::spawnProcessUnix(
     }
 
     if (pid == 0) {
-        // Child process
-
-        // Redirect stdout and stderr
+        // Child process: redirect stdout and stderr; dup2 clears close-on-exec
         dup2(stdoutPipe[1], STDOUT_FILENO);
         dup2(stderrPipe[1], STDERR_FILENO);
 
-        // Close unused pipe ends
-        close(stdoutPipe[0]);
-        close(stdoutPipe[1]);
-        close(stderrPipe[0]);
-        close(stderrPipe[1]);
-
-        // Prepare arguments for exec
-        std::vector<char*> cargs;
-        cargs.push_back(const_cast<char*>(program.c_str()));
-        for (const auto& arg : args) {
-            cargs.push_back(const_cast<char*>(arg.c_str()));
-        }
-        cargs.push_back(nullptr); // Null-terminate the array
-
-        // Execute the program
         execvp(program.c_str(), cargs.data());
 
         // If we get here, exec failed
-        exit(EXIT_FAILURE);
+        _exit(EXIT_FAILURE);
     }
 
-    // Parent process
-
-    // Close write ends of pipes
+    // Parent process: close write ends of pipes
     close(stdoutPipe[1]);
     close(stderrPipe[1]);
 
-    // Set non-blocking mode for the pipes
     fcntl(stdoutPipe[0], F_SETFL, O_NONBLOCK);
     fcntl(stderrPipe[0], F_SETFL, O_NONBLOCK);
 
-    // Create threads to read from pipes
-    std::thread stdoutThread([stdoutPipe, onStdOut]() {
-        char buffer[4096];
-        ssize_t bytesRead;
-        while (true) {
-            bytesRead = read(stdoutPipe[0], buffer, sizeof(buffer) - 1);
-            if (bytesRead > 0) {
-                buffer[bytesRead] = '\0';
-                onStdOut(std::string(buffer, bytesRead));
-            } else if (bytesRead == 0 || (bytesRead == -1 && errno != EAGAIN)) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pid = pid;
+        m_reaped = false;
+        m_output[0] = stdoutPipe[0];
+        m_output[1] = stderrPipe[0];
+        m_running = true;
+        m_killed = false;
+        m_exitCode = 0;
+    }
+    m_thread = std::thread(&ProcessRunner::ioLoop, this, onStdOut, onStdErr, onComplete);
+    return true;
+}
+
+bool ProcessRunner::kill() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_reaped) {
+        return false;
+    }
+    // Checked under m_mutex, which ioLoop holds to reap, so onComplete hasn't run yet
+    m_killed = m_killed || ::kill(m_pid, SIGKILL) == 0;
+    return m_killed;
+}
+
+void ProcessRunner::ioLoop(OutputCallback onStdOut, OutputCallback onStdErr, CompletionCallback onComplete) {
+    OutputStream streams[2];
+    streams[0].callback = onStdOut;
+    streams[1].callback = onStdErr;
+
+    char buffer[SUBPROCESS_READ_BYTES];
+    bool exited = false;
+    int openStreams = 2;
+
+    while (openStreams > 0) {
+        pollfd fds[2];
+        int streamOf[2];
+        nfds_t count = 0;
+        for (int i = 0; i < 2; i++) {
+            if (m_output[i] >= 0) {
+                fds[count].fd = m_output[i];
+                fds[count].events = POLLIN;
+                fds[count].revents = 0;
+                streamOf[count++] = i;
+            }
+        }
+
+        // Normally the pipes close when the child exits. A long timeout
+        // catches a child that exited while something it started still holds
+        // them; after that, what's in flight gets a short grace period.
+        int ready = poll(fds, count, exited ? SUBPROCESS_DRAIN_MS : SUBPROCESS_EXIT_CHECK_MS);
+        if (ready < 0 && errno != EINTR) {
+            perror("ProcessRunner: poll");
+            break;
+        }
+        if (ready == 0) {
+            if (exited) {
                 break;
-            } else {
-                // No data available, sleep a bit
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
             }
+            siginfo_t info;
+            info.si_pid = 0;
+            exited = waitid(P_PID, m_pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == m_pid;
+            continue;
         }
-        close(stdoutPipe[0]);
-    });
 
-    std::thread stderrThread([stderrPipe, onStdErr]() {
-        char buffer[4096];
-        ssize_t bytesRead;
-        while (true) {
-            bytesRead = read(stderrPipe[0], buffer, sizeof(buffer) - 1);
+        for (nfds_t i = 0; i < count && ready > 0; i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            int index = streamOf[i];
+            ssize_t bytesRead = read(m_output[index], buffer, sizeof(buffer));
             if (bytesRead > 0) {
-                buffer[bytesRead] = '\0';
-                onStdErr(std::string(buffer, bytesRead));
-            } else if (bytesRead == 0 || (bytesRead == -1 && errno != EAGAIN)) {
-                break;
-            } else {
-                // No data available, sleep a bit
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                deliverOutput(streams[index], buffer, (size_t)bytesRead);
+            } else if (bytesRead == 0 || (errno != EAGAIN && errno != EINTR)) {
+                close(m_output[index]);
+                m_output[index] = -1;
+                openStreams--;
             }
         }
-        close(stderrPipe[0]);
-    });
+    }
 
-    // Wait for process to complete
-    std::thread completionThread([pid, onComplete]() {
-        int status;
-        waitpid(pid, &status, 0);
+    for (int i = 0; i < 2; i++) {
+        if (m_output[i] >= 0) {
+            close(m_output[i]);
+            m_output[i] = -1;
+        }
+        flushOutput(streams[i]);
+    }
+
+    // Wait without reaping, so kill() can't hit a recycled pid, then reap
+    // under the lock
+    siginfo_t info;
+    while (waitid(P_PID, m_pid, &info, WEXITED | WNOWAIT) != 0 && errno == EINTR) {
+    }
+    int status = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        waitpid(m_pid, &status, 0);
+        m_reaped = true;
 
-        int exitCode = 0;
         if (WIFEXITED(status)) {
-            exitCode = WEXITSTATUS(status);
+            m_exitCode = WEXITSTATUS(status);
         } else if (WIFSIGNALED(status)) {
-            exitCode = 128 + WTERMSIG(status);
+            m_exitCode = 128 + WTERMSIG(status);
         }
+    }
 
-        onComplete(exitCode);
-    });
-
-    // Detach threads to let them run independently
-    stdoutThread.detach();
-    stderrThread.detach();
-    completionThread.detach();
+    onComplete(exitCode());
 
-    return true;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+    m_finished.notify_all();
 }
 #endif
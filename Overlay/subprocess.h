@@ -1,74 +1,120 @@
 #ifndef SUBPROCESS_H
 #define SUBPROCESS_H
 
+#include <condition_variable>
 #include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
-/**
- * @brief Spawns a child process and provides callbacks for output and completion
- *
- * This function creates a new process with the specified program and arguments,
- * and provides callbacks for standard output, standard error, and process completion.
- *
- * @param program The path to the executable to run
- * @param params Command line arguments for the program
- * @param onStdOut Callback function that receives stdout output as it becomes available
- * @param onStdErr Callback function that receives stderr output as it becomes available
- * @param onComplete Callback function that is called when the process terminates with the exit code
- * @return true if the process was successfully started, false otherwise
- */
-bool spawnProcess(
-    const std::string& program,
-    const std::vector<std::string>& params,
-    std::function<void(const std::string&)> onStdOut,
-    std::function<void(const std::string&)> onStdErr,
-    std::function<void(int)> onComplete);
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+#define SUBPROCESS_READ_BYTES       4096  // Pipe read size
+#define SUBPROCESS_MAX_LINE_BYTES   65536 // Longer lines are delivered in pieces of this size
+#define SUBPROCESS_EXIT_CHECK_MS    1000  // How often to check for an exited child whose pipes are still held open
+#define SUBPROCESS_DRAIN_MS         100   // After the child exits, how long to wait for output still in flight
+#define SUBPROCESS_KILLED_EXIT_CODE 137   // Exit code after kill(), as a shell reports SIGKILL
 
 /**
- * @brief ProcessRunner class that handles the details of spawning and managing processes
+ * @brief Runs a child process and delivers its output line by line
+ *
+ * One I/O thread per runner waits on both output pipes and on the child
+ * itself (poll on POSIX, overlapped named pipes on Windows), so an idle
+ * child costs no CPU. Output is delivered one line at a time, without the
+ * line ending; a line longer than SUBPROCESS_MAX_LINE_BYTES is delivered in
+ * pieces so memory stays bounded. A last line without a newline is delivered
+ * when the pipe closes.
  *
- * This class contains the platform-specific implementation details for process management.
- * It's generally not needed to use this class directly - use the spawnProcess function instead.
+ * All callbacks run on the I/O thread, stdout and stderr in the order they
+ * were read, then onComplete once the child has exited and its output has
+ * been delivered. Callbacks must not call wait() or the destructor of their
+ * own runner.
  */
 class ProcessRunner {
 public:
     using OutputCallback = std::function<void(const std::string&)>;
     using CompletionCallback = std::function<void(int)>;
 
+    ProcessRunner();
+
+    // Kills a child that is still running and waits for the I/O thread
+    ~ProcessRunner();
+
     /**
      * @brief Spawns a child process with the specified parameters
      *
      * @param program The path to the executable to run
      * @param args Command line arguments for the program
-     * @param onStdOut Callback function for stdout output
-     * @param onStdErr Callback function for stderr output
-     * @param onComplete Callback function for process completion
-     * @return true if the process was started successfully, false otherwise
+     * @param onStdOut Called with each line of stdout
+     * @param onStdErr Called with each line of stderr
+     * @param onComplete Called with the exit code (128 + signal if it was killed by one)
+     * @return false if the process couldn't be started or a previous one is still running
      */
-    static bool spawnProcess(
+    bool start(
         const std::string& program,
         const std::vector<std::string>& args,
         OutputCallback onStdOut,
         OutputCallback onStdErr,
         CompletionCallback onComplete);
 
+    // True from start() until onComplete has returned
+    bool isRunning() const;
+
+    /**
+     * @brief Terminate the child immediately; onComplete still runs
+     *
+     * @return false if there was nothing to kill, including a child that
+     *         exited on its own and has been reaped or is about to be
+     */
+    bool kill();
+
+    // Whether kill() succeeded for the last child. Settled before onComplete
+    // runs, so onComplete can tell a kill from the child exiting on its own.
+    bool wasKilled() const;
+
+    /**
+     * @brief Wait for the child to exit and its callbacks to finish
+     *
+     * @param timeoutMs Longest wait; negative waits for as long as it takes
+     * @return true if the child has finished (or none was started)
+     */
+    bool wait(int timeoutMs = -1);
+
+    // Exit code of the last child, once wait() returned true
+    int exitCode() const;
+
 private:
+    struct OutputStream {
+        std::string pending; // Start of a line whose newline hasn't arrived yet
+        OutputCallback callback;
+    };
+
+    void ioLoop(OutputCallback onStdOut, OutputCallback onStdErr, CompletionCallback onComplete);
+
+    // Hand every complete line in data to the stream's callback
+    static void deliverOutput(OutputStream& stream, const char* data, size_t size);
+
+    // Hand over a last line that has no newline
+    static void flushOutput(OutputStream& stream);
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_finished;
+    bool m_running;
+    bool m_killed;
+    int m_exitCode;
+    std::thread m_thread;
+
 #ifdef _WIN32
-    static bool spawnProcessWindows(
-        const std::string& program,
-        const std::vector<std::string>& args,
-        OutputCallback onStdOut,
-        OutputCallback onStdErr,
-        CompletionCallback onComplete);
+    void* m_process;   // HANDLE; closed under m_mutex once the child has exited
+    void* m_output[2]; // Read ends of the stdout and stderr pipes
 #else
-    static bool spawnProcessUnix(
-        const std::string& program,
-        const std::vector<std::string>& args,
-        OutputCallback onStdOut,
-        OutputCallback onStdErr,
-        CompletionCallback onComplete);
+    pid_t m_pid;
+    bool m_reaped; // Set under m_mutex, after which m_pid may belong to another process
+    int m_output[2];
 #endif
 };
 
-#endif // SUBPROCESS_H
\ No newline at end of file
+#endif // SUBPROCESS_H
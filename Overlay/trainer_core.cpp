@@ -0,0 +1,1110 @@
+// trainer_core.cpp
+#include "trainer_core.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <onnxruntime_cxx_api.h>
+#include <onnxruntime_training_c_api.h>
+#include <opencv2/opencv.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "flags.h"
+#include "label_ranges.h"
+#include "ort_cache.h"
+#include "preprocess.h"
+
+#define STD_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// Configuration constants
+#define TRAIN_RESOLUTION PREPROCESS_RESOLUTION
+#define NUM_FRAMES       4 // Updated for new model (current frame + 3 previous frames)
+#define NUM_CLASSES      3 // Updated for MicroChad model (3 outputs: pitch, yaw, convergence)
+#define ENABLE_CUDA      1 // Set to 1 to build with CUDA support, 0 to use CPU only
+
+#include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#undef max // Undefines the macro
+#undef min // If you also have min issues
+#else
+#include <unistd.h>
+#endif
+
+static int get_cpu_thread_count() {
+    int num_threads = 0;
+
+#ifdef _WIN32
+    SYSTEM_INFO sysinfo;
+    GetSystemInfo(&sysinfo);
+    num_threads = sysinfo.dwNumberOfProcessors;
+#else
+#ifdef _SC_NPROCESSORS_ONLN
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    num_threads = sysconf(_SC_NPROCESSORS_CONF);
+#endif
+#endif
+
+    // Fallback to at least 1 if detection failed
+    return (num_threads > 0) ? num_threads : 1;
+}
+
+// Helper function to convert string to wstring
+static std::wstring to_wstring(const std::string& str) {
+    std::wstring result;
+    result.reserve(str.size());
+    for (char c : str) {
+        result.push_back(static_cast<wchar_t>(c));
+    }
+    return result;
+}
+
+// Fast corruption detection (ported from trainerte2.py)
+static float calculate_row_pattern_consistency(const cv::Mat& image) {
+    cv::Mat gray;
+    if (image.channels() == 3) {
+        cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+    } else {
+        gray = image;
+    }
+
+    // Normalize to 0-1 range
+    cv::Mat gray_norm;
+    gray.convertTo(gray_norm, CV_32F, 1.0 / 255.0);
+
+    // Calculate row means
+    cv::Mat row_means;
+    cv::reduce(gray_norm, row_means, 1, cv::REDUCE_AVG);
+
+    // Calculate consistency (standard deviation of row differences)
+    if (row_means.rows > 1) {
+        cv::Mat row_diffs;
+        cv::Mat shifted_means = row_means(cv::Range(1, row_means.rows), cv::Range::all());
+        cv::Mat original_means = row_means(cv::Range(0, row_means.rows - 1), cv::Range::all());
+        row_diffs = shifted_means - original_means;
+
+        cv::Scalar mean_diff, stddev_diff;
+        cv::meanStdDev(row_diffs, mean_diff, stddev_diff);
+        return (float)stddev_diff[0]; // Cast to fix warning
+    }
+    return 0.0f;
+}
+
+class FastCorruptionDetector {
+private:
+    float base_threshold;
+    float current_threshold;
+    bool use_adaptive;
+    int adaptation_window;
+    std::deque<float> recent_values;
+    int total_frames;
+    int detected_corrupted_left;
+    int detected_corrupted_right;
+    int threshold_updates;
+
+public:
+    FastCorruptionDetector(float threshold = 0.022669f, bool adaptive = true, int window = 100)
+        : base_threshold(threshold)
+        , current_threshold(threshold)
+        , use_adaptive(adaptive)
+        , adaptation_window(window)
+        , total_frames(0)
+        , detected_corrupted_left(0)
+        , detected_corrupted_right(0)
+        , threshold_updates(0) { }
+
+    void update_adaptive_threshold(float value) {
+        if (!use_adaptive)
+            return;
+
+        recent_values.push_back(value);
+        if (recent_values.size() > adaptation_window) {
+            recent_values.pop_front();
+        }
+
+        if (recent_values.size() < 20)
+            return;
+
+        // Calculate median and MAD for robust statistics
+        std::vector<float> values(recent_values.begin(), recent_values.end());
+        std::sort(values.begin(), values.end());
+
+        float median = values[values.size() / 2];
+
+        // Calculate MAD (Median Absolute Deviation)
+        std::vector<float> abs_deviations;
+        for (float val : values) {
+            abs_deviations.push_back(std::abs(val - median));
+        }
+        std::sort(abs_deviations.begin(), abs_deviations.end());
+        float mad = abs_deviations[abs_deviations.size() / 2];
+
+        // Set threshold as median + 3*MAD
+        float adaptive_threshold = median + 3.0f * mad;
+
+        // Clamp to reasonable bounds
+        float min_threshold = base_threshold * 0.5f;
+        float max_threshold = base_threshold * 3.0f;
+        current_threshold = std::max(min_threshold, std::min(max_threshold, adaptive_threshold));
+        threshold_updates++;
+    }
+
+    bool is_corrupted(const cv::Mat& frame, float* metric_value = nullptr, float* threshold_used = nullptr) {
+        float metric = calculate_row_pattern_consistency(frame);
+        update_adaptive_threshold(metric);
+
+        bool corrupted = metric > current_threshold;
+
+        if (metric_value)
+            *metric_value = metric;
+        if (threshold_used)
+            *threshold_used = current_threshold;
+
+        return corrupted;
+    }
+
+    struct FramePairResult {
+        bool left_corrupted;
+        bool right_corrupted;
+        float left_value;
+        float right_value;
+        float left_threshold;
+        float right_threshold;
+    };
+
+    FramePairResult process_frame_pair(const cv::Mat& left_frame, const cv::Mat& right_frame) {
+        total_frames++;
+
+        FramePairResult result;
+        result.left_corrupted = is_corrupted(left_frame, &result.left_value, &result.left_threshold);
+        result.right_corrupted = is_corrupted(right_frame, &result.right_value, &result.right_threshold);
+
+        if (result.left_corrupted)
+            detected_corrupted_left++;
+        if (result.right_corrupted)
+            detected_corrupted_right++;
+
+        return result;
+    }
+
+    void get_stats() {
+        printf("Corruption detection stats:\n");
+        printf("  Total frames: %d\n", total_frames);
+        printf("  Corrupted left: %d (%.2f%%)\n", detected_corrupted_left,
+               100.0f * detected_corrupted_left / std::max(1, total_frames));
+        printf("  Corrupted right: %d (%.2f%%)\n", detected_corrupted_right,
+               100.0f * detected_corrupted_right / std::max(1, total_frames));
+        printf("  Current threshold: %.6f\n", current_threshold);
+        printf("  Threshold updates: %d\n", threshold_updates);
+    }
+};
+
+// Structure to hold a temporal sequence of frames with pre-processed images
+struct TemporalSequence {
+    std::vector<AlignedFrame> frames; // Changed to AlignedFrame to match what read_capture_file returns
+    bool is_valid;
+    // Pre-processed image data to avoid repeated JPEG decoding
+    std::vector<std::vector<float>> preprocessed_images; // [frame_idx][pixel_data]
+};
+
+// Function to extract temporal sequences from frames - updated to use AlignedFrame
+static std::vector<TemporalSequence> createTemporalSequences(const std::vector<AlignedFrame>& frames, int num_frames) {
+    std::vector<TemporalSequence> sequences;
+
+    if (frames.size() < num_frames) {
+        printf("Not enough frames to create sequences\n");
+        return sequences;
+    }
+
+    // Initialize corruption detector for dataset filtering
+    FastCorruptionDetector corruption_detector;
+    int corrupted_sequences = 0;
+
+    // Sequences end in a frame with FLAG_GOOD_DATA; inference_bench picks its labels the same way
+    for (const AlignedFrame* label : selectSequenceLabels(frames, num_frames)) {
+        TemporalSequence seq;
+        const size_t i = (size_t)(label - frames.data()) + 1 - num_frames; // First frame of the sequence
+
+        // The most recent frame, which carries the sequence's label
+        const auto& latest_frame = *label;
+
+        // Decode images to check for corruption (matching trainerte2.py)
+        static thread_local std::vector<uint32_t> left_eye_data;
+        static thread_local std::vector<uint32_t> right_eye_data;
+        int left_width, left_height, right_width, right_height;
+
+        latest_frame.DecodeImageLeft(left_eye_data, left_width, left_height);
+        latest_frame.DecodeImageRight(right_eye_data, right_width, right_height);
+
+        // Convert to OpenCV format for corruption detection
+        cv::Mat left_mat(left_height, left_width, CV_8UC4, left_eye_data.data());
+        cv::Mat right_mat(right_height, right_width, CV_8UC4, right_eye_data.data());
+
+        // Check for corruption
+        auto corruption_result = corruption_detector.process_frame_pair(left_mat, right_mat);
+
+        if (true) { // if (!corruption_result.left_corrupted && !corruption_result.right_corrupted) {
+            seq.is_valid = true;
+
+            // Collect all frames in the sequence
+            for (int j = 0; j < num_frames; j++) {
+                seq.frames.push_back(frames[i + j]);
+            }
+
+            sequences.push_back(seq);
+        } else {
+            corrupted_sequences++;
+        }
+    }
+
+    printf("Created %zu valid temporal sequences from %zu frames\n",
+           sequences.size(), frames.size());
+    printf("Excluded %d corrupted sequences\n", corrupted_sequences);
+    corruption_detector.get_stats();
+    return sequences;
+}
+
+// Function to print parameter info and check for gradient flow
+static void printParameterInfo(OrtTrainingSession* training_session, const OrtApi* g_ort_api,
+                               const OrtTrainingApi* g_ort_training_api,
+                               std::vector<float>* prev_params = nullptr) {
+
+    // Get size of all parameters (both trainable and non-trainable)
+    size_t all_params_size = 0;
+    OrtStatus* status = g_ort_training_api->GetParametersSize(training_session, &all_params_size, false);
+    if (status != NULL) {
+        const char* error_message = g_ort_api->GetErrorMessage(status);
+        fprintf(stderr, "Error getting all parameters size: %s\n", error_message);
+        g_ort_api->ReleaseStatus(status);
+        return;
+    }
+
+    // Get size of trainable parameters only
+    size_t trainable_params_size = 0;
+    status = g_ort_training_api->GetParametersSize(training_session, &trainable_params_size, true);
+    if (status != NULL) {
+        const char* error_message = g_ort_api->GetErrorMessage(status);
+        fprintf(stderr, "Error getting trainable parameters size: %s\n", error_message);
+        g_ort_api->ReleaseStatus(status);
+        return;
+    }
+
+    // Calculate non-trainable parameters size
+    size_t non_trainable_params_size = all_params_size - trainable_params_size;
+
+    printf("===== Parameter Information =====\n");
+    printf("Total parameters: %zu\n", all_params_size);
+    printf("Trainable parameters: %zu (%.2f%%)\n", trainable_params_size,
+           (float)trainable_params_size / all_params_size * 100.0f);
+    printf("Frozen parameters: %zu (%.2f%%)\n", non_trainable_params_size,
+           (float)non_trainable_params_size / all_params_size * 100.0f);
+
+    // Create memory info for parameter tensor
+    OrtMemoryInfo* memory_info = nullptr;
+    status = g_ort_api->CreateCpuMemoryInfo(OrtArenaAllocator, OrtMemTypeDefault, &memory_info);
+    if (status != NULL) {
+        const char* error_message = g_ort_api->GetErrorMessage(status);
+        fprintf(stderr, "Error creating memory info: %s\n", error_message);
+        g_ort_api->ReleaseStatus(status);
+        return;
+    }
+
+    // Get current parameter values
+    std::vector<float> current_params(trainable_params_size);
+    const int64_t shape[] = { (int64_t)trainable_params_size };
+    OrtValue* params_tensor = nullptr;
+
+    status = g_ort_api->CreateTensorWithDataAsOrtValue(
+        memory_info,
+        current_params.data(),
+        current_params.size() * sizeof(float),
+        shape,
+        1,
+        ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT,
+        &params_tensor);
+
+    if (status != NULL) {
+        const char* error_message = g_ort_api->GetErrorMessage(status);
+        fprintf(stderr, "Error creating parameter tensor: %s\n", error_message);
+        g_ort_api->ReleaseStatus(status);
+        g_ort_api->ReleaseMemoryInfo(memory_info);
+        return;
+    }
+
+    // Copy parameters to our buffer
+    status = g_ort_training_api->CopyParametersToBuffer(
+        training_session,
+        params_tensor,
+        true // Only trainable parameters
+    );
+
+    if (status != NULL) {
+        const char* error_message = g_ort_api->GetErrorMessage(status);
+        fprintf(stderr, "Error copying parameters to buffer: %s\n", error_message);
+        g_ort_api->ReleaseStatus(status);
+        g_ort_api->ReleaseValue(params_tensor);
+        g_ort_api->ReleaseMemoryInfo(memory_info);
+        return;
+    }
+
+    // Print sample of parameters
+    printf("Parameter samples: ");
+    for (size_t i = 0; i < 5 && i < trainable_params_size; i++) {
+        printf("%g ", current_params[i]);
+    }
+    printf("...\n");
+
+    // Check if parameters have changed from previous values
+    if (prev_params != nullptr && prev_params->size() == trainable_params_size) {
+        float total_diff = 0.0f;
+        int changed_count = 0;
+
+        for (size_t i = 0; i < trainable_params_size; i++) {
+            float diff = std::abs(current_params[i] - (*prev_params)[i]);
+            total_diff += diff;
+            if (diff > 1e-6) {
+                changed_count++;
+            }
+        }
+
+        printf("Gradient movement: %g (%.2f%% of parameters changed)\n",
+               total_diff, (float)changed_count / trainable_params_size * 100.0f);
+
+        // Update previous parameters
+        *prev_params = current_params;
+    } else if (prev_params != nullptr) {
+        // First time storing parameters
+        *prev_params = current_params;
+    }
+
+    // Clean up
+    g_ort_api->ReleaseValue(params_tensor);
+    g_ort_api->ReleaseMemoryInfo(memory_info);
+
+    printf("================================\n");
+}
+
+// Copy every parameter, trainable or frozen (BatchNorm running statistics
+// included), from the session into state, or from state back into the session
+static OrtStatus* copySessionState(OrtTrainingSession* training_session, const OrtApi* g_ort_api,
+                                   const OrtTrainingApi* g_ort_training_api, OrtMemoryInfo* memory_info,
+                                   std::vector<float>* state, bool restore) {
+    if (!restore) {
+        size_t size = 0;
+        OrtStatus* status = g_ort_training_api->GetParametersSize(training_session, &size, false);
+        if (status != NULL) {
+            return status;
+        }
+        state->resize(size);
+    }
+
+    const int64_t shape[] = { (int64_t)state->size() };
+    OrtValue* state_tensor = NULL;
+    OrtStatus* status = g_ort_api->CreateTensorWithDataAsOrtValue(memory_info, state->data(), state->size() * sizeof(float),
+                                                                  shape, 1, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &state_tensor);
+    if (status != NULL) {
+        return status;
+    }
+
+    if (restore) {
+        status = g_ort_training_api->CopyBufferToParameters(training_session, state_tensor, false);
+    } else {
+        status = g_ort_training_api->CopyParametersToBuffer(training_session, state_tensor, false);
+    }
+    g_ort_api->ReleaseValue(state_tensor);
+    return status;
+}
+
+bool TrainModel(
+    const std::vector<AlignedFrame>& frames,
+    const TrainerOptions& options,
+    std::function<void(const TrainerProgress&)> onProgress,
+    const std::atomic<bool>* cancel) {
+    const std::string& onnx_model_path = options.outputModelPath;
+
+    TrainerProgress progress;
+    progress.totalEpochs = options.epochs;
+    progress.startTime = std::chrono::steady_clock::now();
+
+    auto report = [&]() {
+        if (onProgress) {
+            onProgress(progress);
+        }
+    };
+    auto fail = [&](const std::string& message) {
+        fprintf(stderr, "%s\n", message.c_str());
+        progress.isTraining = false;
+        progress.hasError = true;
+        progress.lastError = message;
+        report();
+        return false;
+    };
+    auto cancelled = [&]() {
+        return cancel != nullptr && cancel->load();
+    };
+
+    if (options.epochs < 1 || options.batchSize < 1) {
+        return fail("Invalid training options: need at least one epoch and a batch size of at least one");
+    }
+
+    // Create temporal sequences
+    auto sequences = createTemporalSequences(frames, NUM_FRAMES);
+
+    if (sequences.empty()) {
+        return fail("No valid temporal sequences created");
+    }
+
+    // Calculate dynamic label ranges (matching trainerte2.py) from the label of every valid sequence
+    std::vector<const AlignedFrame*> labels;
+    for (const auto& sequence : sequences) {
+        if (sequence.is_valid && !sequence.frames.empty()) {
+            labels.push_back(&sequence.frames.back());
+        }
+    }
+    LabelRanges label_ranges = calculateLabelRanges(labels);
+
+    printf("DEBUG: About to initialize ONNX Runtime...\n");
+    fflush(stdout);
+
+    // Initialize ONNX Runtime
+    printf("DEBUG: Getting ORT API...\n");
+    fflush(stdout);
+    const OrtApi* g_ort_api = OrtGetApiBase()->GetApi(ORT_API_VERSION);
+    printf("DEBUG: Getting ORT Training API...\n");
+    fflush(stdout);
+    const OrtTrainingApi* g_ort_training_api = g_ort_api->GetTrainingApi(ORT_API_VERSION);
+    printf("DEBUG: ONNX APIs obtained successfully\n");
+    fflush(stdout);
+
+    // Create environment
+    printf("DEBUG: Creating ONNX environment...\n");
+    fflush(stdout);
+    OrtEnv* env = NULL;
+    OrtStatus* status = g_ort_api->CreateEnv(ORT_LOGGING_LEVEL_WARNING, "TemporalEyeTracker", &env);
+    if (status != NULL) {
+        std::string message = std::string("Error creating environment: ") + g_ort_api->GetErrorMessage(status);
+        g_ort_api->ReleaseStatus(status);
+        return fail(message);
+    }
+    printf("DEBUG: Environment created successfully\n");
+    fflush(stdout);
+
+    // Create session options
+    printf("DEBUG: Creating session options...\n");
+    fflush(stdout);
+    OrtSessionOptions* session_options = NULL;
+    status = g_ort_api->CreateSessionOptions(&session_options);
+    if (status != NULL) {
+        std::string message = std::string("Error creating session options: ") + g_ort_api->GetErrorMessage(status);
+        g_ort_api->ReleaseStatus(status);
+        g_ort_api->ReleaseEnv(env);
+        return fail(message);
+    }
+    printf("DEBUG: Session options created successfully\n");
+    fflush(stdout);
+
+    // Set session options with optimizations
+    printf("DEBUG: Setting graph optimization level...\n");
+    fflush(stdout);
+    g_ort_api->SetSessionGraphOptimizationLevel(session_options, ORT_ENABLE_ALL); // Enable all optimizations
+    printf("DEBUG: Graph optimization set successfully\n");
+    fflush(stdout);
+
+    bool using_cuda = false;
+#if ENABLE_CUDA
+    if (options.useCuda) {
+        // Try to use GPU if available
+        printf("DEBUG: Trying to set up CUDA provider...\n");
+        fflush(stdout);
+        OrtStatus* gpu_status = g_ort_api->SessionOptionsAppendExecutionProvider_CUDA(session_options, 0);
+        if (gpu_status != NULL) {
+            printf("CUDA not available, falling back to CPU\n");
+            g_ort_api->ReleaseStatus(gpu_status);
+        } else {
+            printf("Using CUDA GPU acceleration\n");
+            using_cuda = true;
+        }
+    }
+#endif
+    if (!using_cuda) {
+        printf("DEBUG: Setting up CPU threading...\n");
+        fflush(stdout);
+        int threads = get_cpu_thread_count() - 1; // Leave one core free
+        if (threads < 1)
+            threads = 1;
+
+        g_ort_api->SetIntraOpNumThreads(session_options, threads);
+        g_ort_api->SetInterOpNumThreads(session_options, threads);
+        printf("Using %d CPU threads\n", threads);
+    }
+    printf("DEBUG: Execution provider setup complete\n");
+    fflush(stdout);
+
+    // Allocate from one pre-sized arena instead of growing it during the first epoch
+    if (RegisterPresizedCpuArena(g_ort_api, env, session_options)) {
+        printf("Pre-sized CPU arena: %d MB initial chunk\n", ORT_ARENA_INITIAL_CHUNK_BYTES / (1024 * 1024));
+    }
+
+    // Session creation + warm-up is reported as cold-start time
+    auto session_start_time = std::chrono::steady_clock::now();
+
+    // Paths to model artifacts
+    std::string checkpoint_path = options.artifactsDir + "/checkpoint";
+    std::string training_model_path = options.artifactsDir + "/training_model.onnx";
+    std::string eval_model_path = options.artifactsDir + "/eval_model.onnx";
+    std::string optimizer_model_path = options.artifactsDir + "/optimizer_model.onnx";
+
+    // Load checkpoint
+    OrtCheckpointState* checkpoint_state = NULL;
+    status = g_ort_training_api->LoadCheckpoint(to_wstring(checkpoint_path).c_str(), &checkpoint_state);
+
+    if (status != NULL) {
+        std::string message = std::string("Error loading checkpoint: ") + g_ort_api->GetErrorMessage(status);
+        g_ort_api->ReleaseStatus(status);
+        g_ort_api->ReleaseSessionOptions(session_options);
+        g_ort_api->ReleaseEnv(env);
+        return fail(message);
+    }
+
+    printf("Checkpoint loaded successfully\n");
+    fflush(stdout);
+
+    // Create training session
+    printf("Creating training session...\n");
+    printf("Training model: %s\n", training_model_path.c_str());
+    printf("Eval model: %s\n", eval_model_path.c_str());
+    printf("Optimizer model: %s\n", optimizer_model_path.c_str());
+    fflush(stdout);
+    OrtTrainingSession* training_session = NULL;
+    status = g_ort_training_api->CreateTrainingSession(
+        env,
+        session_options,
+        checkpoint_state,
+        to_wstring(training_model_path).c_str(),
+        to_wstring(eval_model_path).c_str(),
+        to_wstring(optimizer_model_path).c_str(),
+        &training_session);
+
+    if (status != NULL) {
+        std::string message = std::string("Error creating training session: ") + g_ort_api->GetErrorMessage(status);
+        g_ort_api->ReleaseStatus(status);
+        g_ort_training_api->ReleaseCheckpointState(checkpoint_state);
+        g_ort_api->ReleaseSessionOptions(session_options);
+        g_ort_api->ReleaseEnv(env);
+        return fail(message);
+    }
+
+    printf("Training session created successfully!\n");
+    std::chrono::duration<double> session_duration = std::chrono::steady_clock::now() - session_start_time;
+    fflush(stdout);
+
+    // Vector to track parameter changes
+    std::vector<float> previous_params;
+
+    // Print initial parameter info
+    printf("Initial parameter information:\n");
+    printParameterInfo(training_session, g_ort_api, g_ort_training_api, &previous_params);
+
+    // Set learning rate
+    float learning_rate = options.learningRate;
+    status = g_ort_training_api->SetLearningRate(training_session, learning_rate);
+    if (status != NULL) {
+        const char* error_message = g_ort_api->GetErrorMessage(status);
+        fprintf(stderr, "Error setting learning rate: %s\n", error_message);
+        g_ort_api->ReleaseStatus(status);
+    } else {
+        printf("Learning rate set to: %f\n", learning_rate);
+    }
+
+    // Verify learning rate was set correctly
+    float current_lr = 0.0f;
+    status = g_ort_training_api->GetLearningRate(training_session, &current_lr);
+    if (status == NULL) {
+        printf("Confirmed learning rate: %f\n", current_lr);
+    } else {
+        const char* error_message = g_ort_api->GetErrorMessage(status);
+        fprintf(stderr, "Error getting learning rate: %s\n", error_message);
+        g_ort_api->ReleaseStatus(status);
+    }
+
+    // Create memory info for tensors
+    OrtMemoryInfo* memory_info = NULL;
+    status = g_ort_api->CreateCpuMemoryInfo(OrtArenaAllocator, OrtMemTypeDefault, &memory_info);
+    if (status != NULL) {
+        std::string message = std::string("Error creating memory info: ") + g_ort_api->GetErrorMessage(status);
+        g_ort_api->ReleaseStatus(status);
+        g_ort_training_api->ReleaseTrainingSession(training_session);
+        g_ort_training_api->ReleaseCheckpointState(checkpoint_state);
+        g_ort_api->ReleaseSessionOptions(session_options);
+        g_ort_api->ReleaseEnv(env);
+        return fail(message);
+    }
+
+    // Create indices for shuffling
+    std::vector<size_t> indices(sequences.size());
+    std::iota(indices.begin(), indices.end(), 0); // Fill with 0, 1, 2, ...
+
+    // Training configuration
+    const int num_epochs = options.epochs;
+    const size_t batch_size = options.batchSize;
+    const size_t check_interval = 500; // Check parameters every N batches (reduced frequency)
+    const size_t save_interval = 16;   // Save checkpoint every N epochs
+
+    printf("Starting training with %zu sequences, %d epochs, batch size %zu\n",
+           sequences.size(), num_epochs, (size_t)batch_size);
+
+    // Track overall stats
+    float best_loss = std::numeric_limits<float>::max();
+
+    // Pre-allocate batch tensors to avoid repeated allocations
+    std::vector<float> batch_images(batch_size * 2 * NUM_FRAMES * TRAIN_RESOLUTION * TRAIN_RESOLUTION);
+    std::vector<float> batch_labels(batch_size * NUM_CLASSES);
+
+    // Warm-up: run full-size dummy batches through TrainStep so graph
+    // initialization and arena growth happen before timing starts. No
+    // OptimizerStep runs and gradients are discarded with LazyResetGrad, but
+    // the training-mode forward pass still moves the BatchNorm running
+    // statistics toward the zeroed batch, so all parameters are saved here
+    // and written back once warm-up is done.
+    auto warmup_start_time = std::chrono::steady_clock::now();
+    std::vector<float> warmup_state;
+    int warmup_runs = ORT_WARMUP_RUNS;
+    status = copySessionState(training_session, g_ort_api, g_ort_training_api, memory_info, &warmup_state, false);
+    if (status != NULL) {
+        const char* error_message = g_ort_api->GetErrorMessage(status);
+        fprintf(stderr, "Can't save parameters, skipping warm-up: %s\n", error_message);
+        g_ort_api->ReleaseStatus(status);
+        warmup_runs = 0;
+    }
+
+    for (int warmup = 0; warmup < warmup_runs; warmup++) {
+        const int64_t warmup_input_shape[] = { (int64_t)batch_size, 2 * NUM_FRAMES, TRAIN_RESOLUTION, TRAIN_RESOLUTION };
+        const int64_t warmup_label_shape[] = { (int64_t)batch_size, NUM_CLASSES };
+        OrtValue* warmup_inputs[2] = { NULL, NULL };
+        OrtValue* warmup_outputs[1] = { NULL };
+
+        status = g_ort_api->CreateTensorWithDataAsOrtValue(memory_info, batch_images.data(), batch_images.size() * sizeof(float),
+                                                           warmup_input_shape, 4, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &warmup_inputs[0]);
+        if (status == NULL) {
+            status = g_ort_api->CreateTensorWithDataAsOrtValue(memory_info, batch_labels.data(), batch_labels.size() * sizeof(float),
+                                                               warmup_label_shape, 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &warmup_inputs[1]);
+        }
+        if (status == NULL) {
+            status = g_ort_training_api->TrainStep(training_session, NULL, 2, warmup_inputs, 1, warmup_outputs);
+        }
+        if (status == NULL) {
+            status = g_ort_training_api->LazyResetGrad(training_session);
+        }
+
+        if (warmup_outputs[0] != NULL) {
+            g_ort_api->ReleaseValue(warmup_outputs[0]);
+        }
+        for (int v = 0; v < 2; v++) {
+            if (warmup_inputs[v] != NULL) {
+                g_ort_api->ReleaseValue(warmup_inputs[v]);
+            }
+        }
+
+        if (status != NULL) {
+            const char* error_message = g_ort_api->GetErrorMessage(status);
+            fprintf(stderr, "Warm-up step failed, continuing without: %s\n", error_message);
+            g_ort_api->ReleaseStatus(status);
+            break;
+        }
+    }
+
+    if (warmup_runs > 0) {
+        status = copySessionState(training_session, g_ort_api, g_ort_training_api, memory_info, &warmup_state, true);
+        if (status != NULL) {
+            std::string message = std::string("Error restoring parameters after warm-up: ") + g_ort_api->GetErrorMessage(status);
+            g_ort_api->ReleaseStatus(status);
+            g_ort_api->ReleaseMemoryInfo(memory_info);
+            g_ort_training_api->ReleaseTrainingSession(training_session);
+            g_ort_training_api->ReleaseCheckpointState(checkpoint_state);
+            g_ort_api->ReleaseSessionOptions(session_options);
+            g_ort_api->ReleaseEnv(env);
+            return fail(message);
+        }
+    }
+    std::chrono::duration<double> warmup_duration = std::chrono::steady_clock::now() - warmup_start_time;
+    printf("Cold start: session %.2fs, warm-up %.2fs (%d steps)\n",
+           session_duration.count(), warmup_duration.count(), warmup_runs);
+
+    // Training loop
+    auto training_start_time = std::chrono::steady_clock::now();
+    progress.totalBatches = (int)((sequences.size() + batch_size - 1) / batch_size);
+    progress.isTraining = true;
+
+    for (int epoch = 0; epoch < num_epochs && !cancelled(); epoch++) {
+        auto epoch_start_time = std::chrono::steady_clock::now();
+        printf("\n=== Epoch %d/%d ===\n", epoch + 1, num_epochs);
+
+        progress.currentEpoch = epoch + 1;
+        progress.currentBatch = 0;
+        progress.epochStartTime = epoch_start_time;
+        report();
+
+        // Shuffle data for this epoch
+        std::random_device rd;
+        std::mt19937 g(rd());
+        std::shuffle(indices.begin(), indices.end(), g);
+
+        // Track metrics
+        float epoch_loss_sum = 0.0f;
+        size_t batch_count = 0;
+
+        // Process data in batches
+        for (size_t batch_start = 0; batch_start < sequences.size() && !cancelled(); batch_start += batch_size) {
+            // Determine actual batch size (may be smaller for the last batch)
+            size_t current_batch_size = STD_MIN(batch_size, sequences.size() - batch_start);
+
+            // Resize pre-allocated batch vectors instead of creating new ones
+            size_t required_image_size = current_batch_size * 2 * NUM_FRAMES * TRAIN_RESOLUTION * TRAIN_RESOLUTION;
+            size_t required_label_size = current_batch_size * NUM_CLASSES;
+
+            if (batch_images.size() != required_image_size) {
+                batch_images.resize(required_image_size);
+            }
+            if (batch_labels.size() != required_label_size) {
+                batch_labels.resize(required_label_size);
+            }
+
+            // Fill batch with data
+            for (size_t i = 0; i < current_batch_size; i++) {
+                const auto& sequence = sequences[indices[batch_start + i]];
+
+                // Use the last frame for labels (most recent)
+                const auto& last_frame = sequence.frames.back();
+
+                // DEBUG: Check frame validity
+                // printf("Processing sequence %zu, frame timestamp: %llu\n",
+                //       indices[batch_start + i], last_frame.label_timestamp);
+
+                // Extract MicroChad parameters using dynamic normalization (matching trainerte2.py)
+                float raw_pitch = std::get<0>(last_frame.label_data);
+                float raw_yaw = std::get<1>(last_frame.label_data);
+                float raw_convergence = std::get<2>(last_frame.label_data);
+
+                // Apply dynamic normalization like trainerte2.py
+                float pitch = (raw_pitch - label_ranges.pitchOffset()) / label_ranges.pitch_range;
+                float yaw = (raw_yaw - label_ranges.yawOffset()) / label_ranges.yaw_range;
+                float convergence = raw_convergence / label_ranges.convergence_max;
+
+                // DEBUG: Check for invalid values
+                float all_params[] = { pitch, yaw, convergence };
+                bool has_invalid = false;
+                for (int p = 0; p < 3; p++) {
+                    if (!std::isfinite(all_params[p])) {
+                        printf("ERROR: Invalid value at param %d: %f\n", p, all_params[p]);
+                        has_invalid = true;
+                    }
+                }
+                // if (i == 0) {
+                //     printf("Sample %zu labels: pitch=%.3f yaw=%.3f convergence=%.3f\n",
+                //            i, pitch, yaw, convergence);
+                // }
+                if (has_invalid) {
+                    printf("Skipping batch due to invalid values\n");
+                    continue;
+                }
+
+                // Fill batch labels with 3 parameters for MicroChad model
+                batch_labels[i * NUM_CLASSES + 0] = pitch;
+                batch_labels[i * NUM_CLASSES + 1] = yaw;
+                batch_labels[i * NUM_CLASSES + 2] = convergence;
+
+                // Process all frames in the sequence (most recent frame first)
+                for (int frame_idx = 0; frame_idx < NUM_FRAMES; frame_idx++) {
+                    // Get frame from sequence (most recent to oldest)
+                    const auto& frame = sequence.frames[NUM_FRAMES - 1 - frame_idx];
+
+                    // Get eye images (reuse vectors to avoid allocations)
+                    static thread_local std::vector<uint32_t> left_eye_data;
+                    static thread_local std::vector<uint32_t> right_eye_data;
+                    int left_width, left_height, right_width, right_height;
+
+                    // Decode eye images (uses existing caching)
+                    frame.DecodeImageLeft(left_eye_data, left_width, left_height);
+                    frame.DecodeImageRight(right_eye_data, right_width, right_height);
+
+                    // Calculate offsets in the batch tensor
+                    size_t frame_offset = i * 2 * NUM_FRAMES * TRAIN_RESOLUTION * TRAIN_RESOLUTION + frame_idx * 2 * TRAIN_RESOLUTION * TRAIN_RESOLUTION;
+
+                    // Gray, histogram equalization and scaling (matching trainerte2.py preprocessing).
+                    // The same kernel feeds the native inference engine.
+                    static thread_local std::vector<uint8_t> gray_scratch;
+                    PreprocessEyeImage(left_eye_data.data(), left_width, left_height,
+                                       &batch_images[frame_offset], TRAIN_RESOLUTION, gray_scratch);
+                    PreprocessEyeImage(right_eye_data.data(), right_width, right_height,
+                                       &batch_images[frame_offset + TRAIN_RESOLUTION * TRAIN_RESOLUTION], TRAIN_RESOLUTION, gray_scratch);
+                }
+            }
+
+            // DEBUG: Print tensor shapes before creation
+            // printf("Creating tensors - batch_size: %zu, input_shape: [%lld, %lld, %lld, %lld]\n",
+            //       current_batch_size, (int64_t)current_batch_size, (int64_t)(2 * NUM_FRAMES),
+            //       (int64_t)TRAIN_RESOLUTION, (int64_t)TRAIN_RESOLUTION);
+
+            // Create input tensor for images
+            const int64_t input_shape[] = { (int64_t)current_batch_size, 2 * NUM_FRAMES, TRAIN_RESOLUTION, TRAIN_RESOLUTION };
+            OrtValue* input_tensor = NULL;
+
+            status = g_ort_api->CreateTensorWithDataAsOrtValue(
+                memory_info,
+                batch_images.data(),
+                batch_images.size() * sizeof(float),
+                input_shape,
+                4,
+                ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT,
+                &input_tensor);
+
+            if (status != NULL) {
+                const char* error_message = g_ort_api->GetErrorMessage(status);
+                fprintf(stderr, "Error creating input tensor: %s\n", error_message);
+                g_ort_api->ReleaseStatus(status);
+                continue; // Skip this batch
+            }
+
+            // printf("Input tensor created successfully\n");
+
+            // Create label tensor
+            const int64_t label_shape[] = { (int64_t)current_batch_size, NUM_CLASSES };
+            OrtValue* label_tensor = NULL;
+            // printf("Creating label tensor with shape: [%lld, %lld]\n", label_shape[0], label_shape[1]);
+
+            status = g_ort_api->CreateTensorWithDataAsOrtValue(
+                memory_info,
+                batch_labels.data(),
+                batch_labels.size() * sizeof(float),
+                label_shape,
+                2,
+                ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT,
+                &label_tensor);
+
+            if (status != NULL) {
+                const char* error_message = g_ort_api->GetErrorMessage(status);
+                fprintf(stderr, "Error creating label tensor: %s\n", error_message);
+                g_ort_api->ReleaseStatus(status);
+                g_ort_api->ReleaseValue(input_tensor);
+                continue; // Skip this batch
+            }
+
+            // printf("Label tensor created successfully\n");
+
+            // Setup inputs and outputs for training step
+            OrtValue* input_values[] = { input_tensor, label_tensor };
+            OrtValue* output_values[1] = { NULL };
+
+            // printf("About to call TrainStep for batch %zu...\n", batch_count);
+            // fflush(stdout);
+
+            // Run training step
+            status = g_ort_training_api->TrainStep(
+                training_session,
+                NULL,
+                2,
+                input_values,
+                1,
+                output_values);
+
+            if (status != NULL) {
+                const char* error_message = g_ort_api->GetErrorMessage(status);
+                fprintf(stderr, "Error in training step: %s\n", error_message);
+                g_ort_api->ReleaseStatus(status);
+                g_ort_api->ReleaseValue(input_tensor);
+                g_ort_api->ReleaseValue(label_tensor);
+                continue; // Skip this batch
+            }
+
+            // printf("TrainStep completed successfully for batch %zu\n", batch_count);
+
+            // Get loss value
+            float batch_loss = 0.0f;
+            if (output_values[0] != NULL) {
+                float* loss_data = NULL;
+                status = g_ort_api->GetTensorMutableData(output_values[0], (void**)&loss_data);
+                if (status == NULL) {
+                    batch_loss = loss_data[0];
+                    epoch_loss_sum += batch_loss;
+
+                    progress.currentLoss = batch_loss;
+                    progress.lossHistory.push_back(batch_loss);
+
+                    // Print batch progress
+                    printf("\rBatch %zu/%zu, Loss: %.6f",
+                           batch_count + 1,
+                           (sequences.size() + batch_size - 1) / batch_size,
+                           batch_loss);
+                    fflush(stdout);
+                } else {
+                    const char* error_message = g_ort_api->GetErrorMessage(status);
+                    fprintf(stderr, "Error getting loss data: %s\n", error_message);
+                    g_ort_api->ReleaseStatus(status);
+                }
+            }
+
+            // Run optimizer step - CRITICAL for weight updates
+            status = g_ort_training_api->OptimizerStep(training_session, NULL);
+            if (status != NULL) {
+                const char* error_message = g_ort_api->GetErrorMessage(status);
+                fprintf(stderr, "\nError in optimizer step: %s\n", error_message);
+                g_ort_api->ReleaseStatus(status);
+            }
+
+            // Reset gradients AFTER optimizer step
+            status = g_ort_training_api->LazyResetGrad(training_session);
+            if (status != NULL) {
+                const char* error_message = g_ort_api->GetErrorMessage(status);
+                fprintf(stderr, "\nError resetting gradients: %s\n", error_message);
+                g_ort_api->ReleaseStatus(status);
+            }
+
+            // Check parameter changes periodically
+            if (batch_count % check_interval == 0) {
+                printf("\n"); // Add line break after batch progress
+                printParameterInfo(training_session, g_ort_api, g_ort_training_api, &previous_params);
+            }
+
+            // Clean up batch resources
+            if (output_values[0] != NULL) {
+                g_ort_api->ReleaseValue(output_values[0]);
+            }
+            g_ort_api->ReleaseValue(input_tensor);
+            g_ort_api->ReleaseValue(label_tensor);
+
+            batch_count++;
+            progress.currentBatch = (int)batch_count;
+            report();
+        }
+
+        if (cancelled()) {
+            break;
+        }
+
+        // Print epoch summary
+        auto epoch_end_time = std::chrono::steady_clock::now();
+        std::chrono::duration<double> epoch_duration = epoch_end_time - epoch_start_time;
+
+        float epoch_avg_loss = epoch_loss_sum / batch_count;
+        printf("\nEpoch %d/%d completed in %.2fs. Average loss: %.6f\n",
+               epoch + 1, num_epochs, epoch_duration.count(), epoch_avg_loss);
+
+        progress.epochAverageLoss = epoch_avg_loss;
+        progress.epochDuration = (float)epoch_duration.count();
+        report();
+
+        // Check if this is the best loss so far
+        if (epoch_avg_loss < best_loss) {
+            best_loss = epoch_avg_loss;
+            printf("New best loss achieved!\n");
+
+            // Save best model checkpoint
+            std::string best_checkpoint_path = options.artifactsDir + "/checkpoint_best";
+            status = g_ort_training_api->SaveCheckpoint(
+                checkpoint_state,
+                to_wstring(best_checkpoint_path).c_str(),
+                true // Include optimizer state
+            );
+
+            if (status != NULL) {
+                const char* error_message = g_ort_api->GetErrorMessage(status);
+                fprintf(stderr, "Error saving best checkpoint: %s\n", error_message);
+                g_ort_api->ReleaseStatus(status);
+            } else {
+                printf("Best checkpoint saved to %s\n", best_checkpoint_path.c_str());
+            }
+        }
+
+        // Save checkpoint periodically
+        if ((epoch + 1) % save_interval == 0 || epoch == num_epochs - 1) {
+            std::string checkpoint_save_path = options.artifactsDir + "/checkpoint_epoch" + std::to_string(epoch + 1);
+            status = g_ort_training_api->SaveCheckpoint(
+                checkpoint_state,
+                to_wstring(checkpoint_save_path).c_str(),
+                true // Include optimizer state
+            );
+
+            if (status != NULL) {
+                const char* error_message = g_ort_api->GetErrorMessage(status);
+                fprintf(stderr, "Error saving checkpoint: %s\n", error_message);
+                g_ort_api->ReleaseStatus(status);
+            } else {
+                printf("Checkpoint saved to %s\n", checkpoint_save_path.c_str());
+            }
+        }
+    }
+
+    if (cancelled()) {
+        printf("\nTraining cancelled\n");
+        g_ort_api->ReleaseMemoryInfo(memory_info);
+        g_ort_training_api->ReleaseTrainingSession(training_session);
+        g_ort_training_api->ReleaseCheckpointState(checkpoint_state);
+        g_ort_api->ReleaseSessionOptions(session_options);
+        g_ort_api->ReleaseEnv(env);
+        return fail("Training cancelled");
+    }
+
+    // Print final parameter info
+    printf("\nFinal parameter information:\n");
+    printParameterInfo(training_session, g_ort_api, g_ort_training_api, &previous_params);
+
+    // Calculate total training time
+    auto training_end_time = std::chrono::steady_clock::now();
+    std::chrono::duration<double> total_training_time = training_end_time - training_start_time;
+    printf("Total training time: %.2f seconds\n", total_training_time.count());
+
+    // Export the model
+    std::wstring wide_onnx_path = to_wstring(onnx_model_path);
+
+    // Define the output names for your inference model
+    const char* output_names[] = { "output" };
+
+    // Export the model
+    status = g_ort_training_api->ExportModelForInferencing(
+        training_session,
+        wide_onnx_path.c_str(),
+        1, // Number of outputs
+        output_names);
+
+    std::string export_error;
+    if (status != NULL) {
+        export_error = std::string("Error exporting model to ONNX: ") + g_ort_api->GetErrorMessage(status);
+        g_ort_api->ReleaseStatus(status);
+    } else {
+        printf("Model successfully exported to ONNX at: %s\n", onnx_model_path.c_str());
+
+        // Pre-build the inference engine's optimized-graph cache so the first
+        // launch after calibration doesn't pay for graph optimization
+        std::string cache_path = GetOptimizedModelCachePath(onnx_model_path);
+        auto cache_start_time = std::chrono::steady_clock::now();
+        if (WriteOptimizedModelCache(g_ort_api, env, onnx_model_path, cache_path)) {
+            std::chrono::duration<double> cache_duration = std::chrono::steady_clock::now() - cache_start_time;
+            printf("Optimized model cache written to %s in %.2fs\n", cache_path.c_str(), cache_duration.count());
+        }
+    }
+
+    // Clean up resources
+    g_ort_api->ReleaseMemoryInfo(memory_info);
+    g_ort_training_api->ReleaseTrainingSession(training_session);
+    g_ort_training_api->ReleaseCheckpointState(checkpoint_state);
+    g_ort_api->ReleaseSessionOptions(session_options);
+    g_ort_api->ReleaseEnv(env);
+
+    if (!export_error.empty()) {
+        return fail(export_error);
+    }
+
+    printf("Training completed successfully!\n");
+    progress.isTraining = false;
+    progress.isComplete = true;
+    report();
+    return true;
+}
\ No newline at end of file
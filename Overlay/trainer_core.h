@@ -0,0 +1,55 @@
+#ifndef TRAINER_CORE_H
+#define TRAINER_CORE_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "capture_reader.h"
+#include "trainer_progress.h"
+
+#define TRAINER_DEFAULT_ARTIFACTS "onnx_artifacts/training" // Checkpoint and training/eval/optimizer graphs
+#define TRAINER_DEFAULT_EPOCHS    4
+#define TRAINER_DEFAULT_BATCH     32
+#define TRAINER_DEFAULT_LR        1e-4f // Matches the Python trainer
+
+/**
+ * @brief Settings for one training run
+ */
+struct TrainerOptions {
+    std::string outputModelPath = "tuned_temporal_eye_tracking.onnx";
+    std::string artifactsDir = TRAINER_DEFAULT_ARTIFACTS;
+    int epochs = TRAINER_DEFAULT_EPOCHS;
+    size_t batchSize = TRAINER_DEFAULT_BATCH;
+    float learningRate = TRAINER_DEFAULT_LR;
+    bool useCuda = true; // Falls back to CPU when the CUDA provider isn't available
+};
+
+/**
+ * @brief Fine-tunes the temporal eye tracking model on frames held in memory
+ *
+ * Runs on the calling thread, so an application that wants to keep going
+ * while it trains calls this from a worker thread. The frames are only read;
+ * their decoded images are cached in the frames themselves, as everywhere
+ * else AlignedFrame is used.
+ *
+ * onProgress is called on the training thread at every epoch start, after
+ * every batch, after every epoch and once at the end, with isComplete or
+ * hasError set. Setting *cancel stops training before the next batch; the
+ * model is then not exported.
+ *
+ * @param frames Capture frames, oldest first, as returned by read_capture_file
+ * @param options Output path, artifact directory and hyperparameters
+ * @param onProgress Receives typed progress updates; may be empty
+ * @param cancel Polled between batches; may be null
+ * @return true if the model was trained and exported to options.outputModelPath
+ */
+bool TrainModel(
+    const std::vector<AlignedFrame>& frames,
+    const TrainerOptions& options,
+    std::function<void(const TrainerProgress&)> onProgress = nullptr,
+    const std::atomic<bool>* cancel = nullptr);
+
+#endif // TRAINER_CORE_H
@@ -1,11 +1,22 @@
 #include "trainer_wrapper.h"
-#include "subprocess.h"
+#include "metrics.h"
 #include <iostream>
-#include <sstream>
 
-TrainerWrapper::TrainerWrapper(const std::string& trainerPath)
+TrainerWrapper::TrainerWrapper(const std::string& trainerPath, const MetricLabels& metricLabels)
     : m_trainerPath(trainerPath)
-    , m_isRunning(false) {
+    , m_threads(0) {
+    MetricsRegistry& metrics = MetricsRegistry::global();
+    m_runningMetric = &metrics.gauge("baballs_trainer_running", "1 while the trainer process runs", metricLabels);
+    m_epochMetric = &metrics.gauge("baballs_trainer_epoch", "Current training epoch", metricLabels);
+    m_totalEpochsMetric = &metrics.gauge("baballs_trainer_epochs", "Epochs in the current training run", metricLabels);
+    m_batchMetric = &metrics.gauge("baballs_trainer_batch", "Current batch within the epoch", metricLabels);
+    m_totalBatchesMetric = &metrics.gauge("baballs_trainer_batches", "Batches per epoch", metricLabels);
+    m_lossMetric = &metrics.gauge("baballs_trainer_loss", "Loss of the latest batch", metricLabels);
+    m_epochLossMetric = &metrics.gauge("baballs_trainer_epoch_loss", "Average loss of the latest completed epoch", metricLabels);
+}
+
+void TrainerWrapper::setThreads(int threads) {
+    m_threads = threads;
 }
 
 bool TrainerWrapper::start(
@@ -14,47 +25,45 @@ bool TrainerWrapper::start(
     OutputCallback onOutput,
     ProgressCallback onProgress,
     CompletionCallback onCompleted) {
-    if (m_isRunning) {
+    if (m_process.isRunning()) {
         std::cerr << "Training process is already running" << std::endl;
         return false;
     }
 
     // Reset progress parser
     m_progressParser.Reset();
+    updateMetrics(m_progressParser.GetProgress());
 
     // Prepare arguments for Python script via venv
     std::vector<std::string> args = { "python", "trainermin.py", datasetFile, outputFile };
+    if (m_threads > 0) {
+        args.push_back(std::to_string(m_threads));
+    }
+
+    // Both streams arrive line by line on the runner's I/O thread; stderr
+    // is parsed for errors too
+    auto onLine = [this, onOutput, onProgress](const std::string& line) {
+        onOutput(line + "\n");
+        m_progressParser.ParseLine(line);
+        onProgress(m_progressParser.GetProgress());
+        updateMetrics(m_progressParser.GetProgress());
+    };
 
     // Start the trainer process using venv Python
-    bool success = spawnProcess(
+    m_runningMetric->set(1);
+    bool success = m_process.start(
         args[0],
         std::vector<std::string>(args.begin() + 1, args.end()),
-        // Redirect stdout to the output callback
-        [this, onOutput, onProgress](const std::string& output) {
-            onOutput(output);
-            // Parse each line for progress updates
-            std::istringstream iss(output);
-            std::string line;
-            while (std::getline(iss, line)) {
-                m_progressParser.ParseLine(line);
-                onProgress(m_progressParser.GetProgress());
-            }
-        },
-        // Redirect stderr to the output callback as well
-        [this, onOutput, onProgress](const std::string& output) {
-            onOutput(output);
-            // Parse stderr for errors too
-            std::istringstream iss(output);
-            std::string line;
-            while (std::getline(iss, line)) {
-                m_progressParser.ParseLine(line);
-                onProgress(m_progressParser.GetProgress());
-            }
-        },
+        onLine,
+        onLine,
         // Handle process completion
         [this, onCompleted](int exitCode) {
-            m_isRunning = false;
+            m_runningMetric->set(0);
 
+            if (m_process.wasKilled()) {
+                std::cerr << "Trainer process cancelled" << std::endl;
+                return;
+            }
             if (exitCode != 0) {
                 std::cerr << "Trainer process exited with code: " << exitCode << std::endl;
             }
@@ -62,17 +71,39 @@ bool TrainerWrapper::start(
             onCompleted();
         });
 
-    if (success) {
-        m_isRunning = true;
+    if (!success) {
+        m_runningMetric->set(0);
     }
 
     return success;
 }
 
 bool TrainerWrapper::isRunning() const {
-    return m_isRunning;
+    return m_process.isRunning();
+}
+
+int TrainerWrapper::exitCode() const {
+    return m_process.exitCode();
+}
+
+bool TrainerWrapper::cancel() {
+    // Fails if the trainer already exited, and then onCompleted runs as usual
+    if (!m_process.kill()) {
+        return false;
+    }
+    m_process.wait();
+    return true;
 }
 
 const TrainerProgress& TrainerWrapper::getProgress() const {
     return m_progressParser.GetProgress();
 }
+
+void TrainerWrapper::updateMetrics(const TrainerProgress& progress) {
+    m_epochMetric->set(progress.currentEpoch);
+    m_totalEpochsMetric->set(progress.totalEpochs);
+    m_batchMetric->set(progress.currentBatch);
+    m_totalBatchesMetric->set(progress.totalBatches);
+    m_lossMetric->set(progress.currentLoss);
+    m_epochLossMetric->set(progress.epochAverageLoss);
+}
@@ -1,6 +1,8 @@
 #ifndef TRAINER_WRAPPER_H
 #define TRAINER_WRAPPER_H
 
+#include "metrics.h"
+#include "subprocess.h"
 #include "trainer_progress.h"
 #include <functional>
 #include <string>
@@ -21,16 +23,20 @@ public:
      * @brief Constructor
      *
      * @param trainerPath Path to the trainer executable (defaults to "trainer.exe")
+     * @param metricLabels Labels of this trainer's /metrics gauges, to tell concurrent trainers apart
      */
-    explicit TrainerWrapper(const std::string& trainerPath = "venv");
+    explicit TrainerWrapper(const std::string& trainerPath = "venv", const MetricLabels& metricLabels = MetricLabels());
+
+    // CPU threads the next start() may use; 0 leaves it to the trainer
+    void setThreads(int threads);
 
     /**
      * @brief Start the training process
      *
      * @param datasetFile Path to the input dataset file
      * @param outputFile Path where the trained model will be saved
-     * @param onOutput Callback function that receives output from the trainer
-     * @param onCompleted Callback function that is called when training completes
+     * @param onOutput Callback function that receives each line of trainer output
+     * @param onCompleted Callback function that is called when training completes (not after cancel())
      * @return true if the trainer was successfully started, false otherwise
      */
     bool start(
@@ -47,6 +53,19 @@ public:
      */
     bool isRunning() const;
 
+    // Exit code of the last trainer process; valid in onCompleted
+    int exitCode() const;
+
+    /**
+     * @brief Stop the trainer and wait for it to exit
+     *
+     * Must not be called from the trainer's callbacks.
+     *
+     * @return false if no training was running, including a trainer that
+     *         exited on its own just before; its onCompleted runs as usual
+     */
+    bool cancel();
+
     /**
      * @brief Get current training progress
      *
@@ -56,8 +75,20 @@ public:
 
 private:
     std::string m_trainerPath;
-    bool m_isRunning;
+    int m_threads;
+    ProcessRunner m_process;
     TrainerProgressParser m_progressParser;
+
+    // Mirror the parsed progress into the /metrics gauges
+    void updateMetrics(const TrainerProgress& progress);
+
+    MetricGauge* m_runningMetric;
+    MetricGauge* m_epochMetric;
+    MetricGauge* m_totalEpochsMetric;
+    MetricGauge* m_batchMetric;
+    MetricGauge* m_totalBatchesMetric;
+    MetricGauge* m_lossMetric;
+    MetricGauge* m_epochLossMetric;
 };
 
 #endif // TRAINER_WRAPPER_H
\ No newline at end of file
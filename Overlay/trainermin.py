@@ -19,6 +19,10 @@ FLOAT_TO_INT_CONSTANT = 1
 # Flag definitions (matching flags.h)
 FLAG_GOOD_DATA = 1 << 30  # 1073741824
 
+# JPEG length of an image stored by an earlier record with the same timestamp
+# (CAPTURE_IMAGE_REF in capture_data.h, 0xFFFFFFFF read as signed)
+CAPTURE_IMAGE_REF = -1
+
 TRAINING = True
 
 # Optimized alignment parameters
@@ -503,6 +507,18 @@ def decode_jpeg(jpeg_data):
         
         return error_img
 
+def read_capture_image(f, length, timestamp, stored):
+    """
+    Read one JPEG of a capture record. A CAPTURE_IMAGE_REF resolves to the
+    image stored under timestamp (empty if there is none).
+    """
+    if length == CAPTURE_IMAGE_REF:
+        return stored.get(timestamp, b"") if stored is not None else b""
+    data = f.read(length)
+    if stored is not None and len(data) == length:
+        stored[timestamp] = data
+    return data
+
 def read_capture_file(filename, exclude_after=0, exclude_before=0):
     """
     Optimized frame alignment using advanced pattern-based algorithm
@@ -546,7 +562,7 @@ def read_capture_file(filename, exclude_after=0, exclude_before=0):
                 print(f"Error unpacking frame metadata: {e}", flush=True)
                 break
 
-            if jpeg_data_left_length < 0 or jpeg_data_right_length < 0:
+            if (jpeg_data_left_length < 0 and jpeg_data_left_length != CAPTURE_IMAGE_REF) or (jpeg_data_right_length < 0 and jpeg_data_right_length != CAPTURE_IMAGE_REF):
                 print(f"Invalid JPEG data lengths: left={jpeg_data_left_length}, right={jpeg_data_right_length}", flush=True)
                 break
             
@@ -556,13 +572,13 @@ def read_capture_file(filename, exclude_after=0, exclude_before=0):
             
             # Read the image data
             try:
-                image_left_data = f.read(jpeg_data_left_length)
-                if len(image_left_data) != jpeg_data_left_length:
+                image_left_data = read_capture_image(f, jpeg_data_left_length, video_timestamp_left, None)
+                if jpeg_data_left_length != CAPTURE_IMAGE_REF and len(image_left_data) != jpeg_data_left_length:
                     print(f"Failed to read complete left JPEG data: expected {jpeg_data_left_length}, got {len(image_left_data)}", flush=True)
                     break
                     
-                image_right_data = f.read(jpeg_data_right_length)
-                if len(image_right_data) != jpeg_data_right_length:
+                image_right_data = read_capture_image(f, jpeg_data_right_length, video_timestamp_right, None)
+                if jpeg_data_right_length != CAPTURE_IMAGE_REF and len(image_right_data) != jpeg_data_right_length:
                     print(f"Failed to read complete right JPEG data: expected {jpeg_data_right_length}, got {len(image_right_data)}", flush=True)
                     break
             except Exception as e:
@@ -572,6 +588,8 @@ def read_capture_file(filename, exclude_after=0, exclude_before=0):
     # Read the raw data from file
     print("Detecting corrupted BSB frames...", flush=True)
     last_was_safe = False
+    stored_left = {}   # video_timestamp_left -> image_data of every record read, for CAPTURE_IMAGE_REF
+    stored_right = {}
     with open(filename, 'rb') as f:
         progress = range(total_frames)
         for e in progress:
@@ -601,7 +619,7 @@ def read_capture_file(filename, exclude_after=0, exclude_before=0):
             #    routine_state = 0 # hack: only include single frame examples of safe frames
              
             # Validate JPEG data lengths
-            if jpeg_data_left_length < 0 or jpeg_data_right_length < 0:
+            if (jpeg_data_left_length < 0 and jpeg_data_left_length != CAPTURE_IMAGE_REF) or (jpeg_data_right_length < 0 and jpeg_data_right_length != CAPTURE_IMAGE_REF):
                 print(f"Invalid JPEG data lengths: left={jpeg_data_left_length}, right={jpeg_data_right_length}", flush=True)
                 break
             
@@ -611,13 +629,13 @@ def read_capture_file(filename, exclude_after=0, exclude_before=0):
             
             # Read the image data
             try:
-                image_left_data = f.read(jpeg_data_left_length)
-                if len(image_left_data) != jpeg_data_left_length:
+                image_left_data = read_capture_image(f, jpeg_data_left_length, video_timestamp_left, stored_left)
+                if jpeg_data_left_length != CAPTURE_IMAGE_REF and len(image_left_data) != jpeg_data_left_length:
                     print(f"Failed to read complete left JPEG data: expected {jpeg_data_left_length}, got {len(image_left_data)}", flush=True)
                     break
                     
-                image_right_data = f.read(jpeg_data_right_length)
-                if len(image_right_data) != jpeg_data_right_length:
+                image_right_data = read_capture_image(f, jpeg_data_right_length, video_timestamp_right, stored_right)
+                if jpeg_data_right_length != CAPTURE_IMAGE_REF and len(image_right_data) != jpeg_data_right_length:
                     print(f"Failed to read complete right JPEG data: expected {jpeg_data_right_length}, got {len(image_right_data)}", flush=True)
                     break
             except Exception as e:
@@ -1222,6 +1240,10 @@ def main():
     # Set random seed for reproducibility
     torch.manual_seed(42)
     np.random.seed(42)
+
+    # Optional third argument: CPU thread budget given by the job scheduler
+    if len(sys.argv) > 3:
+        torch.set_num_threads(int(sys.argv[3]))
     
     model=MicroChad()
 
@@ -1231,7 +1253,7 @@ def main():
     model.load_state_dict(torch.load("baseline.pth", map_location=DEVICE))
     trained_model = model
     for e in range(1):
-        dataset = CaptureDataset('user_cal.bin', all_frames=False)
+        dataset = CaptureDataset(sys.argv[1], all_frames=False)
 
         train_dataset = dataset
         train_loader = DataLoader(train_dataset, batch_size=32, shuffle=True, num_workers=0)